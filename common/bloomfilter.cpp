@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2017 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "bloomfilter.h"
+
+#include <QMutex>
+#include <QtEndian>
+
+#include "log.h"
+
+//10 bits and 7 hashes per key result in about 1% false positives.
+static const int bitsPerKey = 10;
+static const int hashesPerKey = 7;
+static const int bitsPerBlock = BloomFilter::blockSize * 8;
+
+/*
+ * The hash is persisted, so it has to be stable across processes and platforms, unlike qHash.
+ */
+static quint64 hash(const QByteArray &key)
+{
+    //FNV-1a
+    quint64 h = 14695981039346656037ull;
+    for (const auto c : key) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    //The finalizer of splitmix64, because FNV mixes the high bits poorly
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+BloomFilter::BloomFilter(qint64 capacity)
+    : mCapacity(capacity),
+    mBits(qMax<qint64>(1, (capacity * bitsPerKey + bitsPerBlock - 1) / bitsPerBlock) * blockSize, '\0')
+{
+}
+
+qint64 BloomFilter::capacity() const
+{
+    return mCapacity;
+}
+
+int BloomFilter::blockCount() const
+{
+    return mBits.size() / blockSize;
+}
+
+int BloomFilter::add(const QByteArray &key)
+{
+    const auto h = hash(key);
+    const int blockIndex = (h >> 32) % blockCount();
+    auto block = reinterpret_cast<unsigned char *>(mBits.data()) + blockIndex * blockSize;
+    //Double hashing within the block
+    const quint32 a = h;
+    const quint32 b = (h >> 23) | 1;
+    bool changed = false;
+    for (int i = 0; i < hashesPerKey; i++) {
+        const auto bit = (a + i * b) % bitsPerBlock;
+        const unsigned char mask = 1 << (bit % 8);
+        if (!(block[bit / 8] & mask)) {
+            block[bit / 8] |= mask;
+            changed = true;
+        }
+    }
+    return changed ? blockIndex : -1;
+}
+
+bool BloomFilter::mayContain(const QByteArray &key) const
+{
+    const auto h = hash(key);
+    const int blockIndex = (h >> 32) % blockCount();
+    const auto block = reinterpret_cast<const unsigned char *>(mBits.constData()) + blockIndex * blockSize;
+    const quint32 a = h;
+    const quint32 b = (h >> 23) | 1;
+    for (int i = 0; i < hashesPerKey; i++) {
+        const auto bit = (a + i * b) % bitsPerBlock;
+        if (!(block[bit / 8] & (1 << (bit % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QByteArray BloomFilter::block(int index) const
+{
+    return mBits.mid(index * blockSize, blockSize);
+}
+
+void BloomFilter::setBlock(int index, const QByteArray &block)
+{
+    if (index < 0 || index >= blockCount() || block.size() != blockSize) {
+        return;
+    }
+    mBits.replace(index * blockSize, blockSize, block);
+}
+
+using namespace Sink::Storage;
+
+/*
+ * Filter name -> capacity
+ * Filter name + '/' + block index -> block
+ *
+ * The capacity is only written once all blocks have been written, so a filter without capacity is incomplete.
+ */
+static const QByteArray bloomFilterDatabase = "bloomfilters";
+
+//Filters smaller than that are not worth rebuilding over and over while a store is filled.
+static const qint64 minimumCapacity = 1024;
+
+static QMutex sMutex;
+
+static QByteArray blockKey(const QByteArray &name, int index)
+{
+    const auto encoded = qToBigEndian(static_cast<quint32>(index));
+    return name + '/' + QByteArray{reinterpret_cast<const char *>(&encoded), sizeof(encoded)};
+}
+
+PersistentBloomFilter::PersistentBloomFilter(const QByteArray &name, DataStore::Transaction &transaction, const KeySource &keySource, qint64 size)
+    : mName(name),
+    mCacheKey(transaction.storeName() + '/' + QString::fromLatin1(name)),
+    mTransaction(transaction),
+    mKeySource(keySource)
+{
+    if (!transaction || transaction.isReadOnly()) {
+        return;
+    }
+    {
+        QMutexLocker locker(&sMutex);
+        mState = cache().value(mCacheKey);
+    }
+    if (mState) {
+        return;
+    }
+    mState = QSharedPointer<State>::create();
+    auto db = transaction.openDatabase(bloomFilterDatabase);
+    qint64 capacity = -1;
+    db.scan(name, [&](const QByteArray &, const QByteArray &value) {
+            capacity = value.toLongLong();
+            return false;
+        },
+        [](const DataStore::Error &) {});
+    if (capacity >= size) {
+        mState->filter = BloomFilter{capacity};
+        mState->count = size;
+        const auto prefix = name + '/';
+        db.scanFrom(prefix, [&](const QByteArray &key, const QByteArray &value) {
+                if (!key.startsWith(prefix) || key.size() != prefix.size() + 4) {
+                    return false;
+                }
+                mState->filter.setBlock(qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(key.constData() + prefix.size())), value);
+                return true;
+            },
+            [](const DataStore::Error &) {});
+    } else {
+        rebuild(qMax(size * 2, minimumCapacity));
+    }
+    QMutexLocker locker(&sMutex);
+    cache().insert(mCacheKey, mState);
+}
+
+bool PersistentBloomFilter::isValid() const
+{
+    return !mState.isNull();
+}
+
+bool PersistentBloomFilter::mayContain(const QByteArray &key) const
+{
+    if (!mState) {
+        return true;
+    }
+    return mState->filter.mayContain(key);
+}
+
+void PersistentBloomFilter::add(const QByteArray &key)
+{
+    if (!mState) {
+        return;
+    }
+    mState->count++;
+    if (mState->count > mState->filter.capacity()) {
+        //Rebuilding also drops the keys that have been removed meanwhile.
+        rebuild(mState->count * 2);
+        return;
+    }
+    const auto changedBlock = mState->filter.add(key);
+    if (changedBlock >= 0) {
+        mTransaction.openDatabase(bloomFilterDatabase).write(blockKey(mName, changedBlock), mState->filter.block(changedBlock),
+            [&](const DataStore::Error &error) { SinkWarning() << "Failed to write the bloom filter: " << mName << error.message; });
+    }
+}
+
+void PersistentBloomFilter::clear()
+{
+    if (!mState) {
+        return;
+    }
+    rebuild(minimumCapacity);
+}
+
+void PersistentBloomFilter::rebuild(qint64 capacity)
+{
+    SinkTrace() << "Building bloom filter: " << mName << capacity;
+    auto db = mTransaction.openDatabase(bloomFilterDatabase);
+    db.remove(mName, [](const DataStore::Error &) {});
+    mState->filter = BloomFilter{capacity};
+    mState->count = 0;
+    mKeySource([&](const QByteArray &key) {
+        mState->filter.add(key);
+        mState->count++;
+    });
+    for (int i = 0; i < mState->filter.blockCount(); i++) {
+        db.write(blockKey(mName, i), mState->filter.block(i));
+    }
+    db.write(mName, QByteArray::number(mState->filter.capacity()),
+        [&](const DataStore::Error &error) { SinkWarning() << "Failed to write the bloom filter: " << mName << error.message; });
+}
+
+QHash<QString, QSharedPointer<PersistentBloomFilter::State>> &PersistentBloomFilter::cache()
+{
+    //Store name + '/' + filter name -> filter
+    static QHash<QString, QSharedPointer<State>> filters;
+    return filters;
+}
+
+void PersistentBloomFilter::clearCache(const QString &storeName)
+{
+    QMutexLocker locker(&sMutex);
+    for (const auto &key : cache().keys()) {
+        if (storeName.isEmpty() || key.startsWith(storeName + '/')) {
+            cache().remove(key);
+        }
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "sink_export.h"
+#include <QByteArray>
+#include <QHash>
+#include <QSharedPointer>
+#include <functional>
+#include "storage.h"
+
+/**
+ * A blocked bloom filter.
+ *
+ * All bits of a key are in the same block, so a lookup only touches a single cache line,
+ * and an update only changes a single block.
+ * Keys can't be removed, removed keys only result in more false positives.
+ */
+class SINK_EXPORT BloomFilter
+{
+public:
+    static const int blockSize = 64;
+
+    explicit BloomFilter(qint64 capacity = 0);
+
+    /**
+     * The number of keys the filter is sized for, with about 1% false positives.
+     */
+    qint64 capacity() const;
+    int blockCount() const;
+
+    /**
+     * @return the index of the block that changed, or -1 if the key was already contained.
+     */
+    int add(const QByteArray &key);
+
+    /**
+     * Returns false if @param key has definitely never been added.
+     */
+    bool mayContain(const QByteArray &key) const;
+
+    QByteArray block(int index) const;
+    void setBlock(int index, const QByteArray &block);
+
+private:
+    qint64 mCapacity;
+    QByteArray mBits;
+};
+
+namespace Sink {
+namespace Storage {
+
+/**
+ * A bloom filter over the keys of a database, that is persisted in the store and kept in memory.
+ *
+ * Only the resource writes to its store, so the filter is only used in write transactions,
+ * where no other process can have added keys that the filter doesn't know about.
+ * Every key that is written to the database has to be added to the filter.
+ */
+class SINK_EXPORT PersistentBloomFilter
+{
+public:
+    typedef std::function<void(const std::function<void(const QByteArray &key)> &)> KeySource;
+
+    /**
+     * Opens the filter @param name in the store of @param transaction.
+     *
+     * @param keySource enumerates all keys of the database, to build the filter if it hasn't been persisted yet or has outgrown its capacity.
+     * @param size an upper bound for the number of keys in the database.
+     */
+    PersistentBloomFilter(const QByteArray &name, DataStore::Transaction &transaction, const KeySource &keySource, qint64 size);
+
+    /**
+     * The filter is not available in read-only transactions.
+     */
+    bool isValid() const;
+
+    /**
+     * Returns false if @param key is definitely not in the database.
+     */
+    bool mayContain(const QByteArray &key) const;
+    void add(const QByteArray &key);
+
+    /**
+     * Forgets all keys, for when the database has been cleared.
+     */
+    void clear();
+
+    /**
+     * Drops the filters of @param storeName from memory, for when the store is removed.
+     */
+    static void clearCache(const QString &storeName);
+
+private:
+    struct State {
+        BloomFilter filter;
+        qint64 count = 0;
+    };
+    static QHash<QString, QSharedPointer<State>> &cache();
+    void rebuild(qint64 capacity);
+    QByteArray mName;
+    QString mCacheKey;
+    DataStore::Transaction &mTransaction;
+    KeySource mKeySource;
+    QSharedPointer<State> mState;
+};
+
+}
+}
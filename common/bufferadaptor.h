@@ -50,6 +50,14 @@ public:
     {
         return QList<QByteArray>();
     }
+
+    /**
+     * The buffer the properties are read from, or nullptr if the properties are not read from a single buffer.
+     */
+    virtual void const *localBuffer() const
+    {
+        return nullptr;
+    }
 };
 
 class MemoryBufferAdaptor : public BufferAdaptor
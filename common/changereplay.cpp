@@ -23,6 +23,7 @@
 #include "log.h"
 #include "definitions.h"
 #include "bufferutils.h"
+#include "resourceconfig.h"
 
 #include <QTimer>
 
@@ -30,7 +31,7 @@ using namespace Sink;
 using namespace Sink::Storage;
 
 ChangeReplay::ChangeReplay(const ResourceContext &resourceContext, const Sink::Log::Context &ctx)
-    : mStorage(storageLocation(), resourceContext.instanceId(), DataStore::ReadOnly), mChangeReplayStore(storageLocation(), resourceContext.instanceId() + ".changereplay", DataStore::ReadWrite), mReplayInProgress(false), mLogCtx{ctx.subContext("changereplay")}
+    : mStorage(storageLocation(), resourceContext.instanceId(), DataStore::ReadOnly), mChangeReplayStore(storageLocation(), resourceContext.instanceId() + ".changereplay", DataStore::ReadWrite), mReplayInProgress(false), mKeepHistory(ResourceConfig::getConfiguration(resourceContext.instanceId()).value("keepHistory", true).toBool()), mLogCtx{ctx.subContext("changereplay")}
 {
 }
 
@@ -111,7 +112,12 @@ KAsync::Job<void> ChangeReplay::replayNextRevision()
                         const auto uid = DataStore::getUidFromRevision(mMainStoreTransaction, revision);
                         const auto type = DataStore::getTypeFromRevision(mMainStoreTransaction, revision);
                         if (uid.isEmpty() || type.isEmpty()) {
-                            SinkErrorCtx(mLogCtx) << "Failed to read uid or type for revison: " << revision << uid << type;
+                            if (mKeepHistory) {
+                                SinkErrorCtx(mLogCtx) << "Failed to read uid or type for revison: " << revision << uid << type;
+                            } else {
+                                //Without history superseded revisions are removed from the revision log.
+                                SinkTraceCtx(mLogCtx) << "Skipping superseded revision: " << revision;
+                            }
                         } else {
                             const auto key = DataStore::assembleKey(uid, revision);
                             QByteArray entityBuffer;
@@ -62,6 +62,8 @@ private:
     void recordReplayedRevision(qint64 revision);
     Sink::Storage::DataStore mChangeReplayStore;
     bool mReplayInProgress;
+    //Without history the revision log has gaps, which are not an error
+    bool mKeepHistory;
     Sink::Storage::DataStore::Transaction mMainStoreTransaction;
     Sink::Log::Context mLogCtx;
     QObject mGuard;
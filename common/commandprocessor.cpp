@@ -38,6 +38,9 @@
 static int sBatchSize = 100;
 // This interval directly affects the roundtrip time of single commands
 static int sCommitInterval = 10;
+// Index builds run in small batches while idle, so they don't delay the processing of commands
+static int sIndexBuildBatchSize = 500;
+static int sIndexBuildInterval = 50;
 
 
 using namespace Sink;
@@ -49,7 +52,7 @@ CommandProcessor::CommandProcessor(Sink::Pipeline *pipeline, const QByteArray &i
     mPipeline(pipeline), 
     mUserQueue(Sink::storageLocation(), instanceId + ".userqueue"),
     mSynchronizerQueue(Sink::storageLocation(), instanceId + ".synchronizerqueue"),
-    mCommandQueues(QList<MessageQueue*>() << &mUserQueue << &mSynchronizerQueue), mProcessingLock(false), mLowerBoundRevision(0)
+    mCommandQueues(QList<MessageQueue*>() << &mUserQueue << &mSynchronizerQueue), mProcessingLock(false), mLowerBoundRevision(0), mIndexBuildRequired(true)
 {
     for (auto queue : mCommandQueues) {
         const bool ret = connect(queue, &MessageQueue::messageReady, this, &CommandProcessor::process);
@@ -59,6 +62,11 @@ CommandProcessor::CommandProcessor(Sink::Pipeline *pipeline, const QByteArray &i
     mCommitQueueTimer.setInterval(sCommitInterval);
     mCommitQueueTimer.setSingleShot(true);
     QObject::connect(&mCommitQueueTimer, &QTimer::timeout, &mUserQueue, &MessageQueue::commit);
+
+    mIndexBuildTimer.setInterval(sIndexBuildInterval);
+    mIndexBuildTimer.setSingleShot(true);
+    QObject::connect(&mIndexBuildTimer, &QTimer::timeout, this, &CommandProcessor::buildIndexes);
+    mIndexBuildTimer.start();
 }
 
 static void enqueueCommand(MessageQueue &mq, int commandId, const QByteArray &data)
@@ -173,11 +181,25 @@ void CommandProcessor::process()
                         mProcessingLock = false;
                         if (messagesToProcessAvailable()) {
                             process();
+                        } else if (mIndexBuildRequired) {
+                            mIndexBuildTimer.start();
                         }
                     })
                     .exec();
 }
 
+void CommandProcessor::buildIndexes()
+{
+    //Processing restarts the timer once it is done
+    if (mProcessingLock || messagesToProcessAvailable()) {
+        return;
+    }
+    mIndexBuildRequired = mPipeline->buildIndexes(sIndexBuildBatchSize);
+    if (mIndexBuildRequired) {
+        mIndexBuildTimer.start();
+    }
+}
+
 KAsync::Job<qint64> CommandProcessor::processQueuedCommand(const Sink::QueuedCommand *queuedCommand)
 {
     SinkTraceCtx(mLogCtx) << "Processing command: " << Sink::Commands::name(queuedCommand->commandId());
@@ -227,7 +249,13 @@ KAsync::Job<qint64> CommandProcessor::processQueuedCommand(const QByteArray &dat
 KAsync::Job<void> CommandProcessor::processQueue(MessageQueue *queue)
 {
     auto time = QSharedPointer<QTime>::create();
-    return KAsync::start([this]() { mPipeline->startTransaction(); })
+    return KAsync::start([this, queue]() {
+            mPipeline->startTransaction();
+            //The synchronizer enqueues whole batches of remote entities at once
+            if (queue == &mSynchronizerQueue) {
+                mPipeline->startBulkLoad();
+            }
+        })
         .then(KAsync::doWhile(
             [this, queue, time]() -> KAsync::Job<KAsync::ControlFlowFlag> {
                 return queue->dequeueBatch(sBatchSize,
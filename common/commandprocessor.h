@@ -70,6 +70,8 @@ private slots:
     // Process all messages of this queue
     KAsync::Job<void> processQueue(MessageQueue *queue);
     KAsync::Job<void> processPipeline();
+    // Build new or outdated indexes from the existing entities while idle
+    void buildIndexes();
 
 private:
     void processFlushCommand(const QByteArray &data);
@@ -90,6 +92,8 @@ private:
     QSharedPointer<Synchronizer> mSynchronizer;
     QSharedPointer<Inspector> mInspector;
     QTimer mCommitQueueTimer;
+    QTimer mIndexBuildTimer;
+    bool mIndexBuildRequired;
 };
 
 };
@@ -20,6 +20,10 @@
 
 #include "log.h"
 #include "applicationdomaintype.h"
+#include "propertymapper.h"
+#include "mail/threadsummary.h"
+#include "sortablekey.h"
+#include <algorithm>
 
 using namespace Sink;
 using namespace Sink::Storage;
@@ -45,6 +49,11 @@ class Source : public FilterBase {
     QVector<QByteArray>::ConstIterator mIt;
     QVector<QByteArray> mIncrementalIds;
     QVector<QByteArray>::ConstIterator mIncrementalIt;
+    //Incremental ids that only changed in derived properties, so they are already known to the client
+    QSet<QByteArray> mTouchedIds;
+    //The keys of the ids in a covering index, if the initial results are read from the index
+    QByteArray mProjectionIndex;
+    QVector<QByteArray> mProjectionKeys;
 
     Source (const QVector<QByteArray> &ids, DataStoreQuery *store)
         : FilterBase(store),
@@ -63,6 +72,34 @@ class Source : public FilterBase {
         }
     };
 
+    virtual void reset() Q_DECL_OVERRIDE
+    {
+        mIt = mIds.constBegin();
+    }
+
+    virtual bool isBatched() const Q_DECL_OVERRIDE
+    {
+        return true;
+    }
+
+    //Moves back to @param identifier, so results that have been read ahead are read again
+    void rewind(const QByteArray &identifier)
+    {
+        for (auto it = mIt; it != mIds.constBegin();) {
+            --it;
+            if (*it == identifier) {
+                mIt = it;
+                return;
+            }
+        }
+    }
+
+    void setProjections(const QByteArray &index, const QVector<QByteArray> &keys)
+    {
+        mProjectionIndex = index;
+        mProjectionKeys = keys;
+    }
+
     void add(const QVector<QByteArray> &ids)
     {
         mIncrementalIds = ids;
@@ -75,8 +112,12 @@ class Source : public FilterBase {
             if (mIncrementalIt == mIncrementalIds.constEnd()) {
                 return false;
             }
-            readEntity(*mIncrementalIt, [this, callback](const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
+            const auto touched = mTouchedIds.contains(*mIncrementalIt);
+            readEntity(*mIncrementalIt, [this, callback, touched](const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
                 SinkTraceCtx(mDatastore->mLogCtx) << "Source: Read entity: " << entity.identifier() << operationName(operation);
+                if (touched && operation == Sink::Operation_Creation) {
+                    operation = Sink::Operation_Modification;
+                }
                 callback({entity, operation});
             });
             mIncrementalIt++;
@@ -88,14 +129,201 @@ class Source : public FilterBase {
             if (mIt == mIds.constEnd()) {
                 return false;
             }
-            readEntity(*mIt, [this, callback](const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
+            const auto readCallback = [this, callback](const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
                 SinkTraceCtx(mDatastore->mLogCtx) << "Source: Read entity: " << entity.identifier() << operationName(operation);
                 callback({entity, operation});
-            });
+            };
+            if (!mProjectionKeys.isEmpty()) {
+                mDatastore->readProjection(mProjectionIndex, *mIt, mProjectionKeys.at(mIt - mIds.constBegin()), readCallback);
+            } else {
+                readEntity(*mIt, readCallback);
+            }
             mIt++;
             return mIt != mIds.constEnd();
         }
     }
+
+    bool nextBatch(Batch &batch) Q_DECL_OVERRIDE
+    {
+        //Incremental updates are small, and projections are read from the index
+        if (!mIncrementalIds.isEmpty() || !mProjectionKeys.isEmpty()) {
+            return FilterBase::nextBatch(batch);
+        }
+        const int count = qMin<int>(batchSize - batch.size(), mIds.constEnd() - mIt);
+        if (count <= 0) {
+            return mIt != mIds.constEnd();
+        }
+        const auto keys = mIds.mid(mIt - mIds.constBegin(), count);
+        mIt += count;
+        //The entities are read in key order, but are passed on in the order of the ids
+        QVector<Sink::ApplicationDomain::ApplicationDomainType> entities(count);
+        QVector<Sink::Operation> operations(count);
+        QVector<bool> found(count, false);
+        readEntities(keys, [&](int index, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
+            entities[index] = entity;
+            operations[index] = operation;
+            found[index] = true;
+        });
+        for (int i = 0; i < count; i++) {
+            if (found.at(i)) {
+                SinkTraceCtx(mDatastore->mLogCtx) << "Source: Read entity: " << keys.at(i) << operationName(operations.at(i));
+                batch << ResultSet::Result{entities.at(i), operations.at(i)};
+            }
+        }
+        return mIt != mIds.constEnd();
+    }
+};
+
+/*
+ * Orders like the sorted indexes: newest first for dates, and case insensitive for strings.
+ */
+static QByteArray sortKey(const QVariant &value)
+{
+    if (value.type() == QVariant::DateTime) {
+        return SortableKey::fromDateNewestFirst(value.toDateTime());
+    }
+    if (value.type() == QVariant::Int || value.type() == QVariant::LongLong) {
+        return SortableKey::fromNumber(value.toLongLong());
+    }
+    if (value.type() == QVariant::String) {
+        return value.toString().toCaseFolded().toUtf8();
+    }
+    return value.toByteArray();
+}
+
+/*
+ * Sorts the results of the source if no sorted index is available.
+ *
+ * Every scan of the source keeps the limit smallest results after the last emitted one in a bounded heap,
+ * so the memory stays bounded by the limit. Once they are emitted the source is scanned again,
+ * resuming after the sort key of the last emitted result.
+ * Incremental updates that sort after the last emitted result are not part of the loaded results,
+ * and will be picked up with the next page instead. Emitted results that move there are removed until then.
+ */
+class Sort : public FilterBase {
+public:
+    typedef QSharedPointer<Sort> Ptr;
+
+    Sort(const QByteArray &sortProperty, int limit, FilterBase::Ptr source, DataStoreQuery *store)
+        : FilterBase(source, store),
+        mSortProperty(sortProperty),
+        mLimit(limit)
+    {
+
+    }
+
+    virtual ~Sort(){}
+
+    QByteArray key(const Sink::ApplicationDomain::ApplicationDomainType &entity) const
+    {
+        //The identifier makes the key unique and the order stable
+        return sortKey(entity.getProperty(mSortProperty)) + '\0' + entity.identifier();
+    }
+
+    void fill()
+    {
+        mSource->reset();
+        mSorted.clear();
+        mPosition = 0;
+        Batch batch;
+        bool more = true;
+        while (more) {
+            batch.clear();
+            more = mSource->nextBatch(batch);
+            for (const auto &result : batch) {
+                if (result.operation == Sink::Operation_Removal) {
+                    continue;
+                }
+                const auto k = key(result.entity);
+                if (!mBoundary.isEmpty() && k <= mBoundary) {
+                    continue;
+                }
+                //The heap keeps the largest key on top, which is replaced by any smaller one
+                if (mLimit && mSorted.size() >= mLimit) {
+                    if (k >= mSorted.first().first) {
+                        continue;
+                    }
+                    std::pop_heap(mSorted.begin(), mSorted.end());
+                    mSorted.last() = qMakePair(k, result.entity.identifier());
+                } else {
+                    mSorted.append(qMakePair(k, result.entity.identifier()));
+                }
+                std::push_heap(mSorted.begin(), mSorted.end());
+            }
+        }
+        std::sort_heap(mSorted.begin(), mSorted.end());
+        mExhausted = !mLimit || mSorted.size() < mLimit;
+        SinkTraceCtx(mDatastore->mLogCtx) << "Sort: Loaded " << mSorted.size() << " results, exhausted: " << mExhausted;
+    }
+
+    /*
+     * Whether the revision of @param entity that the update is based on sorted up to the boundary, so it has been emitted.
+     */
+    bool wasEmitted(const Sink::ApplicationDomain::ApplicationDomainType &entity)
+    {
+        bool emitted = false;
+        mDatastore->mStore.readPrevious(mDatastore->mType, entity.identifier(), mDatastore->mBaseRevision, [&](const Sink::ApplicationDomain::ApplicationDomainType &previous) {
+            emitted = key(previous) <= mBoundary;
+        });
+        return emitted;
+    }
+
+    void skip() Q_DECL_OVERRIDE
+    {
+        if (mPosition < mSorted.size()) {
+            mBoundary = mSorted.at(mPosition).first;
+            mPosition++;
+        }
+    }
+
+    bool next(const std::function<void(const ResultSet::Result &result)> &callback) Q_DECL_OVERRIDE
+    {
+        if (mIncremental) {
+            bool foundValue = false;
+            while(!foundValue && mSource->next([this, callback, &foundValue](const ResultSet::Result &result) {
+                    //Anything after the boundary is not loaded yet
+                    if (result.operation == Sink::Operation_Removal || mExhausted || key(result.entity) <= mBoundary) {
+                        callback(result);
+                        foundValue = true;
+                    } else if (result.operation == Sink::Operation_Modification && wasEmitted(result.entity)) {
+                        SinkTraceCtx(mDatastore->mLogCtx) << "Sort: Moved after the loaded results: " << result.entity.identifier();
+                        callback({result.entity, Sink::Operation_Removal});
+                        foundValue = true;
+                    } else {
+                        SinkTraceCtx(mDatastore->mLogCtx) << "Sort: Not loaded yet: " << result.entity.identifier();
+                    }
+                }))
+            {}
+            return foundValue;
+        }
+        if (mPosition >= mSorted.size()) {
+            if (mExhausted) {
+                return false;
+            }
+            fill();
+            if (mSorted.isEmpty()) {
+                return false;
+            }
+        }
+        mBoundary = mSorted.at(mPosition).first;
+        const auto identifier = mSorted.at(mPosition).second;
+        mPosition++;
+        readEntity(identifier, [this, callback](const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
+            SinkTraceCtx(mDatastore->mLogCtx) << "Sort: Read entity: " << entity.identifier() << operationName(operation);
+            callback({entity, operation});
+        });
+        return mPosition < mSorted.size() || !mExhausted;
+    }
+
+    QByteArray mSortProperty;
+    //Number of results kept by a scan, or 0 to keep all of them
+    int mLimit;
+    //Sort key of the last emitted result, the next scan resumes after it
+    QByteArray mBoundary;
+    //Sort key and identifier of the loaded results, a heap while scanning and sorted afterwards
+    QVector<QPair<QByteArray, QByteArray>> mSorted;
+    int mPosition = 0;
+    bool mExhausted = false;
 };
 
 class Collector : public FilterBase {
@@ -111,8 +339,60 @@ public:
 
     bool next(const std::function<void(const ResultSet::Result &result)> &callback) Q_DECL_OVERRIDE
     {
-        return mSource->next(callback);
+        if (!mSource->isBatched()) {
+            return mSource->next(callback);
+        }
+        while (mBatchIt >= mBatch.size()) {
+            mBatch.clear();
+            mBatchIt = 0;
+            mMore = mSource->nextBatch(mBatch);
+            if (mBatch.isEmpty() && !mMore) {
+                return false;
+            }
+        }
+        callback(mBatch.at(mBatchIt));
+        mBatchIt++;
+        return mBatchIt < mBatch.size() || mMore;
+    }
+
+    void skip() Q_DECL_OVERRIDE
+    {
+        if (mBatchIt < mBatch.size()) {
+            mBatchIt++;
+        } else {
+            mSource->skip();
+        }
+    }
+
+    void reset() Q_DECL_OVERRIDE
+    {
+        mBatch.clear();
+        mBatchIt = 0;
+        mSource->reset();
+    }
+
+    /**
+     * Hands the results that have been read ahead back to the source.
+     *
+     * The entities are only valid during the transaction they have been read in,
+     * so they are read again once more results are requested.
+     */
+    void suspend()
+    {
+        if (mBatchIt < mBatch.size() && !mIncremental) {
+            auto source = mSource;
+            while (source->mSource) {
+                source = source->mSource;
+            }
+            source.staticCast<Source>()->rewind(mBatch.at(mBatchIt).entity.identifier());
+        }
+        mBatch.clear();
+        mBatchIt = 0;
     }
+
+    Batch mBatch;
+    int mBatchIt = 0;
+    bool mMore = false;
 };
 
 class Filter : public FilterBase {
@@ -120,6 +400,7 @@ public:
     typedef QSharedPointer<Filter> Ptr;
 
     QHash<QByteArray, Sink::QueryBase::Comparator> propertyFilter;
+    QList<Sink::QueryBase::Or> orFilters;
 
     Filter(FilterBase::Ptr source, DataStoreQuery *store)
         : FilterBase(source, store)
@@ -129,6 +410,26 @@ public:
 
     virtual ~Filter(){}
 
+    virtual bool isBatched() const Q_DECL_OVERRIDE
+    {
+        return mSource->isBatched();
+    }
+
+    virtual bool nextBatch(Batch &batch) Q_DECL_OVERRIDE
+    {
+        const auto first = batch.size();
+        const bool more = mSource->nextBatch(batch);
+        for (auto it = batch.begin() + first; it != batch.end(); it++) {
+            //Always accept removals. They can't match the filter since the data is gone.
+            //Rejected entities turn into removals, like in next().
+            if (it->operation != Sink::Operation_Removal && !matchesFilter(it->entity)) {
+                SinkTraceCtx(mDatastore->mLogCtx) << "Rejected: " << it->entity.identifier() << operationName(it->operation);
+                it->operation = Sink::Operation_Removal;
+            }
+        }
+        return more;
+    }
+
     virtual bool next(const std::function<void(const ResultSet::Result &result)> &callback) Q_DECL_OVERRIDE {
         bool foundValue = false;
         while(!foundValue && mSource->next([this, callback, &foundValue](const ResultSet::Result &result) {
@@ -156,17 +457,98 @@ public:
         return foundValue;
     }
 
+    QVariant getProperty(const ApplicationDomain::ApplicationDomainType &entity, const QByteArray &filterProperty, const QueryBase::Comparator &comparator)
+    {
+        //A fulltext filter without property matches against all indexed content, which is only available from the index.
+        if (filterProperty.isEmpty() && comparator.comparator == QueryBase::Comparator::Fulltext) {
+            return QVariant::fromValue(QString::fromUtf8(fulltextTokens(entity.identifier()).join(' ')));
+        }
+        return entity.getProperty(filterProperty);
+    }
+
+    /*
+     * A filter on a single property.
+     *
+     * If the property is read from the buffer with a known type, the comparator is compiled into a predicate on the buffer,
+     * so the property doesn't have to be converted to a QVariant for every entity.
+     */
+    struct CompiledFilter {
+        QByteArray property;
+        QueryBase::Comparator comparator;
+        PropertyMapper::Predicate predicate;
+    };
+
+    CompiledFilter compile(const QByteArray &property, const QueryBase::Comparator &comparator, const QSharedPointer<PropertyMapper> &mapper)
+    {
+        //A fulltext filter without property is matched against the index
+        if (!mapper || property.isEmpty()) {
+            return {property, comparator, {}};
+        }
+        return {property, comparator, mapper->predicate(property, comparator)};
+    }
+
+    void compileFilters()
+    {
+        const auto mapper = propertyMapper();
+        mCompiledFilters.clear();
+        for (auto it = propertyFilter.constBegin(); it != propertyFilter.constEnd(); it++) {
+            mCompiledFilters << compile(it.key(), it.value(), mapper);
+        }
+        //The cheap predicates go first, so the others are only evaluated for entities that pass them
+        std::stable_partition(mCompiledFilters.begin(), mCompiledFilters.end(), [] (const CompiledFilter &filter) {
+            return bool(filter.predicate);
+        });
+        mCompiledOrFilters.clear();
+        for (const auto &filter : orFilters) {
+            QVector<CompiledFilter> alternatives;
+            for (const auto &alternative : filter.alternatives) {
+                alternatives << compile(alternative.first, alternative.second, mapper);
+            }
+            mCompiledOrFilters << alternatives;
+        }
+        mCompiled = true;
+    }
+
+    bool matchesProperty(const ApplicationDomain::ApplicationDomainType &entity, void const *buffer, const CompiledFilter &filter)
+    {
+        if (buffer && filter.predicate) {
+            return filter.predicate(buffer);
+        }
+        return filter.comparator.matches(getProperty(entity, filter.property, filter.comparator));
+    }
+
     bool matchesFilter(const ApplicationDomain::ApplicationDomainType &entity) {
-        for (const auto &filterProperty : propertyFilter.keys()) {
-            const auto property = entity.getProperty(filterProperty);
-            const auto comparator = propertyFilter.value(filterProperty);
-            if (!comparator.matches(property)) {
-                SinkTraceCtx(mDatastore->mLogCtx) << "Filtering entity due to property mismatch on filter: " << entity.identifier() << "Property: " << filterProperty << property << " Filter:" << comparator.value;
+        if (!mCompiled) {
+            compileFilters();
+        }
+        //Deltas and in-memory entities are not read from a single buffer, and fall back to reading the properties
+        const auto buffer = entity.localBuffer();
+        for (const auto &filter : mCompiledFilters) {
+            if (!matchesProperty(entity, buffer, filter)) {
+                SinkTraceCtx(mDatastore->mLogCtx) << "Filtering entity due to property mismatch on filter: " << entity.identifier() << "Property: " << filter.property << " Filter:" << filter.comparator.value;
+                return false;
+            }
+        }
+        for (int i = 0; i < mCompiledOrFilters.size(); i++) {
+            const auto &alternatives = mCompiledOrFilters.at(i);
+            const bool matches = std::any_of(alternatives.constBegin(), alternatives.constEnd(), [&] (const CompiledFilter &alternative) {
+                return matchesProperty(entity, buffer, alternative);
+            });
+            if (!matches) {
+                SinkTraceCtx(mDatastore->mLogCtx) << "Filtering entity due to mismatch on filter: " << entity.identifier() << orFilters.at(i);
                 return false;
             }
         }
         return true;
     }
+
+protected:
+    //Has to be reset whenever the filters change
+    bool mCompiled = false;
+
+private:
+    QVector<CompiledFilter> mCompiledFilters;
+    QVector<QVector<CompiledFilter>> mCompiledOrFilters;
 };
 
 class Reduce : public Filter {
@@ -189,6 +571,8 @@ public:
                 mResult = mResult.toList() << value;
             } else if (operation == QueryBase::Reduce::Aggregator::Count) {
                 mResult = mResult.toInt() + 1;
+            } else if (operation == QueryBase::Reduce::Aggregator::CountTrue) {
+                mResult = mResult.toInt() + (value.toBool() ? 1 : 0);
             } else {
                 Q_ASSERT(false);
             }
@@ -213,6 +597,10 @@ public:
     QByteArray mSelectionProperty;
     QueryBase::Reduce::Selector::Comparator mSelectionComparator;
     QList<Aggregator> mAggregators;
+    //Set if the reduction can be read from the thread summaries instead of reading all mails of a thread
+    bool mUseThreadSummaries = false;
+    //The folder the reduced mails are filtered on, in which case the summaries of that folder are read
+    QByteArray mThreadSummaryFolder;
 
     Reduce(const QByteArray &reductionProperty, const QByteArray &selectionProperty, QueryBase::Reduce::Selector::Comparator comparator, FilterBase::Ptr source, DataStoreQuery *store)
         : Filter(source, store),
@@ -225,6 +613,17 @@ public:
 
     virtual ~Reduce(){}
 
+    //The reduction keeps track of the reduced values, so results can't be read ahead
+    bool isBatched() const Q_DECL_OVERRIDE
+    {
+        return false;
+    }
+
+    bool nextBatch(Batch &batch) Q_DECL_OVERRIDE
+    {
+        return FilterBase::nextBatch(batch);
+    }
+
     static QByteArray getByteArray(const QVariant &value) {
         if (value.type() == QVariant::DateTime) {
             return value.toDateTime().toString().toLatin1();
@@ -242,8 +641,32 @@ public:
         return false;
     }
 
+    static QVariant aggregate(const Aggregator &aggregator, const ThreadSummary &summary)
+    {
+        if (aggregator.operation == QueryBase::Reduce::Aggregator::Count) {
+            return summary.messageCount;
+        }
+        return aggregator.property == ApplicationDomain::Mail::Unread::name ? summary.unreadCount : summary.importantCount;
+    }
+
+    //The summaries only contain the number of mails, and of the unread and important ones
+    static bool canAggregate(const QueryBase::Reduce::Aggregator &aggregator)
+    {
+        return aggregator.operation == QueryBase::Reduce::Aggregator::Count
+            || (aggregator.operation == QueryBase::Reduce::Aggregator::CountTrue
+                && (aggregator.propertyToCollect == ApplicationDomain::Mail::Unread::name || aggregator.propertyToCollect == ApplicationDomain::Mail::Important::name));
+    }
+
     QByteArray reduceOnValue(const QVariant &reductionValue, QMap<QByteArray, QVariant> &aggregateValues)
     {
+        ThreadSummary summary;
+        if (mUseThreadSummaries && mDatastore->readThreadSummary(getByteArray(reductionValue), summary, mThreadSummaryFolder)) {
+            for (const auto &aggregator : mAggregators) {
+                aggregateValues.insert(aggregator.resultProperty, aggregate(aggregator, summary));
+            }
+            return summary.latestMail;
+        }
+
         QVariant selectionResultValue;
         QByteArray selectionResult;
         auto results = indexLookup(mReductionProperty, reductionValue);
@@ -251,28 +674,26 @@ public:
             aggregator.reset();
         }
 
-        for (const auto &r : results) {
-            readEntity(r, [&, this](const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
-                //We need to apply all property filters that we have until the reduction, because the index lookup was unfiltered.
-                if (!matchesFilter(entity)) {
-                    return;
-                }
+        readEntities(results, [&, this](int, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
+            //We need to apply all property filters that we have until the reduction, because the index lookup was unfiltered.
+            if (!matchesFilter(entity)) {
+                return;
+            }
 
-                Q_ASSERT(operation != Sink::Operation_Removal);
-                for (auto &aggregator : mAggregators) {
-                    if (!aggregator.property.isEmpty()) {
-                        aggregator.process(entity.getProperty(aggregator.property));
-                    } else {
-                        aggregator.process(QVariant{});
-                    }
-                }
-                auto selectionValue = entity.getProperty(mSelectionProperty);
-                if (!selectionResultValue.isValid() || compare(selectionValue, selectionResultValue, mSelectionComparator)) {
-                    selectionResultValue = selectionValue;
-                    selectionResult = entity.identifier();
+            Q_ASSERT(operation != Sink::Operation_Removal);
+            for (auto &aggregator : mAggregators) {
+                if (!aggregator.property.isEmpty()) {
+                    aggregator.process(entity.getProperty(aggregator.property));
+                } else {
+                    aggregator.process(QVariant{});
                 }
-            });
-        }
+            }
+            auto selectionValue = entity.getProperty(mSelectionProperty);
+            if (!selectionResultValue.isValid() || compare(selectionValue, selectionResultValue, mSelectionComparator)) {
+                selectionResultValue = selectionValue;
+                selectionResult = entity.identifier();
+            }
+        });
 
         for (auto &aggregator : mAggregators) {
             aggregateValues.insert(aggregator.resultProperty, aggregator.result());
@@ -351,6 +772,16 @@ public:
 
     virtual ~Bloom(){}
 
+    bool isBatched() const Q_DECL_OVERRIDE
+    {
+        return false;
+    }
+
+    bool nextBatch(Batch &batch) Q_DECL_OVERRIDE
+    {
+        return FilterBase::nextBatch(batch);
+    }
+
     bool next(const std::function<void(const ResultSet::Result &result)> &callback) Q_DECL_OVERRIDE {
         if (!mBloomed) {
             //Initially we bloom on the first value that matches.
@@ -359,18 +790,17 @@ public:
             while(!foundValue && mSource->next([this, callback, &foundValue](const ResultSet::Result &result) {
                     mBloomValue = result.entity.getProperty(mBloomProperty);
                     auto results = indexLookup(mBloomProperty, mBloomValue);
-                    for (const auto &r : results) {
-                        readEntity(r, [&, this](const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
-                            callback({entity, Sink::Operation_Creation});
-                            SinkTraceCtx(mDatastore->mLogCtx) << "Bloom result: " << entity.identifier() << operationName(operation);
-                            foundValue = true;
-                        });
-                    }
+                    readEntities(results, [&, this](int, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
+                        callback({entity, Sink::Operation_Creation});
+                        SinkTraceCtx(mDatastore->mLogCtx) << "Bloom result: " << entity.identifier() << operationName(operation);
+                        foundValue = true;
+                    });
                     return false;
                 }))
             {}
             mBloomed = true;
             propertyFilter.insert(mBloomProperty, mBloomValue);
+            mCompiled = false;
             return foundValue;
         } else {
             //Filter on bloom value
@@ -388,6 +818,12 @@ DataStoreQuery::DataStoreQuery(const Sink::QueryBase &query, const QByteArray &t
     setupQuery(query);
 }
 
+DataStoreQuery::DataStoreQuery(const Sink::Query &query, const QByteArray &type, EntityStore &store)
+    : mType(type), mRequestedProperties(query.requestedProperties), mStore(store), mLogCtx(store.logContext().subContext("datastorequery"))
+{
+    setupQuery(query, query.limit());
+}
+
 DataStoreQuery::DataStoreQuery(const DataStoreQuery::State &state, const QByteArray &type, Sink::Storage::EntityStore &store, bool incremental)
     : mType(type), mStore(store), mLogCtx(store.logContext().subContext("datastorequery"))
 {
@@ -395,6 +831,8 @@ DataStoreQuery::DataStoreQuery(const DataStoreQuery::State &state, const QByteAr
     //And this is what we use when the data changed and we want to update with incremental = true
     mCollector = state.mCollector;
     mSource = state.mSource;
+    mRevision = state.mRevision;
+    mIncremental = incremental;
 
     auto source = mCollector;
     while (source) {
@@ -402,6 +840,7 @@ DataStoreQuery::DataStoreQuery(const DataStoreQuery::State &state, const QByteAr
         source->mIncremental = incremental;
         source = source->mSource;
     }
+    checkSnapshot();
 }
 
 DataStoreQuery::~DataStoreQuery()
@@ -411,20 +850,113 @@ DataStoreQuery::~DataStoreQuery()
 
 DataStoreQuery::State::Ptr DataStoreQuery::getState()
 {
+    //The state outlives the transaction, so nothing that has been read ahead can be kept
+    mCollector.staticCast<Collector>()->suspend();
     auto state = State::Ptr::create();
     state->mSource = mSource;
     state->mCollector = mCollector;
+    state->mRevision = mRevision;
     return state;
 }
 
+QString DataStoreQuery::error() const
+{
+    return mError;
+}
+
+bool DataStoreQuery::readsSnapshot() const
+{
+    //Incremental updates always read the latest state, the snapshot is moved forward once the update is complete.
+    return mRevision && !mIncremental;
+}
+
+void DataStoreQuery::checkSnapshot()
+{
+    if (readsSnapshot() && mRevision < mStore.cleanedUpRevision()) {
+        SinkWarningCtx(mLogCtx) << "The snapshot revision has already been cleaned up: " << mRevision;
+        mError = QString("The revision %1 of the snapshot has been cleaned up, the query has to be restarted.").arg(mRevision);
+    }
+}
+
+/*
+ * The indexes only reflect the latest revision, so entities that changed since the snapshot revision
+ * have to be read at the snapshot revision instead of being looked up in the indexes.
+ */
+const QSet<QByteArray> &DataStoreQuery::snapshotChanges()
+{
+    if (!mSnapshotChangesRead) {
+        mSnapshotChangesRead = true;
+        if (readsSnapshot()) {
+            mStore.readRevisions(mRevision + 1, mType, [&](const QByteArray &key) {
+                mSnapshotChanges.insert(DataStore::uidFromKey(key));
+            });
+        }
+    }
+    return mSnapshotChanges;
+}
+
 void DataStoreQuery::readEntity(const QByteArray &key, const BufferCallback &resultCallback)
 {
-    mStore.readLatest(mType, key, resultCallback);
+    if (readsSnapshot()) {
+        mStore.readAt(mType, key, mRevision, resultCallback);
+    } else {
+        mStore.readLatest(mType, key, resultCallback);
+    }
+}
+
+void DataStoreQuery::readEntities(const QVector<QByteArray> &keys, const std::function<void(int index, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> &resultCallback)
+{
+    mStore.readBatch(mType, keys, readsSnapshot() ? mRevision : 0, resultCallback);
+}
+
+void DataStoreQuery::readProjection(const QByteArray &index, const QByteArray &uid, const QByteArray &key, const BufferCallback &resultCallback)
+{
+    mStore.readProjection(mType, index, uid, key, resultCallback);
 }
 
 QVector<QByteArray> DataStoreQuery::indexLookup(const QByteArray &property, const QVariant &value)
 {
-    return mStore.indexLookup(mType, property, value);
+    const auto results = mStore.indexLookup(mType, property, value);
+    const auto &changes = snapshotChanges();
+    if (changes.isEmpty()) {
+        return results;
+    }
+    QVector<QByteArray> snapshotResults;
+    for (const auto &uid : results) {
+        if (!changes.contains(uid)) {
+            snapshotResults << uid;
+        }
+    }
+    for (const auto &uid : changes) {
+        readEntity(uid, [&](const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
+            if (operation != Sink::Operation_Removal && entity.getProperty(property) == value) {
+                snapshotResults << uid;
+            }
+        });
+    }
+    return snapshotResults;
+}
+
+QByteArrayList DataStoreQuery::fulltextTokens(const QByteArray &key)
+{
+    if (snapshotChanges().contains(key)) {
+        mError = QString("The fulltext index no longer contains the snapshot revision %1 of %2, the query has to be restarted.").arg(mRevision).arg(QString::fromUtf8(key));
+    }
+    return mStore.fulltextTokens(mType, key);
+}
+
+QSharedPointer<PropertyMapper> DataStoreQuery::propertyMapper()
+{
+    return mStore.propertyMapper(mType);
+}
+
+bool DataStoreQuery::readThreadSummary(const QByteArray &threadId, Sink::ThreadSummary &summary, const QByteArray &folder)
+{
+    //The summaries only reflect the latest revision
+    if (readsSnapshot()) {
+        return false;
+    }
+    return mStore.readThreadSummary(threadId, summary, folder);
 }
 
 /* ResultSet DataStoreQuery::filterAndSortSet(ResultSet &resultSet, const FilterFunction &filter, const QByteArray &sortProperty) */
@@ -510,19 +1042,52 @@ QVector<QByteArray> DataStoreQuery::indexLookup(const QByteArray &property, cons
 QByteArrayList DataStoreQuery::executeSubquery(const QueryBase &subquery)
 {
     Q_ASSERT(!subquery.type().isEmpty());
-    auto sub = DataStoreQuery(subquery, subquery.type(), mStore);
+    //The subquery is resolved at the same snapshot revision
+    auto query = subquery;
+    if (readsSnapshot()) {
+        query.setSnapshotRevision(mRevision);
+    }
+    auto sub = DataStoreQuery(query, query.type(), mStore);
     auto result = sub.execute();
     QByteArrayList ids;
     while (result.next([&ids](const ResultSet::Result &result) {
             ids << result.entity.identifier();
         }))
     {}
+    if (!sub.error().isEmpty()) {
+        mError = sub.error();
+    }
     return ids;
 }
 
-void DataStoreQuery::setupQuery(const Sink::QueryBase &query_)
+/*
+ * Returns true if the mails are either not filtered, or only filtered on a single folder, which is written to @param folder.
+ */
+static bool threadSummaryFolder(const QHash<QByteArray, QueryBase::Comparator> &filters, QByteArray &folder)
+{
+    if (filters.isEmpty()) {
+        return true;
+    }
+    if (filters.size() != 1 || !filters.contains(ApplicationDomain::Mail::Folder::name)) {
+        return false;
+    }
+    const auto comparator = filters.value(ApplicationDomain::Mail::Folder::name);
+    if (comparator.comparator != QueryBase::Comparator::Equals) {
+        return false;
+    }
+    if (comparator.value.userType() == qMetaTypeId<ApplicationDomain::Reference>()) {
+        folder = comparator.value.value<ApplicationDomain::Reference>().value;
+    } else {
+        folder = comparator.value.toByteArray();
+    }
+    return !folder.isEmpty();
+}
+
+void DataStoreQuery::setupQuery(const Sink::QueryBase &query_, int limit)
 {
     auto query = query_;
+    mRevision = query.snapshotRevision();
+    checkSnapshot();
     auto baseFilters = query.getBaseFilters();
     for (const auto &k : baseFilters.keys()) {
         const auto comparator = baseFilters.value(k);
@@ -537,9 +1102,18 @@ void DataStoreQuery::setupQuery(const Sink::QueryBase &query_)
     FilterBase::Ptr baseSet;
     QSet<QByteArray> remainingFilters = query.getBaseFilters().keys().toSet();
     QByteArray appliedSorting;
+    QByteArray coveringIndex;
+    QVector<QByteArray> coveredIds;
+    QVector<QByteArray> coveringKeys;
     if (!query.ids().isEmpty()) {
         mSource = Source::Ptr::create(query.ids().toVector(), this);
         baseSet = mSource;
+    } else if (query.getFilterStages().isEmpty() && mStore.coveringIndexLookup(mType, query, mRequestedProperties, coveringIndex, coveredIds, coveringKeys)) {
+        //The index contains all requested properties in the requested order, so the main database is never read.
+        mSource = Source::Ptr::create(coveredIds, this);
+        mSource->setProjections(coveringIndex, coveringKeys);
+        appliedSorting = query.sortProperty();
+        baseSet = mSource;
     } else {
         QSet<QByteArray> appliedFilters;
 
@@ -547,25 +1121,42 @@ void DataStoreQuery::setupQuery(const Sink::QueryBase &query_)
         remainingFilters = remainingFilters - appliedFilters;
 
         // We do a full scan if there were no indexes available to create the initial set.
-        if (appliedFilters.isEmpty()) {
+        // An ordered scan applies no filters, but still contains all entities.
+        if (appliedFilters.isEmpty() && appliedSorting.isEmpty()) {
             mSource = Source::Ptr::create(mStore.fullScan(mType), this);
+        } else if (!snapshotChanges().isEmpty()) {
+            //The entities that changed since the snapshot are filtered and sorted at the snapshot revision,
+            //since the indexes no longer reflect it.
+            const auto &changes = snapshotChanges();
+            QVector<QByteArray> snapshotResultSet;
+            for (const auto &uid : resultSet) {
+                if (!changes.contains(uid)) {
+                    snapshotResultSet << uid;
+                }
+            }
+            for (const auto &uid : changes) {
+                snapshotResultSet << uid;
+            }
+            mSource = Source::Ptr::create(snapshotResultSet, this);
+            appliedSorting.clear();
         } else {
             mSource = Source::Ptr::create(resultSet, this);
         }
         baseSet = mSource;
     }
-    if (!query.getBaseFilters().isEmpty()) {
+    if (!query.getBaseFilters().isEmpty() || !query.getOrFilters().isEmpty()) {
         auto filter = Filter::Ptr::create(baseSet, this);
         //For incremental queries the remaining filters are not sufficient
         for (const auto &f : query.getBaseFilters().keys()) {
             filter->propertyFilter.insert(f, query.getFilter(f));
         }
+        filter->orFilters = query.getOrFilters();
         baseSet = filter;
     }
-    /* if (appliedSorting.isEmpty() && !query.sortProperty.isEmpty()) { */
-    /*     //Apply manual sorting */
-    /*     baseSet = Sort::Ptr::create(baseSet, query.sortProperty); */
-    /* } */
+    if (appliedSorting.isEmpty() && !query.sortProperty().isEmpty()) {
+        //Apply manual sorting
+        baseSet = Sort::Ptr::create(query.sortProperty(), limit, baseSet, this);
+    }
 
     //Setup the rest of the filter stages on top of the base set
     for (const auto &stage : query.getFilterStages()) {
@@ -579,6 +1170,15 @@ void DataStoreQuery::setupQuery(const Sink::QueryBase &query_)
                 reduction->mAggregators << Reduce::Aggregator(aggregator.operation, aggregator.propertyToCollect, aggregator.resultProperty);
             }
             reduction->propertyFilter = query.getBaseFilters();
+            reduction->orFilters = query.getOrFilters();
+            //The summaries count all mails of a thread, or all mails of a thread in a folder,
+            //so they can't be used if the mails are filtered otherwise.
+            reduction->mUseThreadSummaries = mType == ApplicationDomain::Mail::name
+                && filter->property == ApplicationDomain::Mail::ThreadId::name
+                && filter->selector.property == ApplicationDomain::Mail::Date::name
+                && filter->selector.comparator == QueryBase::Reduce::Selector::Max
+                && threadSummaryFolder(reduction->propertyFilter, reduction->mThreadSummaryFolder) && reduction->orFilters.isEmpty()
+                && std::all_of(filter->aggregators.constBegin(), filter->aggregators.constEnd(), Reduce::canAggregate);
             baseSet = reduction;
         } else if (auto filter = stage.dynamicCast<Query::Bloom>()) {
             baseSet = Bloom::Ptr::create(filter->property, baseSet, this);
@@ -588,11 +1188,40 @@ void DataStoreQuery::setupQuery(const Sink::QueryBase &query_)
     mCollector = Collector::Ptr::create(baseSet, this);
 }
 
+qint64 DataStoreQuery::count(const Sink::QueryBase &query_, const QByteArray &type, EntityStore &store)
+{
+    auto query = query_;
+    if (query.getFilterStages().isEmpty()) {
+        const auto count = store.indexCount(type, query);
+        if (count >= 0) {
+            return count;
+        }
+    }
+    //The order doesn't matter for counting
+    query.setSortProperty({});
+    DataStoreQuery dataStoreQuery{query, type, store};
+    auto resultSet = dataStoreQuery.execute();
+    qint64 count = 0;
+    while (resultSet.next([&](const ResultSet::Result &) { count++; })) {
+    }
+    return count;
+}
+
 QVector<QByteArray> DataStoreQuery::loadIncrementalResultSet(qint64 baseRevision)
 {
     QVector<QByteArray> changedKeys;
+    QSet<QByteArray> changedUids;
     mStore.readRevisions(baseRevision, mType, [&](const QByteArray &key) {
         changedKeys << key;
+        changedUids << DataStore::uidFromKey(key);
+    });
+    //Entities that didn't change themselves, but of which a derived property changed, are read in their latest revision
+    mSource->mTouchedIds.clear();
+    mStore.readDerivedChanges(baseRevision, mType, [&](const QByteArray &uid) {
+        if (!changedUids.contains(uid) && !mSource->mTouchedIds.contains(uid)) {
+            mSource->mTouchedIds.insert(uid);
+            changedKeys << uid;
+        }
     });
     return changedKeys;
 }
@@ -600,6 +1229,7 @@ QVector<QByteArray> DataStoreQuery::loadIncrementalResultSet(qint64 baseRevision
 ResultSet DataStoreQuery::update(qint64 baseRevision)
 {
     SinkTraceCtx(mLogCtx) << "Executing query update from revision " << baseRevision;
+    mBaseRevision = baseRevision;
     auto incrementalResultSet = loadIncrementalResultSet(baseRevision);
     SinkTraceCtx(mLogCtx) << "Incremental changes: " << incrementalResultSet;
     mSource->add(incrementalResultSet);
@@ -619,6 +1249,10 @@ ResultSet DataStoreQuery::update(qint64 baseRevision)
 void DataStoreQuery::updateComplete()
 {
     mSource->mIncrementalIds.clear();
+    mSource->mTouchedIds.clear();
+    if (mRevision) {
+        mRevision = mStore.maxRevision();
+    }
 }
 
 ResultSet DataStoreQuery::execute()
@@ -626,6 +1260,9 @@ ResultSet DataStoreQuery::execute()
     SinkTraceCtx(mLogCtx) << "Executing query";
 
     ResultSet::ValueGenerator generator = [this](const ResultSet::Callback &callback) -> bool {
+        if (!mError.isEmpty()) {
+            return false;
+        }
         if (mCollector->next([this, callback](const ResultSet::Result &result) {
                 if (result.operation != Sink::Operation_Removal) {
                     SinkTraceCtx(mLogCtx) << "Got initial result: " << result.entity.identifier() << result.operation;
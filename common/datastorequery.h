@@ -25,6 +25,7 @@
 
 
 class Source;
+class Sort;
 class Bloom;
 class Reduce;
 class Filter;
@@ -33,6 +34,7 @@ class FilterBase;
 class DataStoreQuery {
     friend class FilterBase;
     friend class Source;
+    friend class Sort;
     friend class Bloom;
     friend class Reduce;
     friend class Filter;
@@ -43,9 +45,15 @@ public:
         typedef QSharedPointer<State> Ptr;
         QSharedPointer<FilterBase> mCollector;
         QSharedPointer<Source> mSource;
+        //The snapshot revision the query reads at, or 0 for the latest revision
+        qint64 mRevision = 0;
     };
 
     DataStoreQuery(const Sink::QueryBase &query, const QByteArray &type, Sink::Storage::EntityStore &store);
+    /**
+     * The limit of @param query bounds the memory used for sorting without a sorted index.
+     */
+    DataStoreQuery(const Sink::Query &query, const QByteArray &type, Sink::Storage::EntityStore &store);
     DataStoreQuery(const DataStoreQuery::State &state, const QByteArray &type, Sink::Storage::EntityStore &store, bool incremental);
     ~DataStoreQuery();
     ResultSet execute();
@@ -54,24 +62,58 @@ public:
 
     State::Ptr getState();
 
+    /**
+     * Set if the query can't be answered, e.g. because the revisions of its snapshot have been cleaned up.
+     *
+     * The results that have been returned so far are not reliable in that case, and the query has to be restarted.
+     */
+    QString error() const;
+
+    /**
+     * Counts the results of @param query.
+     *
+     * If a single index applies all filters the count is read from the index,
+     * otherwise the results are streamed through the query without being collected.
+     */
+    static qint64 count(const Sink::QueryBase &query, const QByteArray &type, Sink::Storage::EntityStore &store);
+
 private:
 
     typedef std::function<bool(const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> FilterFunction;
     typedef std::function<void(const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> BufferCallback;
 
     QVector<QByteArray> indexLookup(const QByteArray &property, const QVariant &value);
+    QByteArrayList fulltextTokens(const QByteArray &key);
+    QSharedPointer<PropertyMapper> propertyMapper();
+    bool readThreadSummary(const QByteArray &threadId, Sink::ThreadSummary &summary, const QByteArray &folder);
 
     void readEntity(const QByteArray &key, const BufferCallback &resultCallback);
+    void readEntities(const QVector<QByteArray> &keys, const std::function<void(int index, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> &resultCallback);
+    void readProjection(const QByteArray &index, const QByteArray &uid, const QByteArray &key, const BufferCallback &resultCallback);
 
     ResultSet createFilteredSet(ResultSet &resultSet, const FilterFunction &);
     QVector<QByteArray> loadIncrementalResultSet(qint64 baseRevision);
 
-    void setupQuery(const Sink::QueryBase &query_);
+    void setupQuery(const Sink::QueryBase &query_, int limit = 0);
     QByteArrayList executeSubquery(const Sink::QueryBase &subquery);
 
+    bool readsSnapshot() const;
+    void checkSnapshot();
+    const QSet<QByteArray> &snapshotChanges();
+
     const QByteArray mType;
+    //Empty if all properties are required
+    QByteArrayList mRequestedProperties;
     QSharedPointer<FilterBase> mCollector;
     QSharedPointer<Source> mSource;
+    qint64 mRevision = 0;
+    bool mIncremental = false;
+    //The revision an incremental update reads the changes from
+    qint64 mBaseRevision = 0;
+    //The entities that changed since the snapshot revision, which the indexes no longer reflect
+    QSet<QByteArray> mSnapshotChanges;
+    bool mSnapshotChangesRead = false;
+    QString mError;
 
     Sink::Storage::EntityStore &mStore;
     Sink::Log::Context mLogCtx;
@@ -81,6 +123,9 @@ private:
 class FilterBase {
 public:
     typedef QSharedPointer<FilterBase> Ptr;
+    typedef QVector<ResultSet::Result> Batch;
+    //The number of results the stages pass on at once
+    static const int batchSize = 256;
     FilterBase(DataStoreQuery *store)
         : mDatastore(store)
     {
@@ -101,17 +146,59 @@ public:
         mDatastore->readEntity(key, callback);
     }
 
+    void readEntities(const QVector<QByteArray> &keys, const std::function<void(int index, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> &callback)
+    {
+        Q_ASSERT(mDatastore);
+        mDatastore->readEntities(keys, callback);
+    }
+
     QVector<QByteArray> indexLookup(const QByteArray &property, const QVariant &value)
     {
         Q_ASSERT(mDatastore);
         return mDatastore->indexLookup(property, value);
     }
 
+    QByteArrayList fulltextTokens(const QByteArray &key)
+    {
+        Q_ASSERT(mDatastore);
+        return mDatastore->fulltextTokens(key);
+    }
+
+    QSharedPointer<PropertyMapper> propertyMapper()
+    {
+        Q_ASSERT(mDatastore);
+        return mDatastore->propertyMapper();
+    }
+
     virtual void skip() { mSource->skip(); };
 
+    //Starts over with the first result of the source
+    virtual void reset() { mSource->reset(); };
+
     //Returns true for as long as a result is available
     virtual bool next(const std::function<void(const ResultSet::Result &)> &callback) = 0;
 
+    /**
+     * Appends up to batchSize results to @param batch, in the order next() would produce them.
+     *
+     * Returns true for as long as more results are available.
+     * Stages that don't process batches pull their results one by one.
+     */
+    virtual bool nextBatch(Batch &batch)
+    {
+        bool more = true;
+        while (more && batch.size() < batchSize) {
+            more = next([&](const ResultSet::Result &result) { batch << result; });
+        }
+        return more;
+    }
+
+    /**
+     * Returns true if the stage passes on the entities of the source in order and without keeping any state,
+     * so results that have been read ahead in a batch can be read again from the source.
+     */
+    virtual bool isBatched() const { return false; }
+
     FilterBase::Ptr mSource;
     DataStoreQuery *mDatastore;
     bool mIncremental = false;
@@ -93,6 +93,7 @@ SINK_REGISTER_PROPERTY(Mail, Trash);
 SINK_REGISTER_PROPERTY(Mail, Sent);
 SINK_REGISTER_PROPERTY(Mail, MessageId);
 SINK_REGISTER_PROPERTY(Mail, ParentMessageId);
+SINK_REGISTER_PROPERTY(Mail, Ancestors);
 SINK_REGISTER_PROPERTY(Mail, ThreadId);
 
 SINK_REGISTER_ENTITY(Folder);
@@ -103,6 +104,9 @@ SINK_REGISTER_PROPERTY(Folder, Enabled);
 SINK_REGISTER_PROPERTY(Folder, Parent);
 SINK_REGISTER_PROPERTY(Folder, Count);
 SINK_REGISTER_PROPERTY(Folder, FullContentAvailable);
+SINK_REGISTER_PROPERTY(Folder, TotalCount);
+SINK_REGISTER_PROPERTY(Folder, UnreadCount);
+SINK_REGISTER_PROPERTY(Folder, ImportantCount);
 
 SINK_REGISTER_ENTITY(Contact);
 SINK_REGISTER_PROPERTY(Contact, Uid);
@@ -213,6 +217,14 @@ QVariant ApplicationDomainType::getProperty(const QByteArray &key) const
     return mAdaptor->getProperty(key);
 }
 
+void const *ApplicationDomainType::localBuffer() const
+{
+    if (!mAdaptor) {
+        return nullptr;
+    }
+    return mAdaptor->localBuffer();
+}
+
 void ApplicationDomainType::setProperty(const QByteArray &key, const QVariant &value)
 {
     Q_ASSERT(mAdaptor);
@@ -234,6 +246,10 @@ void ApplicationDomainType::setProperty(const QByteArray &key, const Application
 QByteArray ApplicationDomainType::getBlobProperty(const QByteArray &key) const
 {
     const auto path = getProperty(key).value<BLOB>().value;
+    if (path.isEmpty()) {
+        //The blob is not locally available
+        return QByteArray();
+    }
     QFile file(path);
     if (!file.open(QIODevice::ReadOnly)) {
         SinkError() << "Failed to open the file for reading: " << file.errorString() << "Path:" << path << " For property:" << key;
@@ -273,6 +273,13 @@ public:
     void setProperty(const QByteArray &key, const QVariant &value);
     void setProperty(const QByteArray &key, const ApplicationDomainType &value);
 
+    /**
+     * The buffer the properties are read from, for filters that are evaluated on the buffer directly.
+     *
+     * Returns nullptr if the entity is not read from a single buffer.
+     */
+    void const *localBuffer() const;
+
     QByteArray getBlobProperty(const QByteArray &key) const;
     void setBlobProperty(const QByteArray &key, const QByteArray &value);
 
@@ -407,6 +414,9 @@ struct SINK_EXPORT Folder : public Entity {
     SINK_EXTRACTED_PROPERTY(QDateTime, LastUpdated, lastUpdated);
     SINK_EXTRACTED_PROPERTY(int, Count, count);
     SINK_EXTRACTED_PROPERTY(bool, FullContentAvailable, fullContentAvailable);
+    SINK_INDEX_PROPERTY(int, TotalCount, totalCount);
+    SINK_INDEX_PROPERTY(int, UnreadCount, unreadCount);
+    SINK_INDEX_PROPERTY(int, ImportantCount, importantCount);
 };
 
 struct SINK_EXPORT Mail : public Entity {
@@ -432,6 +442,7 @@ struct SINK_EXPORT Mail : public Entity {
     SINK_PROPERTY(bool, Sent, sent);
     SINK_EXTRACTED_PROPERTY(QByteArray, MessageId, messageId);
     SINK_EXTRACTED_PROPERTY(QByteArray, ParentMessageId, parentMessageId);
+    SINK_EXTRACTED_PROPERTY(QByteArrayList, Ancestors, ancestors);
     SINK_INDEX_PROPERTY(QByteArray, ThreadId, threadId);
 };
 
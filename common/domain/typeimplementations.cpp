@@ -27,6 +27,7 @@
 #include "entitybuffer.h"
 #include "entity_generated.h"
 #include "mail/threadindexer.h"
+#include "mail/foldercounts.h"
 #include "domainadaptor.h"
 #include "typeimplementations_p.h"
 
@@ -43,9 +44,15 @@ typedef IndexConfig<Mail,
         ValueIndex<Mail::MessageId>,
         ValueIndex<Mail::Draft>,
         SortedIndex<Mail::Folder, Mail::Date>,
+        CoveringIndex<Mail::Folder, Mail::Date, Mail::Subject, Mail::Sender, Mail::Unread, Mail::Important>,
+        SortIndex<Mail::Date>,
+        CompoundIndex<Mail::Folder, Mail::Unread, Mail::Draft>,
+        CompoundIndex<Mail::Folder, Mail::Important>,
         SecondaryIndex<Mail::MessageId, Mail::ThreadId>,
         SecondaryIndex<Mail::ThreadId, Mail::MessageId>,
-        CustomSecondaryIndex<Mail::MessageId, Mail::ThreadId, ThreadIndexer>
+        CustomSecondaryIndex<Mail::MessageId, Mail::ThreadId, ThreadIndexer>,
+        CustomIndex<FolderCountIndexer>,
+        FulltextSearchIndex
     > MailIndexConfig;
 
 typedef IndexConfig<Folder,
@@ -54,7 +61,9 @@ typedef IndexConfig<Folder,
     > FolderIndexConfig;
 
 typedef IndexConfig<Contact,
-        ValueIndex<Contact::Uid>
+        ValueIndex<Contact::Uid>,
+        ValueIndex<Contact::Addressbook>,
+        SortIndex<Contact::Fn>
     > ContactIndexConfig;
 
 typedef IndexConfig<Addressbook,
@@ -78,11 +87,12 @@ QMap<QByteArray, int> TypeImplementation<Mail>::typeDatabases()
 
 void TypeImplementation<Mail>::configure(IndexPropertyMapper &indexPropertyMapper)
 {
-    indexPropertyMapper.addIndexLookupProperty<Mail::ThreadId>([](TypeIndex &index, const ApplicationDomain::BufferAdaptor &entity) {
+    indexPropertyMapper.addIndexLookupProperty<Mail::ThreadId>([](TypeIndex &index, const QByteArray &, const ApplicationDomain::BufferAdaptor &entity) {
             auto messageId = entity.getProperty(Mail::MessageId::name);
             auto thread = index.secondaryLookup<Mail::MessageId, Mail::ThreadId>(messageId);
             if (!thread.isEmpty()) {
-                return thread.first();
+                //The thread may have been merged with another one since
+                return index.resolveValue<Mail::ThreadId>(thread.first());
             }
             return QByteArray{};
         });
@@ -96,6 +106,27 @@ void TypeImplementation<Mail>::configure(PropertyMapper &propertyMapper)
     SINK_REGISTER_SERIALIZER(propertyMapper, Mail, Bcc, bcc);
     SINK_REGISTER_SERIALIZER(propertyMapper, Mail, Subject, subject);
     SINK_REGISTER_SERIALIZER(propertyMapper, Mail, Date, date);
+    //Buffers written before dates were stored as numbers only contain the serialized QDateTime
+    propertyMapper.addReadMapping(Mail::Date::name, [](void const *buffer) -> QVariant {
+        const auto mail = static_cast<const Sink::ApplicationDomain::Buffer::Mail *>(buffer);
+        if (mail->legacyDate()) {
+            return propertyToVariant<QDateTime>(mail->legacyDate());
+        }
+        return propertyToVariant<QDateTime>(mail->date());
+    });
+    propertyMapper.addPredicate(Mail::Date::name, [](const Sink::QueryBase::Comparator &comparator) -> PropertyMapper::Predicate {
+        const auto matcher = propertyMatcher<QDateTime, int64_t>(comparator);
+        if (!matcher) {
+            return {};
+        }
+        return [comparator, matcher](void const *buffer) {
+            const auto mail = static_cast<const Sink::ApplicationDomain::Buffer::Mail *>(buffer);
+            if (mail->legacyDate()) {
+                return comparator.matches(propertyToVariant<QDateTime>(mail->legacyDate()));
+            }
+            return matcher(mail->date());
+        };
+    });
     SINK_REGISTER_SERIALIZER(propertyMapper, Mail, Unread, unread);
     SINK_REGISTER_SERIALIZER(propertyMapper, Mail, Important, important);
     SINK_REGISTER_SERIALIZER(propertyMapper, Mail, Folder, folder);
@@ -106,6 +137,7 @@ void TypeImplementation<Mail>::configure(PropertyMapper &propertyMapper)
     SINK_REGISTER_SERIALIZER(propertyMapper, Mail, Sent, sent);
     SINK_REGISTER_SERIALIZER(propertyMapper, Mail, MessageId, messageId);
     SINK_REGISTER_SERIALIZER(propertyMapper, Mail, ParentMessageId, parentMessageId);
+    SINK_REGISTER_SERIALIZER(propertyMapper, Mail, Ancestors, ancestors);
 }
 
 
@@ -128,9 +160,30 @@ void TypeImplementation<Folder>::configure(PropertyMapper &propertyMapper)
     SINK_REGISTER_SERIALIZER(propertyMapper, Folder, Enabled, enabled);
 }
 
-void TypeImplementation<Folder>::configure(IndexPropertyMapper &)
+void TypeImplementation<Folder>::configure(IndexPropertyMapper &indexPropertyMapper)
 {
-
+    //The counts are maintained by the FolderCountIndexer of the mails
+    indexPropertyMapper.addIndexLookupProperty<Folder::TotalCount>([](TypeIndex &index, const QByteArray &identifier, const ApplicationDomain::BufferAdaptor &) {
+            FolderCounts counts;
+            if (!FolderCounts::read(identifier, counts, index.transaction())) {
+                return QVariant{};
+            }
+            return QVariant::fromValue(static_cast<int>(counts.total));
+        });
+    indexPropertyMapper.addIndexLookupProperty<Folder::UnreadCount>([](TypeIndex &index, const QByteArray &identifier, const ApplicationDomain::BufferAdaptor &) {
+            FolderCounts counts;
+            if (!FolderCounts::read(identifier, counts, index.transaction())) {
+                return QVariant{};
+            }
+            return QVariant::fromValue(static_cast<int>(counts.unread));
+        });
+    indexPropertyMapper.addIndexLookupProperty<Folder::ImportantCount>([](TypeIndex &index, const QByteArray &identifier, const ApplicationDomain::BufferAdaptor &) {
+            FolderCounts counts;
+            if (!FolderCounts::read(identifier, counts, index.transaction())) {
+                return QVariant{};
+            }
+            return QVariant::fromValue(static_cast<int>(counts.important));
+        });
 }
 
 
@@ -78,6 +78,38 @@ public:
     }
 };
 
+template <typename Property, typename SortProperty, typename ... ProjectedProperties>
+class CoveringIndex
+{
+public:
+    static void configure(TypeIndex &index)
+    {
+        index.addCoveringProperty<Property, SortProperty, ProjectedProperties...>();
+    }
+
+    template <typename EntityType>
+    static QMap<QByteArray, int> databases()
+    {
+        return {{QByteArray{EntityType::name} +".index." + Property::name + ".sort." + SortProperty::name + ".covering", 0}};
+    }
+};
+
+template <typename SortProperty>
+class SortIndex
+{
+public:
+    static void configure(TypeIndex &index)
+    {
+        index.addSortedProperty<SortProperty>();
+    }
+
+    template <typename EntityType>
+    static QMap<QByteArray, int> databases()
+    {
+        return {{QByteArray{EntityType::name} +".index.sort." + SortProperty::name, 1}};
+    }
+};
+
 template <typename Property, typename SecondaryProperty>
 class SecondaryIndex
 {
@@ -110,6 +142,54 @@ public:
     }
 };
 
+template <typename ... Properties>
+class CompoundIndex
+{
+public:
+    static void configure(TypeIndex &index)
+    {
+        index.addCompoundProperty<Properties...>();
+    }
+
+    template <typename EntityType>
+    static QMap<QByteArray, int> databases()
+    {
+        return {{QByteArray{EntityType::name} +".index." + QByteArrayList{Properties::name...}.join('.'), 1}};
+    }
+};
+
+template <typename Indexer>
+class CustomIndex
+{
+public:
+    static void configure(TypeIndex &index)
+    {
+        index.addCustomIndexer<Indexer>();
+    }
+
+    template <typename EntityType>
+    static QMap<QByteArray, int> databases()
+    {
+        return Indexer::databases();
+    }
+};
+
+class FulltextSearchIndex
+{
+public:
+    static void configure(TypeIndex &index)
+    {
+        index.addFulltextIndex();
+    }
+
+    template <typename EntityType>
+    static QMap<QByteArray, int> databases()
+    {
+        return {{QByteArray{EntityType::name} +".fulltext", 1},
+                {QByteArray{EntityType::name} +".fulltext.tokens", 0}};
+    }
+};
+
 template <typename EntityType, typename ... Indexes>
 class IndexConfig
 {
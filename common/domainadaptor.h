@@ -82,17 +82,17 @@ static void createBufferPartBuffer(const Sink::ApplicationDomain::ApplicationDom
 class IndexPropertyMapper
 {
 public:
-    typedef std::function<QVariant(TypeIndex &index, const Sink::ApplicationDomain::BufferAdaptor &adaptor)> Accessor;
+    typedef std::function<QVariant(TypeIndex &index, const QByteArray &identifier, const Sink::ApplicationDomain::BufferAdaptor &adaptor)> Accessor;
     virtual ~IndexPropertyMapper(){};
 
-    virtual QVariant getProperty(const QByteArray &key, TypeIndex &index, const Sink::ApplicationDomain::BufferAdaptor &adaptor) const
+    virtual QVariant getProperty(const QByteArray &key, TypeIndex &index, const QByteArray &identifier, const Sink::ApplicationDomain::BufferAdaptor &adaptor) const
     {
         auto accessor = mReadAccessors.value(key);
         Q_ASSERT(accessor);
         if (!accessor) {
             return QVariant();
         }
-        return accessor(index, adaptor);
+        return accessor(index, identifier, adaptor);
     }
 
     bool hasMapping(const QByteArray &key) const
@@ -136,11 +136,16 @@ public:
         if (mLocalBuffer && mLocalMapper->hasMapping(key)) {
             return mLocalMapper->getProperty(key, mLocalBuffer);
         } else if (mIndex && mIndexMapper->hasMapping(key)) {
-            return mIndexMapper->getProperty(key, *mIndex, *this);
+            return mIndexMapper->getProperty(key, *mIndex, mIdentifier, *this);
         }
         return QVariant();
     }
 
+    virtual void const *localBuffer() const Q_DECL_OVERRIDE
+    {
+        return mLocalBuffer;
+    }
+
     /**
      * Returns all available properties for which a mapping exists (no matter what the buffer contains)
      */
@@ -153,6 +158,7 @@ public:
     QSharedPointer<PropertyMapper> mLocalMapper;
     QSharedPointer<IndexPropertyMapper> mIndexMapper;
     TypeIndex *mIndex;
+    QByteArray mIdentifier;
 };
 
 /**
@@ -182,16 +188,22 @@ public:
      *
      * This returns by default a DatastoreBufferAdaptor initialized with the corresponding property mappers.
      */
-    virtual QSharedPointer<Sink::ApplicationDomain::BufferAdaptor> createAdaptor(const Sink::Entity &entity, TypeIndex *index = nullptr) Q_DECL_OVERRIDE
+    virtual QSharedPointer<Sink::ApplicationDomain::BufferAdaptor> createAdaptor(const Sink::Entity &entity, TypeIndex *index = nullptr, const QByteArray &identifier = {}) Q_DECL_OVERRIDE
     {
         auto adaptor = QSharedPointer<DatastoreBufferAdaptor>::create();
         adaptor->mLocalBuffer = Sink::EntityBuffer::readBuffer<LocalBuffer>(entity.local());
         adaptor->mLocalMapper = mPropertyMapper;
         adaptor->mIndexMapper = mIndexMapper;
         adaptor->mIndex = index;
+        adaptor->mIdentifier = identifier;
         return adaptor;
     }
 
+    virtual QSharedPointer<PropertyMapper> propertyMapper() const Q_DECL_OVERRIDE
+    {
+        return mPropertyMapper;
+    }
+
     virtual bool
     createBuffer(const Sink::ApplicationDomain::ApplicationDomainType &domainObject, flatbuffers::FlatBufferBuilder &fbb, void const *metadataData = 0, size_t metadataSize = 0) Q_DECL_OVERRIDE
     {
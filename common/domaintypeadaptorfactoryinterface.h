@@ -19,8 +19,10 @@
 #pragma once
 
 #include <QSharedPointer>
+#include <QByteArray>
 
 class TypeIndex;
+class PropertyMapper;
 namespace Sink {
 namespace ApplicationDomain {
 class BufferAdaptor;
@@ -38,7 +40,15 @@ class DomainTypeAdaptorFactoryInterface
 public:
     typedef QSharedPointer<DomainTypeAdaptorFactoryInterface> Ptr;
     virtual ~DomainTypeAdaptorFactoryInterface(){};
-    virtual QSharedPointer<Sink::ApplicationDomain::BufferAdaptor> createAdaptor(const Sink::Entity &entity, TypeIndex *index = nullptr) = 0;
+    virtual QSharedPointer<Sink::ApplicationDomain::BufferAdaptor> createAdaptor(const Sink::Entity &entity, TypeIndex *index = nullptr, const QByteArray &identifier = {}) = 0;
+
+    /**
+     * The mapper the adaptors read the properties with, if they are read from a buffer.
+     */
+    virtual QSharedPointer<PropertyMapper> propertyMapper() const
+    {
+        return {};
+    }
 
     /*
      * Creates a buffer from @param domainType
@@ -25,6 +25,8 @@
 #include "definitions.h"
 #include "domainadaptor.h"
 #include "queryrunner.h"
+#include "datastorequery.h"
+#include "storage/entitystore.h"
 #include "bufferutils.h"
 #include "resourceconfig.h"
 
@@ -111,6 +113,16 @@ QPair<KAsync::Job<void>, typename ResultEmitter<typename DomainType::Ptr>::Ptr>
     return qMakePair(KAsync::null<void>(), runner->emitter());
 }
 
+template <class DomainType>
+qint64 GenericFacade<DomainType>::count(const Sink::Query &query, const Log::Context &ctx)
+{
+    Q_ASSERT(DomainType::name == query.type() || query.type().isEmpty());
+    Storage::EntityStore store{mResourceContext, ctx};
+    const auto count = DataStoreQuery::count(query, bufferTypeForDomainType(), store);
+    SinkTraceCtx(ctx) << "Counted " << count << " entities.";
+    return count;
+}
+
 #define REGISTER_TYPE(T) \
     template class Sink::GenericFacade<T>; \
 
@@ -66,6 +66,7 @@ public:
     KAsync::Job<void> copy(const DomainType &domainObject, const QByteArray &newResource) Q_DECL_OVERRIDE;
     KAsync::Job<void> remove(const DomainType &domainObject) Q_DECL_OVERRIDE;
     virtual QPair<KAsync::Job<void>, typename ResultEmitter<typename DomainType::Ptr>::Ptr> load(const Sink::Query &query, const Log::Context &) Q_DECL_OVERRIDE;
+    virtual qint64 count(const Sink::Query &query, const Log::Context &) Q_DECL_OVERRIDE;
 
 protected:
     std::function<void(Sink::ApplicationDomain::ApplicationDomainType &domainObject)> mResultTransformation;
@@ -90,6 +90,16 @@ public:
      * Load entities from the store.
      */
     virtual QPair<KAsync::Job<void>, typename Sink::ResultEmitter<typename DomainType::Ptr>::Ptr> load(const Query &query, const Log::Context &) = 0;
+
+    /**
+     * Count entities in the store without loading them.
+     *
+     * Returns -1 if the facade can't count, in which case the entities are loaded and counted instead.
+     */
+    virtual qint64 count(const Query &, const Log::Context &)
+    {
+        return -1;
+    }
 };
 
 template <class DomainType>
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2016 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fulltextindex.h"
+
+#include <QSet>
+#include <algorithm>
+
+#include "log.h"
+
+//Single letters are not worth indexing, and overlong tokens are truncated to stay well below the lmdb key size limit.
+static const int minimumTokenLength = 2;
+static const int maximumTokenLength = 64;
+
+FulltextIndex::FulltextIndex(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction)
+    : mIndex(name, transaction),
+    mTokens(transaction.openDatabase(name + ".tokens", std::function<void(const Sink::Storage::DataStore::Error &)>(), false)),
+    mName(name),
+    mLogCtx("fulltextindex." + name)
+{
+}
+
+QByteArrayList FulltextIndex::tokenize(const QString &text)
+{
+    QSet<QByteArray> tokens;
+    QString token;
+    auto addToken = [&] {
+        if (token.size() >= minimumTokenLength) {
+            tokens.insert(token.left(maximumTokenLength).toUtf8());
+        }
+        token.clear();
+    };
+    for (const auto &c : text) {
+        if (c.isLetterOrNumber()) {
+            token.append(c.toCaseFolded());
+        } else {
+            addToken();
+        }
+    }
+    addToken();
+    auto list = tokens.toList();
+    std::sort(list.begin(), list.end());
+    return list;
+}
+
+bool FulltextIndex::matches(const QByteArrayList &tokens, const QString &query)
+{
+    const auto queryTokens = tokenize(query);
+    if (queryTokens.isEmpty()) {
+        return false;
+    }
+    for (const auto &queryToken : queryTokens) {
+        //The tokens are sorted, so a token with the prefix can only be at the lower bound.
+        const auto it = std::lower_bound(tokens.constBegin(), tokens.constEnd(), queryToken);
+        if (it == tokens.constEnd() || !it->startsWith(queryToken)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QByteArrayList FulltextIndex::tokens(const QByteArray &identifier)
+{
+    QByteArrayList result;
+    mTokens.scan(identifier, [&](const QByteArray &, const QByteArray &value) -> bool {
+            //Create a deep copy, the value is only valid during the transaction
+            result = QByteArray{value.constData(), value.size()}.split(' ');
+            return false;
+        },
+        [&](const Sink::Storage::DataStore::Error &error) {
+            if (error.code != Sink::Storage::DataStore::NotFound) {
+                SinkWarningCtx(mLogCtx) << "Error while reading the tokens: " << identifier << error;
+            }
+        });
+    result.removeAll(QByteArray{});
+    return result;
+}
+
+void FulltextIndex::update(const QByteArray &identifier, const QString &content)
+{
+    const auto oldTokens = tokens(identifier).toSet();
+    const auto newTokenList = tokenize(content);
+    const auto newTokens = newTokenList.toSet();
+    //Only touch the tokens that actually changed
+    for (const auto &token : oldTokens - newTokens) {
+        mIndex.remove(token, identifier);
+    }
+    for (const auto &token : newTokens - oldTokens) {
+        mIndex.add(token, identifier);
+    }
+    if (newTokenList.isEmpty()) {
+        mTokens.remove(identifier, [](const Sink::Storage::DataStore::Error &) {});
+        return;
+    }
+    mTokens.write(identifier, newTokenList.join(' '), [&](const Sink::Storage::DataStore::Error &error) {
+        SinkWarningCtx(mLogCtx) << "Error while writing the tokens: " << identifier << error;
+    });
+}
+
+void FulltextIndex::remove(const QByteArray &identifier)
+{
+    for (const auto &token : tokens(identifier)) {
+        mIndex.remove(token, identifier);
+    }
+    mTokens.remove(identifier, [](const Sink::Storage::DataStore::Error &) {});
+}
+
+QVector<QByteArray> FulltextIndex::lookup(const QString &query)
+{
+    const auto queryTokens = tokenize(query);
+    if (queryTokens.isEmpty()) {
+        return {};
+    }
+    QSet<QByteArray> result;
+    bool first = true;
+    for (const auto &queryToken : queryTokens) {
+        //All tokens with the prefix are in [prefix, prefix with the last byte incremented). 0xff never occurs in utf8.
+        auto upperBound = queryToken;
+        upperBound[upperBound.size() - 1] = upperBound.at(upperBound.size() - 1) + 1;
+        QSet<QByteArray> matches;
+        mIndex.rangeLookup(queryToken, upperBound, [&](const QByteArray &value) {
+                matches.insert(QByteArray{value.constData(), value.size()});
+            },
+            [&](const Index::Error &error) {
+                SinkWarningCtx(mLogCtx) << "Lookup error in index: " << error.message << queryToken;
+            });
+        if (first) {
+            result = matches;
+            first = false;
+        } else {
+            result.intersect(matches);
+        }
+        if (result.isEmpty()) {
+            break;
+        }
+    }
+    SinkTraceCtx(mLogCtx) << "Fulltext lookup for " << query << " found " << result.size() << " results.";
+    return result.toList().toVector();
+}
+
+Index::Statistics FulltextIndex::statistics()
+{
+    return mIndex.statistics();
+}
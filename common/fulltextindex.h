@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "sink_export.h"
+#include <QString>
+#include <QVector>
+#include "storage.h"
+#include "index.h"
+#include "log.h"
+
+/**
+ * An inverted token index for fulltext search.
+ *
+ * Maps every token of the indexed content to the identifier of the entity.
+ * The tokens of every entity are additionally stored per identifier,
+ * so updates and removals don't require the original content.
+ */
+class SINK_EXPORT FulltextIndex
+{
+public:
+    FulltextIndex(const QByteArray &name, Sink::Storage::DataStore::Transaction &);
+
+    /**
+     * Splits @param text into case folded words.
+     *
+     * Every token is returned only once.
+     */
+    static QByteArrayList tokenize(const QString &text);
+
+    /**
+     * Returns true if every word of @param query is a prefix of one of the @param tokens.
+     */
+    static bool matches(const QByteArrayList &tokens, const QString &query);
+
+    /**
+     * Replaces the indexed content of @param identifier with @param content.
+     */
+    void update(const QByteArray &identifier, const QString &content);
+    void remove(const QByteArray &identifier);
+
+    /**
+     * Returns the indexed tokens of @param identifier.
+     */
+    QByteArrayList tokens(const QByteArray &identifier);
+
+    /**
+     * Returns all identifiers that match every word of @param query as a prefix.
+     */
+    QVector<QByteArray> lookup(const QString &query);
+
+    /**
+     * Statistics of the inverted index, the number of distinct keys is the number of distinct tokens.
+     */
+    Index::Statistics statistics();
+
+private:
+    Q_DISABLE_COPY(FulltextIndex);
+    Index mIndex;
+    Sink::Storage::DataStore::NamedDatabase mTokens;
+    QByteArray mName;
+    Sink::Log::Context mLogCtx;
+};
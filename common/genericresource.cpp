@@ -24,6 +24,7 @@
 #include "commandprocessor.h"
 #include "definitions.h"
 #include "storage.h"
+#include "resourceconfig.h"
 
 using namespace Sink;
 using namespace Sink::Storage;
@@ -39,6 +40,12 @@ GenericResource::GenericResource(const ResourceContext &resourceContext, const Q
     QObject::connect(mProcessor.data(), &CommandProcessor::error, [this](int errorCode, const QString &msg) { onProcessorError(errorCode, msg); });
     QObject::connect(mProcessor.data(), &CommandProcessor::notify, this, &GenericResource::notify);
     QObject::connect(mPipeline.data(), &Pipeline::revisionUpdated, this, &Resource::revisionUpdated);
+
+    //Resources that never replay changes (e.g. read-only subscriptions or archives) can opt out of keeping a revision history.
+    const auto keepHistory = ResourceConfig::getConfiguration(resourceContext.instanceId()).value("keepHistory", true).toBool();
+    if (!keepHistory) {
+        mPipeline->setKeepHistory(false);
+    }
 }
 
 GenericResource::~GenericResource()
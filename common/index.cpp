@@ -2,36 +2,141 @@
 
 #include "log.h"
 
+//Shared by all indexes of a store, keyed by the index name.
+static const QByteArray statisticsDatabase = "index.stats";
+
 Index::Index(const QString &storageRoot, const QString &name, Sink::Storage::DataStore::AccessMode mode)
     : mTransaction(Sink::Storage::DataStore(storageRoot, name, mode).createTransaction(mode)),
+      mParentTransaction(&mTransaction),
       mDb(mTransaction.openDatabase(name.toLatin1(), std::function<void(const Sink::Storage::DataStore::Error &)>(), true)),
       mName(name),
       mLogCtx("index." + name.toLatin1())
 {
 }
 
-Index::Index(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction)
-    : mDb(transaction.openDatabase(name, std::function<void(const Sink::Storage::DataStore::Error &)>(), true)), mName(name),
+Index::Index(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction, bool bloomFilter)
+    : mParentTransaction(&transaction),
+      mDb(transaction.openDatabase(name, std::function<void(const Sink::Storage::DataStore::Error &)>(), true)), mName(name),
       mLogCtx("index." + name)
 {
+    if (bloomFilter && !transaction.isReadOnly()) {
+        auto keySource = [&transaction, name](const std::function<void(const QByteArray &key)> &callback) {
+            transaction.openDatabase(name, {}, true).scan({}, [&](const QByteArray &key, const QByteArray &) {
+                    callback(key);
+                    return true;
+                },
+                [](const Sink::Storage::DataStore::Error &) {});
+        };
+        mBloomFilter = QSharedPointer<Sink::Storage::PersistentBloomFilter>::create(name, transaction, keySource, mDb.entryCount());
+    }
 }
 
 void Index::add(const QByteArray &key, const QByteArray &value)
 {
+    const bool isNewKey = !containsKey(key);
     mDb.write(key, value, [&] (const Sink::Storage::DataStore::Error &error) {
         SinkWarningCtx(mLogCtx) << "Error while writing value" << error;
     });
+    if (mBloomFilter) {
+        mBloomFilter->add(key);
+    }
+    if (isNewKey) {
+        updateDistinctKeys(1);
+    }
+}
+
+void Index::append(const QByteArray &key, const QByteArray &value)
+{
+    mDb.append(key, value, [&] (const Sink::Storage::DataStore::Error &error) {
+        SinkWarningCtx(mLogCtx) << "Error while appending value" << error;
+    });
+    if (mBloomFilter) {
+        mBloomFilter->add(key);
+    }
+    if (mAppendedKeys == 0 || key != mLastAppendedKey) {
+        mLastAppendedKey = key;
+        mAppendedKeys++;
+    }
+}
+
+void Index::finishAppend()
+{
+    if (mAppendedKeys) {
+        updateDistinctKeys(mAppendedKeys);
+        mAppendedKeys = 0;
+    }
 }
 
 void Index::remove(const QByteArray &key, const QByteArray &value)
 {
+    const bool hadKey = containsKey(key);
     mDb.remove(key, value, [&] (const Sink::Storage::DataStore::Error &error) {
         SinkWarningCtx(mLogCtx) << "Error while removing value: " << key << value << error;
     });
+    if (hadKey && !containsKey(key)) {
+        updateDistinctKeys(-1);
+    }
+}
+
+void Index::clear()
+{
+    mDb.clear([&] (const Sink::Storage::DataStore::Error &error) {
+        SinkWarningCtx(mLogCtx) << "Error while clearing the index: " << error;
+    });
+    mParentTransaction->openDatabase(statisticsDatabase).remove(mName.toUtf8(), [](const Sink::Storage::DataStore::Error &) {});
+    if (mBloomFilter) {
+        mBloomFilter->clear();
+    }
+}
+
+qint64 Index::count(const QByteArray &lowerBound, const QByteArray &upperBound)
+{
+    return mDb.count(lowerBound, upperBound, [&] (const Sink::Storage::DataStore::Error &error) {
+        SinkWarningCtx(mLogCtx) << "Error while counting: " << error;
+    });
+}
+
+bool Index::containsKey(const QByteArray &key)
+{
+    if (mBloomFilter && !mBloomFilter->mayContain(key)) {
+        return false;
+    }
+    return mDb.scan(key, [](const QByteArray &, const QByteArray &) { return false; }, [](const Sink::Storage::DataStore::Error &) {}) > 0;
+}
+
+void Index::updateDistinctKeys(qint64 difference)
+{
+    auto db = mParentTransaction->openDatabase(statisticsDatabase);
+    qint64 distinctKeys = 0;
+    db.scan(mName.toUtf8(), [&](const QByteArray &, const QByteArray &value) {
+            distinctKeys = value.toLongLong();
+            return false;
+        },
+        [](const Sink::Storage::DataStore::Error &) {});
+    db.write(mName.toUtf8(), QByteArray::number(qMax(distinctKeys + difference, 0ll)), [&] (const Sink::Storage::DataStore::Error &error) {
+        SinkWarningCtx(mLogCtx) << "Error while writing the statistics: " << error;
+    });
+}
+
+Index::Statistics Index::statistics()
+{
+    Statistics statistics;
+    statistics.entries = mDb.entryCount();
+    //The statistics database doesn't exist in read-only stores that have never been written with statistics
+    mParentTransaction->openDatabase(statisticsDatabase, [](const Sink::Storage::DataStore::Error &) {}).scan(mName.toUtf8(), [&](const QByteArray &, const QByteArray &value) {
+            statistics.distinctKeys = value.toLongLong();
+            return false;
+        },
+        [](const Sink::Storage::DataStore::Error &) {});
+    return statistics;
 }
 
 void Index::lookup(const QByteArray &key, const std::function<void(const QByteArray &value)> &resultHandler, const std::function<void(const Error &error)> &errorHandler, bool matchSubStringKeys)
 {
+    //Most lookups of new remote ids and message ids miss, which the filter answers without a lookup.
+    if (mBloomFilter && !matchSubStringKeys && !mBloomFilter->mayContain(key)) {
+        return;
+    }
     mDb.scan(key,
         [&](const QByteArray &key, const QByteArray &value) -> bool {
             resultHandler(value);
@@ -44,6 +149,18 @@ void Index::lookup(const QByteArray &key, const std::function<void(const QByteAr
         matchSubStringKeys);
 }
 
+void Index::rangeLookup(const QByteArray &lowerBound, const QByteArray &upperBound, const std::function<void(const QByteArray &value)> &resultHandler, const std::function<void(const Error &error)> &errorHandler)
+{
+    mDb.findAllInRange(lowerBound, upperBound,
+        [&](const QByteArray &key, const QByteArray &value) {
+            resultHandler(value);
+        },
+        [&](const Sink::Storage::DataStore::Error &error) {
+            SinkWarningCtx(mLogCtx) << "Error while retrieving range:" << error << mName;
+            errorHandler(Error(error.store, error.code, error.message));
+        });
+}
+
 QByteArray Index::lookup(const QByteArray &key)
 {
     QByteArray result;
@@ -5,6 +5,7 @@
 #include <functional>
 #include <QString>
 #include "storage.h"
+#include "bloomfilter.h"
 #include "log.h"
 
 /**
@@ -29,20 +30,71 @@ public:
         int code;
     };
 
+    /**
+     * Cardinality statistics of the index, used to estimate the selectivity of a lookup.
+     */
+    struct Statistics {
+        qint64 entries = 0;
+        qint64 distinctKeys = 0;
+    };
+
     Index(const QString &storageRoot, const QString &name, Sink::Storage::DataStore::AccessMode mode = Sink::Storage::DataStore::ReadOnly);
-    Index(const QByteArray &name, Sink::Storage::DataStore::Transaction &);
+    /**
+     * With @param bloomFilter lookups of keys that are not in the index are answered from a bloom filter in write transactions.
+     *
+     * The option has to be used consistently for all writes to the index, so the filter knows every key.
+     */
+    Index(const QByteArray &name, Sink::Storage::DataStore::Transaction &, bool bloomFilter = false);
 
     void add(const QByteArray &key, const QByteArray &value);
     void remove(const QByteArray &key, const QByteArray &value);
 
+    /**
+     * Loads an empty index from entries sorted by key and value, which are appended instead of being inserted.
+     *
+     * The distinct keys are counted while appending and written once with finishAppend.
+     */
+    void append(const QByteArray &key, const QByteArray &value);
+    void finishAppend();
+
+    /**
+     * Removes all entries and the statistics of the index.
+     */
+    void clear();
+
     void lookup(const QByteArray &key, const std::function<void(const QByteArray &value)> &resultHandler, const std::function<void(const Error &error)> &errorHandler,
         bool matchSubStringKeys = false);
     QByteArray lookup(const QByteArray &key);
 
+    /**
+     * The number of values with a key in the range [@param lowerBound, @param upperBound), without reading them.
+     */
+    qint64 count(const QByteArray &lowerBound, const QByteArray &upperBound);
+
+    /**
+     * Lookup all values with a key in the range [@param lowerBound, @param upperBound).
+     *
+     * Empty bounds leave the range open on that side.
+     */
+    void rangeLookup(const QByteArray &lowerBound, const QByteArray &upperBound, const std::function<void(const QByteArray &value)> &resultHandler, const std::function<void(const Error &error)> &errorHandler);
+
+    /**
+     * The number of entries is always available, the number of distinct keys is maintained on write.
+     *
+     * Indexes that have been written before the statistics were introduced report no distinct keys.
+     */
+    Statistics statistics();
+
 private:
     Q_DISABLE_COPY(Index);
+    bool containsKey(const QByteArray &key);
+    void updateDistinctKeys(qint64 difference);
     Sink::Storage::DataStore::Transaction mTransaction;
+    Sink::Storage::DataStore::Transaction *mParentTransaction;
     Sink::Storage::DataStore::NamedDatabase mDb;
+    QSharedPointer<Sink::Storage::PersistentBloomFilter> mBloomFilter;
     QString mName;
     Sink::Log::Context mLogCtx;
+    QByteArray mLastAppendedKey;
+    qint64 mAppendedKeys = 0;
 };
@@ -18,6 +18,9 @@
  */
 #include "indexer.h"
 
+#include "typeindex.h"
+#include "applicationdomaintype.h"
+
 using namespace Sink;
 
 void Indexer::setup(TypeIndex *index, Storage::DataStore::Transaction *transaction)
@@ -37,3 +40,11 @@ TypeIndex &Indexer::index()
     Q_ASSERT(mTypeIndex);
     return *mTypeIndex;
 }
+
+bool Indexer::isBuilt(const ApplicationDomain::ApplicationDomainType &entity)
+{
+    if (name().isEmpty()) {
+        return true;
+    }
+    return index().isBuilt(name(), entity.identifier(), transaction());
+}
@@ -36,10 +36,46 @@ public:
     virtual void modify(const ApplicationDomain::ApplicationDomainType &old, const ApplicationDomain::ApplicationDomainType &entity) = 0;
     virtual void remove(const ApplicationDomain::ApplicationDomainType &entity) = 0;
 
+    /**
+     * The name and version of the state the indexer maintains, if it can be built from the existing entities.
+     *
+     * The state is then built like the property indexes, so it is also available in stores that already contain entities.
+     */
+    virtual QByteArray name() const
+    {
+        return {};
+    }
+
+    virtual int version() const
+    {
+        return 1;
+    }
+
+    /**
+     * Adds @param entity to the state that is being built.
+     */
+    virtual void build(const ApplicationDomain::ApplicationDomainType &)
+    {
+    }
+
+    /**
+     * Clears the state, so it can be built again.
+     */
+    virtual void clear()
+    {
+    }
+
 protected:
     Storage::DataStore::Transaction &transaction();
     TypeIndex &index();
 
+    /**
+     * Returns true if @param entity is contained in the state, which is the case for all entities once the state is built.
+     *
+     * Changes of entities that are not contained yet are left to the build.
+     */
+    bool isBuilt(const ApplicationDomain::ApplicationDomainType &entity);
+
 private:
     friend class ::TypeIndex;
     void setup(TypeIndex *, Storage::DataStore::Transaction *);
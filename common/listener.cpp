@@ -26,6 +26,7 @@
 #include "common/resourcecontext.h"
 #include "common/adaptorfactoryregistry.h"
 #include "common/bufferutils.h"
+#include "common/resourceconfig.h"
 
 // commands
 #include "common/commandcompletion_generated.h"
@@ -37,6 +38,10 @@
 #include <QLocalServer>
 #include <QLocalSocket>
 #include <QTimer>
+#include <QDateTime>
+
+// Clients that lag behind for longer than this without acknowledging a revision lose their revision pin
+static const qint64 defaultRevisionLeaseTimeout = 5 * 60 * 1000;
 
 Listener::Listener(const QByteArray &resourceInstanceIdentifier, const QByteArray &resourceType, QObject *parent)
     : QObject(parent),
@@ -44,6 +49,8 @@ Listener::Listener(const QByteArray &resourceInstanceIdentifier, const QByteArra
       m_resourceName(resourceType),
       m_resourceInstanceIdentifier(resourceInstanceIdentifier),
       m_clientBufferProcessesTimer(new QTimer(this)),
+      m_revisionLeaseTimeout(ResourceConfig::getConfiguration(resourceInstanceIdentifier).value("revisionLeaseTimeout", defaultRevisionLeaseTimeout).toLongLong()),
+      m_revision(0),
       m_messageId(0),
       m_exiting(false)
 {
@@ -78,6 +85,13 @@ Listener::Listener(const QByteArray &resourceInstanceIdentifier, const QByteArra
     m_clientBufferProcessesTimer->setInterval(0);
     m_clientBufferProcessesTimer->setSingleShot(true);
     connect(m_clientBufferProcessesTimer.get(), &QTimer::timeout, this, &Listener::processClientBuffers);
+
+    if (m_revisionLeaseTimeout > 0) {
+        m_revisionLeaseTimer = std::unique_ptr<QTimer>(new QTimer);
+        m_revisionLeaseTimer->setInterval(qMax(m_revisionLeaseTimeout / 2, qint64{10}));
+        connect(m_revisionLeaseTimer.get(), &QTimer::timeout, this, &Listener::checkRevisionLeases);
+        m_revisionLeaseTimer->start();
+    }
 }
 
 Listener::~Listener()
@@ -261,7 +275,19 @@ void Listener::processCommand(int commandId, uint messageId, const QByteArray &c
             flatbuffers::Verifier verifier((const uint8_t *)commandBuffer.constData(), commandBuffer.size());
             if (Sink::Commands::VerifyRevisionReplayedBuffer(verifier)) {
                 auto buffer = Sink::Commands::GetRevisionReplayed(commandBuffer.constData());
-                client.currentRevision = buffer->revision();
+                if (buffer->pin()) {
+                    const auto pin = QByteArray::fromStdString(buffer->pin()->str());
+                    if (buffer->revision() > 0) {
+                        client.pinnedRevisions.insert(pin, buffer->revision());
+                    } else {
+                        client.pinnedRevisions.remove(pin);
+                    }
+                } else {
+                    client.currentRevision = buffer->revision();
+                }
+                client.leaseExpired = false;
+                //Acknowledging a revision renews the lease, until the client caught up.
+                client.leaseStart = client.pinnedRevision() < m_revision ? QDateTime::currentMSecsSinceEpoch() : 0;
             } else {
                 SinkWarning() << "received invalid command";
             }
@@ -293,18 +319,61 @@ void Listener::processCommand(int commandId, uint messageId, const QByteArray &c
 qint64 Listener::lowerBoundRevision()
 {
     qint64 lowerBound = 0;
+    bool allExpired = !m_connections.isEmpty();
     for (const Client &c : m_connections) {
-        if (c.currentRevision > 0) {
+        //Expired clients requery, so they don't hold back the cleanup
+        if (c.leaseExpired) {
+            continue;
+        }
+        allExpired = false;
+        const auto pinned = c.pinnedRevision();
+        if (pinned > 0) {
             if (lowerBound == 0) {
-                lowerBound = c.currentRevision;
+                lowerBound = pinned;
             } else {
-                lowerBound = qMin(c.currentRevision, lowerBound);
+                lowerBound = qMin(pinned, lowerBound);
             }
         }
     }
+    if (allExpired) {
+        return m_revision;
+    }
     return lowerBound;
 }
 
+void Listener::checkRevisionLeases()
+{
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+    bool expired = false;
+    for (Client &client : m_connections) {
+        if (!client.leaseStart || client.leaseExpired || now - client.leaseStart < m_revisionLeaseTimeout) {
+            continue;
+        }
+        SinkLog() << QString("Revision lease of %1 expired at revision %2, the client will have to requery.").arg(client.name).arg(client.pinnedRevision());
+        client.leaseStart = 0;
+        client.leaseExpired = true;
+        expired = true;
+        if (client.socket && client.socket->isOpen()) {
+            //Queries that pinned a revision are notified individually, they can't continue reading at that revision.
+            for (const auto &pin : client.pinnedRevisions.keys()) {
+                auto pinString = m_fbb.CreateString(pin.constData(), pin.size());
+                auto command = Sink::Commands::CreateNotification(m_fbb, Sink::Notification::RevisionLeaseExpired, pinString);
+                Sink::Commands::FinishNotificationBuffer(m_fbb, command);
+                Sink::Commands::write(client.socket, ++m_messageId, Sink::Commands::NotificationCommand, m_fbb);
+                m_fbb.Clear();
+            }
+            auto command = Sink::Commands::CreateNotification(m_fbb, Sink::Notification::RevisionLeaseExpired);
+            Sink::Commands::FinishNotificationBuffer(m_fbb, command);
+            Sink::Commands::write(client.socket, ++m_messageId, Sink::Commands::NotificationCommand, m_fbb);
+            m_fbb.Clear();
+        }
+        client.pinnedRevisions.clear();
+    }
+    if (expired) {
+        loadResource().setLowerBoundRevision(lowerBoundRevision());
+    }
+}
+
 void Listener::sendShutdownNotification()
 {
     // Broadcast shutdown notifications to open clients, so they don't try to restart the resource
@@ -391,6 +460,13 @@ void Listener::sendCommandCompleted(QLocalSocket *socket, uint messageId, bool s
 void Listener::refreshRevision(qint64 revision)
 {
     updateClientsWithRevision(revision);
+    for (const Client &client : m_connections) {
+        //Without the expired clients the lower bound may depend on the latest revision
+        if (client.leaseExpired) {
+            loadResource().setLowerBoundRevision(lowerBoundRevision());
+            break;
+        }
+    }
 }
 
 void Listener::updateClientsWithRevision(qint64 revision)
@@ -398,10 +474,16 @@ void Listener::updateClientsWithRevision(qint64 revision)
     auto command = Sink::Commands::CreateRevisionUpdate(m_fbb, revision);
     Sink::Commands::FinishRevisionUpdateBuffer(m_fbb, command);
 
-    for (const Client &client : m_connections) {
+    m_revision = revision;
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+    for (Client &client : m_connections) {
         if (!client.socket || !client.socket->isValid()) {
             continue;
         }
+        //The lease starts running as soon as a client that pins a revision falls behind
+        if (!client.leaseStart && client.pinnedRevision() > 0 && client.pinnedRevision() < revision) {
+            client.leaseStart = now;
+        }
 
         SinkTrace() << "Sending revision update for " << client.name << revision;
         Sink::Commands::write(client.socket, ++m_messageId, Sink::Commands::RevisionUpdateCommand, m_fbb);
@@ -22,6 +22,7 @@
 #include "sink_export.h"
 #include <QObject>
 
+#include <QHash>
 #include <QPointer>
 #include <QLocalSocket>
 #include <flatbuffers/flatbuffers.h>
@@ -38,11 +39,11 @@ class QLocalServer;
 class Client
 {
 public:
-    Client() : socket(nullptr), currentRevision(0)
+    Client() : socket(nullptr), currentRevision(0), leaseStart(0), leaseExpired(false)
     {
     }
 
-    Client(const QString &n, QLocalSocket *s) : name(n), socket(s), currentRevision(0)
+    Client(const QString &n, QLocalSocket *s) : name(n), socket(s), currentRevision(0), leaseStart(0), leaseExpired(false)
     {
     }
 
@@ -50,6 +51,26 @@ public:
     QPointer<QLocalSocket> socket;
     QByteArray commandBuffer;
     qint64 currentRevision;
+    //Revisions pinned by individual queries, e.g. to page through a snapshot
+    QHash<QByteArray, qint64> pinnedRevisions;
+    //Time since which the client has been lagging behind without renewing its revision, 0 if it's up to date.
+    qint64 leaseStart;
+    //The client no longer pins a revision and has to requery.
+    bool leaseExpired;
+
+    /**
+     * The lowest revision the client still needs, or 0 if it doesn't need any.
+     */
+    qint64 pinnedRevision() const
+    {
+        qint64 revision = currentRevision;
+        for (const auto pinned : pinnedRevisions) {
+            if (pinned > 0 && (revision == 0 || pinned < revision)) {
+                revision = pinned;
+            }
+        }
+        return revision;
+    }
 };
 
 class SINK_EXPORT Listener : public QObject
@@ -70,6 +91,7 @@ private slots:
     void acceptConnection();
     void clientDropped();
     void checkConnections();
+    void checkRevisionLeases();
     void onDataAvailable();
     void processClientBuffers();
     void refreshRevision(qint64);
@@ -94,6 +116,9 @@ private:
     std::unique_ptr<Sink::Resource> m_resource;
     std::unique_ptr<QTimer> m_clientBufferProcessesTimer;
     std::unique_ptr<QTimer> m_checkConnectionsTimer;
+    std::unique_ptr<QTimer> m_revisionLeaseTimer;
+    qint64 m_revisionLeaseTimeout;
+    qint64 m_revision;
     int m_messageId;
     bool m_exiting;
 };
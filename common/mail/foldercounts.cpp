@@ -0,0 +1,195 @@
+/*
+ *   Copyright (C) 2017 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ */
+#include "foldercounts.h"
+
+#include <QDataStream>
+
+#include "applicationdomaintype.h"
+#include "sortablekey.h"
+#include "typeindex.h"
+#include "log.h"
+
+using namespace Sink;
+using namespace Sink::ApplicationDomain;
+using Sink::Storage::DataStore;
+
+/*
+ * counts: folder id -> serialized counts
+ * changes: revision + folder id -> folder id, for live queries on folders
+ *
+ * The counts change without a revision of the folder, so live queries look up the folders that changed
+ * in the revisions of the mails.
+ */
+static const QByteArray countDatabase = "folder.counts";
+static const QByteArray changeDatabase = "folder.counts.changes";
+//The counts are built from the existing mails like an index of the mails
+static const QByteArray definition = "mail.index.folderCounts";
+static const int definitionVersion = 1;
+
+static void ignoreError(const DataStore::Error &)
+{
+}
+
+bool FolderCounts::isAvailable(const DataStore::Transaction &transaction)
+{
+    return TypeIndex::isReady(definition, definitionVersion, transaction);
+}
+
+static void readCounts(const QByteArray &folder, FolderCounts &counts, const DataStore::Transaction &transaction)
+{
+    counts = FolderCounts{};
+    transaction.openDatabase(countDatabase, ignoreError).scan(folder, [&](const QByteArray &, const QByteArray &value) {
+            QDataStream stream(value);
+            stream >> counts.total >> counts.unread >> counts.important;
+            return false;
+        },
+        ignoreError);
+}
+
+bool FolderCounts::read(const QByteArray &folder, FolderCounts &counts, const DataStore::Transaction &transaction)
+{
+    if (!isAvailable(transaction)) {
+        return false;
+    }
+    readCounts(folder, counts, transaction);
+    return true;
+}
+
+void FolderCounts::readChanges(qint64 baseRevision, const std::function<void(const QByteArray &folder)> &callback, const DataStore::Transaction &transaction)
+{
+    transaction.openDatabase(changeDatabase, ignoreError).scanFrom(SortableKey::fromNumber(baseRevision), [&](const QByteArray &, const QByteArray &folder) {
+            callback(folder);
+            return true;
+        },
+        ignoreError);
+}
+
+void FolderCounts::cleanupChanges(qint64 revision, DataStore::Transaction &transaction)
+{
+    auto changes = transaction.openDatabase(changeDatabase, ignoreError);
+    QByteArrayList keys;
+    changes.scanFrom({}, [&](const QByteArray &key, const QByteArray &) {
+            if (SortableKey::toNumber(key) > revision) {
+                return false;
+            }
+            keys << key;
+            return true;
+        },
+        ignoreError);
+    for (const auto &key : keys) {
+        changes.remove(key, ignoreError);
+    }
+}
+
+static void update(const ApplicationDomainType &mail, int delta, DataStore::Transaction &transaction)
+{
+    const auto folder = mail.getProperty(Mail::Folder::name).value<Reference>().value;
+    if (folder.isEmpty()) {
+        return;
+    }
+    //The counts are also updated while they are built, before they are available
+    FolderCounts counts;
+    readCounts(folder, counts, transaction);
+    counts.total = qMax<qint64>(0, counts.total + delta);
+    if (mail.getProperty(Mail::Unread::name).toBool()) {
+        counts.unread = qMax<qint64>(0, counts.unread + delta);
+    }
+    if (mail.getProperty(Mail::Important::name).toBool()) {
+        counts.important = qMax<qint64>(0, counts.important + delta);
+    }
+
+    QByteArray value;
+    QDataStream stream(&value, QIODevice::WriteOnly);
+    stream << counts.total << counts.unread << counts.important;
+    transaction.openDatabase(countDatabase).write(folder, value,
+        [&](const DataStore::Error &error) { SinkWarning() << "Failed to write folder counts: " << folder << error.message; });
+
+    //The mail is written with the next revision
+    const auto revision = DataStore::maxRevision(transaction) + 1;
+    transaction.openDatabase(changeDatabase).write(SortableKey::fromNumber(revision) + folder, folder);
+}
+
+void FolderCounts::addMail(const ApplicationDomainType &mail, DataStore::Transaction &transaction)
+{
+    update(mail, 1, transaction);
+}
+
+void FolderCounts::removeMail(const ApplicationDomainType &mail, DataStore::Transaction &transaction)
+{
+    update(mail, -1, transaction);
+}
+
+void FolderCounts::clear(DataStore::Transaction &transaction)
+{
+    transaction.openDatabase(countDatabase).clear(ignoreError);
+}
+
+QMap<QByteArray, int> FolderCounts::databases()
+{
+    return {{countDatabase, 0},
+            {changeDatabase, 0}};
+}
+
+
+void FolderCountIndexer::add(const ApplicationDomainType &entity)
+{
+    if (isBuilt(entity)) {
+        FolderCounts::addMail(entity, transaction());
+    }
+}
+
+void FolderCountIndexer::modify(const ApplicationDomainType &old, const ApplicationDomainType &entity)
+{
+    if (isBuilt(entity)) {
+        FolderCounts::removeMail(old, transaction());
+        FolderCounts::addMail(entity, transaction());
+    }
+}
+
+void FolderCountIndexer::remove(const ApplicationDomainType &entity)
+{
+    if (isBuilt(entity)) {
+        FolderCounts::removeMail(entity, transaction());
+    }
+}
+
+QByteArray FolderCountIndexer::name() const
+{
+    return definition;
+}
+
+int FolderCountIndexer::version() const
+{
+    return definitionVersion;
+}
+
+void FolderCountIndexer::build(const ApplicationDomainType &entity)
+{
+    FolderCounts::addMail(entity, transaction());
+}
+
+void FolderCountIndexer::clear()
+{
+    FolderCounts::clear(transaction());
+}
+
+QMap<QByteArray, int> FolderCountIndexer::databases()
+{
+    return FolderCounts::databases();
+}
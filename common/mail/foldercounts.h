@@ -0,0 +1,80 @@
+/*
+ *   Copyright (C) 2017 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ */
+#pragma once
+
+#include "sink_export.h"
+#include "indexer.h"
+#include <functional>
+
+namespace Sink {
+
+/**
+ * The number of mails in a folder, that is maintained whenever a mail is written.
+ *
+ * The counts only reflect the latest revision of the store.
+ */
+struct SINK_EXPORT FolderCounts
+{
+    qint64 total = 0;
+    qint64 unread = 0;
+    qint64 important = 0;
+
+    /**
+     * Returns false if the store doesn't contain the counts of all folders yet,
+     * because they are still being built from the mails the store already contained.
+     */
+    static bool isAvailable(const Storage::DataStore::Transaction &transaction);
+    static bool read(const QByteArray &folder, FolderCounts &counts, const Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Reads the folders whose counts changed since @param baseRevision.
+     *
+     * A folder can be reported more than once.
+     */
+    static void readChanges(qint64 baseRevision, const std::function<void(const QByteArray &folder)> &callback, const Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Forgets the changes until @param revision, once all clients have caught up with it.
+     */
+    static void cleanupChanges(qint64 revision, Storage::DataStore::Transaction &transaction);
+
+    static void addMail(const ApplicationDomain::ApplicationDomainType &mail, Storage::DataStore::Transaction &transaction);
+    static void removeMail(const ApplicationDomain::ApplicationDomainType &mail, Storage::DataStore::Transaction &transaction);
+    static void clear(Storage::DataStore::Transaction &transaction);
+    static QMap<QByteArray, int> databases();
+};
+
+/**
+ * Maintains the FolderCounts of the folders of all mails.
+ */
+class FolderCountIndexer : public Indexer
+{
+public:
+    typedef QSharedPointer<FolderCountIndexer> Ptr;
+    virtual void add(const ApplicationDomain::ApplicationDomainType &entity) Q_DECL_OVERRIDE;
+    virtual void modify(const ApplicationDomain::ApplicationDomainType &old, const ApplicationDomain::ApplicationDomainType &entity) Q_DECL_OVERRIDE;
+    virtual void remove(const ApplicationDomain::ApplicationDomainType &entity) Q_DECL_OVERRIDE;
+    virtual QByteArray name() const Q_DECL_OVERRIDE;
+    virtual int version() const Q_DECL_OVERRIDE;
+    virtual void build(const ApplicationDomain::ApplicationDomainType &entity) Q_DECL_OVERRIDE;
+    virtual void clear() Q_DECL_OVERRIDE;
+    static QMap<QByteArray, int> databases();
+};
+
+}
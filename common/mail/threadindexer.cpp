@@ -19,6 +19,7 @@
 #include "threadindexer.h"
 
 #include "typeindex.h"
+#include "threadsummary.h"
 #include "log.h"
 
 using namespace Sink;
@@ -32,30 +33,59 @@ void ThreadIndexer::updateThreadingIndex(const QByteArray &identifier, const App
         SinkWarning() << "Found an email without messageId. This is illegal and threading will break. Entity id: " << identifier;
     }
 
-    QVector<QByteArray> thread;
+    //The complete ancestry if available, so we can thread the message even if some ancestors are missing.
+    auto ancestors = entity.getProperty(Mail::Ancestors::name).value<QByteArrayList>();
+    if (ancestors.isEmpty() && parentMessageId.isValid()) {
+        ancestors << parentMessageId.toByteArray();
+    }
 
-    //a child already registered our thread.
-    thread = index().secondaryLookup<Mail::MessageId, Mail::ThreadId>(messageId);
+    //A child already registered our thread.
+    const auto ownThread = index().secondaryLookup<Mail::MessageId, Mail::ThreadId>(messageId);
+    //If any ancestor is already available, add to the thread of the ancestor.
+    QVector<QByteArray> ancestorThreads;
+    QByteArrayList missingAncestors;
+    for (const auto &ancestor : ancestors) {
+        if (ancestor.isEmpty() || ancestor == messageId.toByteArray()) {
+            continue;
+        }
+        const auto thread = index().secondaryLookup<Mail::MessageId, Mail::ThreadId>(ancestor);
+        if (thread.isEmpty()) {
+            missingAncestors << ancestor;
+        } else {
+            ancestorThreads += thread;
+        }
+    }
+    SinkTrace() << "Found ancestors: " << ancestorThreads;
 
-    //If parent is already available, add to thread of parent
-    if (thread.isEmpty() && parentMessageId.isValid()) {
-        thread = index().secondaryLookup<Mail::MessageId, Mail::ThreadId>(parentMessageId);
-        SinkTrace() << "Found parent: " << thread;
+    //If both exist we connect two threads that have been created independently, e.g. because the parent arrived last.
+    //Instead of moving all messages of one thread to the other, the threads are merged in the index.
+    QByteArray thread;
+    for (const auto &t : ownThread + ancestorThreads) {
+        const auto resolved = index().resolveValue<Mail::ThreadId>(t);
+        if (thread.isEmpty()) {
+            thread = resolved;
+        } else if (resolved != thread) {
+            const auto root = index().mergeValues<Mail::ThreadId>(thread, resolved, transaction);
+            ThreadSummary::merge(root, root == thread ? resolved : thread, transaction);
+            thread = root;
+        }
     }
     if (thread.isEmpty()) {
-        thread << QUuid::createUuid().toByteArray();
+        thread = QUuid::createUuid().toByteArray();
         SinkTrace() << "Created a new thread: " << thread;
     }
 
-    Q_ASSERT(!thread.isEmpty());
-
-    if (parentMessageId.isValid()) {
-        Q_ASSERT(!parentMessageId.toByteArray().isEmpty());
-        //Register parent with thread for when it becomes available
-        index().index<Mail::MessageId, Mail::ThreadId>(parentMessageId, thread.first(), transaction);
+    //Register missing ancestors with thread for when they become available
+    for (const auto &ancestor : missingAncestors) {
+        index().index<Mail::MessageId, Mail::ThreadId>(ancestor, thread, transaction);
+    }
+    if (ownThread.isEmpty()) {
+        index().index<Mail::MessageId, Mail::ThreadId>(messageId, thread, transaction);
+    }
+    index().index<Mail::ThreadId, Mail::MessageId>(thread, messageId, transaction);
+    if (isBuilt(entity)) {
+        ThreadSummary::addMail(thread, entity, transaction);
     }
-    index().index<Mail::MessageId, Mail::ThreadId>(messageId, thread.first(), transaction);
-    index().index<Mail::ThreadId, Mail::MessageId>(thread.first(), messageId, transaction);
 }
 
 
@@ -64,22 +94,92 @@ void ThreadIndexer::add(const ApplicationDomain::ApplicationDomainType &entity)
     updateThreadingIndex(entity.identifier(), entity, transaction());
 }
 
-void ThreadIndexer::modify(const ApplicationDomain::ApplicationDomainType &old, const ApplicationDomain::ApplicationDomainType &entity)
+static QByteArrayList ancestry(const ApplicationDomain::ApplicationDomainType &entity)
 {
+    auto ancestors = entity.getProperty(Mail::Ancestors::name).value<QByteArrayList>();
+    if (ancestors.isEmpty()) {
+        ancestors << entity.getProperty(Mail::ParentMessageId::name).toByteArray();
+    }
+    return ancestors;
+}
 
+void ThreadIndexer::modify(const ApplicationDomain::ApplicationDomainType &old, const ApplicationDomain::ApplicationDomainType &entity)
+{
+    const auto messageId = entity.getProperty(Mail::MessageId::name);
+    //Only a new message id or ancestry can move the mail to another thread
+    if (messageId != old.getProperty(Mail::MessageId::name) || ancestry(entity) != ancestry(old)) {
+        remove(old);
+        add(entity);
+        return;
+    }
+    const auto threads = index().secondaryLookup<Mail::MessageId, Mail::ThreadId>(messageId);
+    if (threads.isEmpty()) {
+        add(entity);
+        return;
+    }
+    //Otherwise the mail stays in its thread, and only the summary is updated, e.g. for a changed flag
+    if (!isBuilt(entity)) {
+        return;
+    }
+    const auto root = index().resolveValue<Mail::ThreadId>(threads.first());
+    ThreadSummary::removeMail(root, index().mergedValues<Mail::ThreadId>(root), old, transaction());
+    ThreadSummary::addMail(root, entity, transaction());
 }
 
 void ThreadIndexer::remove(const ApplicationDomain::ApplicationDomainType &entity)
 {
     auto messageId = entity.getProperty(Mail::MessageId::name);
-    auto thread = index().secondaryLookup<Mail::MessageId, Mail::ThreadId>(messageId);
-    index().unindex<Mail::MessageId, Mail::ThreadId>(messageId.toByteArray(), thread.first(), transaction());
-    index().unindex<Mail::ThreadId, Mail::MessageId>(thread.first(), messageId.toByteArray(), transaction());
+    const auto threads = index().secondaryLookup<Mail::MessageId, Mail::ThreadId>(messageId);
+    if (threads.isEmpty()) {
+        return;
+    }
+    for (const auto &thread : threads) {
+        index().unindex<Mail::MessageId, Mail::ThreadId>(messageId.toByteArray(), thread, transaction());
+    }
+    //The message may have been indexed with any thread that has been merged into the same one
+    const auto root = index().resolveValue<Mail::ThreadId>(threads.first());
+    const auto merged = index().mergedValues<Mail::ThreadId>(root);
+    for (const auto &thread : QByteArrayList{root} + merged) {
+        index().unindex<Mail::ThreadId, Mail::MessageId>(thread, messageId.toByteArray(), transaction());
+    }
+    if (isBuilt(entity)) {
+        ThreadSummary::removeMail(root, merged, entity, transaction());
+    }
+}
+
+QByteArray ThreadIndexer::name() const
+{
+    return ThreadSummary::definition();
+}
+
+int ThreadIndexer::version() const
+{
+    return ThreadSummary::definitionVersion();
+}
+
+//The threads of the existing mails are already indexed, so only the summaries are built.
+void ThreadIndexer::build(const ApplicationDomain::ApplicationDomainType &entity)
+{
+    const auto threads = index().secondaryLookup<Mail::MessageId, Mail::ThreadId>(entity.getProperty(Mail::MessageId::name));
+    if (threads.isEmpty()) {
+        SinkWarning() << "Mail without thread: " << entity.identifier();
+        return;
+    }
+    ThreadSummary::addMail(index().resolveValue<Mail::ThreadId>(threads.first()), entity, transaction());
+}
+
+void ThreadIndexer::clear()
+{
+    ThreadSummary::clear(transaction());
 }
 
 QMap<QByteArray, int> ThreadIndexer::databases()
 {
-    return {{"mail.index.messageIdthreadId", 1},
-            {"mail.index.threadIdmessageId", 1}};
+    QMap<QByteArray, int> databases{{"mail.index.messageIdthreadId", 1},
+            {"mail.index.threadIdmessageId", 1},
+            {"mail.index.threadId.alias", 0},
+            {"mail.index.threadId.merged", 1}};
+    databases.unite(ThreadSummary::databases());
+    return databases;
 }
 
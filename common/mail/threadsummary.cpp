@@ -0,0 +1,365 @@
+/*
+ *   Copyright (C) 2017 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ */
+#include "threadsummary.h"
+
+#include <QDataStream>
+
+#include "applicationdomaintype.h"
+#include "sortablekey.h"
+#include "typeindex.h"
+#include "log.h"
+
+using namespace Sink;
+using namespace Sink::ApplicationDomain;
+using Sink::Storage::DataStore;
+
+/*
+ * summary: thread id -> serialized summary
+ * members: thread id + date + mail id -> mail id, newest first, to find the next latest mail when the latest is removed
+ * date: date of the latest mail + thread id -> thread id, newest first
+ *
+ * The summaries per folder use the same layout in their own databases, with the folder id as additional key part:
+ * summary: thread id + folder id, so all folders of a thread can be found when the thread is merged
+ * members: folder id + thread id + date + mail id
+ * date: folder id + date + thread id, so the threads of a folder can be read newest first
+ *
+ * Mails stay in the members of the thread id they have been added with, also if that thread has been merged since.
+ */
+static const QByteArray summaryDatabase = "mail.threads.summary";
+static const QByteArray memberDatabase = "mail.threads.members";
+static const QByteArray dateDatabase = "mail.threads.date";
+static const QByteArray folderSummaryDatabase = "mail.threads.folder.summary";
+static const QByteArray folderMemberDatabase = "mail.threads.folder.members";
+static const QByteArray folderDateDatabase = "mail.threads.folder.date";
+
+namespace {
+/*
+ * The summaries of all mails of a thread, or of the mails of a thread in a single folder.
+ */
+struct Scope
+{
+    QByteArray summaryDatabase;
+    QByteArray memberDatabase;
+    QByteArray dateDatabase;
+    QByteArray folder;
+
+    QByteArray summaryKey(const QByteArray &threadId) const
+    {
+        return threadId + folder;
+    }
+
+    QByteArray memberPrefix(const QByteArray &threadId) const
+    {
+        return folder + threadId;
+    }
+
+    QByteArray dateKey(const QDateTime &date, const QByteArray &threadId) const
+    {
+        return folder + SortableKey::fromDateNewestFirst(date) + threadId;
+    }
+};
+}
+
+static Scope threadScope()
+{
+    return {summaryDatabase, memberDatabase, dateDatabase, {}};
+}
+
+static Scope folderScope(const QByteArray &folder)
+{
+    return {folderSummaryDatabase, folderMemberDatabase, folderDateDatabase, folder};
+}
+
+static Scope scope(const QByteArray &folder)
+{
+    return folder.isEmpty() ? threadScope() : folderScope(folder);
+}
+
+static QByteArray folderOf(const ApplicationDomainType &mail)
+{
+    return mail.getProperty(Mail::Folder::name).value<Reference>().value;
+}
+
+static bool isNewer(const QDateTime &left, const QDateTime &right)
+{
+    return SortableKey::fromDateNewestFirst(left) < SortableKey::fromDateNewestFirst(right);
+}
+
+static void ignoreError(const DataStore::Error &)
+{
+}
+
+QByteArray ThreadSummary::serialize() const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << latestMail << static_cast<qint64>(latestDate.isValid() ? latestDate.toMSecsSinceEpoch() : SortableKey::invalidDate)
+        << static_cast<qint32>(messageCount) << static_cast<qint32>(unreadCount) << static_cast<qint32>(importantCount) << participants;
+    return data;
+}
+
+ThreadSummary ThreadSummary::deserialize(const QByteArray &threadId, const QByteArray &data)
+{
+    ThreadSummary summary;
+    summary.threadId = threadId;
+    qint64 date;
+    qint32 messageCount;
+    qint32 unreadCount;
+    qint32 importantCount;
+    QDataStream stream(data);
+    stream >> summary.latestMail >> date >> messageCount >> unreadCount >> importantCount >> summary.participants;
+    if (date != SortableKey::invalidDate) {
+        summary.latestDate = QDateTime::fromMSecsSinceEpoch(date);
+    }
+    summary.messageCount = messageCount;
+    summary.unreadCount = unreadCount;
+    summary.importantCount = importantCount;
+    return summary;
+}
+
+bool ThreadSummary::isAvailable(const DataStore::Transaction &transaction)
+{
+    return TypeIndex::isReady(definition(), definitionVersion(), transaction);
+}
+
+static bool read(const Scope &scope, const QByteArray &threadId, ThreadSummary &summary, const DataStore::Transaction &transaction)
+{
+    bool found = false;
+    transaction.openDatabase(scope.summaryDatabase, ignoreError).scan(scope.summaryKey(threadId), [&](const QByteArray &, const QByteArray &value) {
+            summary = ThreadSummary::deserialize(threadId, value);
+            found = true;
+            return false;
+        },
+        ignoreError);
+    return found;
+}
+
+bool ThreadSummary::read(const QByteArray &threadId, ThreadSummary &summary, const DataStore::Transaction &transaction, const QByteArray &folder)
+{
+    return ::read(scope(folder), threadId, summary, transaction);
+}
+
+void ThreadSummary::readAll(const std::function<bool(const ThreadSummary &summary)> &callback, const DataStore::Transaction &transaction, const QByteArray &folder)
+{
+    const auto s = scope(folder);
+    transaction.openDatabase(s.dateDatabase, ignoreError).scanFrom(s.folder, [&](const QByteArray &key, const QByteArray &threadId) {
+            if (!key.startsWith(s.folder)) {
+                return false;
+            }
+            ThreadSummary summary;
+            if (!::read(s, threadId, summary, transaction)) {
+                SinkWarning() << "Missing thread summary: " << threadId << s.folder;
+                return true;
+            }
+            return callback(summary);
+        },
+        [](const DataStore::Error &error) { SinkWarning() << "Failed to read thread summaries: " << error.message; });
+}
+
+static void write(const Scope &scope, const ThreadSummary *previous, const ThreadSummary &summary, DataStore::Transaction &transaction)
+{
+    if (!previous || previous->latestDate != summary.latestDate) {
+        auto dates = transaction.openDatabase(scope.dateDatabase);
+        if (previous) {
+            dates.remove(scope.dateKey(previous->latestDate, summary.threadId), ignoreError);
+        }
+        dates.write(scope.dateKey(summary.latestDate, summary.threadId), summary.threadId);
+    }
+    transaction.openDatabase(scope.summaryDatabase).write(scope.summaryKey(summary.threadId), summary.serialize(),
+        [&](const DataStore::Error &error) { SinkWarning() << "Failed to write thread summary: " << summary.threadId << scope.folder << error.message; });
+}
+
+static void erase(const Scope &scope, const ThreadSummary &summary, DataStore::Transaction &transaction)
+{
+    transaction.openDatabase(scope.dateDatabase).remove(scope.dateKey(summary.latestDate, summary.threadId), ignoreError);
+    transaction.openDatabase(scope.summaryDatabase).remove(scope.summaryKey(summary.threadId), ignoreError);
+}
+
+static void addMail(const Scope &scope, const QByteArray &threadId, const ApplicationDomainType &mail, DataStore::Transaction &transaction)
+{
+    ThreadSummary summary;
+    const bool existed = read(scope, threadId, summary, transaction);
+    const auto previous = summary;
+    summary.threadId = threadId;
+
+    const auto date = mail.getProperty(Mail::Date::name).toDateTime();
+    summary.messageCount++;
+    if (mail.getProperty(Mail::Unread::name).toBool()) {
+        summary.unreadCount++;
+    }
+    if (mail.getProperty(Mail::Important::name).toBool()) {
+        summary.importantCount++;
+    }
+    const auto sender = mail.getProperty(Mail::Sender::name).value<Mail::Contact>().emailAddress;
+    if (!sender.isEmpty()) {
+        summary.participants[sender]++;
+    }
+    if (!existed || isNewer(date, summary.latestDate)) {
+        summary.latestMail = mail.identifier();
+        summary.latestDate = date;
+    }
+
+    transaction.openDatabase(scope.memberDatabase).write(scope.memberPrefix(threadId) + SortableKey::fromDateNewestFirst(date) + mail.identifier(), mail.identifier());
+    write(scope, existed ? &previous : nullptr, summary, transaction);
+}
+
+void ThreadSummary::addMail(const QByteArray &threadId, const ApplicationDomainType &mail, DataStore::Transaction &transaction)
+{
+    ::addMail(threadScope(), threadId, mail, transaction);
+    const auto folder = folderOf(mail);
+    if (!folder.isEmpty()) {
+        ::addMail(folderScope(folder), threadId, mail, transaction);
+    }
+}
+
+static void removeMail(const Scope &scope, const QByteArray &threadId, const QByteArrayList &mergedThreadIds, const ApplicationDomainType &mail, DataStore::Transaction &transaction)
+{
+    ThreadSummary summary;
+    if (!read(scope, threadId, summary, transaction)) {
+        SinkWarning() << "Missing thread summary: " << threadId << scope.folder;
+        return;
+    }
+    const auto previous = summary;
+
+    const auto threadIds = QByteArrayList{threadId} + mergedThreadIds;
+    const auto memberKey = SortableKey::fromDateNewestFirst(mail.getProperty(Mail::Date::name).toDateTime()) + mail.identifier();
+    auto members = transaction.openDatabase(scope.memberDatabase);
+    for (const auto &id : threadIds) {
+        members.remove(scope.memberPrefix(id) + memberKey, ignoreError);
+    }
+
+    summary.messageCount--;
+    if (summary.messageCount <= 0) {
+        erase(scope, summary, transaction);
+        return;
+    }
+    if (mail.getProperty(Mail::Unread::name).toBool()) {
+        summary.unreadCount = qMax(0, summary.unreadCount - 1);
+    }
+    if (mail.getProperty(Mail::Important::name).toBool()) {
+        summary.importantCount = qMax(0, summary.importantCount - 1);
+    }
+    const auto sender = mail.getProperty(Mail::Sender::name).value<Mail::Contact>().emailAddress;
+    if (summary.participants.contains(sender) && --summary.participants[sender] <= 0) {
+        summary.participants.remove(sender);
+    }
+
+    if (summary.latestMail == mail.identifier()) {
+        //The first member of every thread id is its newest mail
+        QByteArray newest;
+        for (const auto &id : threadIds) {
+            const auto prefix = scope.memberPrefix(id);
+            members.scanFrom(prefix, [&](const QByteArray &key, const QByteArray &) {
+                    if (key.startsWith(prefix)) {
+                        const auto candidate = key.mid(prefix.size());
+                        if (newest.isEmpty() || candidate < newest) {
+                            newest = candidate;
+                        }
+                    }
+                    return false;
+                },
+                ignoreError);
+        }
+        summary.latestDate = newest.isEmpty() ? QDateTime{} : SortableKey::toDateNewestFirst(newest);
+        summary.latestMail = newest.mid(SortableKey::size);
+    }
+    write(scope, &previous, summary, transaction);
+}
+
+void ThreadSummary::removeMail(const QByteArray &threadId, const QByteArrayList &mergedThreadIds, const ApplicationDomainType &mail, DataStore::Transaction &transaction)
+{
+    ::removeMail(threadScope(), threadId, mergedThreadIds, mail, transaction);
+    const auto folder = folderOf(mail);
+    if (!folder.isEmpty()) {
+        ::removeMail(folderScope(folder), threadId, mergedThreadIds, mail, transaction);
+    }
+}
+
+static void merge(const Scope &scope, const QByteArray &threadId, const QByteArray &mergedThreadId, DataStore::Transaction &transaction)
+{
+    ThreadSummary merged;
+    if (!read(scope, mergedThreadId, merged, transaction)) {
+        return;
+    }
+    ThreadSummary summary;
+    const bool existed = read(scope, threadId, summary, transaction);
+    const auto previous = summary;
+    summary.threadId = threadId;
+
+    summary.messageCount += merged.messageCount;
+    summary.unreadCount += merged.unreadCount;
+    summary.importantCount += merged.importantCount;
+    for (auto it = merged.participants.constBegin(); it != merged.participants.constEnd(); ++it) {
+        summary.participants[it.key()] += it.value();
+    }
+    if (!existed || isNewer(merged.latestDate, summary.latestDate)) {
+        summary.latestMail = merged.latestMail;
+        summary.latestDate = merged.latestDate;
+    }
+
+    erase(scope, merged, transaction);
+    write(scope, existed ? &previous : nullptr, summary, transaction);
+}
+
+void ThreadSummary::merge(const QByteArray &threadId, const QByteArray &mergedThreadId, DataStore::Transaction &transaction)
+{
+    ::merge(threadScope(), threadId, mergedThreadId, transaction);
+
+    //The summaries are collected first, because they are rewritten while merging
+    QByteArrayList folders;
+    transaction.openDatabase(folderSummaryDatabase).scanFrom(mergedThreadId, [&](const QByteArray &key, const QByteArray &) {
+            if (!key.startsWith(mergedThreadId)) {
+                return false;
+            }
+            folders << key.mid(mergedThreadId.size());
+            return true;
+        },
+        ignoreError);
+    for (const auto &folder : folders) {
+        ::merge(folderScope(folder), threadId, mergedThreadId, transaction);
+    }
+}
+
+void ThreadSummary::clear(DataStore::Transaction &transaction)
+{
+    for (const auto &database : databases().keys()) {
+        transaction.openDatabase(database).clear(ignoreError);
+    }
+}
+
+//The summaries are built from the existing mails like an index of the mails
+QByteArray ThreadSummary::definition()
+{
+    return "mail.index.threadSummary";
+}
+
+int ThreadSummary::definitionVersion()
+{
+    return 1;
+}
+
+QMap<QByteArray, int> ThreadSummary::databases()
+{
+    return {{summaryDatabase, 0},
+            {memberDatabase, 0},
+            {dateDatabase, 0},
+            {folderSummaryDatabase, 0},
+            {folderMemberDatabase, 0},
+            {folderDateDatabase, 0}};
+}
@@ -0,0 +1,102 @@
+/*
+ *   Copyright (C) 2017 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ */
+#pragma once
+
+#include "sink_export.h"
+#include "storage.h"
+#include <QDateTime>
+#include <QMap>
+#include <functional>
+
+namespace Sink {
+namespace ApplicationDomain {
+    class ApplicationDomainType;
+}
+
+/**
+ * A summary of a mail thread, that is maintained by the ThreadIndexer whenever a mail is written.
+ *
+ * Thread lists can be read from the summaries alone, instead of reducing over all mails of every thread.
+ * Besides the summary of all mails of a thread, every folder has a summary of the mails of the thread it contains,
+ * so thread lists of a folder can be read from the summaries as well.
+ * The summaries only reflect the latest revision of the store.
+ */
+struct SINK_EXPORT ThreadSummary
+{
+    QByteArray threadId;
+    QByteArray latestMail;
+    QDateTime latestDate;
+    int messageCount = 0;
+    int unreadCount = 0;
+    int importantCount = 0;
+    //Sender address -> number of mails
+    QMap<QString, int> participants;
+
+    QByteArray serialize() const;
+    static ThreadSummary deserialize(const QByteArray &threadId, const QByteArray &data);
+
+    /**
+     * Returns false if the store doesn't contain the summaries of all threads yet,
+     * because they are still being built from the mails the store already contained.
+     */
+    static bool isAvailable(const Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Reads the summary of the thread @param threadId, which has to be the resolved thread id.
+     *
+     * If @param folder is set, the summary only covers the mails of the thread in that folder.
+     */
+    static bool read(const QByteArray &threadId, ThreadSummary &summary, const Storage::DataStore::Transaction &transaction, const QByteArray &folder = {});
+
+    /**
+     * Reads the summaries with the most recently active thread first, for as long as @param callback returns true.
+     *
+     * If @param folder is set, only the threads with mails in that folder are read, with the summaries of those mails.
+     */
+    static void readAll(const std::function<bool(const ThreadSummary &summary)> &callback, const Storage::DataStore::Transaction &transaction, const QByteArray &folder = {});
+
+    /**
+     * Adds @param mail to the summary of @param threadId.
+     */
+    static void addMail(const QByteArray &threadId, const ApplicationDomain::ApplicationDomainType &mail, Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Removes @param mail from the summary of the thread with the resolved id @param threadId.
+     *
+     * @param mergedThreadIds are the ids that have been merged into the thread, which the mail may have been added with.
+     */
+    static void removeMail(const QByteArray &threadId, const QByteArrayList &mergedThreadIds, const ApplicationDomain::ApplicationDomainType &mail, Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Merges the summary of @param mergedThreadId into the one of @param threadId.
+     */
+    static void merge(const QByteArray &threadId, const QByteArray &mergedThreadId, Storage::DataStore::Transaction &transaction);
+
+    static void clear(Storage::DataStore::Transaction &transaction);
+
+    /**
+     * The name and version the summaries are built with from the existing mails, see Indexer::name.
+     */
+    static QByteArray definition();
+    static int definitionVersion();
+
+    static QMap<QByteArray, int> databases();
+};
+
+}
@@ -26,6 +26,7 @@
 #include "pipeline.h"
 #include "definitions.h"
 #include "applicationdomaintype.h"
+#include "storage/entitystore.h"
 
 using namespace Sink;
 
@@ -40,7 +41,7 @@ struct MimeMessageReader {
         mapped(0),
         mappedSize(0)
     {
-        if (mimeMessagePath.isNull()) {
+        if (mimeMessagePath.isEmpty()) {
             SinkTrace() << "No mime message";
             return;
         }
@@ -110,21 +111,29 @@ static void updatedIndexedProperties(Sink::ApplicationDomain::Mail &mail, KMime:
     //Ensure the mssageId is unique.
     //If there already is one with the same id we'd have to assign a new message id, which probably doesn't make any sense.
 
-    //The last is the parent
+    //The first is the root of the thread, the last is the parent
     auto references = msg->references(true)->identifiers();
 
     //The first is the parent
     auto inReplyTo = msg->inReplyTo(true)->identifiers();
-    QByteArray parentMessageId;
+    QByteArrayList ancestors;
     if (!references.isEmpty()) {
-        parentMessageId = references.last();
-        //TODO we could use the rest of the references header to complete the ancestry in case we have missing parents.
+        //The complete ancestry allows to thread the message even if some of the ancestors are missing.
+        for (const auto &reference : references) {
+            if (!reference.isEmpty() && reference != messageId && !ancestors.contains(reference)) {
+                ancestors << reference;
+            }
+        }
     } else {
         if (!inReplyTo.isEmpty()) {
             //According to RFC5256 we should ignore all but the first
-            parentMessageId = inReplyTo.first();
+            ancestors << inReplyTo.first();
         }
     }
+    QByteArray parentMessageId;
+    if (!ancestors.isEmpty()) {
+        parentMessageId = ancestors.last();
+    }
     if (messageId.isEmpty()) {
         auto tmp = KMime::Message::Ptr::create();
         auto header = tmp->messageID(true);
@@ -136,24 +145,79 @@ static void updatedIndexedProperties(Sink::ApplicationDomain::Mail &mail, KMime:
     mail.setExtractedMessageId(messageId);
     if (!parentMessageId.isEmpty()) {
         mail.setExtractedParentMessageId(parentMessageId);
+        mail.setExtractedAncestors(ancestors);
     }
 }
 
+//Only the text part is indexed, so we don't have to read large attachments that typically follow it.
+static const qint64 maximumFulltextMessageSize = 1024 * 1024;
+
+static QString getBodyText(const QString &mimeMessagePath)
+{
+    if (mimeMessagePath.isEmpty()) {
+        return {};
+    }
+    QFile f(mimeMessagePath);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    auto msg = KMime::Message::Ptr(new KMime::Message);
+    msg->setContent(KMime::CRLFtoLF(f.read(maximumFulltextMessageSize)));
+    msg->parse();
+    if (const auto text = msg->textContent()) {
+        return text->decodedText();
+    }
+    return {};
+}
+
+static QString getFulltextContent(const Sink::ApplicationDomain::Mail &mail, const QString &body)
+{
+    QStringList content;
+    content << mail.getSubject();
+    const auto sender = mail.getSender();
+    content << sender.name << sender.emailAddress;
+    for (const auto &contact : mail.getTo() + mail.getCc() + mail.getBcc()) {
+        content << contact.name << contact.emailAddress;
+    }
+    content << body;
+    return content.join('\n');
+}
+
+void MailPropertyExtractor::updateFulltextIndex(const Sink::ApplicationDomain::Mail &mail, const QString &mimeMessagePath)
+{
+    entityStore().updateFulltextIndex(ApplicationDomain::getTypeName<ApplicationDomain::Mail>(), mail.identifier(), getFulltextContent(mail, getBodyText(mimeMessagePath)));
+}
+
 void MailPropertyExtractor::newEntity(Sink::ApplicationDomain::Mail &mail)
 {
-    MimeMessageReader mimeMessageReader(getFilePathFromMimeMessagePath(mail.getMimeMessagePath()));
+    const auto mimeMessagePath = getFilePathFromMimeMessagePath(mail.getMimeMessagePath());
+    MimeMessageReader mimeMessageReader(mimeMessagePath);
     auto msg = mimeMessageReader.mimeMessage();
     if (msg) {
         updatedIndexedProperties(mail, msg);
     }
+    updateFulltextIndex(mail, mimeMessagePath);
 }
 
 void MailPropertyExtractor::modifiedEntity(const Sink::ApplicationDomain::Mail &oldMail, Sink::ApplicationDomain::Mail &newMail)
 {
-    MimeMessageReader mimeMessageReader(getFilePathFromMimeMessagePath(newMail.getMimeMessagePath()));
+    const auto mimeMessagePath = getFilePathFromMimeMessagePath(newMail.getMimeMessagePath());
+    MimeMessageReader mimeMessageReader(mimeMessagePath);
     auto msg = mimeMessageReader.mimeMessage();
     if (msg) {
         updatedIndexedProperties(newMail, msg);
     }
+    //Flag changes don't require reindexing
+    const bool mimeMessageChanged = newMail.getMimeMessagePath() != oldMail.getMimeMessagePath();
+    const bool headersChanged = getFulltextContent(newMail, {}) != getFulltextContent(oldMail, {});
+    if (msg && (mimeMessageChanged || headersChanged)) {
+        updateFulltextIndex(newMail, mimeMessagePath);
+    } else if (!msg && headersChanged) {
+        //An evicted body can't be reindexed, so its tokens are kept. Tokens of replaced headers may remain,
+        //which only adds candidates that the filter rejects.
+        const auto type = ApplicationDomain::getTypeName<ApplicationDomain::Mail>();
+        const auto tokens = entityStore().fulltextTokens(type, newMail.identifier());
+        entityStore().updateFulltextIndex(type, newMail.identifier(), getFulltextContent(newMail, QString::fromUtf8(tokens.join(' '))));
+    }
 }
 
@@ -28,5 +28,7 @@ public:
     virtual void modifiedEntity(const Sink::ApplicationDomain::Mail &oldMail, Sink::ApplicationDomain::Mail &newMail) Q_DECL_OVERRIDE;
 protected:
     virtual QString getFilePathFromMimeMessagePath(const QString &) const;
+private:
+    void updateFulltextIndex(const Sink::ApplicationDomain::Mail &mail, const QString &mimeMessagePath);
 };
 
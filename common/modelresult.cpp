@@ -194,6 +194,9 @@ QVariant ModelResult<T, Ptr>::data(const QModelIndex &index, int role) const
     if (role == ChildrenFetchedRole) {
         return childrenFetched(index);
     }
+    if (role == ErrorRole && !index.isValid()) {
+        return mError.isEmpty() ? QVariant{} : mError;
+    }
     if (role == StatusRole) {
         auto it = mEntityStatus.constFind(index.internalId());
         if (it != mEntityStatus.constEnd()) {
@@ -400,6 +403,13 @@ void ModelResult<T, Ptr>::setEmitter(const typename Sink::ResultEmitter<Ptr>::Pt
         }
         emit dataChanged(parentIndex, parentIndex, QVector<int>() << ChildrenFetchedRole);
     });
+    emitter->onError([this, guard](const QString &message) {
+        SinkWarningCtx(mLogCtx) << "Query failed: " << message;
+        Q_ASSERT(guard);
+        Q_ASSERT(QThread::currentThread() == this->thread());
+        mError = message;
+        emit dataChanged(QModelIndex(), QModelIndex(), QVector<int>() << ErrorRole);
+    });
     mEmitter = emitter;
 }
 
@@ -46,7 +46,8 @@ public:
         DomainObjectBaseRole,
         StatusRole, //ApplicationDomain::SyncStatus
         WarningRole, //ApplicationDomain::Warning, only if status == warning || status == error
-        ProgressRole //ApplicationDomain::Progress
+        ProgressRole, //ApplicationDomain::Progress
+    ErrorRole //QString, the error that stopped the query, only on the root index
     };
 
     ModelResult(const Sink::Query &query, const QList<QByteArray> &propertyColumns, const Sink::Log::Context &);
@@ -86,6 +87,7 @@ private:
     QSet<qint64 /* entity id */> mEntityChildrenFetchComplete;
     QSet<qint64 /* entity id */> mEntityAllChildrenFetched;
     QMap<qint64 /* entity id */, int /* Status */> mEntityStatus;
+    QString mError;
     QList<QByteArray> mPropertyColumns;
     Sink::Query mQuery;
     std::function<void(const Ptr &)> loadEntities;
@@ -40,7 +40,8 @@ public:
         Progress,
         Inspection,
         RevisionUpdate,
-        FlushCompletion
+        FlushCompletion,
+        RevisionLeaseExpired
     };
     /**
      * Used as code for Inspection type notifications
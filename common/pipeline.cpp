@@ -63,7 +63,7 @@ public:
 
 Pipeline::Pipeline(const ResourceContext &context, const Sink::Log::Context &ctx) : QObject(nullptr), d(new Private(context, ctx))
 {
-    //Create main store immediately on first start
+    //Create main store immediately on first start, which also schedules the build of new or outdated indexes
     d->entityStore.startTransaction(DataStore::ReadWrite);
     d->entityStore.commitTransaction();
 }
@@ -95,6 +95,11 @@ void Pipeline::startTransaction()
     d->entityStore.startTransaction(DataStore::ReadWrite);
 }
 
+void Pipeline::startBulkLoad()
+{
+    d->entityStore.startBulkLoad();
+}
+
 void Pipeline::commit()
 {
     // TODO call for all types
@@ -359,6 +364,12 @@ KAsync::Job<qint64> Pipeline::deletedEntity(void const *command, size_t size)
     return KAsync::value(d->entityStore.maxRevision());
 }
 
+void Pipeline::setKeepHistory(bool keepHistory)
+{
+    SinkTraceCtx(d->logCtx) << "Keeping history: " << keepHistory;
+    d->entityStore.setKeepHistory(keepHistory);
+}
+
 void Pipeline::cleanupRevisions(qint64 revision)
 {
     //We have to set revisionChanged, otherwise a call to commit might abort
@@ -366,6 +377,14 @@ void Pipeline::cleanupRevisions(qint64 revision)
     d->revisionChanged = d->entityStore.cleanupRevisions(revision);
 }
 
+bool Pipeline::buildIndexes(int batchSize)
+{
+    d->entityStore.startTransaction(DataStore::ReadWrite);
+    const auto buildRequired = d->entityStore.buildIndexes(batchSize);
+    d->entityStore.commitTransaction();
+    return buildRequired;
+}
+
 
 class Preprocessor::Private {
 public:
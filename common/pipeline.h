@@ -53,6 +53,13 @@ public:
     void startTransaction();
     void commit();
 
+    /*
+     * Writes the property indexes in bulk at the end of the current transaction.
+     *
+     * See EntityStore::startBulkLoad.
+     */
+    void startBulkLoad();
+
     KAsync::Job<qint64> newEntity(void const *command, size_t size);
     KAsync::Job<qint64> modifiedEntity(void const *command, size_t size);
     KAsync::Job<qint64> deletedEntity(void const *command, size_t size);
@@ -62,6 +69,20 @@ public:
      */
     void cleanupRevisions(qint64 revision);
 
+    /*
+     * Replace entities in place instead of keeping a history of revisions.
+     *
+     * See EntityStore::setKeepHistory.
+     */
+    void setKeepHistory(bool keepHistory);
+
+    /*
+     * Builds indexes that are new or outdated in batches of @param batchSize entities.
+     *
+     * Returns true if there is more to build.
+     */
+    bool buildIndexes(int batchSize);
+
 
 signals:
     void revisionUpdated(qint64);
@@ -20,8 +20,10 @@
 #include "propertymapper.h"
 
 #include "applicationdomaintype.h"
+#include "sortablekey.h"
 #include <QDateTime>
 #include <QDataStream>
+#include <cstring>
 #include "mail_generated.h"
 #include "contact_generated.h"
 
@@ -77,6 +79,23 @@ flatbuffers::uoffset_t variantToProperty<QDateTime>(const QVariant &property, fl
     return 0;
 }
 
+/*
+ * Dates are stored as milliseconds since epoch, which compare like the dates themselves.
+ *
+ * Invalid dates are stored as the default value of the date fields in the schemas, so they are not written at all.
+ */
+using Sink::SortableKey::invalidDate;
+
+template <>
+int64_t variantToNumber<QDateTime>(const QVariant &property)
+{
+    const auto date = property.toDateTime();
+    if (date.isValid()) {
+        return date.toMSecsSinceEpoch();
+    }
+    return invalidDate;
+}
+
 template <>
 flatbuffers::uoffset_t variantToProperty<QByteArrayList>(const QVariant &property, flatbuffers::FlatBufferBuilder &fbb)
 {
@@ -258,6 +277,15 @@ QVariant propertyToVariant<bool>(uint8_t property)
     return static_cast<bool>(property);
 }
 
+template <>
+QVariant propertyToVariant<QDateTime>(int64_t property)
+{
+    if (property != invalidDate) {
+        return QDateTime::fromMSecsSinceEpoch(property);
+    }
+    return QVariant();
+}
+
 template <>
 QVariant propertyToVariant<QDateTime>(const flatbuffers::String *property)
 {
@@ -270,3 +298,144 @@ QVariant propertyToVariant<QDateTime>(const flatbuffers::String *property)
     }
     return QVariant();
 }
+
+using Sink::QueryBase;
+
+/*
+ * Matches strings on their bytes, which is what the converted value is compared on,
+ * as long as the filter value has the same type as the converted value.
+ */
+static PropertyMatcher<const flatbuffers::String *> stringMatcher(const QueryBase::Comparator &comparator, int typeId, const QByteArray &expected)
+{
+    switch (comparator.comparator) {
+        case QueryBase::Comparator::Equals:
+            if (!comparator.value.isValid()) {
+                return [](const flatbuffers::String *property) { return !property; };
+            }
+            if (comparator.value.userType() != typeId) {
+                return {};
+            }
+            return [expected](const flatbuffers::String *property) {
+                return property && property->size() == static_cast<flatbuffers::uoffset_t>(expected.size()) && !memcmp(property->c_str(), expected.constData(), expected.size());
+            };
+        case QueryBase::Comparator::In: {
+            //The converted value is compared as QByteArray
+            const auto values = comparator.value.value<QByteArrayList>().toSet();
+            return [values](const flatbuffers::String *property) {
+                return property && values.contains(QByteArray::fromRawData(property->c_str(), property->size()));
+            };
+        }
+        default:
+            break;
+    }
+    return {};
+}
+
+template <>
+PropertyMatcher<const flatbuffers::String *> propertyMatcher<QString, const flatbuffers::String *>(const QueryBase::Comparator &comparator)
+{
+    return stringMatcher(comparator, QMetaType::QString, comparator.value.toString().toUtf8());
+}
+
+template <>
+PropertyMatcher<const flatbuffers::String *> propertyMatcher<QByteArray, const flatbuffers::String *>(const QueryBase::Comparator &comparator)
+{
+    return stringMatcher(comparator, QMetaType::QByteArray, comparator.value.toByteArray());
+}
+
+template <>
+PropertyMatcher<const flatbuffers::String *> propertyMatcher<Sink::ApplicationDomain::Reference, const flatbuffers::String *>(const QueryBase::Comparator &comparator)
+{
+    return stringMatcher(comparator, qMetaTypeId<Sink::ApplicationDomain::Reference>(), comparator.value.value<Sink::ApplicationDomain::Reference>().value);
+}
+
+template <>
+PropertyMatcher<bool> propertyMatcher<bool, bool>(const QueryBase::Comparator &comparator)
+{
+    if (comparator.comparator != QueryBase::Comparator::Equals || comparator.value.type() != QVariant::Bool) {
+        return {};
+    }
+    const auto expected = comparator.value.toBool();
+    return [expected](bool property) { return property == expected; };
+}
+
+template <>
+PropertyMatcher<uint8_t> propertyMatcher<bool, uint8_t>(const QueryBase::Comparator &comparator)
+{
+    const auto matcher = propertyMatcher<bool, bool>(comparator);
+    if (!matcher) {
+        return {};
+    }
+    return [matcher](uint8_t property) { return matcher(static_cast<bool>(property)); };
+}
+
+/*
+ * Returns false if @param value is not a valid date, since invalid dates don't compare like numbers.
+ */
+static bool toDateNumber(const QVariant &value, int64_t &number)
+{
+    if (value.type() != QVariant::DateTime || !value.toDateTime().isValid()) {
+        return false;
+    }
+    number = value.toDateTime().toMSecsSinceEpoch();
+    return true;
+}
+
+template <>
+PropertyMatcher<int64_t> propertyMatcher<QDateTime, int64_t>(const QueryBase::Comparator &comparator)
+{
+    int64_t expected;
+    switch (comparator.comparator) {
+        case QueryBase::Comparator::Equals:
+            if (!comparator.value.isValid()) {
+                return [](int64_t property) { return property == invalidDate; };
+            }
+            if (!toDateNumber(comparator.value, expected)) {
+                return {};
+            }
+            return [expected](int64_t property) { return property != invalidDate && property == expected; };
+        case QueryBase::Comparator::LessThan:
+            if (!toDateNumber(comparator.value, expected)) {
+                return {};
+            }
+            return [expected](int64_t property) { return property != invalidDate && property < expected; };
+        case QueryBase::Comparator::GreaterThan:
+            if (!toDateNumber(comparator.value, expected)) {
+                return {};
+            }
+            return [expected](int64_t property) { return property != invalidDate && property > expected; };
+        case QueryBase::Comparator::Within: {
+            const auto range = comparator.value.value<QVariantList>();
+            int64_t lower;
+            int64_t upper;
+            if (range.size() != 2 || !toDateNumber(range.at(0), lower) || !toDateNumber(range.at(1), upper)) {
+                return {};
+            }
+            return [lower, upper](int64_t property) { return property != invalidDate && property >= lower && property <= upper; };
+        }
+        default:
+            break;
+    }
+    return {};
+}
+
+template <>
+PropertyMatcher<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *> propertyMatcher<QByteArrayList, const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(const QueryBase::Comparator &comparator)
+{
+    if (comparator.comparator != QueryBase::Comparator::Contains) {
+        return {};
+    }
+    const auto expected = comparator.value.toByteArray();
+    return [expected](const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *property) {
+        if (!property) {
+            return false;
+        }
+        for (auto it = property->begin(); it != property->end(); it.operator++()) {
+            const auto value = *it;
+            if (value->size() == static_cast<flatbuffers::uoffset_t>(expected.size()) && !memcmp(value->c_str(), expected.constData(), expected.size())) {
+                return true;
+            }
+        }
+        return false;
+    };
+}
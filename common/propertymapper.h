@@ -24,6 +24,7 @@
 #include <QByteArray>
 #include <functional>
 #include <flatbuffers/flatbuffers.h>
+#include "query.h"
 
 namespace Sink {
 namespace ApplicationDomain {
@@ -39,6 +40,8 @@ namespace Buffer {
  */
 template <class T>
 flatbuffers::uoffset_t SINK_EXPORT variantToProperty(const QVariant &, flatbuffers::FlatBufferBuilder &fbb);
+template <class T>
+int64_t SINK_EXPORT variantToNumber(const QVariant &);
 
 /**
  * Defines how to convert flatbuffer primitives to qt ones
@@ -48,6 +51,8 @@ QVariant SINK_EXPORT propertyToVariant(const flatbuffers::String *);
 template <typename T>
 QVariant SINK_EXPORT propertyToVariant(uint8_t);
 template <typename T>
+QVariant SINK_EXPORT propertyToVariant(int64_t);
+template <typename T>
 QVariant SINK_EXPORT propertyToVariant(const flatbuffers::Vector<uint8_t> *);
 template <typename T>
 QVariant SINK_EXPORT propertyToVariant(const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *);
@@ -58,6 +63,35 @@ QVariant SINK_EXPORT propertyToVariant(const flatbuffers::Vector<flatbuffers::Of
 template <typename T>
 QVariant SINK_EXPORT propertyToVariant(const flatbuffers::Vector<flatbuffers::Offset<Sink::ApplicationDomain::Buffer::ContactEmail>> *);
 
+/**
+ * Defines how to match flatbuffer primitives against a filter, without converting them to qt ones.
+ *
+ * A matcher matches like Sink::QueryBase::Comparator::matches on the converted value.
+ * An empty matcher is returned for comparisons that are not supported on the flatbuffer primitive.
+ */
+template <typename Field>
+using PropertyMatcher = std::function<bool(Field)>;
+
+template <typename T, typename Field>
+PropertyMatcher<Field> propertyMatcher(const Sink::QueryBase::Comparator &)
+{
+    return {};
+}
+template <>
+PropertyMatcher<const flatbuffers::String *> SINK_EXPORT propertyMatcher<QString, const flatbuffers::String *>(const Sink::QueryBase::Comparator &);
+template <>
+PropertyMatcher<const flatbuffers::String *> SINK_EXPORT propertyMatcher<QByteArray, const flatbuffers::String *>(const Sink::QueryBase::Comparator &);
+template <>
+PropertyMatcher<const flatbuffers::String *> SINK_EXPORT propertyMatcher<Sink::ApplicationDomain::Reference, const flatbuffers::String *>(const Sink::QueryBase::Comparator &);
+template <>
+PropertyMatcher<bool> SINK_EXPORT propertyMatcher<bool, bool>(const Sink::QueryBase::Comparator &);
+template <>
+PropertyMatcher<uint8_t> SINK_EXPORT propertyMatcher<bool, uint8_t>(const Sink::QueryBase::Comparator &);
+template <>
+PropertyMatcher<int64_t> SINK_EXPORT propertyMatcher<QDateTime, int64_t>(const Sink::QueryBase::Comparator &);
+template <>
+PropertyMatcher<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *> SINK_EXPORT propertyMatcher<QByteArrayList, const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(const Sink::QueryBase::Comparator &);
+
 /**
  * The property mapper is a non-typesafe virtual dispatch.
  *
@@ -68,6 +102,11 @@ QVariant SINK_EXPORT propertyToVariant(const flatbuffers::Vector<flatbuffers::Of
 class PropertyMapper
 {
 public:
+    /**
+     * A filter that is evaluated on the buffer directly.
+     */
+    typedef std::function<bool(void const *buffer)> Predicate;
+
     virtual ~PropertyMapper(){};
 
     template <typename T, typename Buffer, typename BufferBuilder, typename FunctionReturnValue, typename Arg>
@@ -104,16 +143,49 @@ public:
         return mReadAccessors.keys();
     }
 
-private:
+    /**
+     * Compiles @param comparator on the property @param key into a predicate on the buffer.
+     *
+     * Returns an empty predicate if the property has to be read to be compared.
+     */
+    Predicate predicate(const QByteArray &key, const Sink::QueryBase::Comparator &comparator) const
+    {
+        const auto factory = mPredicateFactories.value(key);
+        if (!factory) {
+            return {};
+        }
+        return factory(comparator);
+    }
+
+    /**
+     * Replaces the read accessor of @param property, e.g. to fall back to a field that has been replaced.
+     *
+     * The predicates of the property are dropped, since they would no longer match the accessor.
+     */
     void addReadMapping(const QByteArray &property, const std::function<QVariant(void const *)> &mapping)
     {
         mReadAccessors.insert(property, mapping);
+        mPredicateFactories.remove(property);
+    }
+
+    void addPredicate(const QByteArray &property, const std::function<Predicate(const Sink::QueryBase::Comparator &)> &factory)
+    {
+        mPredicateFactories.insert(property, factory);
     }
 
+private:
+
     template <typename T, typename Buffer, typename FunctionReturnValue>
     void addReadMapping(FunctionReturnValue (Buffer::*f)() const)
     {
         addReadMapping(T::name, [f](void const *buffer) -> QVariant { return propertyToVariant<typename T::Type>((static_cast<const Buffer*>(buffer)->*f)()); });
+        addPredicate(T::name, [f](const Sink::QueryBase::Comparator &comparator) -> Predicate {
+            const auto matcher = propertyMatcher<typename T::Type, FunctionReturnValue>(comparator);
+            if (!matcher) {
+                return {};
+            }
+            return [f, matcher](void const *buffer) { return matcher((static_cast<const Buffer*>(buffer)->*f)()); };
+        });
     }
 
 
@@ -138,6 +210,15 @@ private:
         });
     }
 
+    template <typename T, typename BufferBuilder>
+    void addWriteMapping(void (BufferBuilder::*f)(int64_t))
+    {
+        addWriteMapping(T::name, [f](const QVariant &value, flatbuffers::FlatBufferBuilder &fbb) -> std::function<void(void *builder)> {
+            const auto number = variantToNumber<typename T::Type>(value);
+            return [number, f](void *builder) { (static_cast<BufferBuilder*>(builder)->*f)(number); };
+        });
+    }
+
     template <typename T, typename BufferBuilder, typename Arg>
     void addWriteMapping(void (BufferBuilder::*f)(flatbuffers::Offset<Arg>))
     {
@@ -149,5 +230,6 @@ private:
 
     QHash<QByteArray, std::function<QVariant(void const *)>> mReadAccessors;
     QHash<QByteArray, std::function<std::function<void(void *builder)>(const QVariant &, flatbuffers::FlatBufferBuilder &)>> mWriteAccessors;
+    QHash<QByteArray, std::function<Predicate(const Sink::QueryBase::Comparator &)>> mPredicateFactories;
 };
 
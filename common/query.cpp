@@ -22,6 +22,8 @@
 #include <QList>
 #include <QDataStream>
 
+#include "fulltextindex.h"
+
 using namespace Sink;
 
 static const int registerQuery = qRegisterMetaTypeStreamOperators<Sink::QueryBase>();
@@ -34,6 +36,14 @@ QDebug operator<<(QDebug dbg, const Sink::QueryBase::Comparator &c)
         dbg.nospace() << "contains " << c.value;
     } else if (c.comparator == Sink::Query::Comparator::In) {
         dbg.nospace() << "in " << c.value;
+    } else if (c.comparator == Sink::Query::Comparator::LessThan) {
+        dbg.nospace() << "< " << c.value;
+    } else if (c.comparator == Sink::Query::Comparator::GreaterThan) {
+        dbg.nospace() << "> " << c.value;
+    } else if (c.comparator == Sink::Query::Comparator::Within) {
+        dbg.nospace() << "within " << c.value;
+    } else if (c.comparator == Sink::Query::Comparator::Fulltext) {
+        dbg.nospace() << "fulltext " << c.value;
     } else {
         dbg.nospace() << "unknown comparator: " << c.value;
     }
@@ -41,10 +51,20 @@ QDebug operator<<(QDebug dbg, const Sink::QueryBase::Comparator &c)
     return dbg.space();
 }
 
+QDebug operator<<(QDebug dbg, const Sink::QueryBase::Or &filter)
+{
+    dbg.nospace() << "Or(" << filter.alternatives << ")";
+    return dbg.maybeSpace();
+}
+
 QDebug operator<<(QDebug dbg, const Sink::QueryBase::Filter &filter)
 {
     if (filter.ids.isEmpty()) {
-        dbg.nospace() << "Filter(" << filter.propertyFilter << ")";
+        dbg.nospace() << "Filter(" << filter.propertyFilter;
+        if (!filter.orFilters.isEmpty()) {
+            dbg.nospace() << ", " << filter.orFilters;
+        }
+        dbg.nospace() << ")";
     } else {
         dbg.nospace() << "Filter(" << filter.ids << ")";
     }
@@ -57,6 +77,9 @@ QDebug operator<<(QDebug dbg, const Sink::QueryBase &query)
     dbg.nospace() << "  Filter: " << query.getBaseFilters() << "\n";
     dbg.nospace() << "  Ids: " << query.ids() << "\n";
     dbg.nospace() << "  Sorting: " << query.sortProperty() << "\n";
+    if (query.snapshotRevision()) {
+        dbg.nospace() << "  Snapshot: " << query.snapshotRevision() << "\n";
+    }
     return dbg.maybeSpace();
 }
 
@@ -86,10 +109,23 @@ QDataStream & operator>> (QDataStream &stream, Sink::QueryBase::Comparator &comp
     return stream;
 }
 
+QDataStream & operator<< (QDataStream &stream, const Sink::QueryBase::Or &filter)
+{
+    stream << filter.alternatives;
+    return stream;
+}
+
+QDataStream & operator>> (QDataStream &stream, Sink::QueryBase::Or &filter)
+{
+    stream >> filter.alternatives;
+    return stream;
+}
+
 QDataStream & operator<< (QDataStream &stream, const Sink::QueryBase::Filter &filter)
 {
     stream << filter.ids;
     stream << filter.propertyFilter;
+    stream << filter.orFilters;
     return stream;
 }
 
@@ -97,6 +133,7 @@ QDataStream & operator>> (QDataStream &stream, Sink::QueryBase::Filter &filter)
 {
     stream >> filter.ids;
     stream >> filter.propertyFilter;
+    stream >> filter.orFilters;
     return stream;
 }
 
@@ -122,9 +159,14 @@ QDataStream & operator>> (QDataStream &stream, Sink::QueryBase &query)
     return stream;
 }
 
+bool QueryBase::Or::operator==(const QueryBase::Or &other) const
+{
+    return alternatives == other.alternatives;
+}
+
 bool QueryBase::Filter::operator==(const QueryBase::Filter &other) const
 {
-    auto ret = ids == other.ids && propertyFilter == other.propertyFilter;
+    auto ret = ids == other.ids && propertyFilter == other.propertyFilter && orFilters == other.orFilters;
     return ret;
 }
 
@@ -148,6 +190,28 @@ QueryBase::Comparator::Comparator(const QVariant &v, Comparators c) : value(v),
 {
 }
 
+static int compare(const QVariant &left, const QVariant &right)
+{
+    if (left.type() == QVariant::DateTime || right.type() == QVariant::DateTime) {
+        const auto l = left.toDateTime();
+        const auto r = right.toDateTime();
+        return l < r ? -1 : (r < l ? 1 : 0);
+    }
+    bool leftIsNumber = false;
+    bool rightIsNumber = false;
+    const auto l = left.toLongLong(&leftIsNumber);
+    const auto r = right.toLongLong(&rightIsNumber);
+    if (leftIsNumber && rightIsNumber) {
+        return l < r ? -1 : (r < l ? 1 : 0);
+    }
+    if (left.type() == QVariant::String || right.type() == QVariant::String) {
+        return left.toString().compare(right.toString());
+    }
+    const auto leftBytes = left.toByteArray();
+    const auto rightBytes = right.toByteArray();
+    return leftBytes < rightBytes ? -1 : (rightBytes < leftBytes ? 1 : 0);
+}
+
 bool QueryBase::Comparator::matches(const QVariant &v) const
 {
     switch(comparator) {
@@ -169,6 +233,31 @@ bool QueryBase::Comparator::matches(const QVariant &v) const
                 return false;
             }
             return value.value<QByteArrayList>().contains(v.toByteArray());
+        case LessThan:
+            if (!v.isValid()) {
+                return false;
+            }
+            return compare(v, value) < 0;
+        case GreaterThan:
+            if (!v.isValid()) {
+                return false;
+            }
+            return compare(v, value) > 0;
+        case Within: {
+            if (!v.isValid()) {
+                return false;
+            }
+            const auto range = value.value<QVariantList>();
+            if (range.size() != 2) {
+                return false;
+            }
+            return compare(v, range.at(0)) >= 0 && compare(v, range.at(1)) <= 0;
+        }
+        case Fulltext:
+            if (!v.isValid()) {
+                return false;
+            }
+            return FulltextIndex::matches(FulltextIndex::tokenize(v.toString()), value.toString());
         case Invalid:
         default:
             break;
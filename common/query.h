@@ -35,7 +35,13 @@ public:
             Invalid,
             Equals,
             Contains,
-            In
+            In,
+            LessThan,
+            GreaterThan,
+            //Matches values between value[0] and value[1], both inclusive.
+            Within,
+            //Matches if every word of the value is a prefix of a word in the property.
+            Fulltext
         };
 
         Comparator();
@@ -48,10 +54,40 @@ public:
         Comparators comparator;
     };
 
+    /**
+     * Matches if any of its property filters matches.
+     */
+    class Or {
+    public:
+        Or &filter(const QByteArray &property, const Comparator &comparator)
+        {
+            alternatives << qMakePair(property, comparator);
+            return *this;
+        }
+
+        template <typename T>
+        Or &filter(const Comparator &comparator)
+        {
+            return filter(T::name, comparator);
+        }
+
+        template <typename T>
+        Or &filter(const typename T::Type &value)
+        {
+            return filter(T::name, Comparator(QVariant::fromValue(value)));
+        }
+
+        bool operator==(const Or &other) const;
+
+        QList<QPair<QByteArray, Comparator>> alternatives;
+    };
+
     class Filter {
     public:
         QByteArrayList ids;
         QHash<QByteArray, Comparator> propertyFilter;
+        //Every Or filter has to match in addition to the property filters.
+        QList<Or> orFilters;
         bool operator==(const Filter &other) const;
     };
 
@@ -132,6 +168,16 @@ public:
         mBaseFilterStage.propertyFilter.insert(property, comparator);
     }
 
+    void filter(const Or &filter)
+    {
+        mBaseFilterStage.orFilters << filter;
+    }
+
+    QList<Or> getOrFilters() const
+    {
+        return mBaseFilterStage.orFilters;
+    }
+
     void setType(const QByteArray &type)
     {
         mType = type;
@@ -158,6 +204,21 @@ public:
         return mSortProperty;
     }
 
+    /**
+     * Execute the query against the state at @param revision instead of the latest state.
+     *
+     * A revision of 0 means the latest revision is used.
+     */
+    void setSnapshotRevision(qint64 revision)
+    {
+        mSnapshotRevision = revision;
+    }
+
+    qint64 snapshotRevision() const
+    {
+        return mSnapshotRevision;
+    }
+
     class FilterStage {
     public:
         virtual ~FilterStage(){};
@@ -199,7 +260,8 @@ public:
         public:
             enum Operation {
                 Count,
-                Collect
+                Collect,
+                CountTrue
             };
 
             Aggregator(const QByteArray &p, Operation o, const QByteArray &c = QByteArray())
@@ -233,6 +295,16 @@ public:
             return *this;
         }
 
+        /**
+         * Counts the reduced entities for which the boolean property T is set, such as the unread mails of a thread.
+         */
+        template <typename T>
+        Reduce &countTrue(const QByteArray &propertyName)
+        {
+            aggregators << Aggregator(propertyName, Aggregator::CountTrue, T::name);
+            return *this;
+        }
+
         //Reduce on property
         QByteArray property;
         Selector selector;
@@ -286,6 +358,7 @@ private:
     QByteArray mType;
     QByteArray mSortProperty;
     QByteArray mId;
+    qint64 mSnapshotRevision = 0;
 };
 
 /**
@@ -302,7 +375,9 @@ public:
         /** Run the query synchronously. */
         SynchronousQuery = 2,
         /** Include status updates via notifications */
-        UpdateStatus = 4
+        UpdateStatus = 4,
+        /** Page through the result set as it was when the query was started. */
+        Snapshot = 8
     };
     Q_DECLARE_FLAGS(Flags, Flag)
 
@@ -360,6 +435,17 @@ public:
         return *this;
     }
 
+    /**
+     * Matches entities that contain every word of @param text as a prefix in their fulltext indexed content.
+     *
+     * Only types with a fulltext index support this filter.
+     */
+    Query &fulltextFilter(const QString &text)
+    {
+        QueryBase::filter(QByteArray{}, QueryBase::Comparator(text, QueryBase::Comparator::Fulltext));
+        return *this;
+    }
+
     Query &filter(const QByteArray &id)
     {
         QueryBase::filter(id);
@@ -378,6 +464,17 @@ public:
         return *this;
     }
 
+    /**
+     * Matches entities that match any of the property filters in @param filter.
+     *
+     * If all alternatives are indexed, the union of the index lookups is used as source.
+     */
+    Query &filter(const QueryBase::Or &filter)
+    {
+        QueryBase::filter(filter);
+        return *this;
+    }
+
     template <typename T>
     Query &filter(const ApplicationDomain::Entity &value)
     {
@@ -427,6 +524,11 @@ public:
         return mFlags.testFlag(SynchronousQuery);
     }
 
+    bool snapshotQuery() const
+    {
+        return mFlags.testFlag(Snapshot) || snapshotRevision();
+    }
+
     Query &limit(int l)
     {
         mLimit = l;
@@ -571,6 +673,7 @@ private:
 }
 
 SINK_EXPORT QDebug operator<<(QDebug dbg, const Sink::QueryBase::Comparator &);
+SINK_EXPORT QDebug operator<<(QDebug dbg, const Sink::QueryBase::Or &);
 SINK_EXPORT QDebug operator<<(QDebug dbg, const Sink::QueryBase &);
 SINK_EXPORT QDebug operator<<(QDebug dbg, const Sink::Query &);
 SINK_EXPORT QDataStream &operator<< (QDataStream &stream, const Sink::QueryBase &query);
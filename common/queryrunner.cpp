@@ -19,12 +19,14 @@
 #include "queryrunner.h"
 
 #include <limits>
+#include <utime.h>
 #include <QTime>
 #include <QPointer>
 
 #include "commands.h"
 #include "asyncutils.h"
 #include "datastorequery.h"
+#include "bufferadaptor.h"
 
 using namespace Sink;
 using namespace Sink::Storage;
@@ -34,6 +36,12 @@ struct ReplayResult {
     qint64 replayedEntities;
     bool replayedAll;
     DataStoreQuery::State::Ptr queryState;
+    QByteArrayList evictedEntities;
+    //Only tracked for live queries, so we can requery if necessary
+    QByteArrayList updatedEntities;
+    QByteArrayList removedEntities;
+    //Set if the query failed, in which case the replayed results are not reliable
+    QString error;
 };
 
 /*
@@ -52,6 +60,7 @@ public:
 
     ReplayResult executeIncrementalQuery(const Sink::Query &query, Sink::ResultProviderInterface<typename DomainType::Ptr> &resultProvider, DataStoreQuery::State::Ptr state);
     ReplayResult executeInitialQuery(const Sink::Query &query, const typename DomainType::Ptr &parent, Sink::ResultProviderInterface<typename DomainType::Ptr> &resultProvider, int batchsize, DataStoreQuery::State::Ptr state);
+    ReplayResult executeRequery(const Sink::Query &query, Sink::ResultProviderInterface<typename DomainType::Ptr> &resultProvider, int batchsize);
 
 private:
     void resultProviderCallback(const Sink::Query &query, Sink::ResultProviderInterface<typename DomainType::Ptr> &resultProvider, const ResultSet::Result &result);
@@ -59,6 +68,9 @@ private:
     QueryRunnerBase::ResultTransformation mResultTransformation;
     ResourceContext mResourceContext;
     Sink::Log::Context mLogCtx;
+    QByteArrayList mEvictedEntities;
+    QByteArrayList mUpdatedEntities;
+    QByteArrayList mRemovedEntities;
 };
 
 template <class DomainType>
@@ -79,6 +91,10 @@ QueryRunner<DomainType>::QueryRunner(const Sink::Query &query, const Sink::Resou
         auto resourceContext = mResourceContext;
         auto logCtx = mLogCtx;
         auto state = mQueryState.value(parentId);
+        if (!mSnapshotError.isEmpty()) {
+            fail(parent, mSnapshotError);
+            return;
+        }
         const bool runAsync = !query.synchronousQuery();
         //The lambda will be executed in a separate thread, so copy all arguments
         async::run<ReplayResult>([=]() {
@@ -91,10 +107,33 @@ QueryRunner<DomainType>::QueryRunner(const Sink::Query &query, const Sink::Resou
                     return;
                 }
                 mInitialQueryComplete = true;
+                //The lease of the snapshot may also have expired while we were reading it
+                const auto error = result.error.isEmpty() ? mSnapshotError : result.error;
+                if (!error.isEmpty()) {
+                    mQueryState.remove(parentId);
+                    fail(parent, error);
+                    return;
+                }
                 mQueryState[parentId] = result.queryState;
+                for (const auto &id : result.updatedEntities) {
+                    mResultSet.insert(id);
+                }
+                fetchEvictedEntities(result.evictedEntities);
+                if (query.snapshotQuery() && !result.replayedAll) {
+                    // Pin the snapshot revision for as long as we're paging through the result set, so it is not cleaned up meanwhile.
+                    // The pin belongs to this query alone, the replayed revision is shared with all other queries on the resource.
+                    if (mSnapshotPin.isEmpty()) {
+                        mSnapshotPin = DataStore::generateUid();
+                    }
+                    mResourceAccess->sendRevisionPinCommand(mSnapshotPin, result.queryState->mRevision).exec();
+                } else if (!mSnapshotPin.isEmpty()) {
+                    mResourceAccess->sendRevisionPinCommand(mSnapshotPin, 0).exec();
+                    mSnapshotPin.clear();
+                }
                 // Only send the revision replayed information if we're connected to the resource, there's no need to start the resource otherwise.
+                // The job has to be executed for the command to be sent at all, the resource then keeps the revision until we acknowledge a later one.
                 if (query.liveQuery()) {
-                    mResourceAccess->sendRevisionReplayedCommand(result.newRevision);
+                    mResourceAccess->sendRevisionReplayedCommand(result.newRevision).exec();
                 }
                 resultProvider->setRevision(result.newRevision);
                 resultProvider->initialResultSetComplete(parent, result.replayedAll);
@@ -105,6 +144,17 @@ QueryRunner<DomainType>::QueryRunner(const Sink::Query &query, const Sink::Resou
     // We delegate loading of initial data to the result provider, so it can decide for itself what it needs to load.
     mResultProvider->setFetcher(fetcher);
 
+    if (query.snapshotQuery()) {
+        QObject::connect(mResourceAccess.data(), &Sink::ResourceAccess::notification, this, [this](const Sink::Notification &notification) {
+            if (notification.type == Sink::Notification::RevisionLeaseExpired && !mSnapshotPin.isEmpty() && notification.id == mSnapshotPin) {
+                //The snapshot may be cleaned up from now on, so we can't continue paging through it.
+                SinkLogCtx(mLogCtx) << "Revision lease of the snapshot expired.";
+                mSnapshotPin.clear();
+                mSnapshotError = "The revision lease of the snapshot expired, the query has to be restarted.";
+            }
+        });
+    }
+
     // In case of a live query we keep the runner for as long alive as the result provider exists
     if (query.liveQuery()) {
         Q_ASSERT(!query.synchronousQuery());
@@ -125,6 +175,13 @@ QueryRunner<DomainType>::QueryRunner(const Sink::Query &query, const Sink::Resou
                 return KAsync::null();
             }
             Q_ASSERT(!mQueryInProgress);
+            if (mRequeryRequired) {
+                if (query.parentProperty().isEmpty()) {
+                    return requery(query, bufferType);
+                }
+                SinkWarningCtx(mLogCtx) << "Can't requery tree queries, continuing with incremental updates.";
+                mRequeryRequired = false;
+            }
             return KAsync::start([&] {
                     mQueryInProgress = true;
                 })
@@ -138,8 +195,20 @@ QueryRunner<DomainType>::QueryRunner(const Sink::Query &query, const Sink::Resou
                         return;
                     }
                     mQueryInProgress = false;
+                    for (const auto &id : newRevisionAndReplayedEntities.updatedEntities) {
+                        mResultSet.insert(id);
+                    }
+                    for (const auto &id : newRevisionAndReplayedEntities.removedEntities) {
+                        mResultSet.remove(id);
+                    }
+                    fetchEvictedEntities(newRevisionAndReplayedEntities.evictedEntities);
+                    if (mRequeryRequired) {
+                        //The lease expired while we were updating
+                        revisionChanged(0);
+                        return;
+                    }
                     // Only send the revision replayed information if we're connected to the resource, there's no need to start the resource otherwise.
-                    mResourceAccess->sendRevisionReplayedCommand(newRevisionAndReplayedEntities.newRevision);
+                    mResourceAccess->sendRevisionReplayedCommand(newRevisionAndReplayedEntities.newRevision).exec();
                     resultProvider->setRevision(newRevisionAndReplayedEntities.newRevision);
                 });
         });
@@ -147,6 +216,15 @@ QueryRunner<DomainType>::QueryRunner(const Sink::Query &query, const Sink::Resou
         // TODO If we are not connected already, we have to check for the latest revision once connected, otherwise we could miss some updates
         mResourceAccess->open();
         QObject::connect(mResourceAccess.data(), &Sink::ResourceAccess::revisionChanged, this, &QueryRunner::revisionChanged);
+        QObject::connect(mResourceAccess.data(), &Sink::ResourceAccess::notification, this, [this](const Sink::Notification &notification) {
+            //Expired pins of snapshots are notified with the pin as identifier
+            if (notification.type == Sink::Notification::RevisionLeaseExpired && notification.id.isEmpty()) {
+                //The revisions we'd need for an incremental update may be gone by now.
+                SinkLogCtx(mLogCtx) << "Revision lease expired, requerying.";
+                mRequeryRequired = true;
+                revisionChanged(0);
+            }
+        });
     }
     mResultProvider->onDone([this]() {
         delete this;
@@ -157,6 +235,82 @@ template <class DomainType>
 QueryRunner<DomainType>::~QueryRunner()
 {
     SinkTraceCtx(mLogCtx) << "Stopped query";
+    if (!mSnapshotPin.isEmpty()) {
+        //Release the snapshot revision if the result set was not fetched completely.
+        mResourceAccess->sendRevisionPinCommand(mSnapshotPin, 0).exec();
+    }
+}
+
+template <class DomainType>
+KAsync::Job<void> QueryRunner<DomainType>::requery(const Sink::Query &query, const QByteArray &bufferType)
+{
+    mQueryInProgress = true;
+    mRequeryRequired = false;
+    auto resultProvider = mResultProvider;
+    auto resourceContext = mResourceContext;
+    auto resultTransformation = mResultTransformation;
+    auto logCtx = mLogCtx;
+    //Reload as many entities as we already have in the result set.
+    const int batchSize = mBatchSize ? qMax(mBatchSize, mResultSet.size()) : 0;
+    auto guardPtr = QPointer<QObject>(&guard);
+    return async::run<ReplayResult>([=]() {
+            QueryWorker<DomainType> worker(query, resourceContext, bufferType, resultTransformation, logCtx);
+            return worker.executeRequery(query, *resultProvider, batchSize);
+        })
+        .then([=](const ReplayResult &result) {
+            if (!guardPtr) {
+                //Not an error, the query can vanish at any time.
+                return;
+            }
+            mQueryInProgress = false;
+            const auto currentResultSet = result.updatedEntities.toSet();
+            //Anything we no longer got was removed meanwhile
+            for (const auto &id : mResultSet) {
+                if (!currentResultSet.contains(id)) {
+                    resultProvider->remove(DomainType::Ptr::create(mResourceContext.instanceId(), id, 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()));
+                }
+            }
+            mResultSet = currentResultSet;
+            mQueryState[QByteArray{}] = result.queryState;
+            fetchEvictedEntities(result.evictedEntities);
+            mResourceAccess->sendRevisionReplayedCommand(result.newRevision).exec();
+            resultProvider->setRevision(result.newRevision);
+        });
+}
+
+template <class DomainType>
+void QueryRunner<DomainType>::fail(const typename DomainType::Ptr &parent, const QString &error)
+{
+    SinkWarningCtx(mLogCtx) << "Query failed: " << error;
+    if (!mSnapshotPin.isEmpty()) {
+        mResourceAccess->sendRevisionPinCommand(mSnapshotPin, 0).exec();
+        mSnapshotPin.clear();
+    }
+    mResultProvider->error(error);
+    mResultProvider->initialResultSetComplete(parent, true);
+}
+
+template <class DomainType>
+void QueryRunner<DomainType>::fetchEvictedEntities(const QByteArrayList &entities)
+{
+    QByteArrayList ids;
+    for (const auto &id : entities) {
+        //We only have to ask once, the entity will be updated once it's available.
+        if (mFetchedEntities.contains(id)) {
+            continue;
+        }
+        mFetchedEntities.insert(id);
+        ids << id;
+    }
+    if (ids.isEmpty()) {
+        return;
+    }
+    SinkTraceCtx(mLogCtx) << "Fetching evicted entities: " << ids;
+    //A single request so the resource can fetch all of them in one go
+    Sink::QueryBase query;
+    query.setType(ApplicationDomain::getTypeName<DomainType>());
+    query.filter(ids);
+    mResourceAccess->synchronizeResource(query).exec();
 }
 
 template <class DomainType>
@@ -188,6 +342,31 @@ QueryWorker<DomainType>::~QueryWorker()
 template <class DomainType>
 void QueryWorker<DomainType>::resultProviderCallback(const Sink::Query &query, Sink::ResultProviderInterface<typename DomainType::Ptr> &resultProvider, const ResultSet::Result &result)
 {
+    if (result.operation != Sink::Operation_Removal) {
+        for (const auto &property : query.requestedProperties) {
+            const auto value = result.entity.getProperty(property);
+            if (value.canConvert<ApplicationDomain::BLOB>()) {
+                const auto path = value.value<ApplicationDomain::BLOB>().value;
+                if (!path.isEmpty()) {
+                    //Mark the blob as recently used, so the resource evicts it last.
+                    utime(path.toLocal8Bit().constData(), nullptr);
+                }
+            }
+        }
+        //The body has been requested but is not locally available (anymore).
+        if (query.requestedProperties.contains(ApplicationDomain::Mail::MimeMessage::name)
+                && result.entity.getProperty(ApplicationDomain::Mail::MimeMessage::name).value<ApplicationDomain::BLOB>().value.isEmpty()
+                && !result.entity.getProperty(ApplicationDomain::Mail::FullPayloadAvailable::name).toBool()) {
+            mEvictedEntities << result.entity.identifier();
+        }
+    }
+    if (query.liveQuery()) {
+        if (result.operation == Sink::Operation_Removal) {
+            mRemovedEntities << result.entity.identifier();
+        } else {
+            mUpdatedEntities << result.entity.identifier();
+        }
+    }
     auto valueCopy = Sink::ApplicationDomain::ApplicationDomainType::getInMemoryRepresentation<DomainType>(result.entity, query.requestedProperties).template staticCast<DomainType>();
     for (auto it = result.aggregateValues.constBegin(); it != result.aggregateValues.constEnd(); it++) {
         valueCopy->setProperty(it.key(), it.value());
@@ -235,7 +414,7 @@ ReplayResult QueryWorker<DomainType>::executeIncrementalQuery(const Sink::Query
     SinkTraceCtx(mLogCtx) << "Replayed " << replayResult.replayedEntities << " results.\n"
         << (replayResult.replayedAll ? "Replayed all available results.\n" : "")
         << "Incremental query took: " << Log::TraceTime(time.elapsed());
-    return {entityStore.maxRevision(), replayResult.replayedEntities, false, preparedQuery.getState()};
+    return {entityStore.maxRevision(), replayResult.replayedEntities, false, preparedQuery.getState(), mEvictedEntities, mUpdatedEntities, mRemovedEntities};
 }
 
 template <class DomainType>
@@ -257,6 +436,11 @@ ReplayResult QueryWorker<DomainType>::executeInitialQuery(
     }
 
     auto entityStore = EntityStore{mResourceContext, mLogCtx};
+    if (!state && query.snapshotQuery() && !modifiedQuery.snapshotRevision()) {
+        //Subsequent fetches will read at this revision, so entities don't appear twice or vanish between pages.
+        modifiedQuery.setSnapshotRevision(entityStore.maxRevision());
+        SinkTraceCtx(mLogCtx) << "Executing query at snapshot revision: " << modifiedQuery.snapshotRevision();
+    }
     auto preparedQuery = [&] {
         if (state) {
             return DataStoreQuery{*state, ApplicationDomain::getTypeName<DomainType>(), entityStore, false};
@@ -275,7 +459,24 @@ ReplayResult QueryWorker<DomainType>::executeInitialQuery(
         << (replayResult.replayedAll ? "Replayed all available results.\n" : "")
         << "Initial query took: " << Log::TraceTime(time.elapsed());
 
-    return {entityStore.maxRevision(), replayResult.replayedEntities, replayResult.replayedAll, preparedQuery.getState()};
+    return {entityStore.maxRevision(), replayResult.replayedEntities, replayResult.replayedAll, preparedQuery.getState(), mEvictedEntities, mUpdatedEntities, mRemovedEntities, preparedQuery.error()};
+}
+
+template <class DomainType>
+ReplayResult QueryWorker<DomainType>::executeRequery(const Sink::Query &query, Sink::ResultProviderInterface<typename DomainType::Ptr> &resultProvider, int batchsize)
+{
+    QTime time;
+    time.start();
+    auto entityStore = EntityStore{mResourceContext, mLogCtx};
+    auto preparedQuery = DataStoreQuery{query, ApplicationDomain::getTypeName<DomainType>(), entityStore};
+    auto resultSet = preparedQuery.execute();
+    auto replayResult = resultSet.replaySet(0, batchsize, [this, query, &resultProvider](const ResultSet::Result &result) {
+        //Entities that are already part of the result set are updated, the rest is added.
+        resultProviderCallback(query, resultProvider, {result.entity, Sink::Operation_Modification, result.aggregateValues});
+    });
+    SinkTraceCtx(mLogCtx) << "Replayed " << replayResult.replayedEntities << " results.\n"
+        << "Requery took: " << Log::TraceTime(time.elapsed());
+    return {entityStore.maxRevision(), replayResult.replayedEntities, replayResult.replayedAll, preparedQuery.getState(), mEvictedEntities, mUpdatedEntities, mRemovedEntities};
 }
 
 #define REGISTER_TYPE(T) \
@@ -92,6 +92,23 @@ public:
     typename Sink::ResultEmitter<typename DomainType::Ptr>::Ptr emitter();
 
 private:
+    /**
+     * Requests entities that have been evicted from the local cache to be fetched again.
+     */
+    void fetchEvictedEntities(const QByteArrayList &entities);
+
+    /**
+     * Reports @param error to the result set and stops fetching results for @param parent.
+     */
+    void fail(const typename DomainType::Ptr &parent, const QString &error);
+
+    /**
+     * Reloads the complete result set instead of updating it incrementally.
+     *
+     * Used once our revision lease expired, because the resource may have cleaned up revisions we haven't seen yet.
+     */
+    KAsync::Job<void> requery(const Sink::Query &query, const QByteArray &bufferType);
+
     Sink::ResourceContext mResourceContext;
     QSharedPointer<Sink::ResourceAccessInterface> mResourceAccess;
     QSharedPointer<Sink::ResultProvider<typename DomainType::Ptr>> mResultProvider;
@@ -102,4 +119,12 @@ private:
     Sink::Log::Context mLogCtx;
     bool mInitialQueryComplete = false;
     bool mQueryInProgress = false;
+    //Identifies the pin of the snapshot revision while we're paging through a snapshot, empty otherwise
+    QByteArray mSnapshotPin;
+    //Set once the snapshot can no longer be read, e.g. because its revision lease expired
+    QString mSnapshotError;
+    bool mRequeryRequired = false;
+    QSet<QByteArray> mFetchedEntities;
+    //The identifiers of the toplevel entities we reported so far, only tracked for live queries.
+    QSet<QByteArray> mResultSet;
 };
@@ -359,6 +359,15 @@ KAsync::Job<void> ResourceAccess::sendRevisionReplayedCommand(qint64 revision)
     return sendCommand(Sink::Commands::RevisionReplayedCommand, fbb);
 }
 
+KAsync::Job<void> ResourceAccess::sendRevisionPinCommand(const QByteArray &pin, qint64 revision)
+{
+    flatbuffers::FlatBufferBuilder fbb;
+    auto pinString = fbb.CreateString(pin.toStdString());
+    auto location = Sink::Commands::CreateRevisionReplayed(fbb, revision, pinString);
+    Sink::Commands::FinishRevisionReplayedBuffer(fbb, location);
+    return sendCommand(Sink::Commands::RevisionReplayedCommand, fbb);
+}
+
 KAsync::Job<void>
 ResourceAccess::sendInspectionCommand(int inspectionType, const QByteArray &inspectionId, const QByteArray &domainType, const QByteArray &entityId, const QByteArray &property, const QVariant &expectedValue)
 {
@@ -617,6 +626,8 @@ bool ResourceAccess::processMessageBuffer()
                     [[clang::fallthrough]];
                 case Sink::Notification::FlushCompletion:
                     [[clang::fallthrough]];
+                case Sink::Notification::RevisionLeaseExpired:
+                    [[clang::fallthrough]];
                 case Sink::Notification::Progress: {
                     auto n = getNotification(buffer);
                     SinkTrace() << "Received notification: " << n;
@@ -69,6 +69,15 @@ public:
     {
         return KAsync::null<void>();
     };
+    /**
+     * Keeps @param revision from being cleaned up until the pin is released with a revision of 0.
+     *
+     * Unlike the replayed revision, which is shared by all queries of a connection, every @param pin is tracked separately.
+     */
+    virtual KAsync::Job<void> sendRevisionPinCommand(const QByteArray &pin, qint64 revision)
+    {
+        return KAsync::null<void>();
+    };
     virtual KAsync::Job<void>
     sendInspectionCommand(int inspectionType, const QByteArray &inspectionId, const QByteArray &domainType, const QByteArray &entityId, const QByteArray &property, const QVariant &expecedValue)
     {
@@ -118,6 +127,7 @@ public:
     sendModifyCommand(const QByteArray &uid, qint64 revision, const QByteArray &resourceBufferType, const QByteArrayList &deletedProperties, const QByteArray &buffer, const QByteArrayList &changedProperties, const QByteArray &newResource, bool remove) Q_DECL_OVERRIDE;
     KAsync::Job<void> sendDeleteCommand(const QByteArray &uid, qint64 revision, const QByteArray &resourceBufferType) Q_DECL_OVERRIDE;
     KAsync::Job<void> sendRevisionReplayedCommand(qint64 revision) Q_DECL_OVERRIDE;
+    KAsync::Job<void> sendRevisionPinCommand(const QByteArray &pin, qint64 revision) Q_DECL_OVERRIDE;
     KAsync::Job<void>
     sendInspectionCommand(int inspectionType,const QByteArray &inspectionId, const QByteArray &domainType, const QByteArray &entityId, const QByteArray &property, const QVariant &expecedValue) Q_DECL_OVERRIDE;
     KAsync::Job<void> sendFlushCommand(int flushType, const QByteArray &flushId) Q_DECL_OVERRIDE;
@@ -24,6 +24,7 @@
 #include <memory>
 #include <QMutexLocker>
 #include <QPointer>
+#include <QString>
 
 namespace Sink {
 
@@ -49,6 +50,7 @@ public:
     virtual void modify(const T &value) = 0;
     virtual void remove(const T &value) = 0;
     virtual void initialResultSetComplete(const T &parent, bool) = 0;
+    virtual void error(const QString &message) = 0;
     virtual void complete() = 0;
     virtual void clear() = 0;
     virtual void setFetcher(const std::function<void(const T &parent)> &fetcher) = 0;
@@ -109,6 +111,13 @@ public:
         }
     }
 
+    void error(const QString &message)
+    {
+        if (auto strongRef = mResultEmitter.toStrongRef()) {
+            strongRef->error(message);
+        }
+    }
+
     // Called from worker thread
     void complete()
     {
@@ -227,6 +236,11 @@ public:
         initialResultSetCompleteHandler = handler;
     }
 
+    void onError(const std::function<void(const QString &)> &handler)
+    {
+        errorHandler = handler;
+    }
+
     void onComplete(const std::function<void(void)> &handler)
     {
         completeHandler = handler;
@@ -275,6 +289,14 @@ public:
         }
     }
 
+    void error(const QString &message)
+    {
+        //This callback is only ever called from the main thread, so we don't do any locking
+        if (errorHandler && guardOk()) {
+            errorHandler(message);
+        }
+    }
+
     void complete()
     {
         QMutexLocker locker{&mMutex};
@@ -310,6 +332,7 @@ private:
     std::function<void(const DomainType &)> modifyHandler;
     std::function<void(const DomainType &)> removeHandler;
     std::function<void(const DomainType &, bool)> initialResultSetCompleteHandler;
+    std::function<void(const QString &)> errorHandler;
     std::function<void(void)> completeHandler;
     std::function<void(void)> clearHandler;
 
@@ -358,6 +381,7 @@ public:
             mInitialResultSetInProgress.remove(hashValue, ptr);
             callInitialResultCompleteIfDone(parent);
         });
+        emitter->onError([this](const QString &message) { this->error(message); });
         emitter->onComplete([this]() { this->complete(); });
         emitter->onClear([this]() { this->clear(); });
         mEmitter << emitter;
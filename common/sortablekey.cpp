@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2017 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sortablekey.h"
+
+#include <QtEndian>
+
+using namespace Sink;
+
+static QByteArray invert(QByteArray key)
+{
+    //Inverting all bits reverses the order
+    for (auto &c : key) {
+        c = ~c;
+    }
+    return key;
+}
+
+QByteArray SortableKey::fromNumber(qint64 value)
+{
+    const auto encoded = qToBigEndian(static_cast<quint64>(value) ^ (quint64(1) << 63));
+    return QByteArray{reinterpret_cast<const char *>(&encoded), sizeof(encoded)};
+}
+
+qint64 SortableKey::toNumber(const QByteArray &key)
+{
+    Q_ASSERT(key.size() >= size);
+    return static_cast<qint64>(qFromBigEndian<quint64>(reinterpret_cast<const uchar *>(key.constData())) ^ (quint64(1) << 63));
+}
+
+QByteArray SortableKey::fromDate(const QDateTime &date)
+{
+    return fromNumber(date.isValid() ? date.toMSecsSinceEpoch() : invalidDate);
+}
+
+QByteArray SortableKey::fromDateNewestFirst(const QDateTime &date)
+{
+    return invert(fromDate(date));
+}
+
+QDateTime SortableKey::toDateNewestFirst(const QByteArray &key)
+{
+    const auto value = toNumber(invert(key.left(size)));
+    if (value == invalidDate) {
+        return {};
+    }
+    return QDateTime::fromMSecsSinceEpoch(value);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017 Christian Mollekopf <chrigi_1@fastmail.fm>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "sink_export.h"
+#include <QByteArray>
+#include <QDateTime>
+#include <limits>
+
+namespace Sink {
+
+/**
+ * Fixed width binary keys whose bytewise order matches the order of the encoded values.
+ *
+ * Numbers are encoded as 8 bytes in big-endian order with the sign bit flipped,
+ * which covers the whole qint64 range including negative values such as dates before the epoch.
+ */
+namespace SortableKey {
+
+static const int size = 8;
+
+/**
+ * The value of invalid dates, which is also the default of the date properties in the entity buffers.
+ */
+static const qint64 invalidDate = std::numeric_limits<qint64>::min() + 1;
+
+QByteArray SINK_EXPORT fromNumber(qint64 value);
+qint64 SINK_EXPORT toNumber(const QByteArray &key);
+
+/**
+ * Sorts the oldest date first and invalid dates before all valid ones.
+ */
+QByteArray SINK_EXPORT fromDate(const QDateTime &date);
+
+/**
+ * Sorts the newest date first and invalid dates after all valid ones.
+ */
+QByteArray SINK_EXPORT fromDateNewestFirst(const QDateTime &date);
+QDateTime SINK_EXPORT toDateNewestFirst(const QByteArray &key);
+
+}
+}
@@ -42,6 +42,8 @@ namespace StandardQueries {
 
     /**
      * Returns thread leaders only, sorted by date.
+     *
+     * The number of mails, unread and important mails of each thread are available as "count", "unreadCount" and "importantCount".
      */
     static Query threadLeaders(const ApplicationDomain::Folder &folder)
     {
@@ -54,8 +56,8 @@ namespace StandardQueries {
         query.sort<ApplicationDomain::Mail::Date>();
         query.reduce<ApplicationDomain::Mail::ThreadId>(Query::Reduce::Selector::max<ApplicationDomain::Mail::Date>())
             .count("count")
-            .collect<ApplicationDomain::Mail::Unread>("unreadCollected")
-            .collect<ApplicationDomain::Mail::Important>("importantCollected");
+            .countTrue<ApplicationDomain::Mail::Unread>("unreadCount")
+            .countTrue<ApplicationDomain::Mail::Important>("importantCount");
         return query;
     }
 
@@ -26,6 +26,8 @@
 #include <functional>
 #include <QString>
 #include <QMap>
+#include <QVector>
+#include <QPair>
 
 namespace Sink {
 namespace Storage {
@@ -78,6 +80,14 @@ public:
          */
         bool write(const QByteArray &key, const QByteArray &value, const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>());
 
+        /**
+         * Write a value behind all existing values, without searching for its position.
+         *
+         * The key has to be greater than the last key, or equal to it with a greater value if duplicates are allowed.
+         * Otherwise the write fails. This is used to load sorted entries into an empty database.
+         */
+        bool append(const QByteArray &key, const QByteArray &value, const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>());
+
         /**
          * Remove a key
          */
@@ -87,6 +97,11 @@ public:
          */
         void remove(const QByteArray &key, const QByteArray &value, const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>());
 
+        /**
+         * Remove all keys
+         */
+        void clear(const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>());
+
         /**
         * Read values with a given key.
         *
@@ -108,11 +123,60 @@ public:
         void findLatest(const QByteArray &uid, const std::function<void(const QByteArray &key, const QByteArray &value)> &resultHandler,
             const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>()) const;
 
+        /**
+         * Finds the last value in a series matched by prefix, with a key smaller or equal to @param upperBound.
+         *
+         * This is used to find the revision of an entity that was current at a given revision,
+         * by seeking directly to $uid$revision instead of scanning all revisions.
+         */
+        void findLatestUntil(const QByteArray &uid, const QByteArray &upperBound, const std::function<void(const QByteArray &key, const QByteArray &value)> &resultHandler,
+            const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>()) const;
+
+        /**
+         * Batched findLatestUntil for a list of (uid, upperBound) pairs.
+         *
+         * The lookups share a single cursor and are done in key order, which is also the order @param resultHandler is called in,
+         * with the position of the pair in @param uidsAndUpperBounds. Uids without a value are skipped.
+         */
+        void findLatestUntil(const QVector<QPair<QByteArray, QByteArray>> &uidsAndUpperBounds, const std::function<void(int index, const QByteArray &key, const QByteArray &value)> &resultHandler,
+            const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>()) const;
+
+        /**
+         * Read all values with a key in the range [@param lowerBound, @param upperBound).
+         *
+         * * An empty @param lowerBound starts at the first key, an empty @param upperBound ends at the last key.
+         * * Keys are compared bytewise, so only sortable encodings result in meaningful ranges.
+         *
+         * @return The number of values retrieved.
+         */
+        int findAllInRange(const QByteArray &lowerBound, const QByteArray &upperBound, const std::function<void(const QByteArray &key, const QByteArray &value)> &resultHandler,
+            const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>()) const;
+
+        /**
+         * Read all values with a key greater or equal to @param lowerBound, for as long as @param resultHandler returns true.
+         *
+         * @return The number of values retrieved.
+         */
+        int scanFrom(const QByteArray &lowerBound, const std::function<bool(const QByteArray &key, const QByteArray &value)> &resultHandler,
+            const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>()) const;
+
+        /**
+         * Returns the number of values with a key in the range [@param lowerBound, @param upperBound), without reading them.
+         *
+         * Duplicates are counted per key, so this only iterates over the distinct keys.
+         */
+        qint64 count(const QByteArray &lowerBound, const QByteArray &upperBound, const std::function<void(const DataStore::Error &error)> &errorHandler = std::function<void(const DataStore::Error &error)>()) const;
+
         /**
          * Returns true if the database contains the substring key.
          */
         bool contains(const QByteArray &uid);
 
+        /**
+         * Returns true if the database contains exactly @param key with @param value, without reading the other values of the key.
+         */
+        bool contains(const QByteArray &key, const QByteArray &value) const;
+
         NamedDatabase(NamedDatabase &&other);
         NamedDatabase &operator=(NamedDatabase &&other);
 
@@ -123,6 +187,11 @@ public:
 
         qint64 getSize();
 
+        /**
+         * Returns the number of entries including all duplicates.
+         */
+        qint64 entryCount() const;
+
     private:
         friend Transaction;
         NamedDatabase(NamedDatabase &other);
@@ -142,6 +211,12 @@ public:
 
         QList<QByteArray> getDatabaseNames() const;
 
+        /**
+         * The name of the store the transaction belongs to.
+         */
+        QString storeName() const;
+        bool isReadOnly() const;
+
         NamedDatabase openDatabase(const QByteArray &name = {"default"},
             const std::function<void(const DataStore::Error &error)> &errorHandler = {}, bool allowDuplicates = false) const;
 
@@ -201,6 +276,10 @@ public:
     static void recordUid(DataStore::Transaction &transaction, const QByteArray &uid);
     static void removeUid(DataStore::Transaction &transaction, const QByteArray &uid);
     static void getUids(const Transaction &, const std::function<void(const QByteArray &uid)> &);
+    /**
+     * The number of uids in the store, of all types.
+     */
+    static qint64 uidCount(const Transaction &);
 
     bool exists() const;
 
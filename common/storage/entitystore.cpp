@@ -21,6 +21,7 @@
 
 #include <QDir>
 #include <QFile>
+#include <algorithm>
 
 #include "entitybuffer.h"
 #include "log.h"
@@ -32,6 +33,10 @@
 #include "entity_generated.h"
 #include "applicationdomaintype_p.h"
 #include "typeimplementations.h"
+#include "bufferadaptor.h"
+#include "bloomfilter.h"
+#include "mail/threadsummary.h"
+#include "mail/foldercounts.h"
 
 using namespace Sink;
 using namespace Sink::Storage;
@@ -42,7 +47,10 @@ static QMap<QByteArray, int> baseDbs()
             {"revisions", 0},
             {"uids", 0},
             {"default", 0},
-            {"__flagtable", 0}};
+            {"__flagtable", 0},
+            {"index.stats", 0},
+            {"index.definitions", 0},
+            {"bloomfilters", 0}};
 }
 
 template <typename T, typename First>
@@ -91,6 +99,43 @@ static Sink::Storage::DbLayout dbLayout(const QByteArray &instanceId)
     return {instanceId, databases};
 }
 
+/*
+ * Reconstructs a modification that has been stored as a delta on top of its base revision.
+ */
+class DeltaBufferAdaptor : public ApplicationDomain::BufferAdaptor
+{
+public:
+    DeltaBufferAdaptor(const QSharedPointer<ApplicationDomain::BufferAdaptor> &base, const QSharedPointer<ApplicationDomain::BufferAdaptor> &delta, const QSet<QByteArray> &deltaProperties)
+        : mBase(base), mDelta(delta), mDeltaProperties(deltaProperties)
+    {
+    }
+
+    virtual QVariant getProperty(const QByteArray &key) const Q_DECL_OVERRIDE
+    {
+        if (mDeltaProperties.contains(key)) {
+            return mDelta->getProperty(key);
+        }
+        return mBase->getProperty(key);
+    }
+
+    virtual QList<QByteArray> availableProperties() const Q_DECL_OVERRIDE
+    {
+        //A property may only have been set since the base revision
+        auto properties = mBase->availableProperties();
+        for (const auto &property : mDeltaProperties) {
+            if (!properties.contains(property)) {
+                properties << property;
+            }
+        }
+        return properties;
+    }
+
+private:
+    QSharedPointer<ApplicationDomain::BufferAdaptor> mBase;
+    QSharedPointer<ApplicationDomain::BufferAdaptor> mDelta;
+    QSet<QByteArray> mDeltaProperties;
+};
+
 
 class EntityStore::Private {
 public:
@@ -110,6 +155,12 @@ public:
     DataStore::Transaction transaction;
     QHash<QByteArray, QSharedPointer<TypeIndex> > indexByType;
     Sink::Log::Context logCtx;
+    bool keepHistory = true;
+    bool indexDefinitionsUpdated = false;
+    //Blobs of replaced revisions, which are removed once the transaction has been committed
+    QSet<QString> replacedBlobs;
+    //The uid filters refer to the transaction, so they are only kept until it ends
+    QHash<QByteArray, QSharedPointer<PersistentBloomFilter>> uidFilters;
 
     bool exists()
     {
@@ -127,6 +178,34 @@ public:
         return transaction;
     }
 
+    /*
+     * A bloom filter over the uids in the main database of @param type.
+     *
+     * Most lookups of uids that have just been generated for a new remote entity miss, which the filter answers without touching the main database.
+     * The filter is opened once per type and transaction, and sized from the number of uids rather than the number of revisions.
+     */
+    PersistentBloomFilter &uidFilter(const QByteArray &type)
+    {
+        auto &filter = uidFilters[type];
+        if (!filter) {
+            auto &t = getTransaction();
+            auto keySource = [&t, type](const std::function<void(const QByteArray &key)> &callback) {
+                QByteArray lastUid;
+                DataStore::mainDatabase(t, type).scan({}, [&](const QByteArray &key, const QByteArray &) {
+                        const auto uid = DataStore::uidFromKey(key);
+                        if (uid != lastUid) {
+                            callback(uid);
+                            lastUid = uid;
+                        }
+                        return true;
+                    },
+                    [](const DataStore::Error &) {});
+            };
+            filter = QSharedPointer<PersistentBloomFilter>::create(type + ".main", t, keySource, DataStore::uidCount(t));
+        }
+        return *filter;
+    }
+
     template <class T>
     struct ConfigureHelper {
         void operator()(TypeIndex &arg) const {
@@ -141,11 +220,39 @@ public:
         }
         auto index = QSharedPointer<TypeIndex>::create(type, logCtx);
         TypeHelper<ConfigureHelper>{type}.template operator()<void>(*index);
+        index->setProjector([this, type](const ApplicationDomain::ApplicationDomainType &entity, const QByteArrayList &properties, qint64 revision) {
+            return createProjection(type, entity, properties, revision);
+        });
         indexByType.insert(type, index);
         return *index;
 
     }
 
+    /*
+     * A projection is an entity buffer that only contains @param properties, so it can be read like an entity from the main database.
+     */
+    QByteArray createProjection(const QByteArray &type, const ApplicationDomain::ApplicationDomainType &entity, const QByteArrayList &properties, qint64 revision)
+    {
+        ApplicationDomain::ApplicationDomainType projection{resourceContext.instanceId(), entity.identifier(), revision, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+        for (const auto &property : properties) {
+            const auto value = entity.getProperty(property);
+            if (value.isValid()) {
+                projection.setProperty(property, value);
+            }
+        }
+
+        flatbuffers::FlatBufferBuilder metadataFbb;
+        auto metadataBuilder = MetadataBuilder(metadataFbb);
+        metadataBuilder.add_revision(revision);
+        metadataBuilder.add_operation(Operation_Creation);
+        auto metadataBuffer = metadataBuilder.Finish();
+        FinishMetadataBuffer(metadataFbb, metadataBuffer);
+
+        flatbuffers::FlatBufferBuilder fbb;
+        resourceContext.adaptorFactory(type).createBuffer(projection, fbb, metadataFbb.GetBufferPointer(), metadataFbb.GetSize());
+        return BufferUtils::extractBuffer(fbb);
+    }
+
     TypeIndex &typeIndex(const QByteArray &type)
     {
         auto &index = cachedIndex(type);
@@ -153,10 +260,57 @@ public:
         return index;
     }
 
+    QSharedPointer<ApplicationDomain::BufferAdaptor> createAdaptor(const QByteArray &type, const QByteArray &uid, const EntityBuffer &buffer)
+    {
+        auto adaptor = resourceContext.adaptorFactory(type).createAdaptor(buffer.entity(), &typeIndex(type), uid);
+        const auto metadata = buffer.entity().metadata() ? GetMetadata(buffer.entity().metadata()->Data()) : nullptr;
+        if (!metadata || !metadata->baseRevision()) {
+            return adaptor;
+        }
+        QSharedPointer<ApplicationDomain::BufferAdaptor> baseAdaptor;
+        DataStore::mainDatabase(getTransaction(), type)
+            .scan(DataStore::assembleKey(uid, metadata->baseRevision()),
+                [&](const QByteArray &, const QByteArray &value) -> bool {
+                    EntityBuffer baseBuffer(value.data(), value.size());
+                    if (baseBuffer.isValid()) {
+                        baseAdaptor = resourceContext.adaptorFactory(type).createAdaptor(baseBuffer.entity(), &typeIndex(type), uid);
+                    }
+                    return false;
+                },
+                [&](const DataStore::Error &error) { SinkWarningCtx(logCtx) << "Failed to read the base revision: " << error.message << uid << metadata->baseRevision(); });
+        if (!baseAdaptor) {
+            return adaptor;
+        }
+        const auto deltaProperties = metadata->deltaProperties() ? BufferUtils::fromVector(*metadata->deltaProperties()).toSet() : QSet<QByteArray>{};
+        return QSharedPointer<DeltaBufferAdaptor>::create(baseAdaptor, adaptor, deltaProperties);
+    }
+
     ApplicationDomain::ApplicationDomainType createApplicationDomainType(const QByteArray &type, const QByteArray &uid, qint64 revision, const EntityBuffer &buffer)
     {
-        auto adaptor = resourceContext.adaptorFactory(type).createAdaptor(buffer.entity(), &typeIndex(type));
-        return ApplicationDomain::ApplicationDomainType{resourceContext.instanceId(), uid, revision, adaptor};
+        return ApplicationDomain::ApplicationDomainType{resourceContext.instanceId(), uid, revision, createAdaptor(type, uid, buffer)};
+    }
+
+    /*
+     * Returns the revision a delta has been written against, or 0 if the revision contains the full entity.
+     */
+    qint64 baseRevision(const QByteArray &type, const QByteArray &key, QSet<QByteArray> *deltaProperties = nullptr)
+    {
+        qint64 base = 0;
+        DataStore::mainDatabase(transaction, type)
+            .scan(key,
+                [&](const QByteArray &, const QByteArray &value) -> bool {
+                    EntityBuffer buffer(value.data(), value.size());
+                    if (buffer.isValid()) {
+                        const auto metadata = GetMetadata(buffer.entity().metadata()->Data());
+                        base = metadata->baseRevision();
+                        if (base && deltaProperties && metadata->deltaProperties()) {
+                            *deltaProperties = BufferUtils::fromVector(*metadata->deltaProperties()).toSet();
+                        }
+                    }
+                    return false;
+                },
+                [&](const DataStore::Error &error) { SinkWarningCtx(logCtx) << "Failed to read revision: " << error.message << key; });
+        return base;
     }
 
     QString entityBlobStorageDir()
@@ -169,6 +323,100 @@ public:
         return entityBlobStorageDir() +"/"+ id;
     }
 
+    /*
+     * Removes the current revision of an entity, so it can be replaced by a new one.
+     *
+     * The revision is also removed from the revision log, which results in a gap that readers skip over.
+     * A revision that still has to be replayed to the source is kept instead, and removed by the cleanup once it has been replayed.
+     *
+     * @return The blobs that only the removed revision referred to.
+     */
+    QSet<QString> removeCurrentRevision(const QByteArray &type, const QByteArray &uid)
+    {
+        QByteArray currentKey;
+        bool replayToSource = false;
+        DataStore::mainDatabase(transaction, type)
+            .findLatest(uid,
+                [&](const QByteArray &key, const QByteArray &data) {
+                    currentKey = key;
+                    EntityBuffer buffer(const_cast<const char *>(data.data()), data.size());
+                    replayToSource = buffer.isValid() && flatbuffers::GetRoot<Metadata>(buffer.metadataBuffer())->replayToSource();
+                },
+                [&](const DataStore::Error &error) { SinkWarningCtx(logCtx) << "Failed to find the current revision: " << error.message << uid; });
+        if (currentKey.isEmpty()) {
+            return {};
+        }
+        //Revisions up to the cleaned up revision have been replayed already
+        if (replayToSource && DataStore::revisionFromKey(currentKey) > DataStore::cleanedUpRevision(transaction)) {
+            SinkTraceCtx(logCtx) << "Keeping the revision until it has been replayed: " << currentKey;
+            return {};
+        }
+        const auto blobs = unreferencedBlobs(type, uid, currentKey);
+        DataStore::mainDatabase(transaction, type).remove(currentKey);
+        DataStore::removeRevision(transaction, DataStore::revisionFromKey(currentKey));
+        return blobs;
+    }
+
+    /*
+     * The blobs of the revision @param key that no other revision of the entity refers to.
+     */
+    QSet<QString> unreferencedBlobs(const QByteArray &type, const QByteArray &uid, const QByteArray &key)
+    {
+        QSet<QString> blobs;
+        QSet<QString> referencedBlobs;
+        DataStore::mainDatabase(transaction, type)
+            .scan(uid,
+                [&](const QByteArray &foundKey, const QByteArray &data) -> bool {
+                    EntityBuffer buffer(const_cast<const char *>(data.data()), data.size());
+                    if (buffer.isValid()) {
+                        //Deltas refer to the blobs of their base as well
+                        const auto paths = blobPaths(createApplicationDomainType(type, uid, buffer.revision(), buffer));
+                        if (foundKey == key) {
+                            blobs = paths;
+                        } else {
+                            referencedBlobs += paths;
+                        }
+                    }
+                    return true;
+                },
+                [&](const DataStore::Error &error) { SinkWarningCtx(logCtx) << "Error while reading: " << error.message; }, true);
+        return blobs - referencedBlobs;
+    }
+
+    /*
+     * The blobs a revision refers to.
+     *
+     * Deltas only refer to the blobs that changed since their base.
+     */
+    QSet<QString> blobPaths(const QByteArray &type, const QByteArray &uid, const EntityBuffer &buffer)
+    {
+        return blobPaths(ApplicationDomain::ApplicationDomainType{resourceContext.instanceId(), uid, buffer.revision(), resourceContext.adaptorFactory(type).createAdaptor(buffer.entity())});
+    }
+
+    QSet<QString> blobPaths(const ApplicationDomain::ApplicationDomainType &entity)
+    {
+        QSet<QString> paths;
+        for (const auto &property : entity.availableProperties()) {
+            const auto value = entity.getProperty(property);
+            if (value.canConvert<ApplicationDomain::BLOB>()) {
+                const auto path = value.value<ApplicationDomain::BLOB>().value;
+                if (!path.isEmpty()) {
+                    paths << path;
+                }
+            }
+        }
+        return paths;
+    }
+
+    void removeBlobs(const QByteArray &uid)
+    {
+        QDir dir{entityBlobStorageDir()};
+        const auto infoList = dir.entryInfoList(QStringList{} << QString{uid + "*"});
+        for (const auto &fileInfo : infoList) {
+            QFile::remove(fileInfo.filePath());
+        }
+    }
+
 };
 
 EntityStore::EntityStore(const ResourceContext &context, const Log::Context &ctx)
@@ -177,27 +425,70 @@ EntityStore::EntityStore(const ResourceContext &context, const Log::Context &ctx
 
 }
 
+void EntityStore::setKeepHistory(bool keepHistory)
+{
+    d->keepHistory = keepHistory;
+}
+
+bool EntityStore::keepHistory() const
+{
+    return d->keepHistory;
+}
+
 void EntityStore::startTransaction(Sink::Storage::DataStore::AccessMode accessMode)
 {
     SinkTraceCtx(d->logCtx) << "Starting transaction: " << accessMode;
     Q_ASSERT(!d->transaction);
+    d->uidFilters.clear();
     Sink::Storage::DataStore store(Sink::storageLocation(), dbLayout(d->resourceContext.instanceId()), accessMode);
     d->transaction = store.createTransaction(accessMode);
+    if (accessMode == DataStore::ReadWrite && !d->indexDefinitionsUpdated) {
+        updateIndexDefinitions();
+    }
+    //The initial sync of a resource writes all entities at once
+    if (accessMode == DataStore::ReadWrite && !DataStore::maxRevision(d->transaction)) {
+        startBulkLoad();
+    }
+}
+
+void EntityStore::startBulkLoad()
+{
+    Q_ASSERT(d->transaction);
+    SinkTraceCtx(d->logCtx) << "Starting bulk load";
+    for (const auto &type : d->resourceContext.adaptorFactories.keys()) {
+        d->typeIndex(type).startBulkLoad();
+    }
 }
 
 void EntityStore::commitTransaction()
 {
     SinkTraceCtx(d->logCtx) << "Committing transaction";
     Q_ASSERT(d->transaction);
-    d->transaction.commit();
+    for (const auto &index : d->indexByType) {
+        index->endBulkLoad(d->transaction);
+    }
+    d->uidFilters.clear();
+    const auto committed = d->transaction.commit();
     d->transaction = Storage::DataStore::Transaction();
+    if (committed) {
+        for (const auto &path : d->replacedBlobs) {
+            SinkTraceCtx(d->logCtx) << "Removing replaced blob: " << path;
+            QFile::remove(path);
+        }
+    }
+    d->replacedBlobs.clear();
 }
 
 void EntityStore::abortTransaction()
 {
     SinkTraceCtx(d->logCtx) << "Aborting transaction";
+    for (const auto &index : d->indexByType) {
+        index->abortBulkLoad();
+    }
+    d->uidFilters.clear();
     d->transaction.abort();
     d->transaction = Storage::DataStore::Transaction();
+    d->replacedBlobs.clear();
 }
 
 bool EntityStore::hasTransaction() const
@@ -268,6 +559,8 @@ bool EntityStore::add(const QByteArray &type, ApplicationDomain::ApplicationDoma
     DataStore::setMaxRevision(d->transaction, newRevision);
     DataStore::recordRevision(d->transaction, newRevision, entity.identifier(), type);
     DataStore::recordUid(d->transaction, entity.identifier());
+    d->uidFilter(type).add(entity.identifier());
+    d->typeIndex(type).addToCoveringIndexes(entity.identifier(), entity, newRevision, d->transaction);
     SinkTraceCtx(d->logCtx) << "Wrote entity: " << entity.identifier() << type << newRevision;
     return true;
 }
@@ -312,29 +605,72 @@ bool EntityStore::modify(const QByteArray &type, const ApplicationDomain::Applic
 {
     SinkTraceCtx(d->logCtx) << "Modified entity: " << newEntity;
 
-    d->typeIndex(type).remove(current.identifier(), current, d->transaction);
-    d->typeIndex(type).add(newEntity.identifier(), newEntity, d->transaction);
+    d->typeIndex(type).modify(newEntity.identifier(), current, newEntity, d->transaction);
 
     const qint64 newRevision = DataStore::maxRevision(d->transaction) + 1;
 
     copyBlobs(newEntity, newRevision);
 
+    if (!d->keepHistory) {
+        //Blobs that have been replaced are only removed once the transaction is committed, the new revision may still be rolled back.
+        d->replacedBlobs += d->removeCurrentRevision(type, newEntity.identifier()) - d->blobPaths(newEntity);
+    }
+
+    //If only a few properties changed since the last full revision we only store those, on top of the full revision.
+    qint64 baseRevision = 0;
+    QSet<QByteArray> deltaProperties;
+    if (d->keepHistory) {
+        QByteArray currentKey;
+        DataStore::mainDatabase(d->transaction, type)
+            .findLatest(newEntity.identifier(),
+                [&](const QByteArray &key, const QByteArray &data) {
+                    EntityBuffer buffer(data.data(), data.size());
+                    if (buffer.isValid() && buffer.operation() != Operation_Removal) {
+                        currentKey = key;
+                    }
+                },
+                [&](const DataStore::Error &error) { SinkWarningCtx(d->logCtx) << "Failed to read current revision: " << error.message << newEntity.identifier(); });
+        if (!currentKey.isEmpty()) {
+            //Deltas are cumulative, so we keep building on the same base.
+            baseRevision = d->baseRevision(type, currentKey, &deltaProperties);
+            if (!baseRevision) {
+                baseRevision = DataStore::revisionFromKey(currentKey);
+            }
+            deltaProperties += newEntity.changedProperties();
+            //Once the delta becomes too large we start over with a new full revision.
+            if (deltaProperties.size() * 2 >= newEntity.availableProperties().size()) {
+                baseRevision = 0;
+                deltaProperties.clear();
+            }
+        }
+    }
+
     // Add metadata buffer
     flatbuffers::FlatBufferBuilder metadataFbb;
     {
         //We add availableProperties to account for the properties that have been changed by the preprocessors
         auto modifiedProperties = BufferUtils::toVector(metadataFbb, newEntity.changedProperties());
+        auto deltaPropertiesBuffer = BufferUtils::toVector(metadataFbb, deltaProperties);
         auto metadataBuilder = MetadataBuilder(metadataFbb);
         metadataBuilder.add_revision(newRevision);
         metadataBuilder.add_operation(Operation_Modification);
         metadataBuilder.add_replayToSource(replayToSource);
         metadataBuilder.add_modifiedProperties(modifiedProperties);
+        if (baseRevision) {
+            metadataBuilder.add_baseRevision(baseRevision);
+            metadataBuilder.add_deltaProperties(deltaPropertiesBuffer);
+        }
         auto metadataBuffer = metadataBuilder.Finish();
         FinishMetadataBuffer(metadataFbb, metadataBuffer);
     }
     SinkTraceCtx(d->logCtx) << "Changed properties: " << newEntity.changedProperties();
 
-    newEntity.setChangedProperties(newEntity.availableProperties().toSet());
+    if (baseRevision) {
+        SinkTraceCtx(d->logCtx) << "Writing delta against revision " << baseRevision << deltaProperties;
+        newEntity.setChangedProperties(deltaProperties);
+    } else {
+        newEntity.setChangedProperties(newEntity.availableProperties().toSet());
+    }
 
     flatbuffers::FlatBufferBuilder fbb;
     d->resourceContext.adaptorFactory(type).createBuffer(newEntity, fbb, metadataFbb.GetBufferPointer(), metadataFbb.GetSize());
@@ -344,6 +680,7 @@ bool EntityStore::modify(const QByteArray &type, const ApplicationDomain::Applic
             [&](const DataStore::Error &error) { SinkWarningCtx(d->logCtx) << "Failed to write entity" << newEntity.identifier() << newRevision; });
     DataStore::setMaxRevision(d->transaction, newRevision);
     DataStore::recordRevision(d->transaction, newRevision, newEntity.identifier(), type);
+    d->typeIndex(type).addToCoveringIndexes(newEntity.identifier(), newEntity, newRevision, d->transaction);
     SinkTraceCtx(d->logCtx) << "Wrote modified entity: " << newEntity.identifier() << type << newRevision;
     return true;
 }
@@ -357,11 +694,17 @@ bool EntityStore::remove(const QByteArray &type, const Sink::ApplicationDomain::
     }
 
     d->typeIndex(type).remove(current.identifier(), current, d->transaction);
+    d->typeIndex(type).removeFulltextIndex(current.identifier(), d->transaction);
 
     SinkTraceCtx(d->logCtx) << "Removed entity " << current;
 
     const qint64 newRevision = DataStore::maxRevision(d->transaction) + 1;
 
+    //The removal is kept until all clients caught up, so they are notified about it.
+    if (!d->keepHistory) {
+        d->removeCurrentRevision(type, uid);
+    }
+
     // Add metadata buffer
     flatbuffers::FlatBufferBuilder metadataFbb;
     auto metadataBuilder = MetadataBuilder(metadataFbb);
@@ -388,11 +731,49 @@ void EntityStore::cleanupEntityRevisionsUntil(qint64 revision)
     const auto uid = DataStore::getUidFromRevision(d->transaction, revision);
     const auto bufferType = DataStore::getTypeFromRevision(d->transaction, revision);
     if (bufferType.isEmpty() || uid.isEmpty()) {
+        if (!d->keepHistory) {
+            //The revision has been superseded already
+            DataStore::setCleanedUpRevision(d->transaction, revision);
+            return;
+        }
         SinkErrorCtx(d->logCtx) << "Failed to find revision during cleanup: " << revision;
         Q_ASSERT(false);
         return;
     }
     SinkTraceCtx(d->logCtx) << "Cleaning up revision " << revision << uid << bufferType;
+    if (!d->keepHistory) {
+        //There are no older revisions, so we only have to purge removals and truncate the revision log.
+        //Revisions that are not the latest have been kept until they were replayed, or are left over from when history was still kept.
+        const auto key = DataStore::assembleKey(uid, revision);
+        bool isRemoval = false;
+        QByteArray latestKey;
+        DataStore::mainDatabase(d->transaction, bufferType)
+            .findLatest(uid,
+                [&](const QByteArray &foundKey, const QByteArray &data) {
+                    EntityBuffer buffer(const_cast<const char *>(data.data()), data.size());
+                    isRemoval = buffer.isValid() && buffer.operation() == Operation_Removal;
+                    latestKey = foundKey;
+                },
+                [&](const DataStore::Error &error) { SinkWarningCtx(d->logCtx) << "Error while reading: " << error.message; });
+        if (latestKey != key) {
+            const auto replacedBlobs = d->unreferencedBlobs(bufferType, uid, key);
+            DataStore::mainDatabase(d->transaction, bufferType).remove(key, [](const DataStore::Error &) {});
+            for (const auto &path : replacedBlobs) {
+                SinkTraceCtx(d->logCtx) << "Removing replaced blob: " << path;
+                QFile::remove(path);
+            }
+        } else if (isRemoval) {
+            DataStore::mainDatabase(d->transaction, bufferType).remove(key);
+            d->removeBlobs(uid);
+        }
+        DataStore::removeRevision(d->transaction, revision);
+        DataStore::setCleanedUpRevision(d->transaction, revision);
+        return;
+    }
+    const auto baseRevision = d->baseRevision(bufferType, DataStore::assembleKey(uid, revision));
+    //Blobs that have been replaced are only removed once no remaining revision refers to them anymore
+    QSet<QString> replacedBlobs;
+    bool removed = false;
     DataStore::mainDatabase(d->transaction, bufferType)
         .scan(uid,
             [&](const QByteArray &key, const QByteArray &data) -> bool {
@@ -403,17 +784,18 @@ void EntityStore::cleanupEntityRevisionsUntil(qint64 revision)
                     const auto metadata = flatbuffers::GetRoot<Metadata>(buffer.metadataBuffer());
                     const qint64 rev = metadata->revision();
                     const auto isRemoval = metadata->operation() == Operation_Removal;
-                    // Remove old revisions, and the current if the entity has already been removed
-                    if (rev < revision || isRemoval) {
+                    // Remove old revisions, and the current if the entity has already been removed.
+                    // The base of the remaining delta is kept until it is superseded by a new full revision.
+                    if (rev < revision && !isRemoval) {
+                        replacedBlobs += d->blobPaths(bufferType, uid, buffer);
+                    }
+                    if ((rev < revision && rev != baseRevision) || isRemoval) {
                         DataStore::removeRevision(d->transaction, rev);
                         DataStore::mainDatabase(d->transaction, bufferType).remove(key);
                     }
                     if (isRemoval) {
-                        QDir dir{d->entityBlobStorageDir()};
-                        const auto infoList = dir.entryInfoList(QStringList{} << QString{uid + "*"});
-                        for (const auto &fileInfo : infoList) {
-                            QFile::remove(fileInfo.filePath());
-                        }
+                        d->removeBlobs(uid);
+                        removed = true;
                     }
                     //Don't cleanup more than specified
                     if (rev >= revision) {
@@ -424,6 +806,23 @@ void EntityStore::cleanupEntityRevisionsUntil(qint64 revision)
                 return true;
             },
             [&](const DataStore::Error &error) { SinkWarningCtx(d->logCtx) << "Error while reading: " << error.message; }, true);
+    if (!removed && !replacedBlobs.isEmpty()) {
+        //The remaining revisions may still refer to a blob, also through the base of a delta
+        DataStore::mainDatabase(d->transaction, bufferType)
+            .scan(uid,
+                [&](const QByteArray &, const QByteArray &data) -> bool {
+                    EntityBuffer buffer(const_cast<const char *>(data.data()), data.size());
+                    if (buffer.isValid() && buffer.revision() >= revision) {
+                        replacedBlobs -= d->blobPaths(d->createApplicationDomainType(bufferType, uid, buffer.revision(), buffer));
+                    }
+                    return true;
+                },
+                [&](const DataStore::Error &error) { SinkWarningCtx(d->logCtx) << "Error while reading: " << error.message; }, true);
+        for (const auto &path : replacedBlobs) {
+            SinkTraceCtx(d->logCtx) << "Removing replaced blob: " << path;
+            QFile::remove(path);
+        }
+    }
     DataStore::setCleanedUpRevision(d->transaction, revision);
 }
 
@@ -442,6 +841,7 @@ bool EntityStore::cleanupRevisions(qint64 revision)
         for (qint64 rev = firstRevisionToCleanup; rev <= revision; rev++) {
             cleanupEntityRevisionsUntil(rev);
         }
+        FolderCounts::cleanupChanges(revision, d->transaction);
     }
     if (implicitTransaction) {
         commitTransaction();
@@ -449,6 +849,164 @@ bool EntityStore::cleanupRevisions(qint64 revision)
     return cleanupIsNecessary;
 }
 
+void EntityStore::updateIndexDefinitions()
+{
+    Q_ASSERT(d->transaction);
+    d->indexDefinitionsUpdated = true;
+    for (const auto &type : d->resourceContext.adaptorFactories.keys()) {
+        const auto indexes = d->typeIndex(type).updateDefinitions(d->transaction);
+        if (!indexes.isEmpty()) {
+            SinkLogCtx(d->logCtx) << "Indexes to build: " << indexes;
+        }
+    }
+}
+
+bool EntityStore::buildIndexes(int batchSize)
+{
+    Q_ASSERT(d->transaction);
+    for (const auto &type : d->resourceContext.adaptorFactories.keys()) {
+        auto &index = d->typeIndex(type);
+        const auto indexes = index.incompleteIndexes(d->transaction);
+        if (indexes.isEmpty()) {
+            continue;
+        }
+        const auto name = indexes.first();
+        const auto lastUid = index.buildProgress(name, d->transaction);
+        QByteArrayList uids;
+        //All revisions of an entity are stored under the uid followed by the revision, so we continue after the last revision of the last uid.
+        DataStore::mainDatabase(d->transaction, type)
+            .scanFrom(lastUid.isEmpty() ? QByteArray{} : lastUid + ':',
+                [&](const QByteArray &key, const QByteArray &) -> bool {
+                    const auto uid = DataStore::uidFromKey(key);
+                    if (!uids.isEmpty() && uids.last() == uid) {
+                        return true;
+                    }
+                    if (uids.size() >= batchSize) {
+                        return false;
+                    }
+                    uids << uid;
+                    return true;
+                },
+                [&](const DataStore::Error &error) { SinkWarningCtx(d->logCtx) << "Error while reading: " << error.message; });
+        for (const auto &uid : uids) {
+            readLatest(type, uid, [&](const ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
+                if (operation != Sink::Operation_Removal) {
+                    index.buildIndex(name, uid, entity, d->transaction);
+                }
+            });
+        }
+        if (uids.size() < batchSize) {
+            index.finishBuild(name, d->transaction);
+        } else {
+            SinkTraceCtx(d->logCtx) << "Building index " << name << ", processed until: " << uids.last();
+            index.setBuildProgress(name, uids.last(), d->transaction);
+        }
+        return true;
+    }
+    return false;
+}
+
+QByteArrayList EntityStore::verifyIndexes(const std::function<void(const QByteArray &index, const QByteArray &key, const QByteArray &value, bool missing)> &callback)
+{
+    QByteArrayList brokenIndexes;
+    if (!d->exists()) {
+        return brokenIndexes;
+    }
+    auto &transaction = d->getTransaction();
+    for (const auto &type : d->resourceContext.adaptorFactories.keys()) {
+        auto &index = d->typeIndex(type);
+        QByteArrayList names;
+        for (const auto &name : index.indexDefinitions().keys()) {
+            if (index.customIndexer(name)) {
+                continue;
+            }
+            if (index.isReady(name, transaction)) {
+                names << name;
+            } else {
+                SinkLogCtx(d->logCtx) << "Not verifying index that is being built: " << name;
+            }
+        }
+
+        auto readAllEntities = [&](const std::function<void(const QByteArray &uid, const ApplicationDomain::ApplicationDomainType &entity)> &entityCallback) {
+            QByteArray lastUid;
+            DataStore::mainDatabase(transaction, type)
+                .scan({},
+                    [&](const QByteArray &key, const QByteArray &) -> bool {
+                        const auto uid = DataStore::uidFromKey(key);
+                        if (uid == lastUid) {
+                            return true;
+                        }
+                        lastUid = uid;
+                        readLatest(type, uid, [&](const ApplicationDomain::ApplicationDomainType &entity, Sink::Operation operation) {
+                            if (operation != Sink::Operation_Removal) {
+                                entityCallback(uid, entity);
+                            }
+                        });
+                        return true;
+                    },
+                    [&](const DataStore::Error &error) { SinkWarningCtx(d->logCtx) << "Error while reading: " << error.message; });
+        };
+
+        //A single pass over all entities looks up the expected entries of all indexes
+        QHash<QByteArray, qint64> foundEntries;
+        readAllEntities([&](const QByteArray &uid, const ApplicationDomain::ApplicationDomainType &entity) {
+            const auto expected = index.expectedEntries(uid, entity, transaction);
+            for (const auto &name : names) {
+                for (const auto &entry : expected.value(name)) {
+                    if (index.containsEntry(name, entry.first, entry.second, transaction)) {
+                        foundEntries[name]++;
+                    } else {
+                        callback(name, entry.first, entry.second, true);
+                        if (!brokenIndexes.contains(name)) {
+                            brokenIndexes << name;
+                        }
+                    }
+                }
+            }
+        });
+
+        //Every entry that doesn't belong to an entity is stale. Only then the entries are compared one by one to report them.
+        for (const auto &name : names) {
+            if (index.entryCount(name, transaction) == foundEntries.value(name)) {
+                continue;
+            }
+            QVector<QPair<QByteArray, QByteArray>> expected;
+            readAllEntities([&](const QByteArray &uid, const ApplicationDomain::ApplicationDomainType &entity) {
+                expected += index.expectedEntries(uid, entity, transaction, name).value(name);
+            });
+            std::sort(expected.begin(), expected.end());
+            index.readEntries(name, [&](const QByteArray &key, const QByteArray &value) {
+                if (!std::binary_search(expected.constBegin(), expected.constEnd(), qMakePair(key, value))) {
+                    callback(name, key, value, false);
+                }
+            }, transaction);
+            if (!brokenIndexes.contains(name)) {
+                brokenIndexes << name;
+            }
+        }
+    }
+    return brokenIndexes;
+}
+
+void EntityStore::rebuildIndexes(const QByteArrayList &names)
+{
+    Q_ASSERT(d->transaction);
+    for (const auto &type : d->resourceContext.adaptorFactories.keys()) {
+        auto &index = d->typeIndex(type);
+        const auto definitions = index.indexDefinitions();
+        for (const auto &name : names) {
+            if (definitions.contains(name)) {
+                index.scheduleRebuild(name, d->transaction);
+            }
+        }
+    }
+}
+
+void EntityStore::updateFulltextIndex(const QByteArray &type, const QByteArray &uid, const QString &content)
+{
+    d->typeIndex(type).updateFulltextIndex(uid, content, d->transaction);
+}
+
 QVector<QByteArray> EntityStore::fullScan(const QByteArray &type)
 {
     SinkTraceCtx(d->logCtx) << "Looking for : " << type;
@@ -484,6 +1042,15 @@ QVector<QByteArray> EntityStore::indexLookup(const QByteArray &type, const Query
     return d->typeIndex(type).query(query, appliedFilters, appliedSorting, d->getTransaction());
 }
 
+qint64 EntityStore::indexCount(const QByteArray &type, const QueryBase &query)
+{
+    if (!d->exists()) {
+        SinkTraceCtx(d->logCtx) << "Database is not existing: " << type;
+        return 0;
+    }
+    return d->typeIndex(type).count(query, d->getTransaction());
+}
+
 QVector<QByteArray> EntityStore::indexLookup(const QByteArray &type, const QByteArray &property, const QVariant &value)
 {
     if (!d->exists()) {
@@ -512,6 +1079,54 @@ void EntityStore::indexLookup(const QByteArray &type, const QByteArray &property
     /* }); */
 }
 
+bool EntityStore::coveringIndexLookup(const QByteArray &type, const QueryBase &query, const QByteArrayList &requestedProperties, QByteArray &index, QVector<QByteArray> &uids, QVector<QByteArray> &keys)
+{
+    if (!d->exists()) {
+        SinkTraceCtx(d->logCtx) << "Database is not existing: " << type;
+        return false;
+    }
+    return d->typeIndex(type).coveringQuery(query, requestedProperties, index, uids, keys, d->getTransaction());
+}
+
+void EntityStore::readProjection(const QByteArray &type, const QByteArray &index, const QByteArray &uid, const QByteArray &key, const std::function<void(const ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> callback)
+{
+    d->typeIndex(type).projection(index, key, [&](const QByteArray &projection) {
+            EntityBuffer buffer(projection.data(), projection.size());
+            if (!buffer.isValid()) {
+                SinkWarningCtx(d->logCtx) << "Read invalid projection: " << index << uid;
+                return;
+            }
+            //Like readLatest
+            callback(d->createApplicationDomainType(type, uid, DataStore::maxRevision(d->getTransaction()), buffer), buffer.operation());
+        }, d->getTransaction());
+}
+
+QByteArrayList EntityStore::fulltextTokens(const QByteArray &type, const QByteArray &uid)
+{
+    if (!d->exists()) {
+        SinkTraceCtx(d->logCtx) << "Database is not existing: " << type;
+        return {};
+    }
+    return d->typeIndex(type).fulltextTokens(uid, d->getTransaction());
+}
+
+bool EntityStore::readThreadSummary(const QByteArray &threadId, ThreadSummary &summary, const QByteArray &folder)
+{
+    if (!d->exists() || !ThreadSummary::isAvailable(d->getTransaction())) {
+        return false;
+    }
+    return ThreadSummary::read(threadId, summary, d->getTransaction(), folder);
+}
+
+bool EntityStore::readThreadSummaries(const std::function<bool(const ThreadSummary &summary)> &callback, const QByteArray &folder)
+{
+    if (!d->exists() || !ThreadSummary::isAvailable(d->getTransaction())) {
+        return false;
+    }
+    ThreadSummary::readAll(callback, d->getTransaction(), folder);
+    return true;
+}
+
 void EntityStore::readLatest(const QByteArray &type, const QByteArray &uid, const std::function<void(const QByteArray &uid, const EntityBuffer &entity)> callback)
 {
     auto db = DataStore::mainDatabase(d->getTransaction(), type);
@@ -592,8 +1207,12 @@ void EntityStore::readRevisions(qint64 baseRevision, const QByteArray &expectedT
         const auto uid = DataStore::getUidFromRevision(d->getTransaction(), revisionCounter);
         const auto type = DataStore::getTypeFromRevision(d->getTransaction(), revisionCounter);
         // SinkTrace() << "Revision" << *revisionCounter << type << uid;
-        Q_ASSERT(!uid.isEmpty());
-        Q_ASSERT(!type.isEmpty());
+        if (uid.isEmpty() || type.isEmpty()) {
+            //The revision has been superseded without keeping history, the replacing revision follows later.
+            SinkTraceCtx(d->logCtx) << "Skipping missing revision: " << revisionCounter;
+            revisionCounter++;
+            continue;
+        }
         if (type != expectedType) {
             // Skip revision
             revisionCounter++;
@@ -605,20 +1224,19 @@ void EntityStore::readRevisions(qint64 baseRevision, const QByteArray &expectedT
     }
 }
 
+void EntityStore::readDerivedChanges(qint64 baseRevision, const QByteArray &type, const std::function<void(const QByteArray &uid)> &callback)
+{
+    if (!d->exists()) {
+        return;
+    }
+    if (type == ApplicationDomain::getTypeName<ApplicationDomain::Folder>()) {
+        FolderCounts::readChanges(baseRevision, callback, d->getTransaction());
+    }
+}
+
 void EntityStore::readPrevious(const QByteArray &type, const QByteArray &uid, qint64 revision, const std::function<void(const QByteArray &uid, const EntityBuffer &entity)> callback)
 {
-    auto db = DataStore::mainDatabase(d->getTransaction(), type);
-    qint64 latestRevision = 0;
-    db.scan(uid,
-        [&latestRevision, revision](const QByteArray &key, const QByteArray &) -> bool {
-            const auto foundRevision = Sink::Storage::DataStore::revisionFromKey(key);
-            if (foundRevision < revision && foundRevision > latestRevision) {
-                latestRevision = foundRevision;
-            }
-            return true;
-        },
-        [&](const Sink::Storage::DataStore::Error &error) { SinkWarningCtx(d->logCtx) << "Failed to read current value from storage: " << error.message; }, true);
-    return readEntity(type, Sink::Storage::DataStore::assembleKey(uid, latestRevision), callback);
+    readAt(type, uid, revision - 1, callback);
 }
 
 void EntityStore::readPrevious(const QByteArray &type, const QByteArray &uid, qint64 revision, const std::function<void(const ApplicationDomain::ApplicationDomainType &)> callback)
@@ -637,6 +1255,69 @@ ApplicationDomain::ApplicationDomainType EntityStore::readPrevious(const QByteAr
     return dt;
 }
 
+void EntityStore::readAt(const QByteArray &type, const QByteArray &uid, qint64 revision, const std::function<void(const QByteArray &uid, const EntityBuffer &entity)> callback)
+{
+    if (revision < DataStore::cleanedUpRevision(d->getTransaction())) {
+        SinkWarningCtx(d->logCtx) << "Reading at a revision that has already been cleaned up: " << revision << uid;
+    }
+    //The keys are ordered by revision, so we can seek directly to the last revision of the entity before or at the requested revision.
+    DataStore::mainDatabase(d->getTransaction(), type)
+        .findLatestUntil(uid, DataStore::assembleKey(uid, revision),
+            [&](const QByteArray &key, const QByteArray &value) {
+                callback(DataStore::uidFromKey(key), Sink::EntityBuffer(value.data(), value.size()));
+            },
+            [&](const DataStore::Error &error) { SinkTraceCtx(d->logCtx) << "Failed to read entity at revision: " << error.message << uid << revision; });
+}
+
+void EntityStore::readAt(const QByteArray &type, const QByteArray &uid, qint64 revision, const std::function<void(const ApplicationDomain::ApplicationDomainType &)> callback)
+{
+    readAt(type, uid, revision, [&](const QByteArray &uid, const EntityBuffer &buffer) {
+        callback(d->createApplicationDomainType(type, uid, revision, buffer));
+    });
+}
+
+void EntityStore::readAt(const QByteArray &type, const QByteArray &uid, qint64 revision, const std::function<void(const ApplicationDomain::ApplicationDomainType &, Sink::Operation)> callback)
+{
+    readAt(type, uid, revision, [&](const QByteArray &uid, const EntityBuffer &buffer) {
+        callback(d->createApplicationDomainType(type, uid, revision, buffer), buffer.operation());
+    });
+}
+
+ApplicationDomain::ApplicationDomainType EntityStore::readAt(const QByteArray &type, const QByteArray &uid, qint64 revision)
+{
+    ApplicationDomain::ApplicationDomainType dt;
+    readAt(type, uid, revision, [&](const ApplicationDomain::ApplicationDomainType &entity) {
+        dt = entity;
+    });
+    return dt;
+}
+
+QSharedPointer<PropertyMapper> EntityStore::propertyMapper(const QByteArray &type) const
+{
+    return d->resourceContext.adaptorFactory(type).propertyMapper();
+}
+
+void EntityStore::readBatch(const QByteArray &type, const QVector<QByteArray> &uids, qint64 revision, const std::function<void(int index, const ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> &callback)
+{
+    if (revision && revision < DataStore::cleanedUpRevision(d->getTransaction())) {
+        SinkWarningCtx(d->logCtx) << "Reading at a revision that has already been cleaned up: " << revision;
+    }
+    QVector<QPair<QByteArray, QByteArray>> lookups;
+    lookups.reserve(uids.size());
+    for (const auto &uid : uids) {
+        //Any revision of the uid sorts before the uid followed by 0xff
+        lookups << qMakePair(uid, revision ? DataStore::assembleKey(uid, revision) : uid + '\xff');
+    }
+    const auto entityRevision = revision ? revision : DataStore::maxRevision(d->getTransaction());
+    DataStore::mainDatabase(d->getTransaction(), type)
+        .findLatestUntil(lookups,
+            [&](int index, const QByteArray &key, const QByteArray &value) {
+                const Sink::EntityBuffer buffer(value.data(), value.size());
+                callback(index, d->createApplicationDomainType(type, DataStore::uidFromKey(key), entityRevision, buffer), buffer.operation());
+            },
+            [&](const DataStore::Error &error) { SinkWarningCtx(d->logCtx) << "Error during query: " << error.message; });
+}
+
 void EntityStore::readAllUids(const QByteArray &type, const std::function<void(const QByteArray &uid)> callback)
 {
     DataStore::getUids(d->getTransaction(), callback);
@@ -644,11 +1325,18 @@ void EntityStore::readAllUids(const QByteArray &type, const std::function<void(c
 
 bool EntityStore::contains(const QByteArray &type, const QByteArray &uid)
 {
+    if (!d->uidFilter(type).mayContain(uid)) {
+        return false;
+    }
     return DataStore::mainDatabase(d->getTransaction(), type).contains(uid);
 }
 
 bool EntityStore::exists(const QByteArray &type, const QByteArray &uid)
 {
+    if (!d->uidFilter(type).mayContain(uid)) {
+        SinkTraceCtx(d->logCtx) << "Remove: Failed to find entity " << uid;
+        return false;
+    }
     bool found = false;
     bool alreadyRemoved = false;
     DataStore::mainDatabase(d->transaction, type)
@@ -686,6 +1374,14 @@ qint64 EntityStore::maxRevision()
     return DataStore::maxRevision(d->getTransaction());
 }
 
+qint64 EntityStore::cleanedUpRevision()
+{
+    if (!d->exists()) {
+        return 0;
+    }
+    return DataStore::cleanedUpRevision(d->getTransaction());
+}
+
 Sink::Log::Context EntityStore::logContext() const
 {
     return d->logCtx;
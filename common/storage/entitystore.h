@@ -30,6 +30,7 @@
 
 namespace Sink {
 class EntityBuffer;
+struct ThreadSummary;
 namespace Storage {
 
 class SINK_EXPORT EntityStore
@@ -38,23 +39,112 @@ public:
     typedef QSharedPointer<EntityStore> Ptr;
     EntityStore(const ResourceContext &resourceContext, const Sink::Log::Context &);
 
+    /**
+     * Without history, modifications and removals replace the current revision of an entity instead of adding a new one.
+     *
+     * Revision notifications still work since the revision log is kept until all clients caught up,
+     * but superseded revisions are no longer available for change replay or snapshot reads.
+     * This is only suitable for resources that never replay changes to the source.
+     */
+    void setKeepHistory(bool keepHistory);
+    bool keepHistory() const;
+
     //Only the pipeline may call the following functions outside of tests
     bool add(const QByteArray &type, ApplicationDomain::ApplicationDomainType newEntity, bool replayToSource);
     bool modify(const QByteArray &type, const ApplicationDomain::ApplicationDomainType &diff, const QByteArrayList &deletions, bool replayToSource);
     bool modify(const QByteArray &type, const ApplicationDomain::ApplicationDomainType &current, ApplicationDomain::ApplicationDomainType newEntity, bool replayToSource);
     bool remove(const QByteArray &type, const ApplicationDomain::ApplicationDomainType &current, bool replayToSource);
     bool cleanupRevisions(qint64 revision);
+
+    /**
+     * Compares the index definitions with the indexes in the store, and schedules outdated and new indexes to be built.
+     *
+     * This happens implicitly with the first write transaction.
+     */
+    void updateIndexDefinitions();
+
+    /**
+     * Adds up to @param batchSize entities to an index that is still being built.
+     *
+     * Requires a write transaction, so long builds can be split over many short transactions.
+     * @return false if there was nothing left to build.
+     */
+    bool buildIndexes(int batchSize);
+
+    /**
+     * Compares the indexes with the latest revisions of all entities.
+     *
+     * The entities are read once, and the entries they should have are looked up in all indexes.
+     * Only indexes with stale entries are compared entry by entry, which reads the entities once more.
+     * Secondary indexes, custom indexes such as the thread index, and the fulltext index are not verified.
+     *
+     * @param callback is called for every entry that is missing in an index, or that is in an index without belonging to an entity.
+     * @return the indexes that are inconsistent.
+     */
+    QByteArrayList verifyIndexes(const std::function<void(const QByteArray &index, const QByteArray &key, const QByteArray &value, bool missing)> &callback);
+
+    /**
+     * Clears the indexes @param names, so buildIndexes builds them again.
+     */
+    void rebuildIndexes(const QByteArrayList &names);
+
+    /**
+     * Replaces the fulltext indexed content of an entity.
+     *
+     * The content is removed from the index together with the entity.
+     */
+    void updateFulltextIndex(const QByteArray &type, const QByteArray &uid, const QString &content);
     ApplicationDomain::ApplicationDomainType applyDiff(const QByteArray &type, const ApplicationDomain::ApplicationDomainType &current, const ApplicationDomain::ApplicationDomainType &diff, const QByteArrayList &deletions) const;
 
     void startTransaction(Sink::Storage::DataStore::AccessMode);
     void commitTransaction();
     void abortTransaction();
+
+    /**
+     * Defers the writes to the property indexes until the end of the transaction, to write them in bulk.
+     *
+     * This is done automatically in the first transaction of an empty store.
+     */
+    void startBulkLoad();
     bool hasTransaction() const;
 
     QVector<QByteArray> fullScan(const QByteArray &type);
     QVector<QByteArray> indexLookup(const QByteArray &type, const QueryBase &query, QSet<QByteArray> &appliedFilters, QByteArray &appliedSorting);
     QVector<QByteArray> indexLookup(const QByteArray &type, const QByteArray &property, const QVariant &value);
+    /**
+     * Counts the entities that match @param query from the indexes alone, or returns -1 if that is not possible.
+     */
+    qint64 indexCount(const QByteArray &type, const QueryBase &query);
     void indexLookup(const QByteArray &type, const QByteArray &property, const QVariant &value, const std::function<void(const QByteArray &uid)> &callback);
+    /**
+     * Looks up the entities that match @param query in a covering index that contains all @param requestedProperties.
+     *
+     * @return false if no covering index applies, otherwise @param keys can be read with readProjection.
+     */
+    bool coveringIndexLookup(const QByteArray &type, const QueryBase &query, const QByteArrayList &requestedProperties, QByteArray &index, QVector<QByteArray> &uids, QVector<QByteArray> &keys);
+    /**
+     * Reads the latest state of an entity from a covering index, the entity only contains the projected properties.
+     */
+    void readProjection(const QByteArray &type, const QByteArray &index, const QByteArray &uid, const QByteArray &key, const std::function<void(const ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> callback);
+    QByteArrayList fulltextTokens(const QByteArray &type, const QByteArray &uid);
+
+    /**
+     * Reads the summary of the mail thread @param threadId, that is maintained whenever a mail is written.
+     *
+     * If @param folder is set, the summary only covers the mails of the thread in that folder.
+     *
+     * @return false if the summary is not available, in which case the thread has to be reduced from its mails.
+     */
+    bool readThreadSummary(const QByteArray &threadId, ThreadSummary &summary, const QByteArray &folder = {});
+
+    /**
+     * Reads the summaries of all mail threads with the most recently active thread first, for as long as @param callback returns true.
+     *
+     * If @param folder is set, only the threads with mails in that folder are read.
+     *
+     * @return false if the summaries are not available.
+     */
+    bool readThreadSummaries(const std::function<bool(const ThreadSummary &summary)> &callback, const QByteArray &folder = {});
     template<typename EntityType, typename PropertyType>
     void indexLookup(const QVariant &value, const std::function<void(const QByteArray &uid)> &callback) {
         return indexLookup(ApplicationDomain::getTypeName<EntityType>(), PropertyType::name, value, callback);
@@ -90,6 +180,34 @@ public:
         return T(readPrevious(ApplicationDomain::getTypeName<T>(), uid, revision));
     }
 
+    /**
+     * Read the entity as it was at @param revision.
+     *
+     * This is only reliable for revisions that have not been cleaned up yet, so the revision needs to be pinned for as long as it is read from.
+     */
+    void readAt(const QByteArray &type, const QByteArray &uid, qint64 revision, const std::function<void(const QByteArray &uid, const EntityBuffer &entity)> callback);
+    void readAt(const QByteArray &type, const QByteArray &uid, qint64 revision, const std::function<void(const ApplicationDomain::ApplicationDomainType &entity)> callback);
+    void readAt(const QByteArray &type, const QByteArray &uid, qint64 revision, const std::function<void(const ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> callback);
+    ApplicationDomain::ApplicationDomainType readAt(const QByteArray &type, const QByteArray &uid, qint64 revision);
+
+    template<typename T>
+    T readAt(const QByteArray &uid, qint64 revision) {
+        return T(readAt(ApplicationDomain::getTypeName<T>(), uid, revision));
+    }
+
+    /**
+     * Reads the latest revisions of @param uids, or the revisions current at @param revision if it is not 0.
+     *
+     * The entities are read in key order with a single cursor, and @param callback receives the position of the uid in @param uids.
+     * Uids that can't be found are skipped.
+     */
+    void readBatch(const QByteArray &type, const QVector<QByteArray> &uids, qint64 revision, const std::function<void(int index, const ApplicationDomain::ApplicationDomainType &entity, Sink::Operation)> &callback);
+
+    /**
+     * The mapper the properties of @param type are read with, to evaluate filters on the buffer directly.
+     */
+    QSharedPointer<PropertyMapper> propertyMapper(const QByteArray &type) const;
+
     void readAllUids(const QByteArray &type, const std::function<void(const QByteArray &uid)> callback);
 
     void readAll(const QByteArray &type, const std::function<void(const ApplicationDomain::ApplicationDomainType &entity)> &callback);
@@ -103,6 +221,12 @@ public:
 
     void readRevisions(qint64 baseRevision, const QByteArray &type, const std::function<void(const QByteArray &key)> &callback);
 
+    /**
+     * Reads the uids of the entities of @param type whose derived properties changed since @param baseRevision without a revision of their own,
+     * such as the counts of a folder.
+     */
+    void readDerivedChanges(qint64 baseRevision, const QByteArray &type, const std::function<void(const QByteArray &uid)> &callback);
+
     ///Db contains entity (but may already be marked as removed
     bool contains(const QByteArray &type, const QByteArray &uid);
 
@@ -111,6 +235,11 @@ public:
 
     qint64 maxRevision();
 
+    /**
+     * Revisions up to this one may have been cleaned up, so they can no longer be read.
+     */
+    qint64 cleanedUpRevision();
+
     Sink::Log::Context logContext() const;
 
 private:
@@ -174,6 +174,11 @@ void DataStore::getUids(const Transaction &transaction, const std::function<void
     });
 }
 
+qint64 DataStore::uidCount(const Transaction &transaction)
+{
+    return transaction.openDatabase("uids").entryCount();
+}
+
 bool DataStore::isInternalKey(const char *key)
 {
     return key && strncmp(key, s_internalPrefix, s_internalPrefixSize) == 0;
@@ -22,6 +22,8 @@
 #include "storage.h"
 
 #include <iostream>
+#include <algorithm>
+#include <numeric>
 
 #include <QAtomicInt>
 #include <QDebug>
@@ -34,6 +36,7 @@
 
 #include <lmdb.h>
 #include "log.h"
+#include "bloomfilter.h"
 
 namespace Sink {
 namespace Storage {
@@ -291,6 +294,52 @@ bool DataStore::NamedDatabase::write(const QByteArray &sKey, const QByteArray &s
     return !rc;
 }
 
+bool DataStore::NamedDatabase::append(const QByteArray &sKey, const QByteArray &sValue, const std::function<void(const DataStore::Error &error)> &errorHandler)
+{
+    if (!d || !d->transaction) {
+        Error error("", ErrorCodes::GenericError, "Not open");
+        if (d) {
+            errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+        }
+        return false;
+    }
+    if (sKey.isEmpty()) {
+        Error error(d->name.toLatin1() + d->db, ErrorCodes::GenericError, "Tried to write empty key.");
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+        return false;
+    }
+
+    MDB_cursor *cursor;
+    int rc = mdb_cursor_open(d->transaction, d->dbi, &cursor);
+    if (rc) {
+        Error error(d->name.toLatin1() + d->db, getErrorCode(rc), QByteArray("Error during mdb_cursor_open: ") + QByteArray(mdb_strerror(rc)));
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+        return false;
+    }
+
+    //Another value of the last key is appended to the values of that key
+    unsigned int flags = MDB_APPEND;
+    MDB_val lastKey, lastData;
+    if (d->allowDuplicates && mdb_cursor_get(cursor, &lastKey, &lastData, MDB_LAST) == 0
+        && QByteArray::fromRawData((char *)lastKey.mv_data, lastKey.mv_size) == sKey) {
+        flags = MDB_APPENDDUP;
+    }
+
+    MDB_val key, data;
+    key.mv_size = sKey.size();
+    key.mv_data = const_cast<char *>(sKey.constData());
+    data.mv_size = sValue.size();
+    data.mv_data = const_cast<char *>(sValue.constData());
+    rc = mdb_cursor_put(cursor, &key, &data, flags);
+    mdb_cursor_close(cursor);
+
+    if (rc) {
+        Error error(d->name.toLatin1() + d->db, ErrorCodes::GenericError, "mdb_cursor_put: " + QByteArray(mdb_strerror(rc)));
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+    }
+    return !rc;
+}
+
 void DataStore::NamedDatabase::remove(const QByteArray &k, const std::function<void(const DataStore::Error &error)> &errorHandler)
 {
     remove(k, QByteArray(), errorHandler);
@@ -329,6 +378,24 @@ void DataStore::NamedDatabase::remove(const QByteArray &k, const QByteArray &val
     }
 }
 
+void DataStore::NamedDatabase::clear(const std::function<void(const DataStore::Error &error)> &errorHandler)
+{
+    if (!d || !d->transaction) {
+        if (d) {
+            Error error(d->name.toLatin1() + d->db, ErrorCodes::GenericError, "Not open");
+            errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+        }
+        return;
+    }
+
+    //Empties the database but keeps it open
+    const int rc = mdb_drop(d->transaction, d->dbi, 0);
+    if (rc) {
+        Error error(d->name.toLatin1() + d->db, ErrorCodes::GenericError, QString("Error on mdb_drop: %1 %2").arg(rc).arg(mdb_strerror(rc)).toLatin1());
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+    }
+}
+
 int DataStore::NamedDatabase::scan(const QByteArray &k, const std::function<bool(const QByteArray &key, const QByteArray &value)> &resultHandler,
     const std::function<void(const DataStore::Error &error)> &errorHandler, bool findSubstringKeys, bool skipInternalKeys) const
 {
@@ -481,6 +548,186 @@ void DataStore::NamedDatabase::findLatest(const QByteArray &k, const std::functi
     return;
 }
 
+void DataStore::NamedDatabase::findLatestUntil(const QByteArray &k, const QByteArray &upperBound, const std::function<void(const QByteArray &key, const QByteArray &value)> &resultHandler,
+    const std::function<void(const DataStore::Error &error)> &errorHandler) const
+{
+    if (!d || !d->transaction) {
+        // Not an error. We rely on this to read nothing from non-existing databases.
+        return;
+    }
+
+    int rc;
+    MDB_val key;
+    MDB_val data;
+    MDB_cursor *cursor;
+
+    key.mv_data = (void *)upperBound.constData();
+    key.mv_size = upperBound.size();
+
+    rc = mdb_cursor_open(d->transaction, d->dbi, &cursor);
+    if (rc) {
+        Error error(d->name.toLatin1() + d->db, getErrorCode(rc), QByteArray("Error during mdb_cursor_open: ") + QByteArray(mdb_strerror(rc)));
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+        return;
+    }
+
+    bool foundValue = false;
+    // The lookup will find a key that is equal or greater than the upper bound
+    rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_RANGE);
+    if (rc == 0) {
+        if (QByteArray::fromRawData((char *)key.mv_data, key.mv_size) != upperBound) {
+            // We're past the upper bound, so step back once
+            rc = mdb_cursor_get(cursor, &key, &data, MDB_PREV);
+        }
+    } else if (rc == MDB_NOTFOUND) {
+        // All keys are smaller than the upper bound, so the last one is the candidate
+        rc = mdb_cursor_get(cursor, &key, &data, MDB_LAST);
+    }
+    if (rc == 0) {
+        const auto current = QByteArray::fromRawData((char *)key.mv_data, key.mv_size);
+        if (current.startsWith(k)) {
+            foundValue = true;
+            resultHandler(current, QByteArray::fromRawData((char *)data.mv_data, data.mv_size));
+        }
+    }
+
+    // We never find the last value
+    if (rc == MDB_NOTFOUND) {
+        rc = 0;
+    }
+
+    mdb_cursor_close(cursor);
+
+    if (rc) {
+        Error error(d->name.toLatin1(), getErrorCode(rc), QByteArray("Key: ") + upperBound + " : " + QByteArray(mdb_strerror(rc)));
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+    } else if (!foundValue) {
+        Error error(d->name.toLatin1(), 1, QByteArray("Key: ") + upperBound + " : No value found");
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+    }
+}
+
+void DataStore::NamedDatabase::findLatestUntil(const QVector<QPair<QByteArray, QByteArray>> &uidsAndUpperBounds, const std::function<void(int index, const QByteArray &key, const QByteArray &value)> &resultHandler,
+    const std::function<void(const DataStore::Error &error)> &errorHandler) const
+{
+    if (!d || !d->transaction || uidsAndUpperBounds.isEmpty()) {
+        // Not an error. We rely on this to read nothing from non-existing databases.
+        return;
+    }
+
+    MDB_cursor *cursor;
+    int rc = mdb_cursor_open(d->transaction, d->dbi, &cursor);
+    if (rc) {
+        Error error(d->name.toLatin1() + d->db, getErrorCode(rc), QByteArray("Error during mdb_cursor_open: ") + QByteArray(mdb_strerror(rc)));
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+        return;
+    }
+
+    // Seeking in key order keeps the cursor on the pages we just read
+    QVector<int> order(uidsAndUpperBounds.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int left, int right) {
+        return uidsAndUpperBounds.at(left).second < uidsAndUpperBounds.at(right).second;
+    });
+
+    for (const auto index : order) {
+        const auto &uid = uidsAndUpperBounds.at(index).first;
+        const auto &upperBound = uidsAndUpperBounds.at(index).second;
+        MDB_val key;
+        MDB_val data;
+        key.mv_data = (void *)upperBound.constData();
+        key.mv_size = upperBound.size();
+        rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_RANGE);
+        if (rc == 0) {
+            if (QByteArray::fromRawData((char *)key.mv_data, key.mv_size) != upperBound) {
+                rc = mdb_cursor_get(cursor, &key, &data, MDB_PREV);
+            }
+        } else if (rc == MDB_NOTFOUND) {
+            rc = mdb_cursor_get(cursor, &key, &data, MDB_LAST);
+        }
+        if (rc == 0) {
+            const auto current = QByteArray::fromRawData((char *)key.mv_data, key.mv_size);
+            if (current.startsWith(uid)) {
+                resultHandler(index, current, QByteArray::fromRawData((char *)data.mv_data, data.mv_size));
+            }
+        } else if (rc != MDB_NOTFOUND) {
+            Error error(d->name.toLatin1(), getErrorCode(rc), QByteArray("Key: ") + upperBound + " : " + QByteArray(mdb_strerror(rc)));
+            errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+            break;
+        }
+    }
+
+    mdb_cursor_close(cursor);
+}
+
+int DataStore::NamedDatabase::findAllInRange(const QByteArray &lowerBound, const QByteArray &upperBound, const std::function<void(const QByteArray &key, const QByteArray &value)> &resultHandler,
+    const std::function<void(const DataStore::Error &error)> &errorHandler) const
+{
+    int numberOfRetrievedValues = 0;
+    scanFrom(lowerBound, [&](const QByteArray &key, const QByteArray &value) {
+            if (!upperBound.isEmpty() && key >= upperBound) {
+                return false;
+            }
+            numberOfRetrievedValues++;
+            resultHandler(key, value);
+            return true;
+        }, errorHandler);
+    return numberOfRetrievedValues;
+}
+
+int DataStore::NamedDatabase::scanFrom(const QByteArray &lowerBound, const std::function<bool(const QByteArray &key, const QByteArray &value)> &resultHandler,
+    const std::function<void(const DataStore::Error &error)> &errorHandler) const
+{
+    if (!d || !d->transaction) {
+        // Not an error. We rely on this to read nothing from non-existing databases.
+        return 0;
+    }
+
+    int rc;
+    MDB_val key;
+    MDB_val data;
+    MDB_cursor *cursor;
+
+    key.mv_data = (void *)lowerBound.constData();
+    key.mv_size = lowerBound.size();
+
+    rc = mdb_cursor_open(d->transaction, d->dbi, &cursor);
+    if (rc) {
+        Error error(d->name.toLatin1() + d->db, getErrorCode(rc), QByteArray("Error during mdb_cursor_open: ") + QByteArray(mdb_strerror(rc)));
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+        return 0;
+    }
+
+    int numberOfRetrievedValues = 0;
+    // The first lookup will find a key that is equal or greater than the lower bound
+    MDB_cursor_op op = lowerBound.isEmpty() ? MDB_FIRST : MDB_SET_RANGE;
+    while ((rc = mdb_cursor_get(cursor, &key, &data, op)) == 0) {
+        op = MDB_NEXT;
+        const auto current = QByteArray::fromRawData((char *)key.mv_data, key.mv_size);
+        if (isInternalKey(current)) {
+            continue;
+        }
+        numberOfRetrievedValues++;
+        if (!resultHandler(current, QByteArray::fromRawData((char *)data.mv_data, data.mv_size))) {
+            break;
+        }
+    }
+
+    // We never find the last value
+    if (rc == MDB_NOTFOUND) {
+        rc = 0;
+    }
+
+    mdb_cursor_close(cursor);
+
+    if (rc) {
+        Error error(d->name.toLatin1(), getErrorCode(rc), QByteArray("Scan from: ") + lowerBound + " : " + QByteArray(mdb_strerror(rc)));
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+    }
+
+    return numberOfRetrievedValues;
+}
+
 qint64 DataStore::NamedDatabase::getSize()
 {
     if (!d || !d->transaction) {
@@ -502,6 +749,96 @@ qint64 DataStore::NamedDatabase::getSize()
     return stat.ms_psize * (stat.ms_leaf_pages + stat.ms_branch_pages + stat.ms_overflow_pages);
 }
 
+qint64 DataStore::NamedDatabase::count(const QByteArray &lowerBound, const QByteArray &upperBound, const std::function<void(const DataStore::Error &error)> &errorHandler) const
+{
+    if (!d || !d->transaction) {
+        // Not an error. We rely on this to read nothing from non-existing databases.
+        return 0;
+    }
+
+    MDB_val key;
+    MDB_val data;
+    MDB_cursor *cursor;
+
+    key.mv_data = (void *)lowerBound.constData();
+    key.mv_size = lowerBound.size();
+
+    int rc = mdb_cursor_open(d->transaction, d->dbi, &cursor);
+    if (rc) {
+        Error error(d->name.toLatin1() + d->db, getErrorCode(rc), QByteArray("Error during mdb_cursor_open: ") + QByteArray(mdb_strerror(rc)));
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+        return 0;
+    }
+
+    qint64 count = 0;
+    MDB_cursor_op op = lowerBound.isEmpty() ? MDB_FIRST : MDB_SET_RANGE;
+    while ((rc = mdb_cursor_get(cursor, &key, &data, op)) == 0) {
+        op = d->allowDuplicates ? MDB_NEXT_NODUP : MDB_NEXT;
+        const auto current = QByteArray::fromRawData((char *)key.mv_data, key.mv_size);
+        if (!upperBound.isEmpty() && current >= upperBound) {
+            break;
+        }
+        if (isInternalKey(current)) {
+            continue;
+        }
+        if (d->allowDuplicates) {
+            size_t duplicates = 0;
+            if ((rc = mdb_cursor_count(cursor, &duplicates))) {
+                break;
+            }
+            count += duplicates;
+        } else {
+            count++;
+        }
+    }
+    mdb_cursor_close(cursor);
+
+    if (rc && rc != MDB_NOTFOUND) {
+        Error error(d->name.toLatin1(), getErrorCode(rc), QByteArray("Count: ") + lowerBound + " - " + upperBound + " : " + QByteArray(mdb_strerror(rc)));
+        errorHandler ? errorHandler(error) : d->defaultErrorHandler(error);
+    }
+    return count;
+}
+
+bool DataStore::NamedDatabase::contains(const QByteArray &key, const QByteArray &value) const
+{
+    if (!d || !d->transaction) {
+        return false;
+    }
+
+    MDB_cursor *cursor;
+    if (mdb_cursor_open(d->transaction, d->dbi, &cursor)) {
+        return false;
+    }
+
+    MDB_val k;
+    MDB_val v;
+    k.mv_data = (void *)key.constData();
+    k.mv_size = key.size();
+    v.mv_data = (void *)value.constData();
+    v.mv_size = value.size();
+    //Only databases with duplicates can look up a key and value pair
+    const int rc = mdb_cursor_get(cursor, &k, &v, d->allowDuplicates ? MDB_GET_BOTH : MDB_SET_KEY);
+    const bool found = !rc && (d->allowDuplicates || QByteArray::fromRawData((char *)v.mv_data, v.mv_size) == value);
+    mdb_cursor_close(cursor);
+    return found;
+}
+
+qint64 DataStore::NamedDatabase::entryCount() const
+{
+    if (!d || !d->transaction) {
+        return 0;
+    }
+
+    MDB_stat stat;
+    const int rc = mdb_stat(d->transaction, d->dbi, &stat);
+    if (rc) {
+        SinkWarning() << "Failed to read the database statistics: " << QByteArray(mdb_strerror(rc));
+        return 0;
+    }
+    return stat.ms_entries;
+}
+
 
 class DataStore::Transaction::Private
 {
@@ -633,6 +970,10 @@ void DataStore::Transaction::abort()
     Q_ASSERT(sEnvironments.values().contains(d->env));
     mdb_txn_abort(d->transaction);
     d->transaction = nullptr;
+    if (!d->requestedRead) {
+        //The bloom filters in memory may contain blocks that have not been persisted.
+        PersistentBloomFilter::clearCache(d->name);
+    }
 }
 
 //Ensure that we opened the correct database by comparing the expected identifier with the one
@@ -694,6 +1035,16 @@ DataStore::NamedDatabase DataStore::Transaction::openDatabase(const QByteArray &
     return database;
 }
 
+QString DataStore::Transaction::storeName() const
+{
+    return d ? d->name : QString{};
+}
+
+bool DataStore::Transaction::isReadOnly() const
+{
+    return !d || d->requestedRead;
+}
+
 QList<QByteArray> DataStore::Transaction::getDatabaseNames() const
 {
     if (!d) {
@@ -730,7 +1081,7 @@ public:
                     qCritical() << "mdb_env_create: " << rc << " " << mdb_strerror(rc);
                 } else {
                     //Limit large enough to accomodate all our named dbs. This only starts to matter if the number gets large, otherwise it's just a bunch of extra entries in the main table.
-                    mdb_env_set_maxdbs(env, 50);
+                    mdb_env_set_maxdbs(env, 100);
                     const bool readOnly = (mode == ReadOnly);
                     unsigned int flags = MDB_NOTLS;
                     if (readOnly) {
@@ -862,6 +1213,7 @@ void DataStore::removeFromDisk() const
     }
     auto env = sEnvironments.take(fullPath);
     mdb_env_close(env);
+    PersistentBloomFilter::clearCache(d->name);
     QDir dir(fullPath);
     if (!dir.removeRecursively()) {
         Error error(d->name.toLatin1(), ErrorCodes::GenericError, QString("Failed to remove directory %1 %2").arg(d->storageRoot).arg(d->name).toLatin1());
@@ -877,6 +1229,7 @@ void DataStore::clearEnv()
     }
     sDbis.clear();
     sEnvironments.clear();
+    PersistentBloomFilter::clearCache({});
 }
 
 }
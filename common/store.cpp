@@ -31,6 +31,7 @@
 #include "resourcefacade.h"
 #include "definitions.h"
 #include "resourceconfig.h"
+#include "resourcecontrol.h"
 #include "facadefactory.h"
 #include "modelresult.h"
 #include "storage.h"
@@ -74,6 +75,25 @@ KAsync::Job<void> queryResource(const QByteArray resourceType, const QByteArray
     }
 }
 
+/*
+ * The resources that may contain results for @param query.
+ */
+template <class DomainType>
+static Query getResourceQuery(const Query &query)
+{
+    Sink::Query resourceQuery;
+    resourceQuery.request<ApplicationDomain::SinkResource::Capabilities>();
+
+    //Filter resources by available content types (unless the query already specifies a capability filter)
+    auto resourceFilter = query.getResourceFilter();
+    if (!resourceFilter.propertyFilter.contains(ApplicationDomain::SinkResource::Capabilities::name)) {
+        resourceFilter.propertyFilter.insert(ApplicationDomain::SinkResource::Capabilities::name, Query::Comparator{ApplicationDomain::getTypeName<DomainType>(), Query::Comparator::Contains});
+    }
+    resourceQuery.setFilter(resourceFilter);
+    resourceQuery.requestedProperties << resourceFilter.propertyFilter.keys();
+    return resourceQuery;
+}
+
 template <class DomainType>
 QPair<typename AggregatingResultEmitter<typename DomainType::Ptr>::Ptr,  typename ResultEmitter<typename ApplicationDomain::SinkResource::Ptr>::Ptr> getEmitter(Query query, const Log::Context &ctx)
 {
@@ -89,21 +109,12 @@ QPair<typename AggregatingResultEmitter<typename DomainType::Ptr>::Ptr,  typenam
         auto resourceCtx = ctx.subContext("resourceQuery");
         auto facade = FacadeFactory::instance().getFacade<ApplicationDomain::SinkResource>();
         Q_ASSERT(facade);
-        Sink::Query resourceQuery;
-        resourceQuery.request<ApplicationDomain::SinkResource::Capabilities>();
+        auto resourceQuery = getResourceQuery<DomainType>(query);
         if (query.liveQuery()) {
             SinkTraceCtx(ctx) << "Listening for new resources.";
             resourceQuery.setFlags(Query::LiveQuery);
         }
 
-        //Filter resources by available content types (unless the query already specifies a capability filter)
-        auto resourceFilter = query.getResourceFilter();
-        if (!resourceFilter.propertyFilter.contains(ApplicationDomain::SinkResource::Capabilities::name)) {
-            resourceFilter.propertyFilter.insert(ApplicationDomain::SinkResource::Capabilities::name, Query::Comparator{ApplicationDomain::getTypeName<DomainType>(), Query::Comparator::Contains});
-        }
-        resourceQuery.setFilter(resourceFilter);
-        resourceQuery.requestedProperties << resourceFilter.propertyFilter.keys();
-
         auto result = facade->load(resourceQuery, resourceCtx);
         auto emitter = result.second;
         emitter->onAdded([=](const ApplicationDomain::SinkResource::Ptr &resource) {
@@ -280,8 +291,9 @@ KAsync::Job<void> Store::upgrade()
     SinkLog() << "Upgrading...";
     return fetchAll<ApplicationDomain::SinkResource>({})
         .template each([](const ApplicationDomain::SinkResource::Ptr &resource) -> KAsync::Job<void> {
-            SinkLog() << "Removing caches for " << resource->identifier();
-            return removeDataFromDisk(resource->identifier());
+            //The resource migrates its indexes on startup and builds them in the background
+            SinkLog() << "Starting resource for index migration " << resource->identifier();
+            return ResourceControl::start(resource->identifier());
         })
         .then([] {
             SinkLog() << "Upgrade complete.";
@@ -354,7 +366,10 @@ KAsync::Job<QList<typename DomainType::Ptr>> Store::fetch(const Sink::Query &que
             QObject::connect(model.data(), &QAbstractItemModel::dataChanged, context.data(),
                 [model, &future, list, minimumAmount](const QModelIndex &, const QModelIndex &, const QVector<int> &roles) {
                     if (roles.contains(ModelResult<DomainType, typename DomainType::Ptr>::ChildrenFetchedRole)) {
-                        if (list->size() < minimumAmount) {
+                        const auto error = model->data(QModelIndex(), ModelResult<DomainType, typename DomainType::Ptr>::ErrorRole).toString();
+                        if (!error.isEmpty()) {
+                            future.setError(1, error);
+                        } else if (list->size() < minimumAmount) {
                             future.setError(1, "Not enough values.");
                         } else {
                             future.setValue(*list);
@@ -364,7 +379,10 @@ KAsync::Job<QList<typename DomainType::Ptr>> Store::fetch(const Sink::Query &que
                 });
         }
         if (model->data(QModelIndex(), ModelResult<DomainType, typename DomainType::Ptr>::ChildrenFetchedRole).toBool()) {
-            if (list->size() < minimumAmount) {
+            const auto error = model->data(QModelIndex(), ModelResult<DomainType, typename DomainType::Ptr>::ErrorRole).toString();
+            if (!error.isEmpty()) {
+                future.setError(1, error);
+            } else if (list->size() < minimumAmount) {
                 future.setError(1, "Not enough values.");
             } else {
                 future.setValue(*list);
@@ -410,6 +428,37 @@ QList<DomainType> Store::read(const Sink::Query &query_)
     return list;
 }
 
+template <class DomainType>
+qint64 Store::count(const Sink::Query &query_)
+{
+    auto query = query_;
+    query.setType(ApplicationDomain::getTypeName<DomainType>());
+    auto ctx = getQueryContext(query, ApplicationDomain::getTypeName<DomainType>());
+    if (ApplicationDomain::isGlobalType(ApplicationDomain::getTypeName<DomainType>())) {
+        return read<DomainType>(query).size();
+    }
+
+    qint64 count = 0;
+    for (const auto &resource : read<ApplicationDomain::SinkResource>(getResourceQuery<DomainType>(query))) {
+        const auto resourceType = ResourceConfig::getResourceType(resource.identifier());
+        auto facade = FacadeFactory::instance().getFacade<DomainType>(resourceType, resource.identifier());
+        if (!facade) {
+            SinkTraceCtx(ctx) << "Couldn' find a facade for " << resource.identifier();
+            continue;
+        }
+        auto resourceCount = facade->count(query, ctx.subContext(resource.identifier()));
+        if (resourceCount < 0) {
+            auto resourceQuery = query;
+            resourceQuery.resourceFilter(resource.identifier());
+            resourceQuery.limit(0);
+            resourceCount = read<DomainType>(resourceQuery).size();
+        }
+        count += resourceCount;
+    }
+    SinkTraceCtx(ctx) << "Counted " << count << " entities.";
+    return count;
+}
+
 #define REGISTER_TYPE(T)                                                          \
     template KAsync::Job<void> Store::remove<T>(const T &domainObject);           \
     template KAsync::Job<void> Store::remove<T>(const Query &);           \
@@ -423,7 +472,8 @@ QList<DomainType> Store::read(const Sink::Query &query_)
     template KAsync::Job<QList<T::Ptr>> Store::fetchAll<T>(const Query &);        \
     template KAsync::Job<QList<T::Ptr>> Store::fetch<T>(const Query &, int);      \
     template T Store::readOne<T>(const Query &);                                  \
-    template QList<T> Store::read<T>(const Query &);
+    template QList<T> Store::read<T>(const Query &);                              \
+    template qint64 Store::count<T>(const Query &);
 
 SINK_REGISTER_TYPES()
 
@@ -56,7 +56,8 @@ enum Roles
     DomainObjectBaseRole,
     StatusRole, //ApplicationDomain::SyncStatus
     WarningRole, //ApplicationDomain::Warning, only if status == warning || status == error
-    ProgressRole //ApplicationDomain::Progress
+    ProgressRole, //ApplicationDomain::Progress
+    ErrorRole //QString, the error that stopped the query, only on the root index
 };
 
 /**
@@ -126,11 +127,9 @@ KAsync::Job<void> SINK_EXPORT removeDataFromDisk(const QByteArray &resourceIdent
  * Run upgrade jobs.
  *
  * Run this to upgrade your local database to a new version.
- * Note that this may:
- * * take a while
- * * remove some/all of your local caches
  *
- * Note: The initial implementation simply calls removeDataFromDisk for all resources.
+ * Starts all resources, which record the index definitions they are using and build new or outdated indexes in the background.
+ * Queries keep working meanwhile, but don't use an index before it is complete.
  */
 KAsync::Job<void> SINK_EXPORT upgrade();
 
@@ -148,5 +147,14 @@ DomainType SINK_EXPORT readOne(const Sink::Query &query);
 
 template <class DomainType>
 QList<DomainType> SINK_EXPORT read(const Sink::Query &query);
+
+/**
+ * Synchronously count the entities that match @param query.
+ *
+ * If possible the count is read from the indexes, without loading any entities.
+ * Limits and sorting of the query are ignored.
+ */
+template <class DomainType>
+qint64 SINK_EXPORT count(const Sink::Query &query);
 }
 }
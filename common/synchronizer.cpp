@@ -19,7 +19,10 @@
  */
 #include "synchronizer.h"
 
+#include <QDir>
+
 #include "definitions.h"
+#include "resourceconfig.h"
 #include "commands.h"
 #include "bufferutils.h"
 #include "synchronizerstore.h"
@@ -38,7 +41,8 @@ Synchronizer::Synchronizer(const Sink::ResourceContext &context)
     mResourceContext(context),
     mEntityStore(Storage::EntityStore::Ptr::create(mResourceContext, mLogCtx)),
     mSyncStorage(Sink::storageLocation(), mResourceContext.instanceId() + ".synchronization", Sink::Storage::DataStore::DataStore::ReadWrite),
-    mSyncInProgress(false)
+    mSyncInProgress(false),
+    mBodyCacheBudget(ResourceConfig::getConfiguration(mResourceContext.instanceId()).value("bodyCacheBudget").toLongLong())
 {
     mCurrentState.push(ApplicationDomain::Status::OfflineStatus);
     SinkTraceCtx(mLogCtx) << "Starting synchronizer: " << mResourceContext.resourceType << mResourceContext.instanceId();
@@ -258,7 +262,72 @@ QList<Synchronizer::SyncRequest> Synchronizer::getSyncRequests(const Sink::Query
 
 void Synchronizer::mergeIntoQueue(const Synchronizer::SyncRequest &request, QList<Synchronizer::SyncRequest> &queue)
 {
-    mSyncRequestQueue << request;
+    //Requests for individual entities are typically for something the user is looking at, so they go first.
+    auto isIndividualSync = [](const Synchronizer::SyncRequest &request) {
+        return request.requestType == SyncRequest::Synchronization && !(request.options & SyncRequest::RequestFlush) && !request.query.ids().isEmpty();
+    };
+    if (isIndividualSync(request)) {
+        int index = 0;
+        while (index < queue.size() && isIndividualSync(queue.at(index))) {
+            index++;
+        }
+        queue.insert(index, request);
+        return;
+    }
+    queue << request;
+}
+
+void Synchronizer::evictMailBodies()
+{
+    if (mBodyCacheBudget <= 0) {
+        return;
+    }
+    const auto lastReplayedRevision = getLastReplayedRevision();
+    const auto mailType = ApplicationDomain::getTypeName<ApplicationDomain::Mail>();
+    //Queries touch the bodies they read, so the least recently used come first.
+    const auto files = QDir{Sink::resourceStorageLocation(mResourceContext.instanceId()) + "/blob"}
+        .entryInfoList(QStringList{} << QString{"*%1.blob"}.arg(ApplicationDomain::Mail::MimeMessage::name), QDir::Files, QDir::Time | QDir::Reversed);
+    qint64 usage = 0;
+    for (const auto &file : files) {
+        usage += file.size();
+    }
+    SinkTraceCtx(mLogCtx) << "Mail bodies use " << usage << " of " << mBodyCacheBudget << " bytes.";
+    for (const auto &file : files) {
+        if (usage <= mBodyCacheBudget) {
+            break;
+        }
+        //Blobs are named $uid_$revision$property.blob
+        const auto fileName = file.fileName().toUtf8();
+        const auto sinkId = fileName.left(fileName.lastIndexOf('_'));
+        const auto mail = store().readLatest<ApplicationDomain::Mail>(sinkId);
+        if (mail.identifier().isEmpty() || QFileInfo{mail.getMimeMessagePath()} != file) {
+            //Not the current body of the mail, e.g. because it has been evicted already.
+            //The file is removed once the revisions referring to it are cleaned up, so it doesn't count towards the budget.
+            usage -= file.size();
+            continue;
+        }
+        //Anything that has not been written back to the source yet can't be fetched again.
+        if (syncStore().resolveLocalId(mailType, sinkId).isEmpty()) {
+            continue;
+        }
+        qint64 revision = 0;
+        store().readLatest(mailType, sinkId, [&](const QByteArray &, const EntityBuffer &buffer) {
+            revision = buffer.revision();
+        });
+        if (revision > lastReplayedRevision) {
+            continue;
+        }
+        SinkTraceCtx(mLogCtx) << "Evicting mail body: " << sinkId << file.size();
+        //We keep all other properties, an empty body marks the mail as evicted.
+        ApplicationDomain::Mail evicted{mResourceContext.instanceId(), sinkId, mail.revision(), QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+        auto blob = ApplicationDomain::BLOB{QString{""}};
+        blob.isExternal = false;
+        evicted.setProperty(ApplicationDomain::Mail::MimeMessage::name, QVariant::fromValue(blob));
+        evicted.setExtractedFullPayloadAvailable(false);
+        //The file is removed with the revision cleanup, readers may still refer to it until the modification is committed.
+        modify(evicted);
+        usage -= file.size();
+    }
 }
 
 void Synchronizer::synchronize(const Sink::QueryBase &query)
@@ -380,6 +449,7 @@ KAsync::Job<void> Synchronizer::processRequest(const SyncRequest &request)
             setBusy(true, "Synchronization has started.", request.requestId);
             emitNotification(Notification::Info, ApplicationDomain::SyncInProgress, {}, {}, request.applicableEntities);
         }).then(synchronizeWithSource(request.query)).then([this] {
+            evictMailBodies();
             //Commit after every request, so implementations only have to commit more if they add a lot of data.
             commit();
         }).then<void>([this, request](const KAsync::Error &error) {
@@ -210,6 +210,12 @@ private:
     void setBusy(bool busy, const QString &reason, const QByteArray requestId);
 
     void modifyIfChanged(Storage::EntityStore &store, const QByteArray &bufferType, const QByteArray &sinkId, const Sink::ApplicationDomain::ApplicationDomainType &entity);
+    /**
+     * Removes the least recently used mail bodies until we're within the configured budget.
+     *
+     * All other properties remain, and the body is fetched again once it is requested.
+     */
+    void evictMailBodies();
     KAsync::Job<void> processRequest(const SyncRequest &request);
     KAsync::Job<void> processSyncQueue();
 
@@ -224,6 +230,7 @@ private:
     MessageQueue *mMessageQueue;
     bool mSyncInProgress;
     QMultiHash<QByteArray, SyncRequest> mPendingSyncRequests;
+    qint64 mBodyCacheBudget;
 };
 
 }
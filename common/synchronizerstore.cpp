@@ -33,13 +33,13 @@ SynchronizerStore::SynchronizerStore(Sink::Storage::DataStore::Transaction &tran
 
 void SynchronizerStore::recordRemoteId(const QByteArray &bufferType, const QByteArray &localId, const QByteArray &remoteId)
 {
-    Index("rid.mapping." + bufferType, mTransaction).add(remoteId, localId);
+    Index("rid.mapping." + bufferType, mTransaction, true).add(remoteId, localId);
     Index("localid.mapping." + bufferType, mTransaction).add(localId, remoteId);
 }
 
 void SynchronizerStore::removeRemoteId(const QByteArray &bufferType, const QByteArray &localId, const QByteArray &remoteId)
 {
-    Index("rid.mapping." + bufferType, mTransaction).remove(remoteId, localId);
+    Index("rid.mapping." + bufferType, mTransaction, true).remove(remoteId, localId);
     Index("localid.mapping." + bufferType, mTransaction).remove(localId, remoteId);
 }
 
@@ -57,7 +57,8 @@ QByteArray SynchronizerStore::resolveRemoteId(const QByteArray &bufferType, cons
         return QByteArray();
     }
     // Lookup local id for remote id, or insert a new pair otherwise
-    Index index("rid.mapping." + bufferType, mTransaction);
+    //New remote ids are looked up first during a sync, which the bloom filter answers without touching the index.
+    Index index("rid.mapping." + bufferType, mTransaction, true);
     QByteArray sinkId = index.lookup(remoteId);
     if (sinkId.isEmpty()) {
         sinkId = Sink::Storage::DataStore::generateUid();
@@ -20,18 +20,22 @@
 
 #include "log.h"
 #include "index.h"
+#include "fulltextindex.h"
+#include "sortablekey.h"
 #include <QDateTime>
-#include <QDataStream>
+#include <cmath>
+#include <algorithm>
 
 using namespace Sink;
 
 static QByteArray getByteArray(const QVariant &value)
 {
+    //Range lookups require the bytewise order of the keys to match the order of the values
     if (value.type() == QVariant::DateTime) {
-        QByteArray result;
-        QDataStream ds(&result, QIODevice::WriteOnly);
-        ds << value.toDateTime();
-        return result;
+        return SortableKey::fromDate(value.toDateTime());
+    }
+    if (value.type() == QVariant::Int || value.type() == QVariant::LongLong) {
+        return SortableKey::fromNumber(value.toLongLong());
     }
     if (value.type() == QVariant::Bool) {
         return value.toBool() ? "t" : "f";
@@ -49,16 +53,6 @@ static QByteArray getByteArray(const QVariant &value)
     return "toplevel";
 }
 
-static QByteArray toSortableByteArray(const QDateTime &date)
-{
-    // Sort invalid last
-    if (!date.isValid()) {
-        return QByteArray::number(std::numeric_limits<unsigned int>::max());
-    }
-    return QByteArray::number(std::numeric_limits<unsigned int>::max() - date.toTime_t());
-}
-
-
 TypeIndex::TypeIndex(const QByteArray &type, const Sink::Log::Context &ctx) : mLogCtx(ctx), mType(type)
 {
 }
@@ -68,6 +62,9 @@ QByteArray TypeIndex::indexName(const QByteArray &property, const QByteArray &so
     if (sortProperty.isEmpty()) {
         return mType + ".index." + property;
     }
+    if (property.isEmpty()) {
+        return mType + ".index.sort." + sortProperty;
+    }
     return mType + ".index." + property + ".sort." + sortProperty;
 }
 
@@ -77,9 +74,9 @@ void TypeIndex::addProperty<QByteArray>(const QByteArray &property)
     auto indexer = [this, property](bool add, const QByteArray &identifier, const QVariant &value, Sink::Storage::DataStore::Transaction &transaction) {
         // SinkTraceCtx(mLogCtx) << "Indexing " << mType + ".index." + property << value.toByteArray();
         if (add) {
-            Index(indexName(property), transaction).add(getByteArray(value), identifier);
+            addEntry(indexName(property), getByteArray(value), identifier, transaction);
         } else {
-            Index(indexName(property), transaction).remove(getByteArray(value), identifier);
+            removeEntry(indexName(property), getByteArray(value), identifier, transaction);
         }
     };
     mIndexer.insert(property, indexer);
@@ -91,9 +88,9 @@ void TypeIndex::addProperty<bool>(const QByteArray &property)
 {
     auto indexer = [this, property](bool add, const QByteArray &identifier, const QVariant &value, Sink::Storage::DataStore::Transaction &transaction) {
         if (add) {
-            Index(indexName(property), transaction).add(getByteArray(value), identifier);
+            addEntry(indexName(property), getByteArray(value), identifier, transaction);
         } else {
-            Index(indexName(property), transaction).remove(getByteArray(value), identifier);
+            removeEntry(indexName(property), getByteArray(value), identifier, transaction);
         }
     };
     mIndexer.insert(property, indexer);
@@ -106,9 +103,9 @@ void TypeIndex::addProperty<QString>(const QByteArray &property)
     auto indexer = [this, property](bool add, const QByteArray &identifier, const QVariant &value, Sink::Storage::DataStore::Transaction &transaction) {
         // SinkTraceCtx(mLogCtx) << "Indexing " << mType + ".index." + property << value.toByteArray();
         if (add) {
-            Index(indexName(property), transaction).add(getByteArray(value), identifier);
+            addEntry(indexName(property), getByteArray(value), identifier, transaction);
         } else {
-            Index(indexName(property), transaction).remove(getByteArray(value), identifier);
+            removeEntry(indexName(property), getByteArray(value), identifier, transaction);
         }
     };
     mIndexer.insert(property, indexer);
@@ -121,9 +118,9 @@ void TypeIndex::addProperty<QDateTime>(const QByteArray &property)
     auto indexer = [this, property](bool add, const QByteArray &identifier, const QVariant &value, Sink::Storage::DataStore::Transaction &transaction) {
         //SinkTraceCtx(mLogCtx) << "Indexing " << mType + ".index." + property << getByteArray(value);
         if (add) {
-            Index(indexName(property), transaction).add(getByteArray(value), identifier);
+            addEntry(indexName(property), getByteArray(value), identifier, transaction);
         } else {
-            Index(indexName(property), transaction).remove(getByteArray(value), identifier);
+            removeEntry(indexName(property), getByteArray(value), identifier, transaction);
         }
     };
     mIndexer.insert(property, indexer);
@@ -143,9 +140,9 @@ void TypeIndex::addPropertyWithSorting<QByteArray, QDateTime>(const QByteArray &
         const auto date = sortValue.toDateTime();
         const auto propertyValue = getByteArray(value);
         if (add) {
-            Index(indexName(property, sortProperty), transaction).add(propertyValue + toSortableByteArray(date), identifier);
+            addEntry(indexName(property, sortProperty), propertyValue + SortableKey::fromDateNewestFirst(date), identifier, transaction);
         } else {
-            Index(indexName(property, sortProperty), transaction).remove(propertyValue + toSortableByteArray(date), identifier);
+            removeEntry(indexName(property, sortProperty), propertyValue + SortableKey::fromDateNewestFirst(date), identifier, transaction);
         }
     };
     mSortIndexer.insert(property + sortProperty, indexer);
@@ -158,42 +155,768 @@ void TypeIndex::addPropertyWithSorting<ApplicationDomain::Reference, QDateTime>(
     addPropertyWithSorting<QByteArray, QDateTime>(property, sortProperty);
 }
 
-void TypeIndex::updateIndex(bool add, const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction)
+template <>
+void TypeIndex::addSortedProperty<QDateTime>(const QByteArray &property)
+{
+    auto indexer = [=](bool add, const QByteArray &identifier, const QVariant &sortValue, Sink::Storage::DataStore::Transaction &transaction) {
+        //Newest first, like the sorted property indexes
+        const auto key = SortableKey::fromDateNewestFirst(sortValue.toDateTime());
+        if (add) {
+            addEntry(indexName({}, property), key, identifier, transaction);
+        } else {
+            removeEntry(indexName({}, property), key, identifier, transaction);
+        }
+    };
+    mSortOnlyIndexer.insert(property, indexer);
+    mSortOnlyProperties << property;
+}
+
+template <>
+void TypeIndex::addSortedProperty<QString>(const QByteArray &property)
+{
+    auto indexer = [=](bool add, const QByteArray &identifier, const QVariant &sortValue, Sink::Storage::DataStore::Transaction &transaction) {
+        //Case insensitive, and the terminating null byte sorts empty values first while avoiding empty keys.
+        const auto key = sortValue.toString().toCaseFolded().toUtf8() + '\0';
+        if (add) {
+            addEntry(indexName({}, property), key, identifier, transaction);
+        } else {
+            removeEntry(indexName({}, property), key, identifier, transaction);
+        }
+    };
+    mSortOnlyIndexer.insert(property, indexer);
+    mSortOnlyProperties << property;
+}
+
+/*
+ * The value is terminated by a null byte so the prefix of a value doesn't match longer values,
+ * and the identifier makes the key unique, so every key holds exactly one projection.
+ */
+static QByteArray toCoveringKey(const QVariant &value, const QVariant &sortValue, const QByteArray &identifier)
+{
+    return getByteArray(value) + '\0' + SortableKey::fromDateNewestFirst(sortValue.toDateTime()) + identifier;
+}
+
+template <>
+void TypeIndex::addCoveringProperty<QByteArray, QDateTime>(const QByteArray &property, const QByteArray &sortProperty, const QByteArrayList &projectedProperties)
+{
+    //The filter stage re-applies the filters on the projection, so the indexed properties are always part of it.
+    auto properties = projectedProperties;
+    for (const auto &p : {property, sortProperty}) {
+        if (!properties.contains(p)) {
+            properties << p;
+        }
+    }
+    mCoveringIndexes << CoveringIndex{indexName(property, sortProperty) + ".covering", property, sortProperty, properties};
+}
+
+template <>
+void TypeIndex::addCoveringProperty<ApplicationDomain::Reference, QDateTime>(const QByteArray &property, const QByteArray &sortProperty, const QByteArrayList &projectedProperties)
+{
+    addCoveringProperty<QByteArray, QDateTime>(property, sortProperty, projectedProperties);
+}
+
+void TypeIndex::setProjector(const Projector &projector)
+{
+    mProjector = projector;
+}
+
+/*
+ * Every value is terminated by a null byte, so a prefix of the values only matches whole values.
+ */
+static QByteArray toCompoundKey(const QVariantList &values)
+{
+    QByteArray key;
+    for (const auto &value : values) {
+        key += getByteArray(value) + '\0';
+    }
+    return key;
+}
+
+void TypeIndex::addCompoundProperty(const QByteArrayList &properties)
 {
+    mCompoundProperties << properties;
+}
+
+//The buffered entries are spilled once there are that many, so the memory usage stays bounded during a large sync.
+static const int bulkLoadBufferSize = 100000;
+//The number of entries that are read from every run at once while the runs are merged.
+static const int bulkRunChunkSize = 1000;
+
+/*
+ * The sorted runs of an index are spilled to a database of their own until the end of the bulk load.
+ * The entries are keyed by the run and their position in it, so every run is appended behind the previous one.
+ */
+static QByteArray bulkRunDatabase(const QByteArray &name)
+{
+    return name + ".bulkruns";
+}
+
+static QByteArray bulkRunKey(int run, qint64 position)
+{
+    return SortableKey::fromNumber(run) + SortableKey::fromNumber(position);
+}
+
+static QByteArray serializeEntry(const QPair<QByteArray, QByteArray> &entry)
+{
+    return SortableKey::fromNumber(entry.first.size()) + entry.first + entry.second;
+}
+
+static QPair<QByteArray, QByteArray> deserializeEntry(const QByteArray &data)
+{
+    const auto keySize = SortableKey::toNumber(data);
+    return qMakePair(data.mid(SortableKey::size, keySize), data.mid(SortableKey::size + keySize));
+}
+
+void TypeIndex::startBulkLoad()
+{
+    mBulkLoad = true;
+    mBulkAppend.clear();
+}
+
+void TypeIndex::endBulkLoad(Sink::Storage::DataStore::Transaction &transaction)
+{
+    flushBulkLoad(transaction);
+    mBulkAppend.clear();
+    mBulkLoad = false;
+}
+
+void TypeIndex::abortBulkLoad()
+{
+    mBulkEntries.clear();
+    mBulkEntryCount = 0;
+    mBulkRuns.clear();
+    mBulkRemovals.clear();
+    mBulkAppend.clear();
+    mBulkLoad = false;
+}
+
+void TypeIndex::addEntry(const QByteArray &name, const QByteArray &key, const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction)
+{
+    if (mCollectedEntries) {
+        (*mCollectedEntries)[name].append(qMakePair(key, identifier));
+        return;
+    }
+    if (!mBulkLoad) {
+        Index(name, transaction).add(key, identifier);
+        return;
+    }
+    if (!mBulkAppend.contains(name)) {
+        //Only an index that is still empty can be loaded by appending the entries
+        mBulkAppend.insert(name, !transaction.openDatabase(name, std::function<void(const Sink::Storage::DataStore::Error &)>(), true).entryCount());
+    }
+    auto &entries = mBulkEntries[name];
+    const auto entry = qMakePair(key, identifier);
+    if (!entries.contains(entry)) {
+        entries.insert(entry);
+        mBulkEntryCount++;
+    }
+    //The entry may have been removed from a spilled run before
+    auto removals = mBulkRemovals.find(name);
+    if (removals != mBulkRemovals.end()) {
+        removals->remove(entry);
+    }
+    if (mBulkEntryCount >= bulkLoadBufferSize) {
+        spillBulkLoad(transaction);
+    }
+}
+
+void TypeIndex::removeEntry(const QByteArray &name, const QByteArray &key, const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction)
+{
+    //A modification removes the entries it added just before during the same bulk load, which are still buffered.
+    //An entry is never buffered and written at the same time, so dropping it from the buffer is sufficient.
+    if (mBulkLoad) {
+        const auto entry = qMakePair(key, identifier);
+        auto it = mBulkEntries.find(name);
+        if (it != mBulkEntries.end() && it->remove(entry)) {
+            mBulkEntryCount--;
+            return;
+        }
+        //The index stays empty until the runs are merged, spilled entries are skipped during the merge.
+        if (mBulkAppend.value(name)) {
+            if (mBulkRuns.value(name)) {
+                mBulkRemovals[name].insert(entry);
+            }
+            return;
+        }
+    }
+    Index(name, transaction).remove(key, identifier);
+}
+
+/*
+ * Writes the buffered entries as sorted runs.
+ *
+ * The runs of indexes that were empty when the bulk load started are spilled, and merged into the index at the end.
+ * The entries of all other indexes are inserted in sorted order, so every page of the index is only touched once per run.
+ */
+void TypeIndex::spillBulkLoad(Sink::Storage::DataStore::Transaction &transaction)
+{
+    SinkTraceCtx(mLogCtx) << "Spilling buffered index entries: " << mBulkEntryCount;
+    for (auto it = mBulkEntries.begin(); it != mBulkEntries.end(); it++) {
+        auto entries = it.value().toList();
+        std::sort(entries.begin(), entries.end());
+        const auto &name = it.key();
+        if (mBulkAppend.value(name)) {
+            const auto run = mBulkRuns.value(name);
+            mBulkRuns.insert(name, run + 1);
+            auto runs = transaction.openDatabase(bulkRunDatabase(name));
+            qint64 position = 0;
+            for (const auto &entry : entries) {
+                runs.append(bulkRunKey(run, position++), serializeEntry(entry));
+            }
+        } else {
+            Index index(name, transaction);
+            for (const auto &entry : entries) {
+                index.add(entry.first, entry.second);
+            }
+        }
+    }
+    mBulkEntries.clear();
+    mBulkEntryCount = 0;
+}
+
+/*
+ * Merges the spilled runs and the remaining sorted @param entries into the empty index @param name.
+ *
+ * Every entry is appended to the index, and the statistics are written once.
+ */
+void TypeIndex::mergeBulkRuns(const QByteArray &name, const QList<QPair<QByteArray, QByteArray>> &entries, Sink::Storage::DataStore::Transaction &transaction)
+{
+    struct Run {
+        QList<QPair<QByteArray, QByteArray>> entries;
+        int position = 0;
+        //The key to continue reading the run from, empty once it has been read completely
+        QByteArray nextKey;
+    };
+    auto runDatabase = transaction.openDatabase(bulkRunDatabase(name));
+    auto read = [&](Run &run) {
+        const auto runPrefix = run.nextKey.left(SortableKey::size);
+        const auto lowerBound = run.nextKey;
+        run.entries.clear();
+        run.position = 0;
+        run.nextKey.clear();
+        runDatabase.scanFrom(lowerBound, [&](const QByteArray &key, const QByteArray &value) {
+                if (!key.startsWith(runPrefix)) {
+                    return false;
+                }
+                if (run.entries.size() == bulkRunChunkSize) {
+                    run.nextKey = key;
+                    return false;
+                }
+                run.entries << deserializeEntry(value);
+                return true;
+            },
+            [&](const Sink::Storage::DataStore::Error &error) { SinkWarningCtx(mLogCtx) << "Failed to read a spilled run: " << error.message; });
+    };
+
+    const auto spilledRuns = mBulkRuns.value(name);
+    QVector<Run> runs(spilledRuns + 1);
+    for (int i = 0; i < spilledRuns; i++) {
+        runs[i].nextKey = bulkRunKey(i, 0);
+        read(runs[i]);
+    }
+    runs[spilledRuns].entries = entries;
+
+    const auto removals = mBulkRemovals.value(name);
+    Index index(name, transaction);
+    QPair<QByteArray, QByteArray> previous;
+    while (true) {
+        int next = -1;
+        for (int i = 0; i < runs.size(); i++) {
+            const auto &run = runs.at(i);
+            if (run.position < run.entries.size() && (next < 0 || run.entries.at(run.position) < runs.at(next).entries.at(runs.at(next).position))) {
+                next = i;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+        auto &run = runs[next];
+        const auto entry = run.entries.at(run.position++);
+        if (run.position == run.entries.size() && !run.nextKey.isEmpty()) {
+            read(run);
+        }
+        //Entries that have been added again after being spilled are in more than one run
+        if (entry == previous || removals.contains(entry)) {
+            continue;
+        }
+        index.append(entry.first, entry.second);
+        previous = entry;
+    }
+    index.finishAppend();
+    if (spilledRuns) {
+        runDatabase.clear();
+    }
+}
+
+void TypeIndex::flushBulkLoad(Sink::Storage::DataStore::Transaction &transaction)
+{
+    if (!mBulkEntryCount && mBulkRuns.isEmpty()) {
+        return;
+    }
+    SinkTraceCtx(mLogCtx) << "Writing buffered index entries: " << mBulkEntryCount;
+    auto names = mBulkEntries.keys().toSet() + mBulkRuns.keys().toSet();
+    for (const auto &name : names) {
+        auto entries = mBulkEntries.value(name).toList();
+        std::sort(entries.begin(), entries.end());
+        if (mBulkAppend.value(name)) {
+            mergeBulkRuns(name, entries, transaction);
+            //Entries that follow are inserted, since the index is no longer empty
+            mBulkAppend.insert(name, false);
+        } else {
+            Index index(name, transaction);
+            for (const auto &entry : entries) {
+                index.add(entry.first, entry.second);
+            }
+        }
+    }
+    mBulkEntries.clear();
+    mBulkEntryCount = 0;
+    mBulkRuns.clear();
+    mBulkRemovals.clear();
+}
+
+void TypeIndex::updateIndex(bool add, const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction, const QByteArray &onlyIndex)
+{
+    auto selected = [&](const QByteArray &name) {
+        return onlyIndex.isEmpty() || name == onlyIndex;
+    };
     for (const auto &property : mProperties) {
+        if (!selected(indexName(property))) {
+            continue;
+        }
         const auto value = entity.getProperty(property);
         auto indexer = mIndexer.value(property);
         indexer(add, identifier, value, transaction);
     }
     for (auto it = mSortedProperties.constBegin(); it != mSortedProperties.constEnd(); it++) {
+        if (!selected(indexName(it.key(), it.value()))) {
+            continue;
+        }
         const auto value = entity.getProperty(it.key());
         const auto sortValue = entity.getProperty(it.value());
         auto indexer = mSortIndexer.value(it.key() + it.value());
         indexer(add, identifier, value, sortValue, transaction);
     }
+    for (const auto &property : mSortOnlyProperties) {
+        if (!selected(indexName({}, property))) {
+            continue;
+        }
+        auto indexer = mSortOnlyIndexer.value(property);
+        indexer(add, identifier, entity.getProperty(property), transaction);
+    }
+    for (const auto &properties : mCompoundProperties) {
+        if (!selected(indexName(properties.join('.')))) {
+            continue;
+        }
+        QVariantList values;
+        for (const auto &property : properties) {
+            values << entity.getProperty(property);
+        }
+        if (add) {
+            addEntry(indexName(properties.join('.')), toCompoundKey(values), identifier, transaction);
+        } else {
+            removeEntry(indexName(properties.join('.')), toCompoundKey(values), identifier, transaction);
+        }
+    }
+    //Projections are added once the revision is known, see addToCoveringIndexes.
+    if (!add) {
+        for (const auto &covering : mCoveringIndexes) {
+            if (!selected(covering.name)) {
+                continue;
+            }
+            transaction.openDatabase(covering.name).remove(toCoveringKey(entity.getProperty(covering.property), entity.getProperty(covering.sortProperty), identifier),
+                [&](const Sink::Storage::DataStore::Error &error) { SinkWarningCtx(mLogCtx) << "Failed to remove projection: " << covering.name << identifier << error; });
+        }
+    }
+
+}
+
+void TypeIndex::addToCoveringIndexes(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, qint64 revision, Sink::Storage::DataStore::Transaction &transaction, const QByteArray &onlyIndex)
+{
+    if (!mProjector && !mCollectedEntries) {
+        return;
+    }
+    for (const auto &covering : mCoveringIndexes) {
+        if (!onlyIndex.isEmpty() && covering.name != onlyIndex) {
+            continue;
+        }
+        const auto key = toCoveringKey(entity.getProperty(covering.property), entity.getProperty(covering.sortProperty), identifier);
+        //Only the keys are verified, the projection is not comparable because it contains the revision
+        if (mCollectedEntries) {
+            (*mCollectedEntries)[covering.name].append(qMakePair(key, QByteArray{}));
+            continue;
+        }
+        transaction.openDatabase(covering.name).write(key, mProjector(entity, covering.projectedProperties, revision),
+            [&](const Sink::Storage::DataStore::Error &error) { SinkWarningCtx(mLogCtx) << "Failed to write projection: " << covering.name << identifier << error; });
+    }
+}
+
+//The version of a kind of index has to be increased whenever its content changes, so existing indexes are rebuilt.
+static const int valueIndexVersion = 2;
+static const int sortedIndexVersion = 2;
+static const int sortIndexVersion = 2;
+static const int compoundIndexVersion = 2;
+static const int coveringIndexVersion = 1;
+
+/*
+ * Index name -> state of the index
+ *
+ * A complete index is recorded with the version of its definition.
+ * An index that is being built is recorded with the version followed by a space and the last processed uid, if any.
+ */
+static const QByteArray definitionsDatabase = "index.definitions";
+
+QMap<QByteArray, int> TypeIndex::indexDefinitions() const
+{
+    QMap<QByteArray, int> definitions;
+    for (const auto &property : mProperties) {
+        definitions.insert(indexName(property), valueIndexVersion);
+    }
+    for (auto it = mSortedProperties.constBegin(); it != mSortedProperties.constEnd(); it++) {
+        definitions.insert(indexName(it.key(), it.value()), sortedIndexVersion);
+    }
+    for (const auto &property : mSortOnlyProperties) {
+        definitions.insert(indexName({}, property), sortIndexVersion);
+    }
+    for (const auto &properties : mCompoundProperties) {
+        definitions.insert(indexName(properties.join('.')), compoundIndexVersion);
+    }
+    for (const auto &covering : mCoveringIndexes) {
+        definitions.insert(covering.name, coveringIndexVersion);
+    }
     for (const auto &indexer : mCustomIndexer) {
+        if (!indexer->name().isEmpty()) {
+            definitions.insert(indexer->name(), indexer->version());
+        }
+    }
+    return definitions;
+}
+
+Sink::Indexer::Ptr TypeIndex::customIndexer(const QByteArray &name) const
+{
+    for (const auto &indexer : mCustomIndexer) {
+        if (indexer->name() == name) {
+            return indexer;
+        }
+    }
+    return {};
+}
+
+void TypeIndex::clearIndex(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction)
+{
+    if (auto indexer = customIndexer(name)) {
         indexer->setup(this, &transaction);
-        if (add) {
-            indexer->add(entity);
+        indexer->clear();
+    } else {
+        Index(name, transaction).clear();
+    }
+}
+
+static QByteArray recordedDefinition(const QByteArray &name, const Sink::Storage::DataStore::Transaction &transaction)
+{
+    QByteArray state;
+    transaction.openDatabase(definitionsDatabase, [](const Sink::Storage::DataStore::Error &) {}).scan(name, [&](const QByteArray &, const QByteArray &value) {
+            state = QByteArray{value.constData(), value.size()};
+            return false;
+        },
+        [](const Sink::Storage::DataStore::Error &) {});
+    return state;
+}
+
+QMap<QByteArray, QByteArray> TypeIndex::recordedDefinitions(Sink::Storage::DataStore::Transaction &transaction) const
+{
+    QMap<QByteArray, QByteArray> definitions;
+    const auto prefix = mType + ".index.";
+    //The database doesn't exist in read-only stores that have never recorded definitions
+    transaction.openDatabase(definitionsDatabase, [](const Sink::Storage::DataStore::Error &) {}).scanFrom(prefix, [&](const QByteArray &key, const QByteArray &value) {
+            if (!key.startsWith(prefix)) {
+                return false;
+            }
+            definitions.insert(QByteArray{key.constData(), key.size()}, QByteArray{value.constData(), value.size()});
+            return true;
+        },
+        [](const Sink::Storage::DataStore::Error &) {});
+    return definitions;
+}
+
+QByteArrayList TypeIndex::updateDefinitions(Sink::Storage::DataStore::Transaction &transaction)
+{
+    const auto recorded = recordedDefinitions(transaction);
+    const auto definitions = indexDefinitions();
+    auto definitionsDb = transaction.openDatabase(definitionsDatabase);
+    QByteArrayList indexesToBuild;
+    for (auto it = definitions.constBegin(); it != definitions.constEnd(); it++) {
+        const auto version = QByteArray::number(it.value());
+        auto state = recorded.value(it.key());
+        if (recorded.isEmpty()) {
+            if (!Sink::Storage::DataStore::mainDatabase(transaction, mType).entryCount()) {
+                //There is nothing to build yet
+                state = version;
+            } else if (Index(it.key(), transaction).statistics().entries > 0) {
+                //Stores that predate recorded definitions were built with the first version of the definitions
+                state = "1";
+            }
+            if (state == version) {
+                definitionsDb.write(it.key(), version);
+                continue;
+            }
+        }
+        if (state == version) {
+            continue;
+        }
+        if (state.startsWith(version + ' ')) {
+            //Continue an interrupted build
+            indexesToBuild << it.key();
+            continue;
+        }
+        if (!state.isEmpty()) {
+            SinkLogCtx(mLogCtx) << "Rebuilding outdated index: " << it.key();
         } else {
-            indexer->remove(entity);
+            SinkLogCtx(mLogCtx) << "Building new index: " << it.key();
+        }
+        //Custom indexers may have maintained their state before it was recorded
+        clearIndex(it.key(), transaction);
+        definitionsDb.write(it.key(), version + ' ');
+        indexesToBuild << it.key();
+    }
+    for (auto it = recorded.constBegin(); it != recorded.constEnd(); it++) {
+        if (!definitions.contains(it.key())) {
+            SinkLogCtx(mLogCtx) << "Removing index that is no longer defined: " << it.key();
+            Index(it.key(), transaction).clear();
+            definitionsDb.remove(it.key());
+        }
+    }
+    return indexesToBuild;
+}
+
+QByteArrayList TypeIndex::incompleteIndexes(Sink::Storage::DataStore::Transaction &transaction) const
+{
+    QByteArrayList indexes;
+    const auto recorded = recordedDefinitions(transaction);
+    for (auto it = recorded.constBegin(); it != recorded.constEnd(); it++) {
+        if (it.value().contains(' ')) {
+            indexes << it.key();
         }
     }
+    return indexes;
+}
+
+QByteArray TypeIndex::buildProgress(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction) const
+{
+    const auto state = recordedDefinitions(transaction).value(name);
+    return state.mid(state.indexOf(' ') + 1);
+}
+
+void TypeIndex::buildIndex(const QByteArray &name, const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction)
+{
+    if (auto indexer = customIndexer(name)) {
+        indexer->setup(this, &transaction);
+        indexer->build(entity);
+        return;
+    }
+    updateIndex(true, identifier, entity, transaction, name);
+    addToCoveringIndexes(identifier, entity, entity.revision(), transaction, name);
+}
 
+void TypeIndex::setBuildProgress(const QByteArray &name, const QByteArray &lastIdentifier, Sink::Storage::DataStore::Transaction &transaction)
+{
+    transaction.openDatabase(definitionsDatabase).write(name, QByteArray::number(indexDefinitions().value(name)) + ' ' + lastIdentifier);
+}
+
+void TypeIndex::finishBuild(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction)
+{
+    SinkLogCtx(mLogCtx) << "Finished building index: " << name;
+    transaction.openDatabase(definitionsDatabase).write(name, QByteArray::number(indexDefinitions().value(name)));
+}
+
+QMap<QByteArray, QVector<QPair<QByteArray, QByteArray>>> TypeIndex::expectedEntries(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction, const QByteArray &onlyIndex)
+{
+    QMap<QByteArray, QVector<QPair<QByteArray, QByteArray>>> entries;
+    mCollectedEntries = &entries;
+    updateIndex(true, identifier, entity, transaction, onlyIndex);
+    addToCoveringIndexes(identifier, entity, entity.revision(), transaction, onlyIndex);
+    mCollectedEntries = nullptr;
+    for (auto &indexEntries : entries) {
+        std::sort(indexEntries.begin(), indexEntries.end());
+        indexEntries.erase(std::unique(indexEntries.begin(), indexEntries.end()), indexEntries.end());
+    }
+    return entries;
+}
+
+bool TypeIndex::isCovering(const QByteArray &name) const
+{
+    return std::any_of(mCoveringIndexes.constBegin(), mCoveringIndexes.constEnd(), [&](const CoveringIndex &covering) { return covering.name == name; });
+}
+
+bool TypeIndex::containsEntry(const QByteArray &name, const QByteArray &key, const QByteArray &value, Sink::Storage::DataStore::Transaction &transaction)
+{
+    if (isCovering(name)) {
+        bool found = false;
+        transaction.openDatabase(name, [](const Sink::Storage::DataStore::Error &) {}).scan(key, [&](const QByteArray &, const QByteArray &) {
+                found = true;
+                return false;
+            },
+            [](const Sink::Storage::DataStore::Error &) {});
+        return found;
+    }
+    return transaction.openDatabase(name, [](const Sink::Storage::DataStore::Error &) {}, true).contains(key, value);
+}
+
+qint64 TypeIndex::entryCount(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction)
+{
+    return transaction.openDatabase(name, [](const Sink::Storage::DataStore::Error &) {}, !isCovering(name)).entryCount();
+}
+
+void TypeIndex::readEntries(const QByteArray &name, const std::function<void(const QByteArray &key, const QByteArray &value)> &callback, Sink::Storage::DataStore::Transaction &transaction)
+{
+    const bool covering = isCovering(name);
+    //The database doesn't exist in read-only stores if nothing has been indexed yet
+    transaction.openDatabase(name, [](const Sink::Storage::DataStore::Error &) {}, !covering).scan({}, [&](const QByteArray &key, const QByteArray &value) {
+            callback(key, covering ? QByteArray{} : value);
+            return true;
+        },
+        [&](const Sink::Storage::DataStore::Error &error) { SinkWarningCtx(mLogCtx) << "Failed to read index: " << name << error.message; });
+}
+
+void TypeIndex::scheduleRebuild(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction)
+{
+    SinkLogCtx(mLogCtx) << "Rebuilding index: " << name;
+    clearIndex(name, transaction);
+    transaction.openDatabase(definitionsDatabase).write(name, QByteArray::number(indexDefinitions().value(name)) + ' ');
+}
+
+bool TypeIndex::isReady(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction) const
+{
+    return isReady(name, indexDefinitions().value(name), transaction);
+}
+
+bool TypeIndex::isReady(const QByteArray &name, int version, const Sink::Storage::DataStore::Transaction &transaction)
+{
+    return recordedDefinition(name, transaction) == QByteArray::number(version);
+}
+
+bool TypeIndex::isBuilt(const QByteArray &name, const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction) const
+{
+    const auto version = QByteArray::number(indexDefinitions().value(name));
+    const auto state = recordedDefinition(name, transaction);
+    if (state == version) {
+        return true;
+    }
+    if (!state.startsWith(version + ' ')) {
+        return false;
+    }
+    //The build processes the entities in the order of their identifiers
+    const auto lastIdentifier = state.mid(version.size() + 1);
+    return !lastIdentifier.isEmpty() && identifier <= lastIdentifier;
 }
 
+//Custom indexers are updated with every write, and only the ones with a name can be built separately, see Indexer::build.
 void TypeIndex::add(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction)
 {
     updateIndex(true, identifier, entity, transaction);
+    for (const auto &indexer : mCustomIndexer) {
+        indexer->setup(this, &transaction);
+        indexer->add(entity);
+    }
+}
+
+void TypeIndex::modify(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &oldEntity, const Sink::ApplicationDomain::ApplicationDomainType &newEntity, Sink::Storage::DataStore::Transaction &transaction)
+{
+    updateIndex(false, identifier, oldEntity, transaction);
+    updateIndex(true, identifier, newEntity, transaction);
+    for (const auto &indexer : mCustomIndexer) {
+        indexer->setup(this, &transaction);
+        indexer->modify(oldEntity, newEntity);
+    }
 }
 
 void TypeIndex::remove(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction)
 {
     updateIndex(false, identifier, entity, transaction);
+    for (const auto &indexer : mCustomIndexer) {
+        indexer->setup(this, &transaction);
+        indexer->remove(entity);
+    }
+}
+
+void TypeIndex::addFulltextIndex()
+{
+    mFulltextIndexed = true;
+}
+
+void TypeIndex::updateFulltextIndex(const QByteArray &identifier, const QString &content, Sink::Storage::DataStore::Transaction &transaction)
+{
+    if (!mFulltextIndexed) {
+        SinkWarningCtx(mLogCtx) << "No fulltext index available for " << mType;
+        return;
+    }
+    FulltextIndex(mType + ".fulltext", transaction).update(identifier, content);
+}
+
+void TypeIndex::removeFulltextIndex(const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction)
+{
+    if (mFulltextIndexed) {
+        FulltextIndex(mType + ".fulltext", transaction).remove(identifier);
+    }
+}
+
+QByteArrayList TypeIndex::fulltextTokens(const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction)
+{
+    if (!mFulltextIndexed) {
+        return {};
+    }
+    return FulltextIndex(mType + ".fulltext", transaction).tokens(identifier);
+}
+
+static bool isRangeComparator(const QueryBase::Comparator &filter)
+{
+    return filter.comparator == Query::Comparator::LessThan || filter.comparator == Query::Comparator::GreaterThan || filter.comparator == Query::Comparator::Within;
+}
+
+/*
+ * The range of keys that matches a range comparator, or an equality comparator.
+ *
+ * The range is [lowerBound, upperBound), and appending a null byte results in the smallest key greater than the value.
+ */
+static bool rangeBounds(const QueryBase::Comparator &filter, QByteArray &lowerBound, QByteArray &upperBound)
+{
+    if (filter.comparator == Query::Comparator::Equals) {
+        lowerBound = getByteArray(filter.value);
+        upperBound = lowerBound + '\0';
+    } else if (filter.comparator == Query::Comparator::LessThan) {
+        upperBound = getByteArray(filter.value);
+    } else if (filter.comparator == Query::Comparator::GreaterThan) {
+        lowerBound = getByteArray(filter.value) + '\0';
+    } else {
+        const auto range = filter.value.value<QVariantList>();
+        if (range.size() != 2) {
+            SinkWarning() << "Invalid range: " << filter.value;
+            return false;
+        }
+        lowerBound = getByteArray(range.at(0));
+        upperBound = getByteArray(range.at(1)) + '\0';
+    }
+    return true;
+}
+
+static QVector<QByteArray> rangeLookup(Index &index, const QueryBase::Comparator &filter)
+{
+    QByteArray lowerBound;
+    QByteArray upperBound;
+    if (!rangeBounds(filter, lowerBound, upperBound)) {
+        return {};
+    }
+    QVector<QByteArray> keys;
+    index.rangeLookup(lowerBound, upperBound, [&](const QByteArray &value) { keys << value; },
+        [&](const Index::Error &error) { SinkWarning() << "Range lookup error in index: " << error.message << lowerBound << upperBound; });
+    return keys;
 }
 
 static QVector<QByteArray> indexLookup(Index &index, QueryBase::Comparator filter)
 {
+    if (isRangeComparator(filter)) {
+        return rangeLookup(index, filter);
+    }
     QVector<QByteArray> keys;
     QByteArrayList lookupKeys;
     if (filter.comparator == Query::Comparator::Equals) {
@@ -211,11 +934,52 @@ static QVector<QByteArray> indexLookup(Index &index, QueryBase::Comparator filte
     return keys;
 }
 
+namespace {
+struct AccessPath {
+    double cost = 0;
+    QByteArrayList filters;
+    QByteArray description;
+    std::function<QVector<QByteArray>()> lookup;
+    //Set if the lookup returns a superset of the matches, so the filters still have to be applied
+    bool superset = false;
+};
+}
+
+/*
+ * Estimates the number of values that match a lookup of a single key.
+ *
+ * @param keyFraction the fraction of the key that is known, for prefix lookups on compound indexes.
+ */
+static double estimateResultSize(const Index::Statistics &statistics, double keyFraction = 1.0)
+{
+    if (statistics.distinctKeys <= 0) {
+        //Without statistics we have to assume the worst
+        return statistics.entries;
+    }
+    return statistics.entries / std::pow(static_cast<double>(statistics.distinctKeys), keyFraction);
+}
+
+static QVector<QByteArray> sortedUnique(QVector<QByteArray> keys)
+{
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+//How many more candidates than we already have an additional index may return to still be used for an intersection.
+static const double intersectionCostFactor = 10;
+
+//How much smaller than the full set the result of an index has to be, to be preferred over an ordered scan.
+static const double selectiveIndexFactor = 10;
+
 QVector<QByteArray> TypeIndex::query(const Sink::QueryBase &query, QSet<QByteArray> &appliedFilters, QByteArray &appliedSorting, Sink::Storage::DataStore::Transaction &transaction)
 {
+    flushBulkLoad(transaction);
     QVector<QByteArray> keys;
+    //Without a sort stage the ordering of a sorted index takes precedence over the selectivity of other indexes.
     for (auto it = mSortedProperties.constBegin(); it != mSortedProperties.constEnd(); it++) {
-        if (query.hasFilter(it.key()) && query.sortProperty() == it.value()) {
+        //The sorted index is only ordered by the sort property within a single value
+        if (query.hasFilter(it.key()) && query.sortProperty() == it.value() && !isRangeComparator(query.getFilter(it.key())) && isReady(indexName(it.key(), it.value()), transaction)) {
             Index index(indexName(it.key(), it.value()), transaction);
             keys << indexLookup(index, query.getFilter(it.key()));
             appliedFilters << it.key();
@@ -224,21 +988,272 @@ QVector<QByteArray> TypeIndex::query(const Sink::QueryBase &query, QSet<QByteArr
             return keys;
         }
     }
-    for (const auto &property : mProperties) {
-        if (query.hasFilter(property)) {
-            Index index(indexName(property), transaction);
-            keys << indexLookup(index, query.getFilter(property));
+    QList<AccessPath> paths;
+
+    for (const auto &properties : mCompoundProperties) {
+        int prefixLength = 0;
+        while (prefixLength < properties.size() && query.hasFilter(properties.at(prefixLength)) && query.getFilter(properties.at(prefixLength)).comparator == Query::Comparator::Equals) {
+            prefixLength++;
+        }
+        const auto name = indexName(properties.join('.'));
+        if (!prefixLength || !isReady(name, transaction)) {
+            continue;
+        }
+        const auto matchedProperties = properties.mid(0, prefixLength);
+        AccessPath path;
+        //Assuming independent properties, every matched property reduces the number of candidates by the same factor.
+        path.cost = estimateResultSize(Index(name, transaction).statistics(), static_cast<double>(prefixLength) / properties.size());
+        path.filters = matchedProperties;
+        path.description = name;
+        path.lookup = [&, name, matchedProperties] {
+            QVariantList values;
+            for (const auto &property : matchedProperties) {
+                values << query.getFilter(property).value;
+            }
+            //All keys with the prefix are in [prefix, prefix with the last null byte replaced by 1)
+            const auto lowerBound = toCompoundKey(values);
+            auto upperBound = lowerBound;
+            upperBound[upperBound.size() - 1] = '\1';
+            QVector<QByteArray> result;
+            Index(name, transaction).rangeLookup(lowerBound, upperBound, [&](const QByteArray &value) { result << value; },
+                [&](const Index::Error &error) { SinkWarningCtx(mLogCtx) << "Lookup error in index: " << error.message << matchedProperties; });
+            return result;
+        };
+        paths << path;
+    }
+
+    //Returns an access path without lookup if the filter can't use an index
+    auto filterPath = [&](const QByteArray &property, const QueryBase::Comparator &filter) {
+        AccessPath path;
+        path.filters = QByteArrayList{property};
+        if (filter.comparator == Query::Comparator::Fulltext) {
+            if (mFulltextIndexed) {
+                const auto text = filter.value.toString();
+                path.cost = estimateResultSize(FulltextIndex(mType + ".fulltext", transaction).statistics());
+                path.description = mType + ".fulltext";
+                //The tokens are a superset of the filtered property, and may contain tokens of previous revisions
+                path.superset = true;
+                path.lookup = [&, text] {
+                    return FulltextIndex(mType + ".fulltext", transaction).lookup(text);
+                };
+            }
+        } else if (mProperties.contains(property) && isReady(indexName(property), transaction)) {
+            const auto name = indexName(property);
+            const auto statistics = Index(name, transaction).statistics();
+            if (isRangeComparator(filter)) {
+                //We have no histograms, so we assume a range matches a third of the values.
+                path.cost = statistics.entries / 3.0;
+            } else if (filter.comparator == Query::Comparator::In) {
+                path.cost = estimateResultSize(statistics) * filter.value.value<QByteArrayList>().size();
+            } else {
+                path.cost = estimateResultSize(statistics);
+            }
+            path.description = name;
+            path.lookup = [&, name, filter] {
+                Index index(name, transaction);
+                return indexLookup(index, filter);
+            };
+        }
+        return path;
+    };
+
+    const auto filters = query.getBaseFilters();
+    for (auto it = filters.constBegin(); it != filters.constEnd(); it++) {
+        const auto path = filterPath(it.key(), it.value());
+        if (path.lookup) {
+            paths << path;
+        }
+    }
+
+    //An Or filter can only use indexes if every alternative can
+    for (const auto &orFilter : query.getOrFilters()) {
+        QList<AccessPath> alternatives;
+        for (const auto &alternative : orFilter.alternatives) {
+            alternatives << filterPath(alternative.first, alternative.second);
+        }
+        if (alternatives.isEmpty() || std::any_of(alternatives.constBegin(), alternatives.constEnd(), [] (const AccessPath &path) { return !path.lookup; })) {
+            continue;
+        }
+        AccessPath path;
+        for (const auto &alternative : alternatives) {
+            path.cost += alternative.cost;
+            path.filters << alternative.filters;
+            path.superset |= alternative.superset;
+            path.description += (path.description.isEmpty() ? "" : " | ") + alternative.description;
+        }
+        path.lookup = [alternatives] {
+            QVector<QByteArray> result;
+            for (const auto &alternative : alternatives) {
+                result << alternative.lookup();
+            }
+            return sortedUnique(result);
+        };
+        paths << path;
+    }
+
+    std::sort(paths.begin(), paths.end(), [] (const AccessPath &left, const AccessPath &right) { return left.cost < right.cost; });
+
+    //The main database also contains old revisions, so this overestimates the cost of a full scan a bit.
+    const double fullScanCost = Sink::Storage::DataStore::mainDatabase(transaction, mType).entryCount();
+    //An ordered scan has to skip every entity that doesn't match the filters, so it doesn't pay off if an index narrows down the result considerably.
+    if (mSortOnlyProperties.contains(query.sortProperty()) && isReady(indexName({}, query.sortProperty()), transaction) && (paths.isEmpty() || paths.first().cost * selectiveIndexFactor >= fullScanCost)) {
+        const auto name = indexName({}, query.sortProperty());
+        Index(name, transaction).rangeLookup({}, {}, [&](const QByteArray &value) { keys << value; },
+            [&](const Index::Error &error) { SinkWarningCtx(mLogCtx) << "Lookup error in index: " << error.message << name; });
+        appliedSorting = query.sortProperty();
+        SinkTraceCtx(mLogCtx) << "Ordered scan of " << name << " found " << keys.size() << " keys.";
+        return keys;
+    }
+    if (paths.isEmpty() || fullScanCost < paths.first().cost) {
+        SinkTraceCtx(mLogCtx) << "No index that is cheaper than a full scan";
+        return keys;
+    }
+
+    const auto best = paths.takeFirst();
+    keys = best.lookup();
+    if (!best.superset) {
+        for (const auto &property : best.filters) {
             appliedFilters << property;
-            SinkTraceCtx(mLogCtx) << "Index lookup on " << property << " found " << keys.size() << " keys.";
-            return keys;
         }
     }
-    SinkTraceCtx(mLogCtx) << "No matching index";
+    SinkTraceCtx(mLogCtx) << "Index lookup on " << best.description << " with estimated cost " << best.cost << " found " << keys.size() << " keys.";
+
+    //Reading index entries is much cheaper than reading entities, so further indexes are worth it unless they return a lot more candidates.
+    for (const auto &path : paths) {
+        if (keys.size() <= 1 || path.cost > intersectionCostFactor * keys.size()) {
+            break;
+        }
+        if (path.filters.toSet().subtract(appliedFilters).isEmpty()) {
+            continue;
+        }
+        keys = sortedUnique(keys);
+        const auto other = sortedUnique(path.lookup());
+        QVector<QByteArray> intersection;
+        std::set_intersection(keys.constBegin(), keys.constEnd(), other.constBegin(), other.constEnd(), std::back_inserter(intersection));
+        keys = intersection;
+        if (!path.superset) {
+            for (const auto &property : path.filters) {
+                appliedFilters << property;
+            }
+        }
+        SinkTraceCtx(mLogCtx) << "Intersected with " << path.description << ", " << keys.size() << " keys remaining.";
+    }
     return keys;
 }
 
+qint64 TypeIndex::count(const Sink::QueryBase &query, Sink::Storage::DataStore::Transaction &transaction)
+{
+    flushBulkLoad(transaction);
+    const auto filters = query.getBaseFilters();
+    if (filters.isEmpty() || !query.ids().isEmpty() || !query.getOrFilters().isEmpty() || query.snapshotRevision()) {
+        return -1;
+    }
+    for (const auto &filter : filters) {
+        if (filter.value.canConvert<Query>()) {
+            return -1;
+        }
+    }
+
+    //Counting the values in the range of a single value index
+    if (filters.size() == 1) {
+        const auto property = filters.constBegin().key();
+        const auto filter = filters.constBegin().value();
+        const auto name = indexName(property);
+        if (mProperties.contains(property) && isReady(name, transaction) && (filter.comparator == Query::Comparator::Equals || isRangeComparator(filter))) {
+            QByteArray lowerBound;
+            QByteArray upperBound;
+            if (!rangeBounds(filter, lowerBound, upperBound)) {
+                return -1;
+            }
+            SinkTraceCtx(mLogCtx) << "Counting in index: " << name;
+            return Index(name, transaction).count(lowerBound, upperBound);
+        }
+    }
+
+    //Counting the values with a prefix of a compound index
+    for (const auto &properties : mCompoundProperties) {
+        if (properties.size() < filters.size()) {
+            continue;
+        }
+        const auto prefix = properties.mid(0, filters.size());
+        const auto matches = std::all_of(prefix.constBegin(), prefix.constEnd(), [&](const QByteArray &property) {
+            return filters.contains(property) && filters.value(property).comparator == Query::Comparator::Equals;
+        });
+        const auto name = indexName(properties.join('.'));
+        if (!matches || !isReady(name, transaction)) {
+            continue;
+        }
+        QVariantList values;
+        for (const auto &property : prefix) {
+            values << filters.value(property).value;
+        }
+        const auto lowerBound = toCompoundKey(values);
+        auto upperBound = lowerBound;
+        upperBound[upperBound.size() - 1] = '\1';
+        SinkTraceCtx(mLogCtx) << "Counting in index: " << name;
+        return Index(name, transaction).count(lowerBound, upperBound);
+    }
+    return -1;
+}
+
+bool TypeIndex::coveringQuery(const Sink::QueryBase &query, const QByteArrayList &requestedProperties, QByteArray &index, QVector<QByteArray> &identifiers, QVector<QByteArray> &keys, Sink::Storage::DataStore::Transaction &transaction)
+{
+    //Without requested properties all properties are required
+    if (requestedProperties.isEmpty() || !query.ids().isEmpty() || !query.getOrFilters().isEmpty() || query.snapshotRevision()) {
+        return false;
+    }
+    const auto filters = query.getBaseFilters();
+    for (const auto &covering : mCoveringIndexes) {
+        if (!filters.contains(covering.property) || filters.value(covering.property).comparator != Query::Comparator::Equals) {
+            continue;
+        }
+        if (!query.sortProperty().isEmpty() && query.sortProperty() != covering.sortProperty) {
+            continue;
+        }
+        const auto isCovered = [&](const QByteArray &property) {
+            return covering.projectedProperties.contains(property);
+        };
+        if (!std::all_of(requestedProperties.constBegin(), requestedProperties.constEnd(), isCovered)) {
+            continue;
+        }
+        const auto filterProperties = filters.keys();
+        if (!std::all_of(filterProperties.constBegin(), filterProperties.constEnd(), isCovered)) {
+            continue;
+        }
+        if (!isReady(covering.name, transaction)) {
+            continue;
+        }
+        const auto prefix = getByteArray(filters.value(covering.property).value) + '\0';
+        //The sort value has a fixed size, so the identifier follows at a fixed offset.
+        const auto identifierOffset = prefix.size() + SortableKey::size;
+        transaction.openDatabase(covering.name).scanFrom(prefix, [&](const QByteArray &key, const QByteArray &) {
+                if (!key.startsWith(prefix)) {
+                    return false;
+                }
+                keys << QByteArray{key.constData(), key.size()};
+                identifiers << key.mid(identifierOffset);
+                return true;
+            },
+            [&](const Sink::Storage::DataStore::Error &error) { SinkWarningCtx(mLogCtx) << "Lookup error in index: " << error.message << covering.name; });
+        index = covering.name;
+        SinkTraceCtx(mLogCtx) << "Covering index lookup on " << covering.name << " found " << keys.size() << " keys.";
+        return true;
+    }
+    return false;
+}
+
+void TypeIndex::projection(const QByteArray &index, const QByteArray &key, const std::function<void(const QByteArray &projection)> &callback, Sink::Storage::DataStore::Transaction &transaction)
+{
+    transaction.openDatabase(index).scan(key, [&](const QByteArray &, const QByteArray &value) {
+            callback(value);
+            return false;
+        },
+        [&](const Sink::Storage::DataStore::Error &error) { SinkWarningCtx(mLogCtx) << "Failed to read projection: " << index << error.message; });
+}
+
 QVector<QByteArray> TypeIndex::lookup(const QByteArray &property, const QVariant &value, Sink::Storage::DataStore::Transaction &transaction)
 {
+    flushBulkLoad(transaction);
     SinkTraceCtx(mLogCtx) << "Index lookup on property: " << property << mSecondaryProperties.keys() << mProperties;
     if (mProperties.contains(property)) {
         QVector<QByteArray> keys;
@@ -254,10 +1269,13 @@ QVector<QByteArray> TypeIndex::lookup(const QByteArray &property, const QVariant
         auto resultProperty = mSecondaryProperties.value(property);
 
         QVector<QByteArray> secondaryKeys;
-        Index index(indexName(property + resultProperty), transaction);
-        const auto lookupKey = getByteArray(value);
-        index.lookup(
-            lookupKey, [&, this](const QByteArray &value) { secondaryKeys << value; }, [property, this](const Index::Error &error) { SinkWarning() << "Error in index: " << error.message << property; });
+        Index index(indexName(property + resultProperty), transaction, true);
+        //Entries may have been indexed with any value that has been merged into the same set
+        const auto root = resolveValue(property, getByteArray(value), transaction);
+        for (const auto &lookupKey : QByteArrayList{root} + mergedValues(property, root, transaction)) {
+            index.lookup(
+                lookupKey, [&, this](const QByteArray &value) { secondaryKeys << value; }, [property, this](const Index::Error &error) { SinkWarning() << "Error in index: " << error.message << property; });
+        }
         SinkTraceCtx(mLogCtx) << "Looked up secondary keys: " << secondaryKeys;
         for (const auto &secondary : secondaryKeys) {
             keys += lookup(resultProperty, secondary, transaction);
@@ -272,32 +1290,84 @@ QVector<QByteArray> TypeIndex::lookup(const QByteArray &property, const QVariant
 template <>
 void TypeIndex::index<QByteArray, QByteArray>(const QByteArray &leftName, const QByteArray &rightName, const QVariant &leftValue, const QVariant &rightValue, Sink::Storage::DataStore::Transaction &transaction)
 {
-    Index(indexName(leftName + rightName), transaction).add(getByteArray(leftValue), getByteArray(rightValue));
+    Index(indexName(leftName + rightName), transaction, true).add(getByteArray(leftValue), getByteArray(rightValue));
 }
 
 template <>
 void TypeIndex::index<QString, QByteArray>(const QByteArray &leftName, const QByteArray &rightName, const QVariant &leftValue, const QVariant &rightValue, Sink::Storage::DataStore::Transaction &transaction)
 {
-    Index(indexName(leftName + rightName), transaction).add(getByteArray(leftValue), getByteArray(rightValue));
+    Index(indexName(leftName + rightName), transaction, true).add(getByteArray(leftValue), getByteArray(rightValue));
 }
 
 template <>
 void TypeIndex::unindex<QByteArray, QByteArray>(const QByteArray &leftName, const QByteArray &rightName, const QVariant &leftValue, const QVariant &rightValue, Sink::Storage::DataStore::Transaction &transaction)
 {
-    Index(indexName(leftName + rightName), transaction).remove(getByteArray(leftValue), getByteArray(rightValue));
+    Index(indexName(leftName + rightName), transaction, true).remove(getByteArray(leftValue), getByteArray(rightValue));
 }
 
 template <>
 void TypeIndex::unindex<QString, QByteArray>(const QByteArray &leftName, const QByteArray &rightName, const QVariant &leftValue, const QVariant &rightValue, Sink::Storage::DataStore::Transaction &transaction)
 {
-    Index(indexName(leftName + rightName), transaction).remove(getByteArray(leftValue), getByteArray(rightValue));
+    Index(indexName(leftName + rightName), transaction, true).remove(getByteArray(leftValue), getByteArray(rightValue));
+}
+
+/*
+ * property.alias: value -> root of its set, only for values that have been merged into another one
+ * property.merged: root -> all values that have been merged into it
+ */
+QByteArray TypeIndex::resolveValue(const QByteArray &property, const QByteArray &value, Sink::Storage::DataStore::Transaction &transaction)
+{
+    QByteArray root = value;
+    //The database doesn't exist in read-only stores if nothing has been merged yet
+    transaction.openDatabase(indexName(property) + ".alias", [](const Sink::Storage::DataStore::Error &) {}).scan(value, [&](const QByteArray &, const QByteArray &v) {
+            root = v;
+            return false;
+        },
+        [](const Sink::Storage::DataStore::Error &) {});
+    return root;
+}
+
+QByteArrayList TypeIndex::mergedValues(const QByteArray &property, const QByteArray &root, Sink::Storage::DataStore::Transaction &transaction)
+{
+    QByteArrayList values;
+    Index(indexName(property) + ".merged", transaction).lookup(root, [&](const QByteArray &value) { values << value; }, [](const Index::Error &) {});
+    return values;
+}
+
+QByteArray TypeIndex::mergeValues(const QByteArray &property, const QByteArray &left, const QByteArray &right, Sink::Storage::DataStore::Transaction &transaction)
+{
+    const auto leftRoot = resolveValue(property, left, transaction);
+    const auto rightRoot = resolveValue(property, right, transaction);
+    if (leftRoot == rightRoot) {
+        return leftRoot;
+    }
+    auto leftMembers = mergedValues(property, leftRoot, transaction);
+    auto rightMembers = mergedValues(property, rightRoot, transaction);
+
+    //Union by size, ties keep the left root
+    const bool keepLeft = leftMembers.size() >= rightMembers.size();
+    const auto root = keepLeft ? leftRoot : rightRoot;
+    const auto mergedRoot = keepLeft ? rightRoot : leftRoot;
+    const auto moved = QByteArrayList{mergedRoot} + (keepLeft ? rightMembers : leftMembers);
+    SinkTraceCtx(mLogCtx) << "Merging " << property << mergedRoot << " into " << root << ", moving " << moved.size() << " values";
+
+    auto aliases = transaction.openDatabase(indexName(property) + ".alias");
+    Index merged(indexName(property) + ".merged", transaction);
+    for (const auto &value : moved) {
+        aliases.write(value, root, [&](const Sink::Storage::DataStore::Error &error) { SinkWarningCtx(mLogCtx) << "Failed to merge values: " << property << error.message; });
+        merged.add(root, value);
+        if (value != mergedRoot) {
+            merged.remove(mergedRoot, value);
+        }
+    }
+    return root;
 }
 
 template <>
 QVector<QByteArray> TypeIndex::secondaryLookup<QByteArray>(const QByteArray &leftName, const QByteArray &rightName, const QVariant &value)
 {
     QVector<QByteArray> keys;
-    Index index(indexName(leftName + rightName), *mTransaction);
+    Index index(indexName(leftName + rightName), *mTransaction, true);
     const auto lookupKey = getByteArray(value);
     index.lookup(
         lookupKey, [&](const QByteArray &value) { keys << value; }, [=](const Index::Error &error) { SinkWarning() << "Lookup error in secondary index: " << error.message << value << lookupKey; });
@@ -309,7 +1379,7 @@ template <>
 QVector<QByteArray> TypeIndex::secondaryLookup<QString>(const QByteArray &leftName, const QByteArray &rightName, const QVariant &value)
 {
     QVector<QByteArray> keys;
-    Index index(indexName(leftName + rightName), *mTransaction);
+    Index index(indexName(leftName + rightName), *mTransaction, true);
     const auto lookupKey = getByteArray(value);
     index.lookup(
         lookupKey, [&](const QByteArray &value) { keys << value; }, [=](const Index::Error &error) { SinkWarning() << "Lookup error in secondary index: " << error.message << value << lookupKey; });
@@ -24,6 +24,7 @@
 #include "log.h"
 #include "indexer.h"
 #include <QByteArray>
+#include <QSet>
 
 namespace Sink {
 namespace Storage {
@@ -59,6 +60,51 @@ public:
         addPropertyWithSorting<typename T::Type>(T::name);
     }
 
+    /**
+     * Adds an index that only orders all entities by @param property.
+     *
+     * A query that sorts by the property can use the index as ordered source, regardless of its filters.
+     */
+    template <typename T>
+    void addSortedProperty(const QByteArray &property);
+
+    template <typename T>
+    void addSortedProperty()
+    {
+        addSortedProperty<typename T::Type>(T::name);
+    }
+
+    /**
+     * Adds an index over the combined values of @param properties.
+     *
+     * A query can use the index if it filters for equality on a prefix of the properties.
+     */
+    void addCompoundProperty(const QByteArrayList &properties);
+
+    template <typename ... Properties>
+    void addCompoundProperty()
+    {
+        addCompoundProperty(QByteArrayList{Properties::name...});
+    }
+
+    /**
+     * Adds an index over @param property sorted by @param sortProperty, that stores the @param projectedProperties of every entity.
+     *
+     * A query that filters for equality on the property and only requests projected properties is answered from the index alone.
+     * The projection is serialized by the projector, because the index doesn't know the buffer format of the type.
+     */
+    template <typename T, typename S>
+    void addCoveringProperty(const QByteArray &property, const QByteArray &sortProperty, const QByteArrayList &projectedProperties);
+
+    template <typename T, typename S, typename ... Projected>
+    void addCoveringProperty()
+    {
+        addCoveringProperty<typename T::Type, typename S::Type>(T::name, S::name, QByteArrayList{Projected::name...});
+    }
+
+    typedef std::function<QByteArray(const Sink::ApplicationDomain::ApplicationDomainType &entity, const QByteArrayList &properties, qint64 revision)> Projector;
+    void setProjector(const Projector &projector);
+
     template <typename Left, typename Right>
     void addSecondaryProperty()
     {
@@ -71,10 +117,156 @@ public:
         mCustomIndexer << CustomIndexer::Ptr::create();
     }
 
+    template <typename CustomIndexer>
+    void addCustomIndexer()
+    {
+        mCustomIndexer << CustomIndexer::Ptr::create();
+    }
+
+    /**
+     * Enables the fulltext index of the type.
+     *
+     * The indexed content is not derived from the entity but supplied via updateFulltextIndex, typically by a preprocessor.
+     */
+    void addFulltextIndex();
+    void updateFulltextIndex(const QByteArray &identifier, const QString &content, Sink::Storage::DataStore::Transaction &transaction);
+    void removeFulltextIndex(const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction);
+    QByteArrayList fulltextTokens(const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * The indexes that are derived from the entity properties alone, with the version of their definition.
+     *
+     * This includes the state of custom indexers that can be built from the existing entities, see Indexer::name.
+     */
+    QMap<QByteArray, int> indexDefinitions() const;
+
+    /**
+     * Compares the index definitions with the indexes in the store.
+     *
+     * Outdated indexes are cleared and indexes that are no longer defined are removed.
+     * @return the indexes that have to be built from the existing entities.
+     */
+    QByteArrayList updateDefinitions(Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * The indexes that are still being built.
+     */
+    QByteArrayList incompleteIndexes(Sink::Storage::DataStore::Transaction &transaction) const;
+
+    /**
+     * Adds @param entity to the index @param name only, to build the index from the existing entities.
+     *
+     * Entities that are written meanwhile are added to all indexes, so a build can be spread over many transactions.
+     */
+    void buildIndex(const QByteArray &name, const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * The identifier of the last entity that has been added to the index @param name, or an empty bytearray.
+     */
+    QByteArray buildProgress(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction) const;
+    void setBuildProgress(const QByteArray &name, const QByteArray &lastIdentifier, Sink::Storage::DataStore::Transaction &transaction);
+    void finishBuild(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * The entries as key and value that the indexes should contain for @param entity, by index name, in the order of the index.
+     *
+     * Covering indexes only report the keys, with an empty value.
+     * Custom indexes such as the thread index, secondary indexes and the fulltext index are not included.
+     */
+    QMap<QByteArray, QVector<QPair<QByteArray, QByteArray>>> expectedEntries(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction, const QByteArray &onlyIndex = QByteArray());
+
+    /**
+     * Returns true if the index @param name contains the entry, as reported by expectedEntries.
+     */
+    bool containsEntry(const QByteArray &name, const QByteArray &key, const QByteArray &value, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * The number of entries of the index @param name.
+     */
+    qint64 entryCount(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Reads all entries of the index @param name in the order of the index, like expectedEntries.
+     */
+    void readEntries(const QByteArray &name, const std::function<void(const QByteArray &key, const QByteArray &value)> &callback, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Clears the index @param name, so it is built again from the existing entities.
+     */
+    void scheduleRebuild(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Returns true if the index @param name is complete, so queries can use it.
+     */
+    bool isReady(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction) const;
+
+    /**
+     * Returns true if the index @param name is complete with @param version, for state that is read without the index of its type.
+     */
+    static bool isReady(const QByteArray &name, int version, const Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Returns true if the entity @param identifier has already been added to the index @param name.
+     *
+     * That is the case for all entities once the index is complete, and for the entities the build has already processed.
+     */
+    bool isBuilt(const QByteArray &name, const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction) const;
+
+    /**
+     * Buffers the entries of the property indexes until endBulkLoad, to write them sorted by key.
+     *
+     * Sorted writes touch every page of an index once, instead of inserting at a random position for every entity.
+     * Indexes that are empty, as during the initial sync, are loaded by appending the sorted entries,
+     * without searching the position of every entry, and their statistics are written once.
+     * If the buffer is full its entries are spilled as a sorted run, and the runs are merged at the end.
+     * Lookups and queries write the buffered entries first, so they always see all entities.
+     * Removals of buffered entries drop them from the buffer instead.
+     */
+    void startBulkLoad();
+    void endBulkLoad(Sink::Storage::DataStore::Transaction &transaction);
+    void abortBulkLoad();
+
     void add(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Replaces the entries of @param oldEntity with the ones of @param newEntity.
+     *
+     * Custom indexers get the modification as a whole, so they can keep state such as the thread of a mail.
+     */
+    void modify(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &oldEntity, const Sink::ApplicationDomain::ApplicationDomainType &newEntity, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Writes the projection of @param entity at @param revision to the covering indexes.
+     *
+     * The projection contains the revision, so this can only be done once the revision of the entity is known.
+     * Removals are handled by remove like for all other indexes.
+     */
+    void addToCoveringIndexes(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, qint64 revision, Sink::Storage::DataStore::Transaction &transaction, const QByteArray &onlyIndex = QByteArray());
     void remove(const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction);
 
     QVector<QByteArray> query(const Sink::QueryBase &query, QSet<QByteArray> &appliedFilters, QByteArray &appliedSorting, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Counts the entities that match the filters of @param query from the index alone.
+     *
+     * This only works if a single index applies all filters, otherwise -1 is returned.
+     */
+    qint64 count(const Sink::QueryBase &query, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Looks up a covering index that can answer @param query with @param requestedProperties on its own.
+     *
+     * @param index is set to the name of the index, @param identifiers and @param keys to the identifiers and index keys of the matching entities in order.
+     * @return false if no covering index applies, in which case the query has to read the main database.
+     */
+    bool coveringQuery(const Sink::QueryBase &query, const QByteArrayList &requestedProperties, QByteArray &index, QVector<QByteArray> &identifiers, QVector<QByteArray> &keys, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Reads the projection stored with @param key in the covering index @param index.
+     *
+     * The projection is only valid during the execution of @param callback.
+     */
+    void projection(const QByteArray &index, const QByteArray &key, const std::function<void(const QByteArray &projection)> &callback, Sink::Storage::DataStore::Transaction &transaction);
     QVector<QByteArray> lookup(const QByteArray &property, const QVariant &value, Sink::Storage::DataStore::Transaction &transaction);
 
     template <typename Left, typename Right>
@@ -98,25 +290,104 @@ public:
     template <typename Left, typename Right>
     void unindex(const QVariant &leftValue, const QVariant &rightValue, Sink::Storage::DataStore::Transaction &transaction)
     {
-        index<typename Left::Type, typename Right::Type>(Left::name, Right::name, leftValue, rightValue, transaction);
+        unindex<typename Left::Type, typename Right::Type>(Left::name, Right::name, leftValue, rightValue, transaction);
     }
 
     template <typename LeftType, typename RightType>
     void unindex(const QByteArray &leftName, const QByteArray &rightName, const QVariant &leftValue, const QVariant &rightValue, Sink::Storage::DataStore::Transaction &transaction);
 
+    /**
+     * Merges the values @param left and @param right of @param property, so both resolve to the same value.
+     *
+     * The values form a union-find structure: every merged value points directly to the root of its set,
+     * and the smaller set is always moved to the larger one, so a value is moved at most a logarithmic number of times.
+     * Entries that have been indexed with a merged value are never rewritten, lookups resolve them instead.
+     * @return the root of the merged set.
+     */
+    QByteArray mergeValues(const QByteArray &property, const QByteArray &left, const QByteArray &right, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Returns the root of the set @param value has been merged into, or @param value itself.
+     */
+    QByteArray resolveValue(const QByteArray &property, const QByteArray &value, Sink::Storage::DataStore::Transaction &transaction);
+
+    /**
+     * Returns the values that have been merged into @param root, without the root itself.
+     */
+    QByteArrayList mergedValues(const QByteArray &property, const QByteArray &root, Sink::Storage::DataStore::Transaction &transaction);
+
+    template <typename T>
+    QByteArray mergeValues(const QByteArray &left, const QByteArray &right, Sink::Storage::DataStore::Transaction &transaction)
+    {
+        return mergeValues(T::name, left, right, transaction);
+    }
+
+    template <typename T>
+    QByteArray resolveValue(const QByteArray &value)
+    {
+        return resolveValue(T::name, value, *mTransaction);
+    }
+
+    template <typename T>
+    QByteArrayList mergedValues(const QByteArray &root)
+    {
+        return mergedValues(T::name, root, *mTransaction);
+    }
+
+    /**
+     * The transaction the index is currently used with, for values that are looked up by the IndexPropertyMapper.
+     */
+    Sink::Storage::DataStore::Transaction &transaction()
+    {
+        return *mTransaction;
+    }
+
 
 private:
     friend class Sink::Storage::EntityStore;
-    void updateIndex(bool add, const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction);
+    void updateIndex(bool add, const QByteArray &identifier, const Sink::ApplicationDomain::ApplicationDomainType &entity, Sink::Storage::DataStore::Transaction &transaction, const QByteArray &onlyIndex = QByteArray());
+    QMap<QByteArray, QByteArray> recordedDefinitions(Sink::Storage::DataStore::Transaction &transaction) const;
+    Sink::Indexer::Ptr customIndexer(const QByteArray &name) const;
+    void clearIndex(const QByteArray &name, Sink::Storage::DataStore::Transaction &transaction);
     QByteArray indexName(const QByteArray &property, const QByteArray &sortProperty = QByteArray()) const;
+    void addEntry(const QByteArray &name, const QByteArray &key, const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction);
+    bool isCovering(const QByteArray &name) const;
+    void removeEntry(const QByteArray &name, const QByteArray &key, const QByteArray &identifier, Sink::Storage::DataStore::Transaction &transaction);
+    void flushBulkLoad(Sink::Storage::DataStore::Transaction &transaction);
+    void spillBulkLoad(Sink::Storage::DataStore::Transaction &transaction);
+    void mergeBulkRuns(const QByteArray &name, const QList<QPair<QByteArray, QByteArray>> &entries, Sink::Storage::DataStore::Transaction &transaction);
     Sink::Log::Context mLogCtx;
     QByteArray mType;
     QByteArrayList mProperties;
     QMap<QByteArray, QByteArray> mSortedProperties;
+    QByteArrayList mSortOnlyProperties;
+    QList<QByteArrayList> mCompoundProperties;
+    struct CoveringIndex {
+        QByteArray name;
+        QByteArray property;
+        QByteArray sortProperty;
+        QByteArrayList projectedProperties;
+    };
+    QList<CoveringIndex> mCoveringIndexes;
+    Projector mProjector;
     //<Property, ResultProperty>
     QMap<QByteArray, QByteArray> mSecondaryProperties;
     QList<Sink::Indexer::Ptr> mCustomIndexer;
+    bool mFulltextIndexed = false;
+    bool mBulkLoad = false;
+    //Index name -> buffered entries
+    QMap<QByteArray, QSet<QPair<QByteArray, QByteArray>>> mBulkEntries;
+    int mBulkEntryCount = 0;
+    //Index name -> whether the index was empty when the bulk load started, so its entries are appended
+    QHash<QByteArray, bool> mBulkAppend;
+    //Index name -> number of sorted runs spilled to the run database
+    QHash<QByteArray, int> mBulkRuns;
+    //Index name -> spilled entries that have been removed since
+    QMap<QByteArray, QSet<QPair<QByteArray, QByteArray>>> mBulkRemovals;
+    //Set while the expected entries of an entity are collected instead of written
+    QMap<QByteArray, QVector<QPair<QByteArray, QByteArray>>> *mCollectedEntries = nullptr;
     Sink::Storage::DataStore::Transaction *mTransaction;
     QHash<QByteArray, std::function<void(bool, const QByteArray &identifier, const QVariant &value, Sink::Storage::DataStore::Transaction &transaction)>> mIndexer;
     QHash<QByteArray, std::function<void(bool, const QByteArray &identifier, const QVariant &value, const QVariant &sortValue, Sink::Storage::DataStore::Transaction &transaction)>> mSortIndexer;
+    QHash<QByteArray, std::function<void(bool, const QByteArray &identifier, const QVariant &sortValue, Sink::Storage::DataStore::Transaction &transaction)>> mSortOnlyIndexer;
 };
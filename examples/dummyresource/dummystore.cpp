@@ -60,8 +60,10 @@ static QByteArray addMail(QMap <QString, QMap<QString, QVariant> > &content, con
 QMap<QString, QMap<QString, QVariant> > DummyStore::populateMails()
 {
     QMap<QString, QMap<QString, QVariant>> content;
+    //Mime messages only have a resolution of seconds
+    const auto date = QDateTime::fromTime_t(QDateTime::currentDateTimeUtc().toTime_t()).toUTC();
     for (const auto &parentFolder : mFolders.keys()) {
-        addMail(content, "Hello World! " + QUuid::createUuid().toByteArray(), QDateTime::currentDateTimeUtc(), "John Doe", "doe@example.com", true, false, parentFolder.toUtf8());
+        addMail(content, "Hello World! " + QUuid::createUuid().toByteArray(), date, "John Doe", "doe@example.com", true, false, parentFolder.toUtf8());
     }
     return content;
 }
@@ -64,10 +64,15 @@ class DummySynchronizer : public Sink::Synchronizer {
         return event;
     }
 
+    static QByteArray messageId(const QByteArray &ridBuffer)
+    {
+        return ridBuffer + "@dummy.example.com";
+    }
+
     Sink::ApplicationDomain::Mail::Ptr createMail(const QByteArray &ridBuffer, const QMap<QString, QVariant> &data)
     {
         auto mail = Sink::ApplicationDomain::Mail::Ptr::create();
-        mail->setExtractedMessageId(ridBuffer);
+        mail->setExtractedMessageId(messageId(ridBuffer));
         mail->setExtractedSubject(data.value("subject").toString());
         mail->setExtractedSender(Sink::ApplicationDomain::Mail::Contact{data.value("senderName").toString(), data.value("senderEmail").toString()});
         mail->setExtractedDate(data.value("date").toDateTime());
@@ -77,6 +82,16 @@ class DummySynchronizer : public Sink::Synchronizer {
         return mail;
     }
 
+    static QByteArray createMimeMessage(const QByteArray &ridBuffer, const QMap<QString, QVariant> &data)
+    {
+        return "From: " + data.value("senderName").toString().toUtf8() + " <" + data.value("senderEmail").toString().toUtf8() + ">\r\n"
+            + "Subject: " + data.value("subject").toString().toUtf8() + "\r\n"
+            + "Date: " + data.value("date").toDateTime().toString(Qt::RFC2822Date).toUtf8() + "\r\n"
+            + "Message-ID: <" + messageId(ridBuffer) + ">\r\n"
+            + "\r\n"
+            + "This is the body of " + ridBuffer + "\r\n";
+    }
+
     Sink::ApplicationDomain::Folder::Ptr createFolder(const QByteArray &ridBuffer, const QMap<QString, QVariant> &data)
     {
         auto folder = Sink::ApplicationDomain::Folder::Ptr::create();
@@ -104,8 +119,25 @@ class DummySynchronizer : public Sink::Synchronizer {
         SinkTrace() << "Sync of " << count << " entities of type " << bufferType << " done." << Sink::Log::TraceTime(time->elapsed());
     }
 
-    KAsync::Job<void> synchronizeWithSource(const Sink::QueryBase &) Q_DECL_OVERRIDE
+    KAsync::Job<void> synchronizeWithSource(const Sink::QueryBase &query) Q_DECL_OVERRIDE
     {
+        if (query.type() == ENTITY_TYPE_MAIL && !query.ids().isEmpty()) {
+            //Individual mails are fetched including the full payload
+            return KAsync::start([this, query]() {
+                for (const auto &id : query.ids()) {
+                    const auto remoteId = syncStore().resolveLocalId(ENTITY_TYPE_MAIL, id);
+                    if (remoteId.isEmpty() || !DummyStore::instance().mails().contains(remoteId)) {
+                        SinkWarning() << "Failed to find mail: " << id;
+                        continue;
+                    }
+                    const auto data = DummyStore::instance().mails().value(remoteId);
+                    auto mail = createMail(remoteId, data);
+                    mail->setMimeMessage(createMimeMessage(remoteId, data));
+                    mail->setExtractedFullPayloadAvailable(true);
+                    createOrModify(ENTITY_TYPE_MAIL, remoteId, *mail);
+                }
+            });
+        }
         SinkLog() << " Synchronizing with the source";
         SinkTrace() << "Synchronize with source and sending a notification about it";
         Sink::Notification n;
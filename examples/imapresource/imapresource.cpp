@@ -463,7 +463,7 @@ public:
                 }
             }
         }
-        queue << request;
+        Synchronizer::mergeIntoQueue(request, queue);
     }
 
     KAsync::Job<void> login(QSharedPointer<ImapServerProxy> imap)
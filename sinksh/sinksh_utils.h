@@ -60,6 +60,7 @@ public:
     virtual KAsync::Job<void> remove(const Sink::ApplicationDomain::ApplicationDomainType &type) = 0;
     virtual QSharedPointer<QAbstractItemModel> loadModel(const Sink::Query &query) = 0;
     virtual QList<Sink::ApplicationDomain::ApplicationDomainType> read(const Sink::Query &query) = 0;
+    virtual qint64 count(const Sink::Query &query) = 0;
 };
 
 class DummyStore : public StoreBase
@@ -99,6 +100,11 @@ public:
     {
         return {};
     }
+
+    qint64 count(const Sink::Query &query) Q_DECL_OVERRIDE
+    {
+        return 0;
+    }
 };
 
 template <typename T>
@@ -143,5 +149,10 @@ public:
         }
         return list;
     }
+
+    qint64 count(const Sink::Query &query) Q_DECL_OVERRIDE
+    {
+        return Sink::Store::count<T>(query);
+    }
 };
 }
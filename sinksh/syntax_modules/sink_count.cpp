@@ -20,7 +20,6 @@
 #include <QCoreApplication>
 #include <QDebug>
 #include <QObject> // tr()
-#include <QModelIndex>
 #include <QTime>
 
 #include "common/resource.h"
@@ -46,24 +45,15 @@ bool count(const QStringList &args, State &state)
         return false;
     }
 
-    auto model = SinkshUtils::loadModel(query.type(), query);
-    QObject::connect(model.data(), &QAbstractItemModel::dataChanged, [model, state](const QModelIndex &, const QModelIndex &, const QVector<int> &roles) {
-        if (roles.contains(Sink::Store::ChildrenFetchedRole)) {
-            state.printLine(QObject::tr("Counted results %1").arg(model->rowCount(QModelIndex())));
-            state.commandFinished();
-        }
-    });
-
-    if (!model->data(QModelIndex(), Sink::Store::ChildrenFetchedRole).toBool()) {
-        return true;
-    }
-
+    //Counts from the indexes where possible, without loading the entities
+    const auto count = SinkshUtils::getStore(query.type()).count(query);
+    state.printLine(QObject::tr("Counted results %1").arg(count));
     return true;
 }
 
 Syntax::List syntax()
 {
-    Syntax count("count", QObject::tr("Returns the number of items of a given type in a resource. Usage: count <type> <resource>"), &SinkCount::count, Syntax::EventDriven);
+    Syntax count("count", QObject::tr("Returns the number of items of a given type in a resource. Usage: count <type> <resource>"), &SinkCount::count, Syntax::NotInteractive);
     count.completer = &SinkshUtils::typeCompleter;
 
     return Syntax::List() << count;
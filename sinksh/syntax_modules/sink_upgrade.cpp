@@ -39,7 +39,7 @@ bool upgrade(const QStringList &args, State &state)
 
 Syntax::List syntax()
 {
-    return Syntax::List() << Syntax{"upgrade", QObject::tr("Upgrades your storage to the latest version (be careful!)"), &SinkUpgrade::upgrade, Syntax::NotInteractive};
+    return Syntax::List() << Syntax{"upgrade", QObject::tr("Upgrades your storage to the latest version"), &SinkUpgrade::upgrade, Syntax::NotInteractive};
 }
 
 REGISTER_SYNTAX(SinkUpgrade)
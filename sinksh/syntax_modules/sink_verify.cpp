@@ -0,0 +1,100 @@
+/*
+ *   Copyright (C) 2017 Christian Mollekopf <mollekopf@kolabsys.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ */
+
+#include <QDebug>
+#include <QObject> // tr()
+#include <QTime>
+
+#include "common/resource.h"
+#include "common/resourcecontext.h"
+#include "common/resourceconfig.h"
+#include "common/resourcecontrol.h"
+#include "common/adaptorfactoryregistry.h"
+#include "common/storage/entitystore.h"
+#include "common/log.h"
+
+#include "sinksh_utils.h"
+#include "state.h"
+#include "syntaxtree.h"
+
+namespace SinkVerify
+{
+
+bool verify(const QStringList &args, State &state)
+{
+    auto options = SyntaxTree::parseOptions(args);
+    if (options.positionalArguments.isEmpty()) {
+        state.printError(QObject::tr("Options: $resource [--repair]"));
+        return false;
+    }
+    const auto resource = options.positionalArguments.first().toUtf8();
+    const bool repair = options.options.contains("repair");
+
+    const auto resourceType = ResourceConfig::getResourceType(resource);
+    if (!Sink::ResourceFactory::load(resourceType)) {
+        state.printError(QObject::tr("Failed to load the resource: ") + resource);
+        return false;
+    }
+    Sink::ResourceContext resourceContext{resource, resourceType, Sink::AdaptorFactoryRegistry::instance().getFactories(resourceType)};
+    Sink::Storage::EntityStore store(resourceContext, {"sinksh.verify"});
+
+    QTime time;
+    time.start();
+    int inconsistentEntries = 0;
+    store.startTransaction(Sink::Storage::DataStore::ReadOnly);
+    const auto brokenIndexes = store.verifyIndexes([&](const QByteArray &index, const QByteArray &key, const QByteArray &value, bool missing) {
+        inconsistentEntries++;
+        state.printLine(QString("%1 entry in %2: Key: %3 Value: %4").arg(missing ? "Missing" : "Stale").arg(QString::fromUtf8(index)).arg(QString::fromUtf8(key)).arg(QString::fromUtf8(value)), 1);
+    });
+    store.abortTransaction();
+    state.printLine(QObject::tr("Found %1 inconsistent entries in %2 indexes, verification took %3 ms.").arg(inconsistentEntries).arg(brokenIndexes.size()).arg(time.elapsed()));
+
+    if (!repair || brokenIndexes.isEmpty()) {
+        return false;
+    }
+
+    //A running resource only checks for incomplete indexes on startup, so it would neither build them nor know about the rebuild.
+    //Once it is started again it continues any build that is interrupted here.
+    state.printLine(QObject::tr("Shutting down the resource..."));
+    Sink::ResourceControl::shutdown(resource).exec().waitForFinished();
+
+    state.printLine(QObject::tr("Rebuilding: ") + QString::fromUtf8(brokenIndexes.join(", ")));
+    store.startTransaction(Sink::Storage::DataStore::ReadWrite);
+    store.rebuildIndexes(brokenIndexes);
+    store.commitTransaction();
+    bool buildRequired = true;
+    while (buildRequired) {
+        store.startTransaction(Sink::Storage::DataStore::ReadWrite);
+        buildRequired = store.buildIndexes(1000);
+        store.commitTransaction();
+    }
+    state.printLine(QObject::tr("done"));
+    return false;
+}
+
+Syntax::List syntax()
+{
+    Syntax verify("verify", QObject::tr("Verify the indexes of a resource against its entities, and rebuild inconsistent indexes with --repair."), &SinkVerify::verify, Syntax::NotInteractive);
+    verify.completer = &SinkshUtils::resourceCompleter;
+    return Syntax::List() << verify;
+}
+
+REGISTER_SYNTAX(SinkVerify)
+
+}
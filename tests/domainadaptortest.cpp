@@ -109,6 +109,7 @@ private slots:
         mail.setExtractedSubject("summary");
         mail.setMimeMessage("foobar");
         mail.setFolder("folder");
+        mail.setExtractedDate(QDateTime::fromString("2017-03-05T10:00:00Z", Qt::ISODate));
 
         flatbuffers::FlatBufferBuilder metadataFbb;
         auto metadataBuilder = Sink::MetadataBuilder(metadataFbb);
@@ -134,10 +135,44 @@ private slots:
             QCOMPARE(readMail.getSubject(), mail.getSubject());
             QCOMPARE(readMail.getMimeMessage(), mail.getMimeMessage());
             QCOMPARE(readMail.getFolder(), mail.getFolder());
+            QCOMPARE(readMail.getDate(), mail.getDate());
         }
 
     }
 
+    void testLegacyMailDate()
+    {
+        const auto date = QDateTime::fromString("2017-03-05T10:00:00Z", Qt::ISODate);
+
+        flatbuffers::FlatBufferBuilder metadataFbb;
+        auto metadataBuilder = Sink::MetadataBuilder(metadataFbb);
+        metadataBuilder.add_revision(1);
+        auto metadataBuffer = metadataBuilder.Finish();
+        Sink::FinishMetadataBuffer(metadataFbb, metadataBuffer);
+
+        //Dates used to be stored as serialized QDateTime
+        QByteArray serializedDate;
+        QDataStream ds(&serializedDate, QIODevice::WriteOnly);
+        ds << date;
+        flatbuffers::FlatBufferBuilder mailFbb;
+        auto legacyDate = mailFbb.CreateString(serializedDate.toStdString());
+        Sink::ApplicationDomain::Buffer::MailBuilder mailBuilder(mailFbb);
+        mailBuilder.add_legacyDate(legacyDate);
+        Sink::ApplicationDomain::Buffer::FinishMailBuffer(mailFbb, mailBuilder.Finish());
+
+        flatbuffers::FlatBufferBuilder fbb;
+        Sink::EntityBuffer::assembleEntityBuffer(
+            fbb, metadataFbb.GetBufferPointer(), metadataFbb.GetSize(), mailFbb.GetBufferPointer(), mailFbb.GetSize(), mailFbb.GetBufferPointer(), mailFbb.GetSize());
+
+        std::string data(reinterpret_cast<const char *>(fbb.GetBufferPointer()), fbb.GetSize());
+        Sink::EntityBuffer buffer((void *)(data.data()), data.size());
+
+        TestMailFactory factory;
+        auto adaptor = factory.createAdaptor(buffer.entity());
+        Sink::ApplicationDomain::Mail readMail{QByteArray{}, QByteArray{}, 0, adaptor};
+        QCOMPARE(readMail.getDate(), date);
+    }
+
     void testContact()
     {
         auto writeMapper = QSharedPointer<PropertyMapper>::create();
@@ -175,6 +175,62 @@ private slots:
         QVERIFY(!value->getSubject().isEmpty());
     }
 
+    void testMailBodyEviction()
+    {
+        //The configuration is only read on startup
+        VERIFYEXEC(Sink::ResourceControl::shutdown("sink.dummy.instance1"));
+        auto configuration = ResourceConfig::getConfiguration("sink.dummy.instance1");
+        configuration.insert("bodyCacheBudget", 1);
+        ResourceConfig::configureResource("sink.dummy.instance1", configuration);
+
+        auto query = Query().resourceFilter("sink.dummy.instance1");
+        query.request<Mail::Subject>().request<Mail::FullPayloadAvailable>();
+        VERIFYEXEC(Sink::Store::synchronize(query));
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        //The initial sync only fetches headers
+        const auto mail = Sink::Store::readOne<Mail>(query);
+        QVERIFY(!mail.getFullPayloadAvailable());
+        const auto subject = mail.getSubject();
+
+        auto bodyQuery = Query(mail);
+        bodyQuery.setFlags(Query::LiveQuery);
+        bodyQuery.request<Mail::Subject>().request<Mail::MimeMessage>().request<Mail::FullPayloadAvailable>();
+        auto getMail = [] (const QSharedPointer<QAbstractItemModel> &model) {
+            return model->index(0, 0, QModelIndex()).data(Sink::Store::DomainObjectRole).value<Mail::Ptr>();
+        };
+
+        //Requesting the body fetches it
+        {
+            auto model = Sink::Store::loadModel<Mail>(bodyQuery);
+            QTRY_COMPARE(model->rowCount(QModelIndex()), 1);
+            QTRY_VERIFY(getMail(model)->getFullPayloadAvailable());
+            QVERIFY(!getMail(model)->getMimeMessage().isEmpty());
+            QCOMPARE(getMail(model)->getSubject(), subject);
+        }
+
+        //The body exceeds the budget and is evicted with the next sync
+        VERIFYEXEC(Sink::Store::synchronize(query));
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+        {
+            const auto evicted = Sink::Store::readOne<Mail>(Query(mail).request<Mail::Subject>().request<Mail::FullPayloadAvailable>());
+            QVERIFY(!evicted.getFullPayloadAvailable());
+            QCOMPARE(evicted.getSubject(), subject);
+        }
+
+        //And fetched again on demand
+        {
+            auto model = Sink::Store::loadModel<Mail>(bodyQuery);
+            QTRY_COMPARE(model->rowCount(QModelIndex()), 1);
+            QTRY_VERIFY(getMail(model)->getFullPayloadAvailable());
+            QVERIFY(!getMail(model)->getMimeMessage().isEmpty());
+        }
+
+        configuration.remove("bodyCacheBudget");
+        ResourceConfig::configureResource("sink.dummy.instance1", configuration);
+        VERIFYEXEC(Sink::ResourceControl::shutdown("sink.dummy.instance1"));
+    }
+
     void testWriteModifyDelete()
     {
         Event event("sink.dummy.instance1");
@@ -2,10 +2,17 @@
 
 #include <QDebug>
 #include <QString>
+#include <QFile>
+#include <algorithm>
+#include <random>
 
 #include "common/storage/entitystore.h"
 #include "common/adaptorfactoryregistry.h"
 #include "common/definitions.h"
+#include "common/entitybuffer.h"
+#include "common/mail/threadsummary.h"
+#include "common/mail/foldercounts.h"
+#include "entity_generated.h"
 #include "testimplementations.h"
 
 class EntityStoreTest : public QObject
@@ -18,6 +25,7 @@ private slots:
     void initTestCase()
     {
         Sink::AdaptorFactoryRegistry::instance().registerFactory<Sink::ApplicationDomain::Mail, TestMailAdaptorFactory>("test");
+        Sink::AdaptorFactoryRegistry::instance().registerFactory<Sink::ApplicationDomain::Folder, DefaultAdaptorFactory<Sink::ApplicationDomain::Folder>>("test");
     }
 
     void cleanup()
@@ -83,6 +91,1080 @@ private slots:
         store.abortTransaction();
 
     }
+
+    void readAt()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+        mail.setExtractedMessageId("messageid");
+        mail.setExtractedSubject("boo");
+
+        auto mail2 = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+        mail2.setExtractedMessageId("messageid2");
+        mail2.setExtractedSubject("foo");
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("mail", mail, false);
+        const auto revisionAfterCreation = store.maxRevision();
+        store.add("mail", mail2, false);
+
+        mail.setExtractedSubject("foo");
+        store.modify("mail", mail, QByteArrayList{}, false);
+        const auto revisionAfterModification = store.maxRevision();
+        store.remove("mail", mail, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QCOMPARE(store.readAt("mail", mail.identifier(), revisionAfterCreation).getProperty(ApplicationDomain::Mail::Subject::name).toString(), QString::fromLatin1("boo"));
+        //Unrelated revisions inbetween don't matter
+        QCOMPARE(store.readAt("mail", mail.identifier(), revisionAfterCreation + 1).getProperty(ApplicationDomain::Mail::Subject::name).toString(), QString::fromLatin1("boo"));
+        QCOMPARE(store.readAt("mail", mail.identifier(), revisionAfterModification).getProperty(ApplicationDomain::Mail::Subject::name).toString(), QString::fromLatin1("foo"));
+        //The entity didn't exist yet
+        QVERIFY(store.readAt("mail", mail2.identifier(), revisionAfterCreation).identifier().isEmpty());
+        {
+            Sink::Operation operation = Sink::Operation_Creation;
+            store.readAt("mail", mail.identifier(), store.maxRevision(), [&] (const ApplicationDomain::ApplicationDomainType &, Sink::Operation op) {
+                operation = op;
+            });
+            QCOMPARE(operation, Sink::Operation_Removal);
+        }
+        store.abortTransaction();
+    }
+
+    void withoutHistory()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+        store.setKeepHistory(false);
+
+        auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+        mail.setExtractedMessageId("messageid");
+        mail.setExtractedSubject("boo");
+
+        auto mail2 = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+        mail2.setExtractedMessageId("messageid2");
+        mail2.setExtractedSubject("foo");
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("mail", mail, false);
+        const auto revisionAfterCreation = store.maxRevision();
+        store.add("mail", mail2, false);
+
+        mail.setExtractedSubject("foo");
+        store.modify("mail", mail, QByteArrayList{}, false);
+        store.remove("mail", mail2, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        //The original revision has been replaced
+        QVERIFY(store.readAt("mail", mail.identifier(), revisionAfterCreation).identifier().isEmpty());
+        QCOMPARE(store.readLatest("mail", mail.identifier()).getProperty(ApplicationDomain::Mail::Subject::name).toString(), QString::fromLatin1("foo"));
+
+        //We still get notified about the latest changes
+        QList<QByteArray> keys;
+        store.readRevisions(1, "mail", [&] (const QByteArray &key) {
+            keys << key;
+        });
+        QCOMPARE(keys.size(), 2);
+        QVERIFY(!store.exists("mail", mail2.identifier()));
+        const auto topRevision = store.maxRevision();
+        store.abortTransaction();
+
+        //Once all clients caught up the removal is gone as well
+        store.cleanupRevisions(topRevision);
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QVERIFY(!store.contains("mail", mail2.identifier()));
+        QVERIFY(store.contains("mail", mail.identifier()));
+        store.abortTransaction();
+    }
+
+    void withoutHistoryReplay()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+        store.setKeepHistory(false);
+
+        auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+        mail.setExtractedSubject("boo");
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("mail", mail, true);
+        const auto revisionAfterCreation = store.maxRevision();
+        mail.setExtractedSubject("foo");
+        store.modify("mail", mail, QByteArrayList{}, true);
+        store.commitTransaction();
+
+        //The revision that still has to be replayed is kept
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QCOMPARE(store.readAt("mail", mail.identifier(), revisionAfterCreation).getProperty(ApplicationDomain::Mail::Subject::name).toString(), QString::fromLatin1("boo"));
+        QCOMPARE(store.readLatest("mail", mail.identifier()).getProperty(ApplicationDomain::Mail::Subject::name).toString(), QString::fromLatin1("foo"));
+        store.abortTransaction();
+
+        //Once it has been replayed it is removed by the cleanup
+        store.cleanupRevisions(revisionAfterCreation);
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QVERIFY(store.readAt("mail", mail.identifier(), revisionAfterCreation).identifier().isEmpty());
+        QCOMPARE(store.readLatest("mail", mail.identifier()).getProperty(ApplicationDomain::Mail::Subject::name).toString(), QString::fromLatin1("foo"));
+        store.abortTransaction();
+    }
+
+    void deltaModifications()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+        mail.setExtractedMessageId("messageid");
+        mail.setExtractedSubject("boo");
+        mail.setUnread(true);
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("mail", mail, false);
+        const auto revisionAfterCreation = store.maxRevision();
+
+        //Only flags change
+        ApplicationDomain::Mail diff{"res1", mail.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+        diff.setUnread(false);
+        store.modify("mail", diff, QByteArrayList{}, false);
+        const auto revisionAfterFirstModification = store.maxRevision();
+        diff.setImportant(true);
+        store.modify("mail", diff, QByteArrayList{}, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        {
+            //Both modifications are stored as delta against the full revision
+            qint64 baseRevision = 0;
+            store.readLatest("mail", mail.identifier(), [&] (const QByteArray &, const EntityBuffer &buffer) {
+                baseRevision = GetMetadata(buffer.entity().metadata()->Data())->baseRevision();
+            });
+            QCOMPARE(baseRevision, revisionAfterCreation);
+        }
+        {
+            const auto latest = store.readLatest<ApplicationDomain::Mail>(mail.identifier());
+            QCOMPARE(latest.getSubject(), QString::fromLatin1("boo"));
+            QCOMPARE(latest.getUnread(), false);
+            QCOMPARE(latest.getImportant(), true);
+        }
+        {
+            const auto previous = store.readAt<ApplicationDomain::Mail>(mail.identifier(), revisionAfterFirstModification);
+            QCOMPARE(previous.getSubject(), QString::fromLatin1("boo"));
+            QCOMPARE(previous.getUnread(), false);
+            QCOMPARE(previous.getImportant(), false);
+        }
+        const auto topRevision = store.maxRevision();
+        store.abortTransaction();
+
+        //The base is kept as long as a delta depends on it
+        store.cleanupRevisions(topRevision);
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        {
+            const auto latest = store.readLatest<ApplicationDomain::Mail>(mail.identifier());
+            QCOMPARE(latest.getSubject(), QString::fromLatin1("boo"));
+            QCOMPARE(latest.getImportant(), true);
+        }
+        store.abortTransaction();
+    }
+
+    void deltaWriteSize()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+        mail.setExtractedMessageId("messageid");
+        mail.setExtractedSubject(QString(2000, 'x'));
+        mail.setUnread(true);
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("mail", mail, false);
+        {
+            ApplicationDomain::Mail diff{"res1", mail.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+            diff.setImportant(true);
+            store.modify("mail", diff, QByteArrayList{}, false);
+        }
+        {
+            //A property that was only set in the previous delta must survive
+            ApplicationDomain::Mail diff{"res1", mail.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+            diff.setUnread(false);
+            store.modify("mail", diff, QByteArrayList{}, false);
+        }
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        const auto latest = store.readLatest<ApplicationDomain::Mail>(mail.identifier());
+        QCOMPARE(latest.getImportant(), true);
+        QCOMPARE(latest.getUnread(), false);
+        QCOMPARE(latest.getSubject().size(), 2000);
+        store.abortTransaction();
+
+        Storage::DataStore storage(Sink::storageLocation(), resourceInstanceIdentifier, Storage::DataStore::ReadOnly);
+        auto transaction = storage.createTransaction(Storage::DataStore::ReadOnly);
+        QList<int> sizes;
+        Storage::DataStore::mainDatabase(transaction, "mail").scan(mail.identifier(), [&] (const QByteArray &, const QByteArray &value) {
+            sizes << value.size();
+            return true;
+        }, {}, true);
+        QCOMPARE(sizes.size(), 3);
+        //The full revision contains the subject, the deltas don't
+        QVERIFY(sizes.at(0) > 2000);
+        QVERIFY(sizes.at(1) < 2000);
+        QVERIFY(sizes.at(2) < 2000);
+        QVERIFY(sizes.at(1) * 4 < sizes.at(0));
+        QVERIFY(sizes.at(2) * 4 < sizes.at(0));
+    }
+
+    void replacedBlobsAreRemovedWithCleanup()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+        mail.setExtractedMessageId("messageid");
+        mail.setMimeMessage("body");
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("mail", mail, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        const auto path = store.readLatest<ApplicationDomain::Mail>(mail.identifier()).getMimeMessagePath();
+        store.abortTransaction();
+        QVERIFY(QFile::exists(path));
+
+        //Drop the body like the eviction does
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        ApplicationDomain::Mail diff{"res1", mail.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+        auto blob = ApplicationDomain::BLOB{QString{""}};
+        blob.isExternal = false;
+        diff.setProperty(ApplicationDomain::Mail::MimeMessage::name, QVariant::fromValue(blob));
+        store.modify("mail", diff, QByteArrayList{}, false);
+        const auto topRevision = store.maxRevision();
+        store.commitTransaction();
+
+        //Readers of the previous revision still find the file
+        QVERIFY(QFile::exists(path));
+
+        store.cleanupRevisions(topRevision);
+        QVERIFY(!QFile::exists(path));
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QVERIFY(store.readLatest<ApplicationDomain::Mail>(mail.identifier()).getMimeMessagePath().isEmpty());
+        QCOMPARE(store.readLatest<ApplicationDomain::Mail>(mail.identifier()).getMessageId(), QByteArray{"messageid"});
+        store.abortTransaction();
+    }
+
+    void compoundIndexLookup()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto createMail = [&] (const QByteArray &folder, bool unread, bool draft) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setFolder(folder);
+            mail.setUnread(unread);
+            mail.setDraft(draft);
+            store.add("mail", mail, false);
+            return mail;
+        };
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        auto unreadMail = createMail("folder1", true, false);
+        createMail("folder1", false, false);
+        createMail("folder1", true, true);
+        createMail("folder2", true, false);
+        //A folder id that is a prefix of another one must not match the other folder
+        createMail("folder", true, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        {
+            Query query;
+            query.filter<ApplicationDomain::Mail::Folder>("folder1");
+            query.filter<ApplicationDomain::Mail::Unread>(true);
+            query.filter<ApplicationDomain::Mail::Draft>(false);
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            const auto keys = store.indexLookup("mail", query, appliedFilters, appliedSorting);
+            QCOMPARE(appliedFilters, (QSet<QByteArray>{"folder", "unread", "draft"}));
+            QCOMPARE(keys.toList(), QList<QByteArray>{unreadMail.identifier()});
+        }
+        {
+            //Only the prefix of the compound index matches, so the planner may just as well pick the folder index
+            Query query;
+            query.filter<ApplicationDomain::Mail::Folder>("folder1");
+            query.filter<ApplicationDomain::Mail::Unread>(true);
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            const auto keys = store.indexLookup("mail", query, appliedFilters, appliedSorting);
+            QVERIFY(appliedFilters.contains("folder"));
+            QVERIFY(keys.contains(unreadMail.identifier()));
+            QVERIFY(keys.size() >= 2);
+        }
+        store.abortTransaction();
+
+        //The index follows modifications
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        ApplicationDomain::Mail diff{"res1", unreadMail.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+        diff.setUnread(false);
+        store.modify("mail", diff, QByteArrayList{}, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        {
+            Query query;
+            query.filter<ApplicationDomain::Mail::Folder>("folder1");
+            query.filter<ApplicationDomain::Mail::Unread>(true);
+            query.filter<ApplicationDomain::Mail::Draft>(false);
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            QVERIFY(store.indexLookup("mail", query, appliedFilters, appliedSorting).isEmpty());
+        }
+        store.abortTransaction();
+    }
+
+    void bulkLoad()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto createMail = [&] (const QByteArray &folder) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setFolder(folder);
+            store.add("mail", mail, false);
+            return mail;
+        };
+
+        //The first transaction of an empty store is a bulk load
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        auto mail1 = createMail("folder1");
+        //Lookups during the bulk load see the buffered entries
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder1"}).toList(), QList<QByteArray>{mail1.identifier()});
+        auto mail2 = createMail("folder1");
+        //A modification of a buffered entity has to remove the buffered entry
+        ApplicationDomain::Mail diff{"res1", mail2.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+        diff.setFolder("folder2");
+        store.modify("mail", diff, QByteArrayList{}, false);
+        createMail("folder2");
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder1"}).toList(), QList<QByteArray>{mail1.identifier()});
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder2"}).size(), 2);
+        store.abortTransaction();
+
+        //Buffered entries of an aborted transaction are discarded
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.startBulkLoad();
+        createMail("folder3");
+        store.abortTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QVERIFY(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder3"}).isEmpty());
+        store.abortTransaction();
+
+        //Removals don't write the buffered entries, they remove written entries and drop buffered ones
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.startBulkLoad();
+        ApplicationDomain::Mail diff1{"res1", mail1.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+        diff1.setFolder("folder3");
+        store.modify("mail", diff1, QByteArrayList{}, false);
+        diff1.setFolder("folder4");
+        store.modify("mail", diff1, QByteArrayList{}, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QVERIFY(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder1"}).isEmpty());
+        QVERIFY(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder3"}).isEmpty());
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder4"}).toList(), QList<QByteArray>{mail1.identifier()});
+        store.abortTransaction();
+    }
+
+    void bulkLoadSpilledRuns()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto move = [&] (const QByteArray &identifier, const QByteArray &folder) {
+            ApplicationDomain::Mail diff{"res1", identifier, 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+            diff.setFolder(folder);
+            store.modify("mail", diff, QByteArrayList{}, false);
+        };
+
+        //Enough mails for the buffered index entries to be spilled as sorted runs
+        const int count = 30000;
+        QByteArrayList identifiers;
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        for (int i = 0; i < count; i++) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setFolder(QByteArray("folder") + QByteArray::number(i % 3));
+            store.add("mail", mail, false);
+            identifiers << mail.identifier();
+        }
+        //Spilled entries are skipped when they are removed, and merged once if they are added again
+        move(identifiers.at(0), "folder3");
+        move(identifiers.at(3), "folder3");
+        move(identifiers.at(3), "folder0");
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder0"}).size(), count / 3 - 1);
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder1"}).size(), count / 3);
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::Folder::name, QByteArray{"folder3"}).toList(), QList<QByteArray>{identifiers.at(0)});
+        store.abortTransaction();
+    }
+
+    void costBasedIndexSelection()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        QByteArrayList messageIds;
+        for (int i = 0; i < 10; i++) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setExtractedMessageId("messageid" + QByteArray::number(i));
+            mail.setDraft(false);
+            store.add("mail", mail, false);
+            messageIds << mail.getMessageId();
+        }
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        {
+            //The declaration order of the indexes doesn't matter, the most selective index is used
+            Query query;
+            query.filter<ApplicationDomain::Mail::Draft>(false);
+            query.filter<ApplicationDomain::Mail::MessageId>("messageid3");
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            const auto keys = store.indexLookup("mail", query, appliedFilters, appliedSorting);
+            QCOMPARE(appliedFilters, QSet<QByteArray>{ApplicationDomain::Mail::MessageId::name});
+            QCOMPARE(keys.size(), 1);
+        }
+        {
+            //Looking up more keys than there are entities is more expensive than a full scan
+            Query query;
+            query.filter<ApplicationDomain::Mail::MessageId>(Query::Comparator(QVariant::fromValue(messageIds + QByteArrayList{"messageid10"}), Query::Comparator::In));
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            store.indexLookup("mail", query, appliedFilters, appliedSorting);
+            QVERIFY(appliedFilters.isEmpty());
+        }
+        store.abortTransaction();
+    }
+
+    void indexIntersectionAndUnion()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        for (int i = 0; i < 10; i++) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setExtractedMessageId("messageid" + QByteArray::number(i));
+            mail.setFolder(i < 5 ? "folder1" : "folder2");
+            store.add("mail", mail, false);
+        }
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        {
+            //The folder index is cheap enough to narrow down the result of the message id index
+            Query query;
+            query.filter<ApplicationDomain::Mail::MessageId>(Query::Comparator(QVariant::fromValue(QByteArrayList{"messageid3", "messageid7"}), Query::Comparator::In));
+            query.filter<ApplicationDomain::Mail::Folder>("folder1");
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            const auto keys = store.indexLookup("mail", query, appliedFilters, appliedSorting);
+            QCOMPARE(appliedFilters, (QSet<QByteArray>{ApplicationDomain::Mail::MessageId::name, ApplicationDomain::Mail::Folder::name}));
+            QCOMPARE(keys.size(), 1);
+        }
+        {
+            //The union of both lookups is used as source, without duplicates
+            Query query;
+            query.filter(QueryBase::Or{}
+                .filter<ApplicationDomain::Mail::Folder>("folder1")
+                .filter<ApplicationDomain::Mail::MessageId>("messageid3")
+                .filter<ApplicationDomain::Mail::MessageId>("messageid7"));
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            const auto keys = store.indexLookup("mail", query, appliedFilters, appliedSorting);
+            QCOMPARE(appliedFilters, (QSet<QByteArray>{ApplicationDomain::Mail::MessageId::name, ApplicationDomain::Mail::Folder::name}));
+            QCOMPARE(keys.size(), 6);
+        }
+        {
+            //An alternative without index requires a full scan
+            Query query;
+            query.filter(QueryBase::Or{}
+                .filter<ApplicationDomain::Mail::MessageId>("messageid3")
+                .filter<ApplicationDomain::Mail::Subject>("subject"));
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            store.indexLookup("mail", query, appliedFilters, appliedSorting);
+            QVERIFY(appliedFilters.isEmpty());
+        }
+        store.abortTransaction();
+    }
+
+    void onlineIndexBuild()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        for (int i = 0; i < 10; i++) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setExtractedMessageId("messageid" + QByteArray::number(i));
+            store.add("mail", mail, false);
+        }
+        store.updateIndexDefinitions();
+        while (store.buildIndexes(100)) {
+        }
+        store.commitTransaction();
+
+        //Pretend the message id index was built with an outdated definition
+        {
+            Storage::DataStore storage(Sink::storageLocation(), resourceInstanceIdentifier, Storage::DataStore::ReadWrite);
+            auto transaction = storage.createTransaction(Storage::DataStore::ReadWrite);
+            transaction.openDatabase("index.definitions").write("mail.index.messageId", "0");
+            transaction.commit();
+        }
+
+        Query query;
+        query.filter<ApplicationDomain::Mail::MessageId>("messageid3");
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.updateIndexDefinitions();
+        {
+            //The cleared index is not used until it is rebuilt
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            store.indexLookup("mail", query, appliedFilters, appliedSorting);
+            QVERIFY(appliedFilters.isEmpty());
+        }
+        //The build is split in batches and continues where the last batch stopped
+        int batches = 0;
+        while (store.buildIndexes(3)) {
+            batches++;
+        }
+        QCOMPARE(batches, 4);
+        {
+            QSet<QByteArray> appliedFilters;
+            QByteArray appliedSorting;
+            const auto keys = store.indexLookup("mail", query, appliedFilters, appliedSorting);
+            QCOMPARE(appliedFilters, QSet<QByteArray>{ApplicationDomain::Mail::MessageId::name});
+            QCOMPARE(keys.size(), 1);
+        }
+        store.commitTransaction();
+    }
+
+    void verifyAndRepairIndexes()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        QByteArrayList uids;
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        for (int i = 0; i < 10; i++) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setFolder("folder" + QByteArray::number(i % 2));
+            mail.setExtractedSubject("subject");
+            store.add("mail", mail, false);
+            uids << mail.identifier();
+        }
+        store.remove("mail", store.readLatest("mail", uids.first()), false);
+        store.commitTransaction();
+
+        auto verify = [&] (int expectedMissing, int expectedStale) {
+            int missing = 0;
+            int stale = 0;
+            store.startTransaction(Storage::DataStore::ReadOnly);
+            const auto brokenIndexes = store.verifyIndexes([&](const QByteArray &, const QByteArray &, const QByteArray &, bool isMissing) {
+                isMissing ? missing++ : stale++;
+            });
+            store.abortTransaction();
+            QCOMPARE(missing, expectedMissing);
+            QCOMPARE(stale, expectedStale);
+            return brokenIndexes;
+        };
+
+        QVERIFY(verify(0, 0).isEmpty());
+
+        //Lose an entry and leave one behind that doesn't belong to any entity
+        {
+            Storage::DataStore storage(Sink::storageLocation(), resourceInstanceIdentifier, Storage::DataStore::ReadWrite);
+            auto transaction = storage.createTransaction(Storage::DataStore::ReadWrite);
+            auto db = transaction.openDatabase("mail.index.folder", {}, true);
+            db.remove("folder1", uids.at(1));
+            db.write("folder1", uids.first());
+            transaction.commit();
+        }
+
+        const auto brokenIndexes = verify(1, 1);
+        QCOMPARE(brokenIndexes, QByteArrayList{"mail.index.folder"});
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.rebuildIndexes(brokenIndexes);
+        while (store.buildIndexes(3)) {
+        }
+        store.commitTransaction();
+
+        QVERIFY(verify(0, 0).isEmpty());
+    }
+
+    void coveringIndex()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        const auto date = QDateTime(QDate(2015, 7, 7), QTime(12, 0));
+        QList<ApplicationDomain::Mail> mails;
+        for (int i = 0; i < 3; i++) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setExtractedMessageId("messageid" + QByteArray::number(i));
+            mail.setExtractedSubject("subject" + QString::number(i));
+            mail.setExtractedDate(date.addDays(i));
+            mail.setFolder("folder1");
+            mail.setUnread(true);
+            mails << mail;
+        }
+        auto otherMail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+        otherMail.setExtractedSubject("other");
+        otherMail.setFolder("folder2");
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        for (const auto &mail : mails) {
+            store.add("mail", mail, false);
+        }
+        store.add("mail", otherMail, false);
+
+        ApplicationDomain::Mail diff{"res1", mails.at(1).identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+        diff.setUnread(false);
+        store.modify("mail", diff, QByteArrayList{}, false);
+        store.remove("mail", mails.at(0), false);
+        store.commitTransaction();
+
+        Query query;
+        query.filter<ApplicationDomain::Mail::Folder>("folder1");
+        query.sort<ApplicationDomain::Mail::Date>();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QByteArray index;
+        QVector<QByteArray> uids;
+        QVector<QByteArray> keys;
+        //The message id is not part of the projection
+        QVERIFY(!store.coveringIndexLookup("mail", query, {ApplicationDomain::Mail::Subject::name, ApplicationDomain::Mail::MessageId::name}, index, uids, keys));
+        QVERIFY(store.coveringIndexLookup("mail", query, {ApplicationDomain::Mail::Subject::name, ApplicationDomain::Mail::Unread::name}, index, uids, keys));
+        QCOMPARE(uids, (QVector<QByteArray>{mails.at(2).identifier(), mails.at(1).identifier()}));
+
+        QStringList subjects;
+        QList<bool> unread;
+        for (int i = 0; i < keys.size(); i++) {
+            store.readProjection("mail", index, uids.at(i), keys.at(i), [&](const ApplicationDomain::ApplicationDomainType &entity, Sink::Operation) {
+                QCOMPARE(entity.identifier(), uids.at(i));
+                QVERIFY(!entity.getProperty(ApplicationDomain::Mail::MessageId::name).isValid());
+                subjects << entity.getProperty(ApplicationDomain::Mail::Subject::name).toString();
+                unread << entity.getProperty(ApplicationDomain::Mail::Unread::name).toBool();
+            });
+        }
+        //Newest first, and the modification is reflected in the projection
+        QCOMPARE(subjects, (QStringList{"subject2", "subject1"}));
+        QCOMPARE(unread, (QList<bool>{true, false}));
+        store.abortTransaction();
+    }
+
+    void threadMergingOnShuffledArrival()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        //A few threads in which every message replies to an earlier one
+        const int threadCount = 4;
+        const int threadSize = 15;
+        QList<ApplicationDomain::Mail> mails;
+        for (int t = 0; t < threadCount; t++) {
+            for (int i = 0; i < threadSize; i++) {
+                auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+                const auto prefix = "thread" + QByteArray::number(t) + "message";
+                mail.setExtractedMessageId(prefix + QByteArray::number(i));
+                if (i > 0) {
+                    mail.setExtractedParentMessageId(prefix + QByteArray::number((i - 1) / 2));
+                }
+                mails << mail;
+            }
+        }
+        //Children arrive before their parents, so independently created threads have to be merged
+        std::shuffle(mails.begin(), mails.end(), std::mt19937{0});
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        for (const auto &mail : mails) {
+            store.add("mail", mail, false);
+        }
+        store.commitTransaction();
+
+        auto threadsOf = [&] {
+            QMap<QByteArray, QByteArrayList> threads;
+            for (const auto &mail : mails) {
+                const auto threadId = store.readLatest<ApplicationDomain::Mail>(mail.identifier()).getProperty(ApplicationDomain::Mail::ThreadId::name).toByteArray();
+                threads[mail.getMessageId().left(7)] << threadId;
+            }
+            return threads;
+        };
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        const auto threads = threadsOf();
+        QCOMPARE(threads.size(), threadCount);
+        QSet<QByteArray> threadIds;
+        for (const auto &threadIdsOfThread : threads) {
+            QCOMPARE(threadIdsOfThread.toSet().size(), 1);
+            const auto threadId = threadIdsOfThread.first();
+            QVERIFY(!threadId.isEmpty());
+            threadIds << threadId;
+            //All messages are found with the merged thread
+            QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::ThreadId::name, threadId).size(), threadSize);
+        }
+        QCOMPARE(threadIds.size(), threadCount);
+        store.abortTransaction();
+
+        //Removing a message of a merged thread removes it from the thread
+        const auto removed = std::find_if(mails.begin(), mails.end(), [](const ApplicationDomain::Mail &mail) { return mail.getMessageId() == "thread0message0"; });
+        QVERIFY(removed != mails.end());
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.remove("mail", *removed, false);
+        store.commitTransaction();
+        mails.erase(removed);
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        const auto threadId = threadsOf().value("thread0").first();
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::ThreadId::name, threadId).size(), threadSize - 1);
+        store.abortTransaction();
+    }
+
+    void threadingWithMissingAncestors()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto createMail = [&] (const QByteArray &messageId, const QByteArrayList &ancestors) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setExtractedMessageId(messageId);
+            if (!ancestors.isEmpty()) {
+                mail.setExtractedParentMessageId(ancestors.last());
+                mail.setExtractedAncestors(ancestors);
+            }
+            return mail;
+        };
+        auto threadId = [&] (const ApplicationDomain::Mail &mail) {
+            return store.readLatest<ApplicationDomain::Mail>(mail.identifier()).getProperty(ApplicationDomain::Mail::ThreadId::name).toByteArray();
+        };
+
+        const auto root = createMail("root", {});
+        const auto middle = createMail("middle", {"root"});
+        const auto leaf = createMail("leaf", {"root", "middle"});
+        const auto other = createMail("other", {});
+
+        //The leaf arrives first and the middle message is missing
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("mail", leaf, false);
+        store.add("mail", other, false);
+        store.add("mail", root, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QVERIFY(!threadId(root).isEmpty());
+        QCOMPARE(threadId(leaf), threadId(root));
+        QVERIFY(threadId(other) != threadId(root));
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::ThreadId::name, threadId(root)).size(), 2);
+        store.abortTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("mail", middle, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QCOMPARE(threadId(middle), threadId(root));
+        QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::ThreadId::name, threadId(root)).size(), 3);
+        store.abortTransaction();
+    }
+
+    void threadSummaries()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        const auto date = QDateTime(QDate(2015, 7, 7), QTime(12, 0));
+        auto createMail = [&] (const QByteArray &messageId, const QByteArray &parent, const QString &sender, int day, bool unread) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setExtractedMessageId(messageId);
+            if (!parent.isEmpty()) {
+                mail.setExtractedParentMessageId(parent);
+            }
+            mail.setExtractedSender(ApplicationDomain::Mail::Contact{{}, sender});
+            mail.setExtractedDate(date.addDays(day));
+            mail.setUnread(unread);
+            return mail;
+        };
+
+        const auto root = createMail("root", {}, "a@example.org", 0, false);
+        const auto reply1 = createMail("reply1", "root", "b@example.org", 1, true);
+        const auto reply2 = createMail("reply2", "reply1", "a@example.org", 2, true);
+        const auto other = createMail("other", {}, "c@example.org", 1, true);
+
+        //The replies form a thread of their own until the first reply arrives
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("mail", root, false);
+        store.add("mail", reply2, false);
+        store.add("mail", other, false);
+        store.add("mail", reply1, false);
+        store.commitTransaction();
+
+        auto summaryOf = [&] (const ApplicationDomain::Mail &mail) {
+            ThreadSummary summary;
+            [&] { QVERIFY(store.readThreadSummary(store.readLatest<ApplicationDomain::Mail>(mail.identifier()).getProperty(ApplicationDomain::Mail::ThreadId::name).toByteArray(), summary)); }();
+            return summary;
+        };
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        {
+            const auto summary = summaryOf(root);
+            QCOMPARE(summary.latestMail, reply2.identifier());
+            QCOMPARE(summary.latestDate, date.addDays(2));
+            QCOMPARE(summary.messageCount, 3);
+            QCOMPARE(summary.unreadCount, 2);
+            QCOMPARE(summary.participants, (QMap<QString, int>{{"a@example.org", 2}, {"b@example.org", 1}}));
+
+            QByteArrayList latestMails;
+            QVERIFY(store.readThreadSummaries([&](const ThreadSummary &summary) {
+                latestMails << summary.latestMail;
+                return true;
+            }));
+            QCOMPARE(latestMails, (QByteArrayList{reply2.identifier(), other.identifier()}));
+        }
+        store.abortTransaction();
+
+        //Modifying the thread root keeps the thread and its summary
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        const auto threadId = store.readLatest<ApplicationDomain::Mail>(root.identifier()).getProperty(ApplicationDomain::Mail::ThreadId::name).toByteArray();
+        store.abortTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        {
+            ApplicationDomain::Mail diff{"res1", root.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+            diff.setImportant(true);
+            store.modify("mail", diff, QByteArrayList{}, false);
+        }
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        {
+            QCOMPARE(store.readLatest<ApplicationDomain::Mail>(root.identifier()).getProperty(ApplicationDomain::Mail::ThreadId::name).toByteArray(), threadId);
+            QCOMPARE(store.readLatest<ApplicationDomain::Mail>(reply2.identifier()).getProperty(ApplicationDomain::Mail::ThreadId::name).toByteArray(), threadId);
+            QCOMPARE(store.indexLookup("mail", ApplicationDomain::Mail::ThreadId::name, threadId).size(), 3);
+            const auto summary = summaryOf(root);
+            QCOMPARE(summary.threadId, threadId);
+            QCOMPARE(summary.latestMail, reply2.identifier());
+            QCOMPARE(summary.messageCount, 3);
+            QCOMPARE(summary.unreadCount, 2);
+            QCOMPARE(summary.participants, (QMap<QString, int>{{"a@example.org", 2}, {"b@example.org", 1}}));
+        }
+        store.abortTransaction();
+
+        //Marking the latest mail as read and removing it updates the summary
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        ApplicationDomain::Mail diff{"res1", reply2.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+        diff.setUnread(false);
+        store.modify("mail", diff, QByteArrayList{}, false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QCOMPARE(summaryOf(root).unreadCount, 1);
+        QCOMPARE(summaryOf(root).latestMail, reply2.identifier());
+        store.abortTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.remove("mail", store.readLatest<ApplicationDomain::Mail>(reply2.identifier()), false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        {
+            const auto summary = summaryOf(root);
+            QCOMPARE(summary.latestMail, reply1.identifier());
+            QCOMPARE(summary.latestDate, date.addDays(1));
+            QCOMPARE(summary.messageCount, 2);
+            QCOMPARE(summary.unreadCount, 1);
+            QCOMPARE(summary.participants, (QMap<QString, int>{{"a@example.org", 1}, {"b@example.org", 1}}));
+        }
+        store.abortTransaction();
+    }
+
+    void folderCounts()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto folder1 = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Folder>("res1");
+        auto folder2 = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Folder>("res1");
+        auto createMail = [&] (const ApplicationDomain::Folder &folder, bool unread, bool important) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setFolder(folder);
+            mail.setUnread(unread);
+            mail.setImportant(important);
+            return mail;
+        };
+        const auto mail1 = createMail(folder1, true, false);
+        const auto mail2 = createMail(folder1, true, true);
+        const auto mail3 = createMail(folder1, false, false);
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("folder", folder1, false);
+        store.add("folder", folder2, false);
+        store.add("mail", mail1, false);
+        store.add("mail", mail2, false);
+        store.add("mail", mail3, false);
+        store.commitTransaction();
+
+        auto countsOf = [&] (const ApplicationDomain::Folder &folder) {
+            const auto entity = store.readLatest<ApplicationDomain::Folder>(folder.identifier());
+            return QVector<int>{entity.getProperty(ApplicationDomain::Folder::TotalCount::name).toInt(),
+                entity.getProperty(ApplicationDomain::Folder::UnreadCount::name).toInt(),
+                entity.getProperty(ApplicationDomain::Folder::ImportantCount::name).toInt()};
+        };
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QCOMPARE(countsOf(folder1), (QVector<int>{3, 2, 1}));
+        QCOMPARE(countsOf(folder2), (QVector<int>{0, 0, 0}));
+        const auto baseRevision = store.maxRevision() + 1;
+        store.abortTransaction();
+
+        //Marking a mail as read and moving another one updates both folders
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        {
+            ApplicationDomain::Mail diff{"res1", mail1.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+            diff.setUnread(false);
+            store.modify("mail", diff, QByteArrayList{}, false);
+        }
+        {
+            ApplicationDomain::Mail diff{"res1", mail2.identifier(), 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+            diff.setFolder(folder2);
+            store.modify("mail", diff, QByteArrayList{}, false);
+        }
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QCOMPARE(countsOf(folder1), (QVector<int>{2, 0, 0}));
+        QCOMPARE(countsOf(folder2), (QVector<int>{1, 1, 1}));
+
+        //Live queries on folders pick up the changed counts
+        QSet<QByteArray> changedFolders;
+        store.readDerivedChanges(baseRevision, "folder", [&](const QByteArray &uid) {
+            changedFolders << uid;
+        });
+        QCOMPARE(changedFolders, (QSet<QByteArray>{folder1.identifier(), folder2.identifier()}));
+        store.abortTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.remove("mail", store.readLatest<ApplicationDomain::Mail>(mail3.identifier()), false);
+        store.remove("mail", store.readLatest<ApplicationDomain::Mail>(mail2.identifier()), false);
+        store.commitTransaction();
+
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        QCOMPARE(countsOf(folder1), (QVector<int>{1, 0, 0}));
+        QCOMPARE(countsOf(folder2), (QVector<int>{0, 0, 0}));
+        const auto topRevision = store.maxRevision();
+        store.abortTransaction();
+
+        //The change log is cleaned up with the revisions
+        store.cleanupRevisions(topRevision);
+        store.startTransaction(Storage::DataStore::ReadOnly);
+        changedFolders.clear();
+        store.readDerivedChanges(baseRevision, "folder", [&](const QByteArray &uid) {
+            changedFolders << uid;
+        });
+        QVERIFY(changedFolders.isEmpty());
+        store.abortTransaction();
+    }
+
+    void derivedStateIsBuiltForExistingMails()
+    {
+        using namespace Sink;
+        ResourceContext resourceContext{resourceInstanceIdentifier.toUtf8(), "dummy", AdaptorFactoryRegistry::instance().getFactories("test")};
+        Storage::EntityStore store(resourceContext, {});
+
+        auto folder = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Folder>("res1");
+        QByteArrayList uids;
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.add("folder", folder, false);
+        for (int i = 0; i < 10; i++) {
+            auto mail = ApplicationDomain::ApplicationDomainType::createEntity<ApplicationDomain::Mail>("res1");
+            mail.setExtractedMessageId("messageid" + QByteArray::number(i));
+            if (i) {
+                mail.setExtractedParentMessageId("messageid0");
+            }
+            mail.setFolder(folder);
+            mail.setUnread(true);
+            store.add("mail", mail, false);
+            uids << mail.identifier();
+        }
+        store.commitTransaction();
+
+        //Pretend the store contained the mails before the counts and summaries were introduced
+        {
+            Storage::DataStore storage(Sink::storageLocation(), resourceInstanceIdentifier, Storage::DataStore::ReadWrite);
+            auto transaction = storage.createTransaction(Storage::DataStore::ReadWrite);
+            transaction.openDatabase("index.definitions").remove("mail.index.folderCounts");
+            transaction.openDatabase("index.definitions").remove("mail.index.threadSummary");
+            transaction.commit();
+        }
+
+        store.startTransaction(Storage::DataStore::ReadWrite);
+        store.updateIndexDefinitions();
+        const auto threadId = store.readLatest<ApplicationDomain::Mail>(uids.first()).getProperty(ApplicationDomain::Mail::ThreadId::name).toByteArray();
+        ThreadSummary summary;
+        QVERIFY(!store.readThreadSummary(threadId, summary));
+        QVERIFY(!store.readLatest<ApplicationDomain::Folder>(folder.identifier()).getProperty(ApplicationDomain::Folder::TotalCount::name).isValid());
+
+        //Mails that are written during the build are counted once, either right away or by the build
+        QVERIFY(store.buildIndexes(3));
+        for (const auto &uid : uids.mid(0, 2)) {
+            ApplicationDomain::Mail diff{"res1", uid, 0, QSharedPointer<ApplicationDomain::MemoryBufferAdaptor>::create()};
+            diff.setUnread(false);
+            store.modify("mail", diff, QByteArrayList{}, false);
+        }
+        store.remove("mail", store.readLatest("mail", uids.last()), false);
+        while (store.buildIndexes(3)) {
+        }
+
+        QVERIFY(store.readThreadSummary(threadId, summary));
+        QCOMPARE(summary.messageCount, 9);
+        QCOMPARE(summary.unreadCount, 7);
+        QVERIFY(store.readThreadSummary(threadId, summary, folder.identifier()));
+        QCOMPARE(summary.messageCount, 9);
+        const auto entity = store.readLatest<ApplicationDomain::Folder>(folder.identifier());
+        QCOMPARE(entity.getProperty(ApplicationDomain::Folder::TotalCount::name).toInt(), 9);
+        QCOMPARE(entity.getProperty(ApplicationDomain::Folder::UnreadCount::name).toInt(), 7);
+        store.commitTransaction();
+    }
 };
 
 QTEST_MAIN(EntityStoreTest)
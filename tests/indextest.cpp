@@ -2,10 +2,13 @@
 
 #include <QString>
 #include <QQueue>
+#include <limits>
 
 #include "store.h"
 #include "storage.h"
 #include "index.h"
+#include "bloomfilter.h"
+#include "sortablekey.h"
 
 /**
  * Test of the index implementation
@@ -55,6 +58,113 @@ private slots:
             QCOMPARE(values.size(), 3);
         }
     }
+
+    void testRangeLookup()
+    {
+        Index index("./testindex", "sink.dummy.testindex", Sink::Storage::DataStore::ReadWrite);
+        index.add("1", "value1");
+        index.add("2", "value2");
+        index.add("2", "value2b");
+        index.add("3", "value3");
+        index.add("4", "value4");
+
+        {
+            QList<QByteArray> values;
+            index.rangeLookup("2", "4", [&values](const QByteArray &value) { values << value; }, [](const Index::Error &error) { qWarning() << "Error: "; });
+            QCOMPARE(values, (QList<QByteArray>{"value2", "value2b", "value3"}));
+        }
+        {
+            QList<QByteArray> values;
+            index.rangeLookup({}, "2", [&values](const QByteArray &value) { values << value; }, [](const Index::Error &error) { qWarning() << "Error: "; });
+            QCOMPARE(values, (QList<QByteArray>{"value1"}));
+        }
+        {
+            QList<QByteArray> values;
+            index.rangeLookup("3", {}, [&values](const QByteArray &value) { values << value; }, [](const Index::Error &error) { qWarning() << "Error: "; });
+            QCOMPARE(values, (QList<QByteArray>{"value3", "value4"}));
+        }
+    }
+
+    void testSortableKeys()
+    {
+        using namespace Sink;
+        const QList<qint64> numbers{std::numeric_limits<qint64>::min(), -1000000000000000000ll, -1, 0, 1, 1000000000000000000ll, std::numeric_limits<qint64>::max()};
+        for (int i = 0; i < numbers.size(); i++) {
+            QCOMPARE(SortableKey::toNumber(SortableKey::fromNumber(numbers.at(i))), numbers.at(i));
+            if (i > 0) {
+                QVERIFY(SortableKey::fromNumber(numbers.at(i - 1)) < SortableKey::fromNumber(numbers.at(i)));
+            }
+        }
+
+        //Dates before the epoch sort like all others
+        const auto preEpoch = QDateTime::fromString("1950-01-01T00:00:00Z", Qt::ISODate);
+        const auto postEpoch = QDateTime::fromString("2017-01-01T00:00:00Z", Qt::ISODate);
+        QVERIFY(SortableKey::fromDate(QDateTime{}) < SortableKey::fromDate(preEpoch));
+        QVERIFY(SortableKey::fromDate(preEpoch) < SortableKey::fromDate(postEpoch));
+        QVERIFY(SortableKey::fromDateNewestFirst(postEpoch) < SortableKey::fromDateNewestFirst(preEpoch));
+        QVERIFY(SortableKey::fromDateNewestFirst(preEpoch) < SortableKey::fromDateNewestFirst(QDateTime{}));
+        QCOMPARE(SortableKey::toDateNewestFirst(SortableKey::fromDateNewestFirst(preEpoch)), preEpoch);
+        QVERIFY(!SortableKey::toDateNewestFirst(SortableKey::fromDateNewestFirst(QDateTime{})).isValid());
+    }
+
+    void testBloomFilter()
+    {
+        BloomFilter filter(1000);
+        for (int i = 0; i < 1000; i++) {
+            filter.add("key" + QByteArray::number(i));
+        }
+        for (int i = 0; i < 1000; i++) {
+            QVERIFY(filter.mayContain("key" + QByteArray::number(i)));
+        }
+        int falsePositives = 0;
+        for (int i = 1000; i < 11000; i++) {
+            if (filter.mayContain("key" + QByteArray::number(i))) {
+                falsePositives++;
+            }
+        }
+        QVERIFY(falsePositives < 300);
+    }
+
+    void testIndexWithBloomFilter()
+    {
+        Sink::Storage::DataStore store("./testindex", "sink.dummy.testindex", Sink::Storage::DataStore::ReadWrite);
+        {
+            auto transaction = store.createTransaction(Sink::Storage::DataStore::ReadWrite);
+            Index index("bloomindex", transaction, true);
+            //More keys than the initial capacity of the filter, so it has to grow
+            for (int i = 0; i < 3000; i++) {
+                index.add("key" + QByteArray::number(i), "value" + QByteArray::number(i));
+            }
+            QCOMPARE(index.lookup("key2999"), QByteArray{"value2999"});
+            QVERIFY(index.lookup("missing").isEmpty());
+            transaction.commit();
+        }
+        //The filter is loaded from the store
+        Sink::Storage::PersistentBloomFilter::clearCache("sink.dummy.testindex");
+        {
+            auto transaction = store.createTransaction(Sink::Storage::DataStore::ReadWrite);
+            Index index("bloomindex", transaction, true);
+            for (int i = 0; i < 3000; i++) {
+                QCOMPARE(index.lookup("key" + QByteArray::number(i)), "value" + QByteArray::number(i));
+            }
+            index.add("newKey", "newValue");
+            transaction.abort();
+        }
+        //An aborted transaction must not leave keys in the filter that are not persisted
+        {
+            auto transaction = store.createTransaction(Sink::Storage::DataStore::ReadWrite);
+            Index index("bloomindex", transaction, true);
+            QVERIFY(index.lookup("newKey").isEmpty());
+            index.add("newKey", "newValue");
+            QCOMPARE(index.lookup("newKey"), QByteArray{"newValue"});
+        }
+        //Read-only transactions don't use the filter
+        {
+            auto transaction = store.createTransaction(Sink::Storage::DataStore::ReadOnly);
+            Index index("bloomindex", transaction, true);
+            QCOMPARE(index.lookup("key0"), QByteArray{"value0"});
+        }
+    }
 };
 
 QTEST_MAIN(IndexTest)
@@ -33,6 +33,8 @@
 
 #include <iostream>
 #include <math.h>
+#include <algorithm>
+#include <random>
 
 #include "mail_generated.h"
 #include "createentity_generated.h"
@@ -78,6 +80,39 @@ class MailQueryBenchmark : public QObject
         entityStore.commitTransaction();
     }
 
+    void populateFulltextDatabase(int count, int needleSpreadFactor)
+    {
+        TestResource::removeFromDisk(resourceIdentifier);
+
+        Sink::ResourceContext resourceContext{resourceIdentifier, "test", {{"mail", QSharedPointer<TestMailAdaptorFactory>::create()}}};
+        Sink::Storage::EntityStore entityStore{resourceContext, {}};
+        entityStore.startTransaction(Sink::Storage::DataStore::ReadWrite);
+
+        const QStringList words{"meeting", "report", "budget", "invoice", "project", "release", "review", "schedule", "holiday", "conference",
+            "deadline", "proposal", "contract", "feedback", "question", "update", "reminder", "agenda", "summary", "planning"};
+        const auto date = QDateTime::currentDateTimeUtc();
+        for (int i = 0; i < count; i++) {
+            auto domainObject = Mail::createEntity<Mail>(resourceIdentifier);
+            domainObject.setExtractedMessageId("uid");
+            const auto subject = words.at(i % words.size()) + " " + words.at((i * 7) % words.size());
+            domainObject.setExtractedSubject(subject);
+            domainObject.setExtractedDate(date.addSecs(count));
+            domainObject.setFolder("folder1");
+            entityStore.add("mail", domainObject, false);
+
+            QStringList body;
+            for (int j = 0; j < 100; j++) {
+                body << words.at((i * 31 + j * 17) % words.size());
+            }
+            if (i % needleSpreadFactor == 0) {
+                body << "needle";
+            }
+            entityStore.updateFulltextIndex("mail", domainObject.identifier(), subject + "\n" + body.join(' '));
+        }
+
+        entityStore.commitTransaction();
+    }
+
     void testLoad(const QByteArray &name, const Sink::Query &query, int count, int expectedSize)
     {
         const auto startingRss = getCurrentRSS();
@@ -178,6 +213,99 @@ private slots:
         populateDatabase(count, mailsPerFolder);
         testLoad("_threadleader", query, count, query.limit());
     }
+
+    void test50kFulltext()
+    {
+        Sink::Query query;
+        query.request<Mail::MessageId>()
+             .request<Mail::Subject>()
+             .request<Mail::Date>();
+        query.fulltextFilter("needle");
+
+        int count = 50000;
+        int needleSpreadFactor = 100;
+        populateFulltextDatabase(count, needleSpreadFactor);
+        testLoad("_fulltext", query, count, count / needleSpreadFactor);
+    }
+
+    void test1MIndexVerification()
+    {
+        int count = 1000000;
+        populateDatabase(count, 100);
+
+        Sink::ResourceContext resourceContext{resourceIdentifier, "test", {{"mail", QSharedPointer<TestMailAdaptorFactory>::create()}}};
+        Sink::Storage::EntityStore entityStore{resourceContext, {}};
+
+        QTime time;
+        time.start();
+        entityStore.startTransaction(Sink::Storage::DataStore::ReadOnly);
+        const auto brokenIndexes = entityStore.verifyIndexes([](const QByteArray &, const QByteArray &, const QByteArray &, bool) {});
+        entityStore.abortTransaction();
+        const auto elapsed = time.elapsed();
+        QVERIFY(brokenIndexes.isEmpty());
+
+        std::cout << "The verification took [ms]: " << elapsed << std::endl;
+
+        HAWD::Dataset dataset("index_verification", mHawdState);
+        HAWD::Dataset::Row row = dataset.row();
+        row.setValue("rows", count);
+        row.setValue("entitiesPerMs", (qreal)count / elapsed);
+        dataset.insertRow(row);
+        HAWD::Formatter::print(dataset);
+    }
+
+    void test50kThreadMerging()
+    {
+        TestResource::removeFromDisk(resourceIdentifier);
+
+        Sink::ResourceContext resourceContext{resourceIdentifier, "test", {{"mail", QSharedPointer<TestMailAdaptorFactory>::create()}}};
+        Sink::Storage::EntityStore entityStore{resourceContext, {}};
+
+        //Mailing list threads that arrive in random order, so most threads are created more than once and merged later on
+        const int count = 50000;
+        const int threadSize = 50;
+        QList<Mail> mails;
+        for (int i = 0; i < count; i++) {
+            auto mail = Mail::createEntity<Mail>(resourceIdentifier);
+            const auto prefix = "thread" + QByteArray::number(i / threadSize) + "message";
+            mail.setExtractedMessageId(prefix + QByteArray::number(i % threadSize));
+            if (i % threadSize) {
+                mail.setExtractedParentMessageId(prefix + QByteArray::number((i % threadSize) - 1));
+            }
+            mail.setFolder("folder1");
+            mails << mail;
+        }
+        std::shuffle(mails.begin(), mails.end(), std::mt19937{0});
+
+        QTime time;
+        time.start();
+        entityStore.startTransaction(Sink::Storage::DataStore::ReadWrite);
+        for (const auto &mail : mails) {
+            entityStore.add("mail", mail, false);
+        }
+        entityStore.commitTransaction();
+        const auto elapsed = time.elapsed();
+
+        entityStore.startTransaction(Sink::Storage::DataStore::ReadOnly);
+        QSet<QByteArray> threadIds;
+        for (const auto &mail : mails) {
+            threadIds << entityStore.readLatest<Mail>(mail.identifier()).getProperty(Mail::ThreadId::name).toByteArray();
+        }
+        QCOMPARE(threadIds.size(), count / threadSize);
+        const auto threadId = entityStore.readLatest<Mail>(mails.first().identifier()).getProperty(Mail::ThreadId::name).toByteArray();
+        QCOMPARE(entityStore.indexLookup("mail", Mail::ThreadId::name, threadId).size(), threadSize);
+        entityStore.abortTransaction();
+
+        std::cout << "Threading took [ms]: " << elapsed << std::endl;
+
+        HAWD::Dataset dataset("thread_merging", mHawdState);
+        HAWD::Dataset::Row row = dataset.row();
+        row.setValue("rows", count);
+        row.setValue("threads", threadIds.size());
+        row.setValue("entitiesPerMs", (qreal)count / elapsed);
+        dataset.insertRow(row);
+        HAWD::Formatter::print(dataset);
+    }
 };
 
 QTEST_MAIN(MailQueryBenchmark)
@@ -25,6 +25,7 @@
 
 #include "store.h"
 #include "resourcecontrol.h"
+#include "resourceconfig.h"
 #include "notifier.h"
 #include "notification.h"
 #include "log.h"
@@ -312,6 +313,81 @@ void MailSyncTest::testResyncMails()
     VERIFYEXEC(job);
 }
 
+void MailSyncTest::testEvictMailBodies()
+{
+    //The configuration is only read on startup
+    VERIFYEXEC(ResourceControl::shutdown(mResourceInstanceIdentifier));
+    auto configuration = ResourceConfig::getConfiguration(mResourceInstanceIdentifier);
+    configuration.insert("bodyCacheBudget", 1);
+    ResourceConfig::configureResource(mResourceInstanceIdentifier, configuration);
+
+    Sink::Query query;
+    query.resourceFilter(mResourceInstanceIdentifier);
+    query.request<Mail::Subject>();
+
+    // Bodies are evicted after the next synchronization
+    VERIFYEXEC(Store::synchronize(query));
+    VERIFYEXEC(ResourceControl::flushMessageQueue(mResourceInstanceIdentifier));
+    VERIFYEXEC(Store::synchronize(query));
+    VERIFYEXEC(ResourceControl::flushMessageQueue(mResourceInstanceIdentifier));
+
+    auto mails = Store::read<Mail>(query);
+    QCOMPARE(mails.size(), 1);
+    QVERIFY(mails.first().getSubject().startsWith(QString("[Nepomuk] Jenkins build is still unstable")));
+
+    // Requesting the body fetches it again if it has been evicted
+    auto bodyQuery = Sink::Query{mails.first()};
+    bodyQuery.setFlags(Query::LiveQuery);
+    bodyQuery.request<Mail::Subject>().request<Mail::MimeMessage>();
+    auto model = Store::loadModel<Mail>(bodyQuery);
+    QTRY_COMPARE(model->rowCount(QModelIndex()), 1);
+    QTRY_VERIFY(!model->index(0, 0, QModelIndex()).data(Store::DomainObjectRole).value<Mail::Ptr>()->getMimeMessage().isEmpty());
+
+    configuration.remove("bodyCacheBudget");
+    ResourceConfig::configureResource(mResourceInstanceIdentifier, configuration);
+}
+
+void MailSyncTest::testSyncEvictedMailBody()
+{
+    //The configuration is only read on startup
+    VERIFYEXEC(ResourceControl::shutdown(mResourceInstanceIdentifier));
+    auto configuration = ResourceConfig::getConfiguration(mResourceInstanceIdentifier);
+    configuration.insert("bodyCacheBudget", 1);
+    ResourceConfig::configureResource(mResourceInstanceIdentifier, configuration);
+
+    Sink::Query query;
+    query.resourceFilter(mResourceInstanceIdentifier);
+    query.request<Mail::Subject>().request<Mail::MimeMessage>().request<Mail::FullPayloadAvailable>();
+
+    // Bodies are evicted after the next synchronization
+    VERIFYEXEC(Store::synchronize(query));
+    VERIFYEXEC(ResourceControl::flushMessageQueue(mResourceInstanceIdentifier));
+    VERIFYEXEC(Store::synchronize(query));
+    VERIFYEXEC(ResourceControl::flushMessageQueue(mResourceInstanceIdentifier));
+
+    auto mails = Store::read<Mail>(query);
+    QCOMPARE(mails.size(), 1);
+    const auto mail = mails.first();
+    // Only bodies in the blob storage are evicted, a maildir keeps referring to the files of the source
+    if (mail.getMimeMessage().isEmpty()) {
+        QVERIFY(!mail.getFullPayloadAvailable());
+    }
+
+    // A synchronization of the mail fetches the evicted body again
+    auto syncScope = Sink::SyncScope{ApplicationDomain::getTypeName<Mail>()};
+    syncScope.resourceFilter(mResourceInstanceIdentifier);
+    syncScope.filter(mail.identifier());
+    VERIFYEXEC(Store::synchronize(syncScope));
+    VERIFYEXEC(ResourceControl::flushMessageQueue(mResourceInstanceIdentifier));
+
+    const auto fetched = Store::readOne<Mail>(Sink::Query{mail}.request<Mail::MimeMessage>().request<Mail::FullPayloadAvailable>());
+    QVERIFY(!fetched.getMimeMessage().isEmpty());
+    QVERIFY(fetched.getFullPayloadAvailable());
+
+    configuration.remove("bodyCacheBudget");
+    ResourceConfig::configureResource(mResourceInstanceIdentifier, configuration);
+}
+
 void MailSyncTest::testFetchNewRemovedMessages()
 {
     Sink::Query query;
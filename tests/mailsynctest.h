@@ -66,6 +66,8 @@ private slots:
 
     void testListMails();
     void testResyncMails();
+    void testEvictMailBodies();
+    void testSyncEvictedMailBody();
     void testFetchNewRemovedMessages();
     void testFlagChange();
 
@@ -115,6 +115,48 @@ private slots:
     {
         populateDatabase(10000, QVector<Sink::Preprocessor *>());
     }
+
+    /*
+     * The initial sync writes all entities in a single bulk load into empty indexes.
+     * There are more entities than the index buffer holds, so sorted runs are spilled and merged.
+     */
+    void testInitialSync()
+    {
+        TestResource::removeFromDisk(resourceIdentifier);
+
+        auto pipeline = QSharedPointer<Sink::Pipeline>::create(Sink::ResourceContext{resourceIdentifier, "test"}, "test");
+        auto domainTypeAdaptorFactory = QSharedPointer<TestMailAdaptorFactory>::create();
+
+        const int count = 150000;
+        const auto date = QDateTime::currentDateTimeUtc();
+        QTime time;
+        time.start();
+        pipeline->startTransaction();
+        for (int i = 0; i < count; i++) {
+            auto domainObject = Sink::ApplicationDomain::Mail::Ptr::create();
+            domainObject->setExtractedMessageId(QString("uid%1").arg(i).toUtf8());
+            domainObject->setExtractedSubject(QString("subject%1").arg(i));
+            domainObject->setExtractedDate(date.addSecs((i * 7919) % count));
+            domainObject->setFolder(QString("folder%1").arg(i % 10).toUtf8());
+            const auto command = createCommand<Sink::ApplicationDomain::Mail>(*domainObject, *domainTypeAdaptorFactory);
+            pipeline->newEntity(command.data(), command.size());
+        }
+        pipeline->commit();
+        const auto elapsed = time.elapsed();
+
+        Sink::Storage::EntityStore store(Sink::ResourceContext{resourceIdentifier, "test"}, {});
+        QCOMPARE(store.count<Sink::ApplicationDomain::Mail>(Sink::Query{}.filter<Sink::ApplicationDomain::Mail::Folder>("folder1")), count / 10);
+
+        const auto size = Sink::Storage::DataStore(Sink::storageLocation(), resourceIdentifier, Sink::Storage::DataStore::ReadOnly).diskUsage() / 1024;
+
+        HAWD::Dataset dataset("initial_sync", mHawdState);
+        HAWD::Dataset::Row row = dataset.row();
+        row.setValue("rows", count);
+        row.setValue("entitiesPerMs", (qreal)count / elapsed);
+        row.setValue("size", size);
+        dataset.insertRow(row);
+        HAWD::Formatter::print(dataset);
+    }
 };
 
 QTEST_MAIN(PipelineBenchmark)
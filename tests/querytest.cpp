@@ -2,6 +2,7 @@
 
 #include <QString>
 #include <QSignalSpy>
+#include <algorithm>
 
 #include "resource.h"
 #include "store.h"
@@ -13,6 +14,7 @@
 #include "test.h"
 #include "testutils.h"
 #include "applicationdomaintype.h"
+#include "standardqueries.h"
 
 using namespace Sink;
 using namespace Sink::ApplicationDomain;
@@ -56,6 +58,7 @@ private slots:
         Sink::QueryBase::Filter filter;
         filter.ids << "id";
         filter.propertyFilter.insert("foo", QVariant::fromValue(QByteArray("bar")));
+        filter.orFilters << Sink::QueryBase::Or{}.filter("foo", QVariant::fromValue(QByteArray("baz"))).filter("bar", QVariant::fromValue(QByteArray("baz")));
 
         Sink::Query query;
         query.setFilter(filter);
@@ -79,6 +82,7 @@ private slots:
         QCOMPARE(deserializedQuery.getFilter().ids, filter.ids);
         QCOMPARE(deserializedQuery.getFilter().propertyFilter.keys(), filter.propertyFilter.keys());
         QCOMPARE(deserializedQuery.getFilter().propertyFilter, filter.propertyFilter);
+        QCOMPARE(deserializedQuery.getFilter().orFilters, filter.orFilters);
     }
 
     void testNoResources()
@@ -377,6 +381,95 @@ private slots:
         QCOMPARE(model->rowCount(), 1);
     }
 
+    void testMailByFolderOrMessageId()
+    {
+        // Setup
+        {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedMessageId("test1");
+            mail.setFolder("folder1");
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+
+            Mail mail1("sink.dummy.instance1");
+            mail1.setExtractedMessageId("test2");
+            mail1.setFolder("folder2");
+            VERIFYEXEC(Sink::Store::create<Mail>(mail1));
+
+            Mail mail2("sink.dummy.instance1");
+            mail2.setExtractedMessageId("test3");
+            mail2.setFolder("folder2");
+            VERIFYEXEC(Sink::Store::create<Mail>(mail2));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        // Test
+        Sink::Query query;
+        query.resourceFilter("sink.dummy.instance1");
+        query.request<Mail::MessageId>();
+        query.filter(Sink::QueryBase::Or{}.filter<Mail::Folder>("folder1").filter<Mail::MessageId>("test3"));
+        QSet<QByteArray> ids;
+        for (const auto &mail : Sink::Store::read<Mail>(query)) {
+            ids << mail.getMessageId();
+        }
+        QCOMPARE(ids, (QSet<QByteArray>{"test1", "test3"}));
+    }
+
+    void testCount()
+    {
+        // Setup
+        {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedSubject("subject1");
+            mail.setFolder("folder1");
+            mail.setUnread(true);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+
+            Mail mail1("sink.dummy.instance1");
+            mail1.setExtractedSubject("subject2");
+            mail1.setFolder("folder1");
+            mail1.setUnread(false);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail1));
+
+            Mail mail2("sink.dummy.instance1");
+            mail2.setExtractedSubject("subject1");
+            mail2.setFolder("folder2");
+            mail2.setUnread(true);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail2));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        // Test
+        {
+            //From the folder index
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.filter<Mail::Folder>("folder1");
+            QCOMPARE(Sink::Store::count<Mail>(query), qint64{2});
+        }
+        {
+            //From a prefix of the compound index
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.filter<Mail::Folder>("folder1");
+            query.filter<Mail::Unread>(true);
+            QCOMPARE(Sink::Store::count<Mail>(query), qint64{1});
+        }
+        {
+            //Without index
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.filter<Mail::Subject>("subject1");
+            QCOMPARE(Sink::Store::count<Mail>(query), qint64{2});
+        }
+        {
+            //The limit doesn't apply
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.limit(1);
+            QCOMPARE(Sink::Store::count<Mail>(query), qint64{3});
+        }
+    }
+
     void testMailByFolderSortedByDate()
     {
         // Setup
@@ -470,6 +563,448 @@ private slots:
         QCOMPARE(model->rowCount(), 4);
     }
 
+    void testMailSortedByDateAcrossFolders()
+    {
+        // Setup
+        const auto date = QDateTime(QDate(2015, 7, 7), QTime(12, 0));
+        {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedMessageId("testSecond");
+            mail.setFolder("folder1");
+            mail.setExtractedDate(date.addDays(-1));
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedMessageId("testLatest");
+            mail.setFolder("folder2");
+            mail.setExtractedDate(date);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedMessageId("testLast");
+            mail.setFolder("folder3");
+            mail.setExtractedDate(date.addDays(-2));
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        // Test
+        Sink::Query query;
+        query.resourceFilter("sink.dummy.instance1");
+        query.request<Mail::MessageId>();
+        query.sort<Mail::Date>();
+        query.limit(2);
+        QByteArrayList messageIds;
+        for (const auto &mail : Sink::Store::read<Mail>(query)) {
+            messageIds << mail.getMessageId();
+        }
+        QCOMPARE(messageIds, (QByteArrayList{"testLatest", "testSecond"}));
+    }
+
+    void testMailSortedWithoutIndex()
+    {
+        // Setup
+        for (const auto &subject : QStringList{"beta", "Gamma", "alpha"}) {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedSubject(subject);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        auto subjects = [] (int limit) {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.request<Mail::Subject>();
+            query.sort<Mail::Subject>();
+            query.limit(limit);
+            QStringList subjects;
+            for (const auto &mail : Sink::Store::read<Mail>(query)) {
+                subjects << mail.getSubject();
+            }
+            return subjects;
+        };
+
+        // Test
+        QCOMPARE(subjects(2), (QStringList{"alpha", "beta"}));
+        QCOMPARE(subjects(0), (QStringList{"alpha", "beta", "Gamma"}));
+    }
+
+    void testMailListFromCoveringIndex()
+    {
+        // Setup
+        const auto date = QDateTime(QDate(2015, 7, 7), QTime(12, 0));
+        for (int i = 0; i < 4; i++) {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedSubject("subject" + QString::number(i));
+            mail.setExtractedDate(date.addDays(i));
+            mail.setFolder(i < 3 ? "folder1" : "folder2");
+            mail.setUnread(i != 1);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        // Test
+        //All requested and filtered properties are part of the projection
+        Sink::Query query;
+        query.resourceFilter("sink.dummy.instance1");
+        query.filter<Mail::Folder>("folder1");
+        query.filter<Mail::Unread>(true);
+        query.request<Mail::Subject>();
+        query.request<Mail::Unread>();
+        query.sort<Mail::Date>();
+        QStringList subjects;
+        for (const auto &mail : Sink::Store::read<Mail>(query)) {
+            QVERIFY(mail.getUnread());
+            subjects << mail.getSubject();
+        }
+        QCOMPARE(subjects, (QStringList{"subject2", "subject0"}));
+    }
+
+    void testPagingAcrossBatches()
+    {
+        // Setup
+        //More mails than are read in a single batch, so the first page leaves results that have been read ahead
+        for (int i = 0; i < 300; i++) {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedMessageId("mail" + QByteArray::number(i));
+            mail.setUnread(i % 2);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        // Test
+        Sink::Query query;
+        query.resourceFilter("sink.dummy.instance1");
+        query.filter<Mail::Unread>(true);
+        query.limit(100);
+
+        auto model = Sink::Store::loadModel<Mail>(query);
+        QTRY_VERIFY(model->data(QModelIndex(), Sink::Store::ChildrenFetchedRole).toBool());
+        QCOMPARE(model->rowCount(), 100);
+
+        model->fetchMore(QModelIndex());
+        QTRY_VERIFY(model->data(QModelIndex(), Sink::Store::ChildrenFetchedRole).toBool());
+        QCOMPARE(model->rowCount(), 150);
+
+        QSet<QByteArray> messageIds;
+        for (int i = 0; i < model->rowCount(); i++) {
+            const auto mail = model->index(i, 0).data(Sink::Store::DomainObjectRole).value<Mail::Ptr>();
+            QVERIFY(mail->getUnread());
+            messageIds << mail->getMessageId();
+        }
+        QCOMPARE(messageIds.size(), 150);
+    }
+
+    void testMailSortedWithoutIndexPaging()
+    {
+        // Setup
+        const QStringList sorted{"a", "b", "c", "d", "e", "f", "g"};
+        for (const auto &subject : QStringList{"d", "g", "a", "f", "c", "e", "b"}) {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedSubject(subject);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        Sink::Query query;
+        query.resourceFilter("sink.dummy.instance1");
+        query.request<Mail::Subject>();
+        query.sort<Mail::Subject>();
+        query.limit(2);
+
+        auto model = Sink::Store::loadModel<Mail>(query);
+        auto loadedSubjects = [&] {
+            QStringList subjects;
+            for (int row = 0; row < model->rowCount(); row++) {
+                subjects << model->index(row, 0).data(Sink::Store::DomainObjectRole).value<Mail::Ptr>()->getSubject();
+            }
+            std::sort(subjects.begin(), subjects.end());
+            return subjects;
+        };
+
+        // Test
+        // Every page continues where the previous one stopped, also once more than a page is kept between the scans
+        QTRY_VERIFY(model->data(QModelIndex(), Sink::Store::ChildrenFetchedRole).toBool());
+        QCOMPARE(loadedSubjects(), sorted.mid(0, 2));
+        for (const auto count : {4, 6, 7}) {
+            model->fetchMore(QModelIndex());
+            QTRY_COMPARE(loadedSubjects(), sorted.mid(0, count));
+        }
+    }
+
+    void testMailSortedWithoutIndexLive()
+    {
+        // Setup
+        for (const auto &subject : QStringList{"c", "a", "d", "b"}) {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedSubject(subject);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        Sink::Query query;
+        query.resourceFilter("sink.dummy.instance1");
+        query.request<Mail::Subject>();
+        query.sort<Mail::Subject>();
+        query.limit(2);
+        query.setFlags(Query::LiveQuery);
+
+        auto model = Sink::Store::loadModel<Mail>(query);
+        auto loadedSubjects = [&] {
+            QStringList subjects;
+            for (int row = 0; row < model->rowCount(); row++) {
+                subjects << model->index(row, 0).data(Sink::Store::DomainObjectRole).value<Mail::Ptr>()->getSubject();
+            }
+            std::sort(subjects.begin(), subjects.end());
+            return subjects;
+        };
+        QTRY_VERIFY(model->data(QModelIndex(), Sink::Store::ChildrenFetchedRole).toBool());
+        QCOMPARE(loadedSubjects(), (QStringList{"a", "b"}));
+
+        // Test
+        // A loaded mail that now sorts after the loaded page is removed, and delivered again with the page it moved to
+        for (int row = 0; row < model->rowCount(); row++) {
+            auto mail = model->index(row, 0).data(Sink::Store::DomainObjectRole).value<Mail::Ptr>();
+            if (mail->getSubject() == "a") {
+                mail->setExtractedSubject("z");
+                VERIFYEXEC(Sink::Store::modify<Mail>(*mail));
+            }
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+        QTRY_COMPARE(loadedSubjects(), (QStringList{"b"}));
+
+        model->fetchMore(QModelIndex());
+        QTRY_COMPARE(loadedSubjects(), (QStringList{"b", "c", "d"}));
+        model->fetchMore(QModelIndex());
+        QTRY_COMPARE(loadedSubjects(), (QStringList{"b", "c", "d", "z"}));
+    }
+
+    void testSnapshotPaging()
+    {
+        // Setup
+        QList<Mail> mails;
+        for (int i = 0; i < 6; i++) {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedMessageId("mail" + QByteArray::number(i));
+            mail.setUnread(true);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+            mails << mail;
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        Sink::Query query;
+        query.resourceFilter("sink.dummy.instance1");
+        query.filter<Mail::Unread>(true);
+        query.setFlags(Sink::Query::Snapshot);
+        query.limit(2);
+
+        auto model = Sink::Store::loadModel<Mail>(query);
+        auto loadedMails = [&] {
+            QSet<QByteArray> identifiers;
+            for (int row = 0; row < model->rowCount(); row++) {
+                identifiers << model->index(row, 0).data(Sink::Store::DomainObjectRole).value<Mail::Ptr>()->identifier();
+            }
+            return identifiers;
+        };
+        QTRY_VERIFY(model->data(QModelIndex(), Sink::Store::ChildrenFetchedRole).toBool());
+        QCOMPARE(model->rowCount(), 2);
+
+        // Test
+        // Mails that no longer match or are removed after the first page are still part of the snapshot
+        QList<Mail> remaining;
+        for (const auto &mail : mails) {
+            if (!loadedMails().contains(mail.identifier())) {
+                remaining << mail;
+            }
+        }
+        QCOMPARE(remaining.size(), 4);
+        remaining[0].setUnread(false);
+        VERIFYEXEC(Sink::Store::modify<Mail>(remaining[0]));
+        VERIFYEXEC(Sink::Store::remove<Mail>(remaining[1]));
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        for (const auto count : {4, 6}) {
+            model->fetchMore(QModelIndex());
+            QTRY_COMPARE(model->rowCount(), count);
+        }
+        QCOMPARE(loadedMails().size(), 6);
+        QVERIFY(model->data(QModelIndex(), Sink::Store::ErrorRole).isNull());
+    }
+
+    void testMailByDateRange()
+    {
+        // Setup
+        const auto date = QDateTime(QDate(2015, 7, 7), QTime(12, 0));
+        for (int i = 0; i < 5; i++) {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedMessageId("day" + QByteArray::number(i));
+            mail.setExtractedDate(date.addDays(-i));
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        auto messageIds = [] (const QList<Mail> &mails) {
+            QSet<QByteArray> ids;
+            for (const auto &mail : mails) {
+                ids << mail.getMessageId();
+            }
+            return ids;
+        };
+
+        {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.request<Mail::MessageId>();
+            query.filter<Mail::Date>(Query::Comparator(date.addDays(-2), Query::Comparator::GreaterThan));
+            QCOMPARE(messageIds(Sink::Store::read<Mail>(query)), (QSet<QByteArray>{"day0", "day1"}));
+        }
+        {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.request<Mail::MessageId>();
+            query.filter<Mail::Date>(Query::Comparator(date.addDays(-2), Query::Comparator::LessThan));
+            QCOMPARE(messageIds(Sink::Store::read<Mail>(query)), (QSet<QByteArray>{"day3", "day4"}));
+        }
+        {
+            //Both bounds are inclusive
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.request<Mail::MessageId>();
+            query.filter<Mail::Date>(Query::Comparator(QVariantList{date.addDays(-3), date.addDays(-1)}, Query::Comparator::Within));
+            QCOMPARE(messageIds(Sink::Store::read<Mail>(query)), (QSet<QByteArray>{"day1", "day2", "day3"}));
+        }
+    }
+
+    /*
+     * Filters on properties without index are evaluated on the buffer directly, and have to match like the converted properties.
+     */
+    void testFilterOnBuffer()
+    {
+        // Setup
+        for (int i = 0; i < 4; i++) {
+            Mail mail("sink.dummy.instance1");
+            mail.setExtractedMessageId("mail" + QByteArray::number(i));
+            mail.setExtractedSubject(QString::fromUtf8("Sübject %1").arg(i % 2));
+            mail.setExtractedAncestors({"ancestor" + QByteArray::number(i)});
+            mail.setUnread(i < 2);
+            mail.setImportant(i % 2);
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        auto messageIds = [] (const QList<Mail> &mails) {
+            QSet<QByteArray> ids;
+            for (const auto &mail : mails) {
+                ids << mail.getMessageId();
+            }
+            return ids;
+        };
+
+        {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.filter<Mail::Subject>(QString::fromUtf8("Sübject 1"));
+            QCOMPARE(messageIds(Sink::Store::read<Mail>(query)), (QSet<QByteArray>{"mail1", "mail3"}));
+        }
+        {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.filter<Mail::Subject>(Query::Comparator(QVariant::fromValue(QByteArrayList{QString::fromUtf8("Sübject 0").toUtf8()}), Query::Comparator::In));
+            QCOMPARE(messageIds(Sink::Store::read<Mail>(query)), (QSet<QByteArray>{"mail0", "mail2"}));
+        }
+        {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.filter<Mail::Unread>(true);
+            query.filter<Mail::Important>(false);
+            QCOMPARE(messageIds(Sink::Store::read<Mail>(query)), (QSet<QByteArray>{"mail0"}));
+        }
+        {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.filter<Mail::Ancestors>(Query::Comparator(QByteArray{"ancestor2"}, Query::Comparator::Contains));
+            QCOMPARE(messageIds(Sink::Store::read<Mail>(query)), (QSet<QByteArray>{"mail2"}));
+        }
+    }
+
+    void testMailFulltext()
+    {
+        auto mimeMessage = [] (const QByteArray &messageId, const QByteArray &from, const QByteArray &subject, const QByteArray &body) {
+            return "From: " + from + "\r\nTo: john@example.org\r\nSubject: " + subject + "\r\nMessage-ID: <" + messageId + ">\r\nContent-Type: text/plain\r\n\r\n" + body + "\r\n";
+        };
+        // Setup
+        {
+            Mail mail("sink.dummy.instance1");
+            mail.setMimeMessage(mimeMessage("fulltext1@example.org", "Jane Doe <jane@example.org>", "Quarterly report", "Find the numbers attached."));
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        {
+            Mail mail("sink.dummy.instance1");
+            mail.setMimeMessage(mimeMessage("fulltext2@example.org", "Jane Doe <jane@example.org>", "Lunch", "Are you free on Friday?"));
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        {
+            Mail mail("sink.dummy.instance1");
+            mail.setMimeMessage(mimeMessage("fulltext3@example.org", "Bob <bob@example.org>", "Report", "The Friday numbers."));
+            VERIFYEXEC(Sink::Store::create<Mail>(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+
+        auto search = [] (const QString &text) {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.request<Mail::MessageId>();
+            query.fulltextFilter(text);
+            QSet<QByteArray> ids;
+            for (const auto &mail : Sink::Store::read<Mail>(query)) {
+                ids << mail.getMessageId();
+            }
+            return ids;
+        };
+
+        //Subject, case insensitive
+        QCOMPARE(search("REPORT"), (QSet<QByteArray>{"fulltext1@example.org", "fulltext3@example.org"}));
+        //Body
+        QCOMPARE(search("friday"), (QSet<QByteArray>{"fulltext2@example.org", "fulltext3@example.org"}));
+        //Sender, all words have to match as prefix
+        QCOMPARE(search("jan numb"), (QSet<QByteArray>{"fulltext1@example.org"}));
+        QCOMPARE(search("nonexistent"), (QSet<QByteArray>{}));
+
+        //Property specific filters don't need the index content
+        {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.request<Mail::MessageId>();
+            query.filter<Mail::Subject>(Query::Comparator(QString{"report"}, Query::Comparator::Fulltext));
+            QCOMPARE(Sink::Store::read<Mail>(query).size(), 2);
+        }
+        //The index contains the tokens of all properties, so its matches are still filtered on the property
+        {
+            Sink::Query query;
+            query.resourceFilter("sink.dummy.instance1");
+            query.request<Mail::MessageId>();
+            query.filter<Mail::Subject>(Query::Comparator(QString{"friday"}, Query::Comparator::Fulltext));
+            QCOMPARE(Sink::Store::read<Mail>(query).size(), 0);
+        }
+
+        //The index follows modifications and removals
+        {
+            auto mail = Sink::Store::readOne<Mail>(Sink::Query().resourceFilter("sink.dummy.instance1").filter<Mail::MessageId>("fulltext1@example.org"));
+            mail.setMimeMessage(mimeMessage("fulltext1@example.org", "Jane Doe <jane@example.org>", "Quarterly report", "Postponed until Monday."));
+            VERIFYEXEC(Sink::Store::modify(mail));
+        }
+        {
+            auto mail = Sink::Store::readOne<Mail>(Sink::Query().resourceFilter("sink.dummy.instance1").filter<Mail::MessageId>("fulltext3@example.org"));
+            VERIFYEXEC(Sink::Store::remove(mail));
+        }
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue(QByteArrayList() << "sink.dummy.instance1"));
+        QCOMPARE(search("numbers"), (QSet<QByteArray>{}));
+        QCOMPARE(search("monday"), (QSet<QByteArray>{"fulltext1@example.org"}));
+        QCOMPARE(search("report"), (QSet<QByteArray>{"fulltext1@example.org"}));
+    }
+
     void testReactToNewResource()
     {
         Sink::Query query;
@@ -871,6 +1406,69 @@ private slots:
         QCOMPARE(resetSpy.size(), 0);
     }
 
+    void testThreadLeadersOfFolder()
+    {
+        // Setup
+        auto folder1 = Folder::createEntity<Folder>("sink.dummy.instance1");
+        VERIFYEXEC(Sink::Store::create<Folder>(folder1));
+
+        auto folder2 = Folder::createEntity<Folder>("sink.dummy.instance1");
+        VERIFYEXEC(Sink::Store::create<Folder>(folder2));
+
+        QDateTime now{QDate{2017, 2, 3}, QTime{10, 0, 0}};
+
+        auto mail1 = Mail::createEntity<Mail>("sink.dummy.instance1");
+        mail1.setExtractedMessageId("mail1");
+        mail1.setFolder(folder1);
+        mail1.setUnread(true);
+        mail1.setExtractedDate(now);
+        VERIFYEXEC(Sink::Store::create(mail1));
+
+        auto mail2 = Mail::createEntity<Mail>("sink.dummy.instance1");
+        mail2.setExtractedMessageId("mail2");
+        mail2.setExtractedParentMessageId("mail1");
+        mail2.setFolder(folder2);
+        mail2.setUnread(true);
+        mail2.setExtractedDate(now.addSecs(7200));
+        VERIFYEXEC(Sink::Store::create(mail2));
+
+        auto mail3 = Mail::createEntity<Mail>("sink.dummy.instance1");
+        mail3.setExtractedMessageId("mail3");
+        mail3.setExtractedParentMessageId("mail1");
+        mail3.setFolder(folder1);
+        mail3.setUnread(false);
+        mail3.setImportant(true);
+        mail3.setExtractedDate(now.addSecs(3600));
+        VERIFYEXEC(Sink::Store::create(mail3));
+
+        // Ensure all local data is processed
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue("sink.dummy.instance1"));
+
+        //The thread leader and aggregates only cover the mails of the thread in the folder
+        auto query = Sink::StandardQueries::threadLeaders(folder1);
+        query.setFlags(Query::LiveQuery);
+        query.request<Mail::MessageId>();
+        auto model = Sink::Store::loadModel<Mail>(query);
+        QTRY_VERIFY(model->data(QModelIndex(), Sink::Store::ChildrenFetchedRole).toBool());
+        QCOMPARE(model->rowCount(), 1);
+        auto mail = model->data(model->index(0, 0, QModelIndex{}), Sink::Store::DomainObjectRole).value<Mail::Ptr>();
+        QCOMPARE(mail->getMessageId(), QByteArray{"mail3"});
+        QCOMPARE(mail->getProperty("count").toInt(), 2);
+        QCOMPARE(mail->getProperty("unreadCount").toInt(), 1);
+        QCOMPARE(mail->getProperty("importantCount").toInt(), 1);
+
+        //Moving the mails into the folder updates the leader
+        mail2.setFolder(folder1);
+        VERIFYEXEC(Sink::Store::modify(mail2));
+        VERIFYEXEC(Sink::ResourceControl::flushMessageQueue("sink.dummy.instance1"));
+
+        QTRY_COMPARE(model->rowCount(), 1);
+        QTRY_COMPARE(model->data(model->index(0, 0, QModelIndex{}), Sink::Store::DomainObjectRole).value<Mail::Ptr>()->getMessageId(), QByteArray{"mail2"});
+        mail = model->data(model->index(0, 0, QModelIndex{}), Sink::Store::DomainObjectRole).value<Mail::Ptr>();
+        QCOMPARE(mail->getProperty("count").toInt(), 3);
+        QCOMPARE(mail->getProperty("unreadCount").toInt(), 2);
+    }
+
     void testBloom()
     {
         // Setup
@@ -4,6 +4,9 @@
 #include "listener.h"
 #include "commands.h"
 #include "handshake_generated.h"
+#include "resourceconfig.h"
+#include "test.h"
+#include "testutils.h"
 
 /**
  * Test that resourceaccess and listener work together.
@@ -12,6 +15,11 @@ class ResourceCommunicationTest : public QObject
 {
     Q_OBJECT
 private slots:
+    void initTestCase()
+    {
+        Sink::Test::initTest();
+    }
+
     void testConnect()
     {
         const QByteArray resourceIdentifier("test");
@@ -112,6 +120,69 @@ private slots:
         QVERIFY(time.elapsed() < 3500);
         QVERIFY(time.elapsed() > 2500);
     }
+
+    void testRevisionLeaseExpiry()
+    {
+        const QByteArray resourceIdentifier("test");
+        ResourceConfig::configureResource(resourceIdentifier, {{"revisionLeaseTimeout", 100}});
+        Listener listener(resourceIdentifier, "");
+        Sink::ResourceAccess resourceAccess(resourceIdentifier, "");
+        resourceAccess.open();
+
+        bool leaseExpired = false;
+        QObject::connect(&resourceAccess, &Sink::ResourceAccess::notification, [&](const Sink::Notification &notification) {
+            if (notification.type == Sink::Notification::RevisionLeaseExpired) {
+                leaseExpired = true;
+            }
+        });
+
+        VERIFYEXEC(resourceAccess.sendRevisionReplayedCommand(1));
+        //Up to date clients keep their pin
+        QTest::qWait(300);
+        QVERIFY(!leaseExpired);
+
+        //A client that falls behind loses it eventually
+        QMetaObject::invokeMethod(&listener, "refreshRevision", Q_ARG(qint64, 2));
+        QTRY_VERIFY(leaseExpired);
+
+        ResourceConfig::configureResource(resourceIdentifier, {});
+    }
+
+    void testRevisionPinIsKeptPerQuery()
+    {
+        const QByteArray resourceIdentifier("test");
+        ResourceConfig::configureResource(resourceIdentifier, {{"revisionLeaseTimeout", 100}});
+        Listener listener(resourceIdentifier, "");
+        Sink::ResourceAccess resourceAccess(resourceIdentifier, "");
+        resourceAccess.open();
+
+        bool leaseExpired = false;
+        QByteArrayList expiredPins;
+        QObject::connect(&resourceAccess, &Sink::ResourceAccess::notification, [&](const Sink::Notification &notification) {
+            if (notification.type == Sink::Notification::RevisionLeaseExpired) {
+                leaseExpired = true;
+                expiredPins << notification.id;
+            }
+        });
+
+        QMetaObject::invokeMethod(&listener, "refreshRevision", Q_ARG(qint64, 2));
+        VERIFYEXEC(resourceAccess.sendRevisionPinCommand("snapshot", 1));
+        //Another query on the same connection catching up doesn't replace the pin
+        VERIFYEXEC(resourceAccess.sendRevisionReplayedCommand(2));
+        QTRY_VERIFY(leaseExpired);
+        //The query holding the pin is told separately
+        QTRY_VERIFY(expiredPins.contains("snapshot"));
+
+        //Without pin the client is up to date and keeps its revision
+        leaseExpired = false;
+        VERIFYEXEC(resourceAccess.sendRevisionPinCommand("snapshot", 1));
+        VERIFYEXEC(resourceAccess.sendRevisionPinCommand("snapshot", 0));
+        VERIFYEXEC(resourceAccess.sendRevisionReplayedCommand(2));
+        QTest::qWait(300);
+        QVERIFY(!leaseExpired);
+
+        ResourceConfig::configureResource(resourceIdentifier, {});
+    }
 };
 
 QTEST_MAIN(ResourceCommunicationTest)
@@ -5,6 +5,7 @@
 #include "hawd/dataset.h"
 #include "hawd/formatter.h"
 #include "common/storage.h"
+#include "common/synchronizerstore.h"
 #include "common/log.h"
 
 #include <fstream>
@@ -205,6 +206,52 @@ private slots:
         HAWD::Formatter::print(dataset);
     }
 
+    /*
+     * Most remote ids are new during an initial sync, so resolving them mostly misses the mapping.
+     */
+    void testRemoteIdResolution()
+    {
+        Sink::Storage::DataStore store(testDataPath, dbName + ".synchronization", Sink::Storage::DataStore::ReadWrite);
+        {
+            auto transaction = store.createTransaction(Sink::Storage::DataStore::ReadWrite);
+            Sink::SynchronizerStore syncStore(transaction);
+            for (int i = 0; i < count; i++) {
+                syncStore.recordRemoteId("mail", Sink::Storage::DataStore::generateUid(), "existing" + QByteArray::number(i));
+            }
+            transaction.commit();
+        }
+
+        QTime time;
+        time.start();
+        {
+            auto transaction = store.createTransaction(Sink::Storage::DataStore::ReadWrite);
+            Sink::SynchronizerStore syncStore(transaction);
+            for (int i = 0; i < count; i++) {
+                syncStore.resolveRemoteId("mail", "new" + QByteArray::number(i));
+            }
+            transaction.abort();
+        }
+        const qreal missDuration = time.restart();
+        {
+            auto transaction = store.createTransaction(Sink::Storage::DataStore::ReadWrite);
+            Sink::SynchronizerStore syncStore(transaction);
+            for (int i = 0; i < count; i++) {
+                syncStore.resolveRemoteId("mail", "existing" + QByteArray::number(i));
+            }
+            transaction.abort();
+        }
+        const qreal hitDuration = time.restart();
+
+        HAWD::Dataset dataset("remoteid_resolution", m_hawdState);
+        HAWD::Dataset::Row row = dataset.row();
+        row.setValue("rows", count);
+        row.setValue("miss", count / missDuration);
+        row.setValue("hit", count / hitDuration);
+        dataset.insertRow(row);
+        HAWD::Formatter::print(dataset);
+
+        store.removeFromDisk();
+    }
 
 private:
     HAWD::State m_hawdState;